@@ -0,0 +1,139 @@
+#include "asset_pack.h"
+#if defined(ASSET_PACK_LZ4)
+#include <lz4.h>
+#endif
+
+STATIC_ASSERT(sizeof(asset_pack_header) == 40, asset_pack_header_has_padding)
+STATIC_ASSERT(sizeof(asset_pack_entry) == 40, asset_pack_entry_has_padding)
+
+result open_asset_pack(const char* path, asset_pack* out_pack) {
+    ASSERT(path != NULL, return RESULT_FAILURE, "Asset pack path is null");
+    ASSERT(out_pack != NULL, return RESULT_FAILURE, "Asset pack pointer is null");
+    memset(out_pack, 0, sizeof(asset_pack));
+    if (create_file_mapping(path, &out_pack->mapping) != RESULT_SUCCESS) {
+        return RESULT_FAILURE;
+    }
+
+    const file_mapping* mapping = &out_pack->mapping;
+    const asset_pack_header* header = mapping->data;
+    bool valid = mapping->size >= sizeof(asset_pack_header) && header->magic == ASSET_PACK_MAGIC && header->version == ASSET_PACK_VERSION &&
+                 header->file_size == mapping->size;
+    valid = valid && header->index_capacity != 0 && (header->index_capacity & (header->index_capacity - 1)) == 0 &&
+            (uint64_t)header->entry_count * 2 <= header->index_capacity && header->index_offset % alignof(asset_pack_entry) == 0 &&
+            header->index_offset <= mapping->size && (uint64_t)header->index_capacity * sizeof(asset_pack_entry) <= mapping->size - header->index_offset;
+    if (!valid) {
+        close_asset_pack(out_pack);
+        ERROR_BREAKPOINT("Asset pack is corrupt or from another version");
+        return RESULT_FAILURE;
+    }
+#if !defined(ASSET_PACK_LZ4)
+    if (header->flags & ASSET_PACK_FLAG_COMPRESSED) {
+        close_asset_pack(out_pack);
+        ERROR_BREAKPOINT("Asset pack is compressed, but LZ4 support is not compiled in");
+        return RESULT_FAILURE;
+    }
+#endif
+
+    out_pack->header = header;
+    out_pack->index = (const asset_pack_entry*)((const uint8_t*)mapping->data + header->index_offset);
+    return RESULT_SUCCESS;
+}
+
+void close_asset_pack(asset_pack* pack) {
+    ASSERT(pack != NULL, return, "Asset pack pointer is null");
+    destroy_file_mapping(&pack->mapping);
+    memset(pack, 0, sizeof(asset_pack));
+}
+
+const asset_pack_entry* find_asset(const asset_pack* pack, uint64_t path_hash) {
+    ASSERT(pack != NULL && pack->header != NULL, return NULL, "Asset pack is not open");
+    if (path_hash == 0) {
+        return NULL;
+    }
+    // The index is at most half full, so probes are short. The bound only matters for a
+    // corrupt index with more used slots than entry_count says.
+    uint32_t capacity = pack->header->index_capacity;
+    uint32_t slot = (uint32_t)path_hash & (capacity - 1);
+    for (uint32_t probe = 0; probe < capacity; ++probe, slot = (slot + 1) & (capacity - 1)) {
+        const asset_pack_entry* entry = &pack->index[slot];
+        if (entry->path_hash == path_hash) {
+            return entry;
+        }
+        if (entry->path_hash == 0) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+static bool is_entry_in_bounds(const asset_pack* pack, const asset_pack_entry* entry) {
+    uint64_t file_size = pack->mapping.size;
+    return entry->offset <= file_size && entry->stored_size <= file_size - entry->offset;
+}
+
+const void* get_asset_data(const asset_pack* pack, const asset_pack_entry* entry) {
+    ASSERT(pack != NULL && entry != NULL, return NULL, "Asset pack and entry must not be null");
+    if (entry->flags & ASSET_ENTRY_FLAG_COMPRESSED) {
+        return NULL;
+    }
+    ASSERT(is_entry_in_bounds(pack, entry), return NULL, "Asset entry lies outside the pack");
+    return (const uint8_t*)pack->mapping.data + entry->offset;
+}
+
+#if defined(ASSET_PACK_LZ4)
+static result decompress_asset(const uint8_t* payload, const asset_pack_entry* entry, uint8_t* destination) {
+    const uint32_t* chunk_sizes = (const uint32_t*)payload;
+    uint64_t table_size = (uint64_t)entry->chunk_count * sizeof(uint32_t);
+    if (table_size > entry->stored_size || (uint64_t)entry->chunk_count * ASSET_PACK_CHUNK_SIZE < entry->size) {
+        return RESULT_FAILURE;
+    }
+
+    const uint8_t* source = payload + table_size;
+    uint64_t source_remaining = entry->stored_size - table_size;
+    uint64_t destination_remaining = entry->size;
+    for (uint32_t i = 0; i < entry->chunk_count; ++i) {
+        uint32_t stored = chunk_sizes[i] & ~ASSET_PACK_CHUNK_RAW;
+        uint32_t expected = destination_remaining < ASSET_PACK_CHUNK_SIZE ? (uint32_t)destination_remaining : ASSET_PACK_CHUNK_SIZE;
+        if (stored > source_remaining) {
+            return RESULT_FAILURE;
+        }
+        if (chunk_sizes[i] & ASSET_PACK_CHUNK_RAW) {
+            if (stored != expected) {
+                return RESULT_FAILURE;
+            }
+            memcpy(destination, source, stored);
+        }
+        else if (LZ4_decompress_safe((const char*)source, (char*)destination, (int)stored, (int)expected) != (int)expected) {
+            return RESULT_FAILURE;
+        }
+        source += stored;
+        source_remaining -= stored;
+        destination += expected;
+        destination_remaining -= expected;
+    }
+    return destination_remaining == 0 ? RESULT_SUCCESS : RESULT_FAILURE;
+}
+#endif
+
+result read_asset(const asset_pack* pack, const asset_pack_entry* entry, void* destination) {
+    ASSERT(pack != NULL && entry != NULL, return RESULT_FAILURE, "Asset pack and entry must not be null");
+    ASSERT(destination != NULL || entry->size == 0, return RESULT_FAILURE, "Asset destination is null");
+    ASSERT(is_entry_in_bounds(pack, entry), return RESULT_FAILURE, "Asset entry lies outside the pack");
+    const uint8_t* payload = (const uint8_t*)pack->mapping.data + entry->offset;
+    if (!(entry->flags & ASSET_ENTRY_FLAG_COMPRESSED)) {
+        ASSERT(entry->stored_size == entry->size, return RESULT_FAILURE, "Uncompressed asset sizes disagree");
+        memcpy(destination, payload, entry->size);
+        return RESULT_SUCCESS;
+    }
+#if defined(ASSET_PACK_LZ4)
+    if (decompress_asset(payload, entry, destination) != RESULT_SUCCESS) {
+        ERROR_BREAKPOINT("Compressed asset is corrupt");
+        return RESULT_FAILURE;
+    }
+    return RESULT_SUCCESS;
+#else
+    // open_asset_pack refuses compressed packs without LZ4 support.
+    ERROR_BREAKPOINT("Compressed asset without LZ4 support");
+    return RESULT_FAILURE;
+#endif
+}
@@ -0,0 +1,143 @@
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include "fundamental.h"
+#include "platform.h"
+
+// Read-only archive of assets, opened with a single file mapping. Layout:
+//
+//     asset_pack_header
+//     asset_pack_entry index[index_capacity]   open-addressed, linear probing on path_hash
+//     payloads, each starting on an ASSET_PACK_ALIGNMENT boundary
+//
+// Uncompressed payloads are used in place, so they can be copied straight into staging memory.
+// Compressed payloads start with a uint32_t size per chunk, followed by the chunks; every chunk
+// expands to ASSET_PACK_CHUNK_SIZE bytes except the last. Chunks with ASSET_PACK_CHUNK_RAW set
+// in their size did not shrink and are stored as is. Integers are little-endian.
+//
+// Packs are built offline by asset_packer.
+
+#define ASSET_PACK_MAGIC 0x4b434150u // "PACK"
+#define ASSET_PACK_VERSION 1
+// Covers optimalBufferCopyOffsetAlignment and nonCoherentAtomSize on every common device.
+#define ASSET_PACK_ALIGNMENT 256
+#define ASSET_PACK_CHUNK_SIZE (64 * 1024)
+#define ASSET_PACK_CHUNK_RAW 0x80000000u
+#define MAX_ASSET_PATH 512
+
+typedef enum {
+    // Some payloads are LZ4 compressed; loading them needs ASSET_PACK_LZ4.
+    ASSET_PACK_FLAG_COMPRESSED = 1 << 0,
+} asset_pack_flags;
+
+typedef enum {
+    ASSET_ENTRY_FLAG_COMPRESSED = 1 << 0,
+} asset_entry_flags;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t entry_count;
+    // Power of two, at least twice entry_count.
+    uint32_t index_capacity;
+    uint32_t reserved;
+    uint64_t index_offset;
+    uint64_t file_size;
+} asset_pack_header;
+
+typedef struct {
+    // 0 marks an empty slot.
+    uint64_t path_hash;
+    // From the start of the file.
+    uint64_t offset;
+    uint64_t stored_size;
+    uint64_t size;
+    uint32_t flags;
+    uint32_t chunk_count;
+} asset_pack_entry;
+
+// Writes the canonical form of path to out: '/' separators, no empty or "." segments, and
+// every ".." applied to the segment before it. A leading separator is kept. Returns false when
+// the path climbs above where it starts or does not fit in capacity bytes.
+static inline bool normalize_asset_path(const char* path, char* out, size_t capacity) {
+    if (capacity == 0) {
+        return false;
+    }
+    size_t length = 0;
+    if (path[0] == '/' || path[0] == '\\') {
+        if (capacity < 2) {
+            return false;
+        }
+        out[length++] = '/';
+    }
+    size_t root_length = length;
+    for (const char* c = path; *c != '\0';) {
+        while (*c == '/' || *c == '\\') {
+            c++;
+        }
+        const char* segment = c;
+        while (*c != '\0' && *c != '/' && *c != '\\') {
+            c++;
+        }
+        size_t segment_length = (size_t)(c - segment);
+        if (segment_length == 0 || (segment_length == 1 && segment[0] == '.')) {
+            continue;
+        }
+        if (segment_length == 2 && segment[0] == '.' && segment[1] == '.') {
+            if (length == root_length) {
+                return false;
+            }
+            while (length > root_length && out[length - 1] != '/') {
+                length--;
+            }
+            if (length > root_length) {
+                length--;
+            }
+            continue;
+        }
+        size_t separator = length > root_length ? 1 : 0;
+        if (length + separator + segment_length >= capacity) {
+            return false;
+        }
+        if (separator != 0) {
+            out[length++] = '/';
+        }
+        memcpy(out + length, segment, segment_length);
+        length += segment_length;
+    }
+    out[length] = '\0';
+    return true;
+}
+
+// Paths are hashed in their normalized form, so "./textures//a.png" finds "textures/a.png".
+// Paths that do not normalize hash to 0, which matches no asset. The packer refuses two paths
+// with the same hash, so a hash identifies one asset.
+static inline uint64_t hash_asset_path(const char* path) {
+    char normalized[MAX_ASSET_PATH];
+    if (!normalize_asset_path(path, normalized, sizeof(normalized))) {
+        return 0;
+    }
+    uint64_t hash = hash_fnv1a64(normalized, strlen(normalized), FNV1A64_OFFSET_BASIS);
+    return hash == 0 ? 1 : hash;
+}
+
+typedef struct {
+    file_mapping mapping;
+    const asset_pack_header* header;
+    const asset_pack_entry* index;
+} asset_pack;
+
+// Only the header and index bounds are checked, so opening costs the same for any pack size.
+// Fails without reporting an error when the file does not exist.
+result open_asset_pack(const char* path, asset_pack* out_pack);
+void close_asset_pack(asset_pack* pack);
+// Returns NULL when the pack has no asset with the hash.
+const asset_pack_entry* find_asset(const asset_pack* pack, uint64_t path_hash);
+// The payload inside the mapping, aligned to ASSET_PACK_ALIGNMENT. NULL for compressed entries.
+const void* get_asset_data(const asset_pack* pack, const asset_pack_entry* entry);
+// Copies or decompresses the asset's entry->size bytes into destination, e.g. mapped staging
+// memory.
+result read_asset(const asset_pack* pack, const asset_pack_entry* entry, void* destination);
+
+#endif // ASSET_PACK_H
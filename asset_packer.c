@@ -0,0 +1,250 @@
+// Builds an asset pack from a list of files under a root directory:
+//
+//     asset_packer [-lz4] output.pack root file...
+//
+// Each file is stored under its normalized path relative to root, so "assets/./b.txt" with
+// root "assets" is found as "b.txt". root and the files must both be relative or both be
+// absolute. -lz4 compresses assets that shrink; it needs a build with ASSET_PACK_LZ4.
+#include "fundamental.h"
+#include "asset_pack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(ASSET_PACK_LZ4)
+#include <lz4.h>
+#endif
+
+typedef struct {
+    char path[MAX_ASSET_PATH];
+    uint8_t* payload;
+    asset_pack_entry entry;
+} packed_asset;
+
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + ASSET_PACK_ALIGNMENT - 1) & ~(uint64_t)(ASSET_PACK_ALIGNMENT - 1);
+}
+
+// Writes path relative to root, both normalized, into out. Fails when path is not inside root.
+static bool get_relative_asset_path(const char* root, const char* path, char* out) {
+    char normalized[MAX_ASSET_PATH];
+    if (!normalize_asset_path(path, normalized, sizeof(normalized))) {
+        return false;
+    }
+    size_t root_length = strlen(root);
+    const char* relative = normalized;
+    if (root_length > 0) {
+        if (strncmp(normalized, root, root_length) != 0) {
+            return false;
+        }
+        // A root of "/" already ends in the separator.
+        bool root_has_separator = root[root_length - 1] == '/';
+        if (!root_has_separator && normalized[root_length] != '/') {
+            return false;
+        }
+        relative = normalized + root_length + (root_has_separator ? 0 : 1);
+    }
+    else if (normalized[0] == '/') {
+        return false;
+    }
+    if (relative[0] == '\0') {
+        return false;
+    }
+    memcpy(out, relative, strlen(relative) + 1);
+    return true;
+}
+
+static uint8_t* read_whole_file(const char* path, uint64_t* out_size) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    uint8_t* data = NULL;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        long size = ftell(file);
+        if (size >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+            data = malloc(size > 0 ? (size_t)size : 1);
+            if (data != NULL && fread(data, 1, (size_t)size, file) != (size_t)size) {
+                free(data);
+                data = NULL;
+            }
+            *out_size = (uint64_t)size;
+        }
+    }
+    fclose(file);
+    return data;
+}
+
+#if defined(ASSET_PACK_LZ4)
+// Replaces the payload with its chunked LZ4 form when that is smaller; the asset stays
+// uncompressed otherwise, so it can still be used in place.
+static bool compress_asset(packed_asset* asset) {
+    uint64_t size = asset->entry.size;
+    uint32_t chunk_count = (uint32_t)((size + ASSET_PACK_CHUNK_SIZE - 1) / ASSET_PACK_CHUNK_SIZE);
+    if (chunk_count == 0) {
+        return true;
+    }
+    uint64_t table_size = (uint64_t)chunk_count * sizeof(uint32_t);
+    uint64_t capacity = table_size + (uint64_t)chunk_count * (uint64_t)LZ4_compressBound(ASSET_PACK_CHUNK_SIZE);
+    uint8_t* compressed = malloc(capacity);
+    if (compressed == NULL) {
+        return false;
+    }
+
+    uint32_t* chunk_sizes = (uint32_t*)compressed;
+    uint64_t stored = table_size;
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+        uint64_t chunk_offset = (uint64_t)i * ASSET_PACK_CHUNK_SIZE;
+        int chunk_size = (int)(size - chunk_offset < ASSET_PACK_CHUNK_SIZE ? size - chunk_offset : ASSET_PACK_CHUNK_SIZE);
+        const char* source = (const char*)asset->payload + chunk_offset;
+        int written = LZ4_compress_default(source, (char*)compressed + stored, chunk_size, LZ4_compressBound(ASSET_PACK_CHUNK_SIZE));
+        if (written <= 0 || written >= chunk_size) {
+            memcpy(compressed + stored, source, (size_t)chunk_size);
+            chunk_sizes[i] = (uint32_t)chunk_size | ASSET_PACK_CHUNK_RAW;
+            stored += (uint64_t)chunk_size;
+        }
+        else {
+            chunk_sizes[i] = (uint32_t)written;
+            stored += (uint64_t)written;
+        }
+    }
+
+    if (stored >= size) {
+        free(compressed);
+        return true;
+    }
+    free(asset->payload);
+    asset->payload = compressed;
+    asset->entry.stored_size = stored;
+    asset->entry.flags |= ASSET_ENTRY_FLAG_COMPRESSED;
+    asset->entry.chunk_count = chunk_count;
+    return true;
+}
+#endif
+
+static bool write_padding(FILE* file, uint64_t* offset, uint64_t target) {
+    static const uint8_t zeros[ASSET_PACK_ALIGNMENT] = { 0 };
+    while (*offset < target) {
+        uint64_t count = target - *offset < ASSET_PACK_ALIGNMENT ? target - *offset : ASSET_PACK_ALIGNMENT;
+        if (fwrite(zeros, 1, (size_t)count, file) != count) {
+            return false;
+        }
+        *offset += count;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    int first_argument = 1;
+    bool compress = false;
+    if (argc > 1 && strcmp(argv[1], "-lz4") == 0) {
+        compress = true;
+        first_argument++;
+    }
+    if (argc - first_argument < 3) {
+        fprintf(stderr, "usage: asset_packer [-lz4] output.pack root file...\n");
+        return 1;
+    }
+#if !defined(ASSET_PACK_LZ4)
+    if (compress) {
+        fprintf(stderr, "asset_packer was built without ASSET_PACK_LZ4\n");
+        return 1;
+    }
+#endif
+
+    const char* output_path = argv[first_argument];
+    char root[MAX_ASSET_PATH];
+    if (!normalize_asset_path(argv[first_argument + 1], root, sizeof(root))) {
+        fprintf(stderr, "invalid root directory %s\n", argv[first_argument + 1]);
+        return 1;
+    }
+    uint32_t asset_count = (uint32_t)(argc - first_argument - 2);
+    uint32_t index_capacity = 1;
+    while (index_capacity < 2 * asset_count) {
+        index_capacity *= 2;
+    }
+    packed_asset* assets = calloc(asset_count, sizeof(packed_asset));
+    asset_pack_entry* index = calloc(index_capacity, sizeof(asset_pack_entry));
+    if (assets == NULL || index == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    asset_pack_header header = {
+        .magic = ASSET_PACK_MAGIC,
+        .version = ASSET_PACK_VERSION,
+        .entry_count = asset_count,
+        .index_capacity = index_capacity,
+        .index_offset = align_offset(sizeof(asset_pack_header)),
+    };
+    uint64_t offset = align_offset(header.index_offset + (uint64_t)index_capacity * sizeof(asset_pack_entry));
+    for (uint32_t i = 0; i < asset_count; ++i) {
+        packed_asset* asset = &assets[i];
+        const char* path = argv[first_argument + 2 + i];
+        if (!get_relative_asset_path(root, path, asset->path)) {
+            fprintf(stderr, "%s is not a file inside %s\n", path, argv[first_argument + 1]);
+            return 1;
+        }
+        asset->payload = read_whole_file(path, &asset->entry.size);
+        if (asset->payload == NULL) {
+            fprintf(stderr, "cannot read %s\n", path);
+            return 1;
+        }
+        asset->entry.path_hash = hash_asset_path(asset->path);
+        asset->entry.stored_size = asset->entry.size;
+#if defined(ASSET_PACK_LZ4)
+        if (compress && !compress_asset(asset)) {
+            fprintf(stderr, "out of memory compressing %s\n", path);
+            return 1;
+        }
+#endif
+        if (asset->entry.flags & ASSET_ENTRY_FLAG_COMPRESSED) {
+            header.flags |= ASSET_PACK_FLAG_COMPRESSED;
+        }
+        asset->entry.offset = offset;
+        offset = align_offset(offset + asset->entry.stored_size);
+
+        uint32_t slot = (uint32_t)asset->entry.path_hash & (index_capacity - 1);
+        while (index[slot].path_hash != 0) {
+            if (index[slot].path_hash == asset->entry.path_hash) {
+                fprintf(stderr, "%s is packed twice or has the same path hash as an earlier file\n", asset->path);
+                return 1;
+            }
+            slot = (slot + 1) & (index_capacity - 1);
+        }
+        index[slot] = asset->entry;
+    }
+    header.file_size = offset;
+
+    // The last payload is padded too, so every payload can be read in whole aligned blocks.
+    FILE* file = fopen(output_path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "cannot create %s\n", output_path);
+        return 1;
+    }
+    uint64_t written = 0;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    written += sizeof(header);
+    ok = ok && write_padding(file, &written, header.index_offset);
+    ok = ok && fwrite(index, sizeof(asset_pack_entry), index_capacity, file) == index_capacity;
+    written += (uint64_t)index_capacity * sizeof(asset_pack_entry);
+    for (uint32_t i = 0; i < asset_count && ok; ++i) {
+        const packed_asset* asset = &assets[i];
+        ok = write_padding(file, &written, asset->entry.offset);
+        ok = ok && fwrite(asset->payload, 1, (size_t)asset->entry.stored_size, file) == asset->entry.stored_size;
+        written += asset->entry.stored_size;
+    }
+    ok = ok && write_padding(file, &written, header.file_size);
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        remove(output_path);
+        fprintf(stderr, "failed writing %s\n", output_path);
+        return 1;
+    }
+
+    printf("packed %u assets into %s (%llu bytes)\n", asset_count, output_path, (unsigned long long)header.file_size);
+    for (uint32_t i = 0; i < asset_count; ++i) {
+        free(assets[i].payload);
+    }
+    free(assets);
+    free(index);
+    return 0;
+}
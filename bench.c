@@ -0,0 +1,1322 @@
+// Microbenchmarks for the platform layer. Runs every case, or only the cases whose name starts
+// with one of the arguments:
+//
+//     bench [case...]
+//
+// A case that needs something the machine lacks, such as an X server, says so and is skipped.
+#define _GNU_SOURCE
+#include "fundamental.h"
+#include "platform.h"
+#include "profiler.h"
+#include "asset_pack.h"
+#if defined(BENCH_VULKAN)
+#include "graphics.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <xcb/xcb.h>
+
+typedef struct {
+    const char* name;
+    void (*run)(void);
+} bench_case;
+
+#if defined(__GLIBC__)
+// Every heap call is counted by interposing glibc's allocator, so cases can show that a code
+// path makes none.
+#define HEAP_CALLS_COUNTED
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* pointer, size_t size);
+extern void __libc_free(void* pointer);
+
+static _Atomic uint64_t heap_calls;
+
+void* malloc(size_t size) {
+    atomic_fetch_add_explicit(&heap_calls, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&heap_calls, 1, memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+    atomic_fetch_add_explicit(&heap_calls, 1, memory_order_relaxed);
+    return __libc_realloc(pointer, size);
+}
+
+void free(void* pointer) {
+    if (pointer != NULL) {
+        atomic_fetch_add_explicit(&heap_calls, 1, memory_order_relaxed);
+    }
+    __libc_free(pointer);
+}
+#endif
+
+static void sleep_until(uint64_t deadline) {
+    uint64_t now = get_time_nanoseconds();
+    if (now < deadline) {
+        struct timespec duration = { (time_t)((deadline - now) / 1000000000ull), (long)((deadline - now) % 1000000000ull) };
+        nanosleep(&duration, NULL);
+    }
+}
+
+#define INPUT_BENCH_EVENTS 200
+// Each simulated frame works this long, and an event arrives halfway through it.
+#define INPUT_BENCH_FRAME_NANOSECONDS 8000000ull
+
+// Windows must not move while they exist.
+static window bench_window;
+
+static xcb_keycode_t find_any_keycode(const window* window) {
+    for (uint32_t keycode = 0; keycode < WINDOW_KEYCODE_COUNT; ++keycode) {
+        if (window->keycode_to_key[keycode] != KEY_NONE) {
+            return (xcb_keycode_t)keycode;
+        }
+    }
+    return 0;
+}
+
+// Synthetic events carry the sender's time, so they are stamped with get_time_nanoseconds in
+// milliseconds. The window learns the offset to that clock like it would for the server's.
+static void send_bench_key(xcb_connection_t* connection, xcb_window_t destination, uint8_t type, xcb_keycode_t keycode) {
+    xcb_key_press_event_t event = { 0 };
+    event.response_type = type;
+    event.detail = keycode;
+    event.time = (uint32_t)(get_time_nanoseconds() / 1000000);
+    event.root = XCB_NONE;
+    event.event = destination;
+    event.child = XCB_NONE;
+    event.same_screen = 1;
+    xcb_send_event(connection, 0, destination, 0, (const char*)&event);
+    xcb_flush(connection);
+}
+
+static void run_input_latency_mode(window_flags flags, const char* name) {
+    if (create_window("bench", 320, 240, WINDOW_MODE_WINDOWED, flags, &bench_window) != RESULT_SUCCESS) {
+        printf("  %-12s create_window failed\n", name);
+        return;
+    }
+    xcb_connection_t* sender = xcb_connect(NULL, NULL);
+    xcb_window_t destination = (xcb_window_t)(uintptr_t)bench_window.handle;
+    xcb_keycode_t keycode = find_any_keycode(&bench_window);
+    if (xcb_connection_has_error(sender) || keycode == 0) {
+        printf("  %-12s no sender connection or no mapped keycode\n", name);
+        xcb_disconnect(sender);
+        destroy_window(&bench_window);
+        return;
+    }
+
+    // Leaves out the events of mapping the window.
+    update_window_input(&bench_window);
+    memset(&bench_window.input_latency, 0, sizeof(bench_window.input_latency));
+    for (uint32_t i = 0; i < INPUT_BENCH_EVENTS; ++i) {
+        uint64_t frame_start = get_time_nanoseconds();
+        sleep_until(frame_start + INPUT_BENCH_FRAME_NANOSECONDS / 2);
+        send_bench_key(sender, destination, (i & 1) ? XCB_KEY_RELEASE : XCB_KEY_PRESS, keycode);
+        sleep_until(frame_start + INPUT_BENCH_FRAME_NANOSECONDS);
+        update_window_input(&bench_window);
+    }
+
+    const input_latency_stats* latency = &bench_window.input_latency;
+    double mean = latency->event_count > 0 ? (double)latency->total_nanoseconds / (double)latency->event_count : 0.0;
+    printf("  %-12s %llu events, mean %.3f ms, max %.3f ms\n", name, (unsigned long long)latency->event_count, mean / 1e6,
+           (double)latency->max_nanoseconds / 1e6);
+    xcb_disconnect(sender);
+    destroy_window(&bench_window);
+}
+
+// Time from an event reaching the window's connection to update_window_input applying it,
+// with a frame of work between consecutive updates.
+static void bench_input_latency(void) {
+    xcb_connection_t* probe = xcb_connect(NULL, NULL);
+    bool has_display = !xcb_connection_has_error(probe);
+    xcb_disconnect(probe);
+    if (!has_display) {
+        printf("  skipped: no X server; run under xvfb-run\n");
+        return;
+    }
+    run_input_latency_mode(WINDOW_FLAG_NONE, "polled");
+    run_input_latency_mode(WINDOW_FLAG_PUMP_THREAD, "pump thread");
+}
+
+#define ALLOCATOR_BENCH_FRAMES 2000
+#define ALLOCATOR_BENCH_ALLOCATIONS 512
+#define ALLOCATOR_BENCH_FRAMES_IN_FLIGHT 2
+
+static uint32_t allocator_bench_size(uint32_t i) {
+    return 16 + (i * 37) % 1024;
+}
+
+static void* allocator_bench_pointers[ALLOCATOR_BENCH_ALLOCATIONS];
+
+// Transient per-frame allocations from the frame allocator and a scratch arena, against
+// malloc and free of the same sizes. Every allocation is touched once.
+static void bench_frame_allocator(void) {
+    frame_allocator frames;
+    if (create_frame_allocator(ALLOCATOR_BENCH_FRAMES_IN_FLIGHT, (size_t)64 * 1024 * 1024, &frames) != RESULT_SUCCESS) {
+        printf("  create_frame_allocator failed\n");
+        return;
+    }
+
+    uint64_t arena_nanoseconds = 0;
+    uint64_t arena_heap_calls = 0;
+    // The first frames commit the pages every later frame reuses; they are not steady state.
+    for (uint32_t frame = 0; frame < ALLOCATOR_BENCH_FRAMES + ALLOCATOR_BENCH_FRAMES_IN_FLIGHT; ++frame) {
+        bool measured = frame >= ALLOCATOR_BENCH_FRAMES_IN_FLIGHT;
+#if defined(HEAP_CALLS_COUNTED)
+        uint64_t heap_calls_before = atomic_load_explicit(&heap_calls, memory_order_relaxed);
+#endif
+        uint64_t start = get_time_nanoseconds();
+        arena_allocator* arena = begin_frame_allocator(&frames, frame % ALLOCATOR_BENCH_FRAMES_IN_FLIGHT);
+        for (uint32_t i = 0; i < ALLOCATOR_BENCH_ALLOCATIONS; ++i) {
+            volatile uint8_t* memory = arena_allocate(arena, allocator_bench_size(i), 16);
+            memory[0] = (uint8_t)i;
+        }
+        scratch_arena scratch = begin_scratch(&arena, 1);
+        for (uint32_t i = 0; i < ALLOCATOR_BENCH_ALLOCATIONS / 4; ++i) {
+            volatile uint8_t* memory = arena_allocate(scratch.arena, allocator_bench_size(i), 16);
+            memory[0] = (uint8_t)i;
+        }
+        end_scratch(scratch);
+        if (measured) {
+            arena_nanoseconds += get_time_nanoseconds() - start;
+#if defined(HEAP_CALLS_COUNTED)
+            arena_heap_calls += atomic_load_explicit(&heap_calls, memory_order_relaxed) - heap_calls_before;
+#endif
+        }
+    }
+    destroy_frame_allocator(&frames);
+
+    uint64_t malloc_nanoseconds = 0;
+    uint64_t malloc_heap_calls = 0;
+    for (uint32_t frame = 0; frame < ALLOCATOR_BENCH_FRAMES; ++frame) {
+#if defined(HEAP_CALLS_COUNTED)
+        uint64_t heap_calls_before = atomic_load_explicit(&heap_calls, memory_order_relaxed);
+#endif
+        uint64_t start = get_time_nanoseconds();
+        for (uint32_t i = 0; i < ALLOCATOR_BENCH_ALLOCATIONS; ++i) {
+            volatile uint8_t* memory = malloc(allocator_bench_size(i));
+            memory[0] = (uint8_t)i;
+            allocator_bench_pointers[i] = (void*)memory;
+        }
+        // The scratch allocations, freed as soon as they are done with.
+        for (uint32_t i = 0; i < ALLOCATOR_BENCH_ALLOCATIONS / 4; ++i) {
+            volatile uint8_t* memory = malloc(allocator_bench_size(i));
+            memory[0] = (uint8_t)i;
+            free((void*)memory);
+        }
+        for (uint32_t i = 0; i < ALLOCATOR_BENCH_ALLOCATIONS; ++i) {
+            free(allocator_bench_pointers[i]);
+        }
+        malloc_nanoseconds += get_time_nanoseconds() - start;
+#if defined(HEAP_CALLS_COUNTED)
+        malloc_heap_calls += atomic_load_explicit(&heap_calls, memory_order_relaxed) - heap_calls_before;
+#endif
+    }
+
+    double allocations = (double)ALLOCATOR_BENCH_FRAMES * (ALLOCATOR_BENCH_ALLOCATIONS + ALLOCATOR_BENCH_ALLOCATIONS / 4);
+    printf("  %-12s %.2f ns/allocation", "frame arena", (double)arena_nanoseconds / allocations);
+#if defined(HEAP_CALLS_COUNTED)
+    printf(", %llu heap calls in %u frames", (unsigned long long)arena_heap_calls, ALLOCATOR_BENCH_FRAMES);
+#endif
+    printf("\n  %-12s %.2f ns/allocation", "malloc", (double)malloc_nanoseconds / allocations);
+#if defined(HEAP_CALLS_COUNTED)
+    printf(", %llu heap calls in %u frames", (unsigned long long)malloc_heap_calls, ALLOCATOR_BENCH_FRAMES);
+#endif
+    printf("\n");
+}
+
+#define JOB_BENCH_SPAWNERS 256
+#define JOB_BENCH_JOBS_PER_SPAWNER 4096
+#define PREFIX_BENCH_COUNT (16u * 1024 * 1024)
+#define PREFIX_BENCH_BLOCKS 256
+#define PREFIX_BENCH_BLOCK_SIZE (PREFIX_BENCH_COUNT / PREFIX_BENCH_BLOCKS)
+
+typedef struct {
+    job_system* system;
+    job* jobs;
+} job_bench;
+
+static void run_empty_job(void* data, uint32_t begin, uint32_t end) {
+    (void)data;
+    (void)begin;
+    (void)end;
+}
+
+// Each spawner queues its share of the empty jobs on its own worker, so thieves spread them.
+static void run_job_spawner(void* data, uint32_t begin, uint32_t end) {
+    job_bench* bench = data;
+    for (uint32_t spawner = begin; spawner < end; ++spawner) {
+        job* jobs = &bench->jobs[(size_t)spawner * JOB_BENCH_JOBS_PER_SPAWNER];
+        for (uint32_t i = 0; i < JOB_BENCH_JOBS_PER_SPAWNER; ++i) {
+            jobs[i] = (job){ .function = run_empty_job };
+        }
+        job_counter counter = 0;
+        run_jobs(bench->system, jobs, JOB_BENCH_JOBS_PER_SPAWNER, &counter);
+        wait_for_counter(bench->system, &counter);
+    }
+}
+
+typedef struct {
+    uint32_t* values;
+    uint64_t block_sums[PREFIX_BENCH_BLOCKS];
+} prefix_bench;
+
+static void scan_prefix_blocks(void* data, uint32_t begin, uint32_t end) {
+    prefix_bench* bench = data;
+    for (uint32_t block = begin; block < end; ++block) {
+        uint32_t* values = bench->values + (size_t)block * PREFIX_BENCH_BLOCK_SIZE;
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i < PREFIX_BENCH_BLOCK_SIZE; ++i) {
+            sum += values[i];
+            values[i] = sum;
+        }
+        bench->block_sums[block] = sum;
+    }
+}
+
+static void add_prefix_block_offsets(void* data, uint32_t begin, uint32_t end) {
+    prefix_bench* bench = data;
+    for (uint32_t block = begin; block < end; ++block) {
+        uint32_t* values = bench->values + (size_t)block * PREFIX_BENCH_BLOCK_SIZE;
+        uint32_t offset = (uint32_t)bench->block_sums[block];
+        for (uint32_t i = 0; i < PREFIX_BENCH_BLOCK_SIZE; ++i) {
+            values[i] += offset;
+        }
+    }
+}
+
+// Throughput of a million empty jobs and of an inclusive prefix sum over 16M integers, from
+// one worker up to one per processor.
+static void bench_jobs(void) {
+    job_system* system = malloc(sizeof(job_system));
+    job* jobs = malloc(sizeof(job) * JOB_BENCH_SPAWNERS * JOB_BENCH_JOBS_PER_SPAWNER);
+    prefix_bench* prefix = malloc(sizeof(prefix_bench));
+    uint32_t* values = malloc(sizeof(uint32_t) * PREFIX_BENCH_COUNT);
+    if (system == NULL || jobs == NULL || prefix == NULL || values == NULL || create_job_system(0, system) != RESULT_SUCCESS) {
+        printf("  out of memory or no job system\n");
+        free(system);
+        free(jobs);
+        free(prefix);
+        free(values);
+        return;
+    }
+    uint32_t max_workers = system->worker_count;
+    destroy_job_system(system);
+    prefix->values = values;
+
+    for (uint32_t workers = 1;; workers = workers * 2 < max_workers ? workers * 2 : max_workers) {
+        if (create_job_system(workers, system) != RESULT_SUCCESS) {
+            printf("  create_job_system failed\n");
+            break;
+        }
+        job_bench bench = { system, jobs };
+        uint64_t start = get_time_nanoseconds();
+        parallel_for(system, JOB_BENCH_SPAWNERS, run_job_spawner, &bench);
+        uint64_t jobs_nanoseconds = get_time_nanoseconds() - start;
+
+        for (uint32_t i = 0; i < PREFIX_BENCH_COUNT; ++i) {
+            values[i] = i & 7;
+        }
+        start = get_time_nanoseconds();
+        parallel_for(system, PREFIX_BENCH_BLOCKS, scan_prefix_blocks, prefix);
+        uint64_t offset = 0;
+        for (uint32_t block = 0; block < PREFIX_BENCH_BLOCKS; ++block) {
+            uint64_t sum = prefix->block_sums[block];
+            prefix->block_sums[block] = offset;
+            offset += sum;
+        }
+        parallel_for(system, PREFIX_BENCH_BLOCKS, add_prefix_block_offsets, prefix);
+        uint64_t prefix_nanoseconds = get_time_nanoseconds() - start;
+        destroy_job_system(system);
+
+        // Every group of 8 values adds 0 + 1 + ... + 7 = 28.
+        bool correct = values[PREFIX_BENCH_COUNT - 1] == (uint32_t)(PREFIX_BENCH_COUNT / 8 * 28);
+        double job_count = (double)JOB_BENCH_SPAWNERS * JOB_BENCH_JOBS_PER_SPAWNER;
+        printf("  %2u workers  %.1f ns/empty job, prefix sum %.2f ms (%.0f M values/s)%s\n", workers, (double)jobs_nanoseconds / job_count,
+               (double)prefix_nanoseconds / 1e6, (double)PREFIX_BENCH_COUNT * 1e3 / (double)prefix_nanoseconds, correct ? "" : ", WRONG RESULT");
+        if (workers == max_workers) {
+            break;
+        }
+    }
+    free(system);
+    free(jobs);
+    free(prefix);
+    free(values);
+}
+
+// Small enough that the ticket lock finishes when threads outnumber processors, where every
+// preempted ticket holder stalls the queue behind it.
+#define LOCK_BENCH_OPERATIONS 200000
+#define LOCK_BENCH_MAX_THREADS 16
+
+typedef enum {
+    LOCK_BENCH_MUTEX,
+    LOCK_BENCH_SPIN_LOCK,
+    LOCK_BENCH_RW_LOCK,
+    LOCK_BENCH_PTHREAD_MUTEX,
+    LOCK_BENCH_KIND_COUNT,
+} lock_bench_kind;
+
+static const char* const lock_bench_names[LOCK_BENCH_KIND_COUNT] = { "mutex", "spin_lock", "rw_lock", "pthread_mutex" };
+
+typedef struct {
+    lock_bench_kind kind;
+    uint32_t operations_per_thread;
+    _Atomic bool start;
+    mutex mutex;
+    spin_lock spin_lock;
+    rw_lock rw_lock;
+    pthread_mutex_t pthread_mutex;
+    // Touched inside the lock, on its own line so it measures the lock rather than false sharing.
+    alignas(64) uint64_t counter;
+} lock_bench;
+
+static void run_lock_bench_thread(void* data) {
+    lock_bench* bench = data;
+    while (!atomic_load_explicit(&bench->start, memory_order_acquire)) {
+        sched_yield();
+    }
+    for (uint32_t i = 0; i < bench->operations_per_thread; ++i) {
+        switch (bench->kind) {
+        case LOCK_BENCH_MUTEX:
+            lock_mutex(&bench->mutex);
+            bench->counter++;
+            unlock_mutex(&bench->mutex);
+            break;
+        case LOCK_BENCH_SPIN_LOCK:
+            lock_spin_lock(&bench->spin_lock);
+            bench->counter++;
+            unlock_spin_lock(&bench->spin_lock);
+            break;
+        case LOCK_BENCH_RW_LOCK:
+            lock_rw_lock_exclusive(&bench->rw_lock);
+            bench->counter++;
+            unlock_rw_lock_exclusive(&bench->rw_lock);
+            break;
+        default:
+            pthread_mutex_lock(&bench->pthread_mutex);
+            bench->counter++;
+            pthread_mutex_unlock(&bench->pthread_mutex);
+            break;
+        }
+    }
+}
+
+// Time per lock and unlock of a counter increment under full contention, against
+// pthread_mutex, at 1 to 16 threads. The same total work is split across the threads.
+static void bench_locks(void) {
+    static lock_bench bench;
+    static thread threads[LOCK_BENCH_MAX_THREADS];
+    printf("  %-14s", "threads");
+    for (uint32_t thread_count = 1; thread_count <= LOCK_BENCH_MAX_THREADS; thread_count *= 2) {
+        printf(" %14u", thread_count);
+    }
+    printf("\n  ns/operation and contended share of acquisitions\n");
+
+    for (uint32_t kind = 0; kind < LOCK_BENCH_KIND_COUNT; ++kind) {
+        printf("  %-14s", lock_bench_names[kind]);
+        for (uint32_t thread_count = 1; thread_count <= LOCK_BENCH_MAX_THREADS; thread_count *= 2) {
+            lock_stats stats = { 0 };
+            memset(&bench, 0, sizeof(bench));
+            bench.kind = (lock_bench_kind)kind;
+            bench.operations_per_thread = LOCK_BENCH_OPERATIONS / thread_count;
+            create_mutex(&stats, &bench.mutex);
+            create_spin_lock(&stats, &bench.spin_lock);
+            create_rw_lock(&stats, &bench.rw_lock);
+            pthread_mutex_init(&bench.pthread_mutex, NULL);
+
+            uint32_t started = 0;
+            while (started < thread_count && create_thread(run_lock_bench_thread, &bench, &threads[started]) == RESULT_SUCCESS) {
+                started++;
+            }
+            uint64_t start = get_time_nanoseconds();
+            atomic_store_explicit(&bench.start, true, memory_order_release);
+            for (uint32_t i = 0; i < started; ++i) {
+                destroy_thread(&threads[i]);
+            }
+            uint64_t elapsed = get_time_nanoseconds() - start;
+            pthread_mutex_destroy(&bench.pthread_mutex);
+
+            uint64_t operations = (uint64_t)bench.operations_per_thread * started;
+            uint64_t acquisitions = atomic_load(&stats.acquisitions);
+            if (kind == LOCK_BENCH_PTHREAD_MUTEX || acquisitions == 0) {
+                printf(" %9.1f     ", operations > 0 ? (double)elapsed / (double)operations : 0.0);
+            }
+            else {
+                printf(" %9.1f %3.0f%%", (double)elapsed / (double)operations, 100.0 * (double)atomic_load(&stats.contended_acquisitions) / (double)acquisitions);
+            }
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+}
+
+// Bursts stay well under the ring capacity and the pauses between them outlast the flush
+// interval, so the flusher drains every burst and no zone is dropped.
+#define PROFILE_BENCH_BURST_ZONES (PROFILE_RING_CAPACITY / 4)
+#define PROFILE_BENCH_BURSTS 64
+#define PROFILE_BENCH_PAUSE_NANOSECONDS (2 * PROFILE_FLUSH_INTERVAL_NANOSECONDS)
+
+static uint64_t time_profile_zones(bool pause) {
+    uint64_t elapsed = 0;
+    for (uint32_t burst = 0; burst < PROFILE_BENCH_BURSTS; ++burst) {
+        uint64_t start = get_time_nanoseconds();
+        for (uint32_t i = 0; i < PROFILE_BENCH_BURST_ZONES; ++i) {
+            PROFILE_BEGIN("bench_zone");
+            PROFILE_END();
+        }
+        elapsed += get_time_nanoseconds() - start;
+        if (pause) {
+            sleep_until(get_time_nanoseconds() + PROFILE_BENCH_PAUSE_NANOSECONDS);
+        }
+    }
+    return elapsed;
+}
+
+// Cost of an empty zone, a begin and an end, while the profiler records and while it is stopped.
+static void bench_profile_zones(void) {
+    const uint64_t zone_count = (uint64_t)PROFILE_BENCH_BURSTS * PROFILE_BENCH_BURST_ZONES;
+    uint64_t stopped_nanoseconds = time_profile_zones(false);
+
+    const char* trace_path = "/tmp/bench_profile_trace.json";
+    if (start_profiler(trace_path) != RESULT_SUCCESS) {
+        printf("  start_profiler failed\n");
+        return;
+    }
+    // Registers this thread, so the timed bursts measure the steady state.
+    PROFILE_BEGIN("bench_register");
+    PROFILE_END();
+    uint64_t running_nanoseconds = time_profile_zones(true);
+    stop_profiler();
+    const profiler_stats* stats = get_profiler_stats();
+    uint64_t dropped = atomic_load(&stats->dropped_events);
+    uint64_t written = atomic_load(&stats->written_events);
+    remove(trace_path);
+
+    printf("  stopped  %6.1f ns/zone\n", (double)stopped_nanoseconds / (double)zone_count);
+    printf("  running  %6.1f ns/zone, %llu events written, %llu dropped\n", (double)running_nanoseconds / (double)zone_count,
+           (unsigned long long)written, (unsigned long long)dropped);
+}
+
+// Writes size bytes of a fixed pattern to path; the file stays in the page cache afterwards.
+static bool write_bench_file(const char* path, size_t size) {
+    uint64_t* data = malloc(size);
+    if (data == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < size / sizeof(uint64_t); ++i) {
+        data[i] = i * 0x9e3779b97f4a7c15ull;
+    }
+    bool written = write_file_atomically(path, data, size) == RESULT_SUCCESS;
+    free(data);
+    return written;
+}
+
+static uint64_t checksum_bench_data(const void* data, size_t size) {
+    const uint64_t* words = data;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < size / sizeof(uint64_t); ++i) {
+        sum += words[i];
+    }
+    return sum;
+}
+
+typedef enum {
+    FILE_LOAD_READ,
+    FILE_LOAD_MAPPING,
+    FILE_LOAD_VIEW_POPULATE,
+    FILE_LOAD_VIEW_SEQUENTIAL,
+    FILE_LOAD_METHOD_COUNT,
+} file_load_method;
+
+static const char* const file_load_method_names[FILE_LOAD_METHOD_COUNT] = { "read", "file_mapping", "view populate", "view sequential" };
+
+// Opens the file, reads every byte through the method and closes it again. Returns 0 on failure.
+static uint64_t load_bench_file(const char* path, size_t size, file_load_method method, void* buffer) {
+    uint64_t sum = 0;
+    if (method == FILE_LOAD_READ) {
+        int descriptor = open(path, O_RDONLY | O_CLOEXEC);
+        if (descriptor < 0) {
+            return 0;
+        }
+        size_t done = 0;
+        while (done < size) {
+            ssize_t count = read(descriptor, (uint8_t*)buffer + done, size - done);
+            if (count <= 0) {
+                break;
+            }
+            done += (size_t)count;
+        }
+        close(descriptor);
+        sum = done == size ? checksum_bench_data(buffer, size) : 0;
+    }
+    else if (method == FILE_LOAD_MAPPING) {
+        file_mapping mapping;
+        if (create_file_mapping(path, &mapping) != RESULT_SUCCESS) {
+            return 0;
+        }
+        sum = checksum_bench_data(mapping.data, mapping.size);
+        destroy_file_mapping(&mapping);
+    }
+    else {
+        mapped_file file;
+        if (open_mapped_file(path, false, &file) != RESULT_SUCCESS) {
+            return 0;
+        }
+        file_view view;
+        uint32_t flags = method == FILE_LOAD_VIEW_POPULATE ? FILE_VIEW_POPULATE : FILE_VIEW_SEQUENTIAL;
+        if (map_file_view(&file, 0, 0, flags, &view) == RESULT_SUCCESS) {
+            sum = checksum_bench_data(view.data, view.size);
+            unmap_file_view(&view);
+        }
+        close_mapped_file(&file);
+    }
+    return sum;
+}
+
+#define FILE_LOAD_BENCH_BYTES ((uint64_t)512 * 1024 * 1024)
+
+// Loading a whole asset with read() into a reused buffer against mapping it, for small, medium
+// and large assets. Each load opens, reads every byte and closes. The file is in the page cache,
+// so this measures the copy and page table costs rather than the disk.
+static void bench_file_loads(void) {
+    static const size_t sizes[] = { 64 * 1024, 1024 * 1024, 16 * 1024 * 1024 };
+    const char* path = "/tmp/bench_file_load.bin";
+    printf("  %-16s", "asset size");
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        printf(" %18zu KiB", sizes[i] / 1024);
+    }
+    printf("\n  us/load and GB/s\n");
+
+    for (uint32_t method = 0; method < FILE_LOAD_METHOD_COUNT; ++method) {
+        printf("  %-16s", file_load_method_names[method]);
+        for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+            size_t size = sizes[i];
+            void* buffer = malloc(size);
+            if (buffer == NULL || !write_bench_file(path, size)) {
+                printf(" %22s", "failed");
+                free(buffer);
+                continue;
+            }
+            // The first load pays for faulting in the read buffer; leave it out.
+            uint64_t expected = load_bench_file(path, size, FILE_LOAD_READ, buffer);
+            uint32_t loads = (uint32_t)(FILE_LOAD_BENCH_BYTES / size);
+            bool correct = true;
+            uint64_t start = get_time_nanoseconds();
+            for (uint32_t load = 0; load < loads; ++load) {
+                correct = load_bench_file(path, size, (file_load_method)method, buffer) == expected && correct;
+            }
+            uint64_t elapsed = get_time_nanoseconds() - start;
+            free(buffer);
+            if (!correct) {
+                printf(" %22s", "wrong data");
+                continue;
+            }
+            printf(" %11.1f %5.2f GB/s", (double)elapsed / loads / 1000.0, (double)size * loads / (double)elapsed);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+    remove(path);
+}
+
+#define IO_BENCH_FILE_SIZE ((size_t)64 * 1024 * 1024)
+#define IO_BENCH_RANDOM_READS 65536
+
+typedef struct {
+    const char* name;
+    uint32_t read_size;
+    uint32_t reads_in_flight;
+    bool random;
+} io_bench_pattern;
+
+static const io_bench_pattern io_bench_patterns[] = {
+    { "4 KiB random", 4096, 64, true },
+    { "1 MiB sequential", 1024 * 1024, 8, false },
+};
+
+// The queue is large and must not move while it runs.
+static io_queue bench_io_queue;
+
+// Keeps pattern->reads_in_flight reads queued until the reads are done, each into its own
+// slice of one registered buffer. Returns false if any read comes back short or failed.
+static bool run_io_bench_pattern(io_queue* queue, uint32_t file, const io_bench_pattern* pattern, uint8_t* buffer) {
+    uint32_t read_count = pattern->random ? IO_BENCH_RANDOM_READS : 4 * (uint32_t)(IO_BENCH_FILE_SIZE / pattern->read_size);
+    uint32_t free_slots[MAX_IO_QUEUE_DEPTH];
+    uint32_t free_count = pattern->reads_in_flight;
+    for (uint32_t i = 0; i < free_count; ++i) {
+        free_slots[i] = i;
+    }
+    uint64_t random_state = 0x9e3779b97f4a7c15ull;
+    uint32_t block_count = (uint32_t)(IO_BENCH_FILE_SIZE / pattern->read_size);
+    uint32_t submitted = 0;
+    uint32_t completed = 0;
+    bool correct = true;
+    while (completed < read_count) {
+        while (submitted < read_count && free_count > 0) {
+            uint32_t block = submitted % block_count;
+            if (pattern->random) {
+                random_state ^= random_state << 13;
+                random_state ^= random_state >> 7;
+                random_state ^= random_state << 17;
+                block = (uint32_t)(random_state % block_count);
+            }
+            uint32_t slot = free_slots[free_count - 1];
+            io_read read = {
+                .file = file,
+                .offset = (uint64_t)block * pattern->read_size,
+                .buffer = buffer + (size_t)slot * pattern->read_size,
+                .size = pattern->read_size,
+                .buffer_index = 0,
+                .user_data = (void*)(uintptr_t)slot,
+            };
+            if (submit_io_reads(queue, &read, 1) != 1) {
+                break;
+            }
+            free_count--;
+            submitted++;
+        }
+        io_completion completion;
+        if (!poll_io_completion(queue, &completion)) {
+            sched_yield();
+            continue;
+        }
+        correct = correct && completion.result == (int32_t)pattern->read_size;
+        free_slots[free_count++] = (uint32_t)(uintptr_t)completion.user_data;
+        completed++;
+    }
+    return correct;
+}
+
+// Reads through the io_uring and the thread backends: 4 KiB at random offsets and 1 MiB in
+// order. The file was just written, so it is in the page cache and the numbers show the cost
+// of the queue and the copies, not of the disk.
+static void bench_io(void) {
+    const char* path = "/tmp/bench_io.bin";
+    const size_t buffer_size = 8 * 1024 * 1024;
+    uint8_t* buffer = malloc(buffer_size);
+    if (buffer == NULL || !write_bench_file(path, IO_BENCH_FILE_SIZE)) {
+        printf("  could not write %s\n", path);
+        free(buffer);
+        return;
+    }
+    memset(buffer, 0, buffer_size);
+    printf("  %-8s %-18s %10s %14s %14s\n", "backend", "pattern", "MB/s", "mean latency", "max latency");
+
+    for (uint32_t force_threads = 0; force_threads < 2; ++force_threads) {
+        if (create_io_queue(0, force_threads != 0, &bench_io_queue) != RESULT_SUCCESS) {
+            printf("  create_io_queue failed\n");
+            continue;
+        }
+        io_queue* queue = &bench_io_queue;
+        const char* backend = queue->backend == IO_BACKEND_URING ? "io_uring" : "threads";
+        if (force_threads == 0 && queue->backend != IO_BACKEND_URING) {
+            printf("  io_uring is unavailable here\n");
+            destroy_io_queue(queue);
+            continue;
+        }
+        io_buffer registered = { buffer, buffer_size };
+        register_io_buffers(queue, &registered, 1);
+        uint64_t file_size = 0;
+        uint32_t file = open_io_file(queue, path, false, &file_size);
+        for (uint32_t i = 0; i < sizeof(io_bench_patterns) / sizeof(io_bench_patterns[0]) && file != UINT32_MAX; ++i) {
+            const io_bench_pattern* pattern = &io_bench_patterns[i];
+            io_stats* stats = &queue->stats;
+            uint64_t bytes_before = atomic_load(&stats->bytes_read);
+            uint64_t completed_before = atomic_load(&stats->completed);
+            uint64_t latency_before = atomic_load(&stats->total_latency_nanoseconds);
+            atomic_store(&stats->max_latency_nanoseconds, 0);
+            uint64_t start = get_time_nanoseconds();
+            bool correct = run_io_bench_pattern(queue, file, pattern, buffer);
+            uint64_t elapsed = get_time_nanoseconds() - start;
+            uint64_t bytes = atomic_load(&stats->bytes_read) - bytes_before;
+            uint64_t completed = atomic_load(&stats->completed) - completed_before;
+            uint64_t latency = atomic_load(&stats->total_latency_nanoseconds) - latency_before;
+            printf("  %-8s %-18s %10.0f %11.1f us %11.1f us%s\n", backend, pattern->name, (double)bytes * 1000.0 / (double)elapsed,
+                   completed > 0 ? (double)latency / (double)completed / 1000.0 : 0.0, (double)atomic_load(&stats->max_latency_nanoseconds) / 1000.0,
+                   correct ? "" : "  (reads failed)");
+        }
+        if (file == UINT32_MAX) {
+            printf("  open_io_file failed\n");
+        }
+        else {
+            close_io_file(queue, file);
+        }
+        destroy_io_queue(queue);
+    }
+    free(buffer);
+    remove(path);
+}
+
+#define PACK_BENCH_ASSET_SIZE 256
+#define PACK_BENCH_OPENS 2000
+
+static void format_bench_asset_path(uint32_t asset, char* out, size_t capacity) {
+    snprintf(out, capacity, "textures/set_%u/asset_%u.bin", asset % 16, asset);
+}
+
+// Lays out a pack of asset_count small uncompressed assets the way asset_packer does.
+static bool write_bench_pack(const char* path, uint32_t asset_count) {
+    uint32_t index_capacity = 1;
+    while (index_capacity < 2 * asset_count) {
+        index_capacity *= 2;
+    }
+    uint64_t index_offset = (sizeof(asset_pack_header) + ASSET_PACK_ALIGNMENT - 1) & ~(uint64_t)(ASSET_PACK_ALIGNMENT - 1);
+    uint64_t payload_offset = (index_offset + (uint64_t)index_capacity * sizeof(asset_pack_entry) + ASSET_PACK_ALIGNMENT - 1) &
+                              ~(uint64_t)(ASSET_PACK_ALIGNMENT - 1);
+    uint64_t file_size = payload_offset + (uint64_t)asset_count * ASSET_PACK_ALIGNMENT;
+    uint8_t* data = calloc(1, (size_t)file_size);
+    if (data == NULL) {
+        return false;
+    }
+    asset_pack_header* header = (asset_pack_header*)data;
+    *header = (asset_pack_header){
+        .magic = ASSET_PACK_MAGIC,
+        .version = ASSET_PACK_VERSION,
+        .entry_count = asset_count,
+        .index_capacity = index_capacity,
+        .index_offset = index_offset,
+        .file_size = file_size,
+    };
+    asset_pack_entry* index = (asset_pack_entry*)(data + index_offset);
+    for (uint32_t asset = 0; asset < asset_count; ++asset) {
+        char asset_path[MAX_ASSET_PATH];
+        format_bench_asset_path(asset, asset_path, sizeof(asset_path));
+        asset_pack_entry entry = {
+            .path_hash = hash_asset_path(asset_path),
+            .offset = payload_offset + (uint64_t)asset * ASSET_PACK_ALIGNMENT,
+            .stored_size = PACK_BENCH_ASSET_SIZE,
+            .size = PACK_BENCH_ASSET_SIZE,
+        };
+        memset(data + entry.offset, (int)(asset & 0xff), PACK_BENCH_ASSET_SIZE);
+        uint32_t slot = (uint32_t)entry.path_hash & (index_capacity - 1);
+        while (index[slot].path_hash != 0) {
+            slot = (slot + 1) & (index_capacity - 1);
+        }
+        index[slot] = entry;
+    }
+    bool written = write_file_atomically(path, data, (size_t)file_size) == RESULT_SUCCESS;
+    free(data);
+    return written;
+}
+
+// Opening packs of growing size and looking assets up by path. Lookups hash the path, which
+// normalizes it first, so the cost is shown with and without the hashing.
+static void bench_asset_pack(void) {
+    static const uint32_t asset_counts[] = { 256, 4096, 65536 };
+    const char* path = "/tmp/bench_asset_pack.pack";
+    printf("  %8s %12s %16s %16s %14s\n", "assets", "open + close", "lookup by path", "lookup by hash", "missing path");
+    for (uint32_t i = 0; i < sizeof(asset_counts) / sizeof(asset_counts[0]); ++i) {
+        uint32_t asset_count = asset_counts[i];
+        if (!write_bench_pack(path, asset_count)) {
+            printf("  could not write %s\n", path);
+            return;
+        }
+
+        asset_pack pack;
+        uint64_t start = get_time_nanoseconds();
+        bool opened = true;
+        for (uint32_t open = 0; open < PACK_BENCH_OPENS && opened; ++open) {
+            opened = open_asset_pack(path, &pack) == RESULT_SUCCESS;
+            if (opened) {
+                close_asset_pack(&pack);
+            }
+        }
+        uint64_t open_nanoseconds = get_time_nanoseconds() - start;
+        if (!opened || open_asset_pack(path, &pack) != RESULT_SUCCESS) {
+            printf("  open_asset_pack failed\n");
+            remove(path);
+            return;
+        }
+
+        char (*paths)[MAX_ASSET_PATH] = malloc((size_t)asset_count * MAX_ASSET_PATH);
+        uint64_t* hashes = malloc((size_t)asset_count * sizeof(uint64_t));
+        if (paths == NULL || hashes == NULL) {
+            printf("  out of memory\n");
+            free(paths);
+            free(hashes);
+            close_asset_pack(&pack);
+            remove(path);
+            return;
+        }
+        // Looked up in a scattered order so the index is not walked front to back.
+        for (uint32_t asset = 0; asset < asset_count; ++asset) {
+            format_bench_asset_path((uint32_t)(((uint64_t)asset * 40503u) % asset_count), paths[asset], MAX_ASSET_PATH);
+            hashes[asset] = hash_asset_path(paths[asset]);
+        }
+
+        uint32_t found = 0;
+        start = get_time_nanoseconds();
+        for (uint32_t asset = 0; asset < asset_count; ++asset) {
+            found += find_asset(&pack, hash_asset_path(paths[asset])) != NULL;
+        }
+        uint64_t path_nanoseconds = get_time_nanoseconds() - start;
+        start = get_time_nanoseconds();
+        for (uint32_t asset = 0; asset < asset_count; ++asset) {
+            found += find_asset(&pack, hashes[asset]) != NULL;
+        }
+        uint64_t hash_nanoseconds = get_time_nanoseconds() - start;
+        for (uint32_t asset = 0; asset < asset_count; ++asset) {
+            snprintf(paths[asset], MAX_ASSET_PATH, "textures/missing/asset_%u.bin", asset);
+        }
+        uint32_t missing = 0;
+        start = get_time_nanoseconds();
+        for (uint32_t asset = 0; asset < asset_count; ++asset) {
+            missing += find_asset(&pack, hash_asset_path(paths[asset])) == NULL;
+        }
+        uint64_t missing_nanoseconds = get_time_nanoseconds() - start;
+        close_asset_pack(&pack);
+        free(paths);
+        free(hashes);
+
+        printf("  %8u %9.1f us %13.1f ns %13.1f ns %11.1f ns%s\n", asset_count, (double)open_nanoseconds / PACK_BENCH_OPENS / 1000.0,
+               (double)path_nanoseconds / asset_count, (double)hash_nanoseconds / asset_count, (double)missing_nanoseconds / asset_count,
+               found == 2 * asset_count && missing == asset_count ? "" : "  (lookups wrong)");
+    }
+    remove(path);
+}
+
+#if defined(BENCH_VULKAN)
+// The Vulkan cases measure the CPU side, so their shaders only have to be valid. Assembled by
+// hand from
+//
+//     void main() { gl_Position = vec4(0.0, 0.0, 0.0, 1.0); }
+//     layout(location = 0) out vec4 color; void main() { color = vec4(1.0); }
+static const uint32_t bench_vertex_shader[] = {
+    0x07230203, 0x00010000, 0x00000000, 0x0000000c, 0x00000000, 0x00020011, 0x00000001, 0x0003000e,
+    0x00000000, 0x00000001, 0x0006000f, 0x00000000, 0x00000001, 0x6e69616d, 0x00000000, 0x00000007,
+    0x00040047, 0x00000007, 0x0000000b, 0x00000000, 0x00020013, 0x00000002, 0x00030021, 0x00000003,
+    0x00000002, 0x00030016, 0x00000004, 0x00000020, 0x00040017, 0x00000005, 0x00000004, 0x00000004,
+    0x00040020, 0x00000006, 0x00000003, 0x00000005, 0x0004003b, 0x00000006, 0x00000007, 0x00000003,
+    0x0004002b, 0x00000004, 0x00000008, 0x00000000, 0x0004002b, 0x00000004, 0x00000009, 0x3f800000,
+    0x0007002c, 0x00000005, 0x0000000a, 0x00000008, 0x00000008, 0x00000008, 0x00000009, 0x00050036,
+    0x00000002, 0x00000001, 0x00000000, 0x00000003, 0x000200f8, 0x0000000b, 0x0003003e, 0x00000007,
+    0x0000000a, 0x000100fd, 0x00010038,
+};
+static const uint32_t bench_fragment_shader[] = {
+    0x07230203, 0x00010000, 0x00000000, 0x0000000c, 0x00000000, 0x00020011, 0x00000001, 0x0003000e,
+    0x00000000, 0x00000001, 0x0006000f, 0x00000004, 0x00000001, 0x6e69616d, 0x00000000, 0x00000007,
+    0x00030010, 0x00000001, 0x00000007, 0x00040047, 0x00000007, 0x0000001e, 0x00000000, 0x00020013,
+    0x00000002, 0x00030021, 0x00000003, 0x00000002, 0x00030016, 0x00000004, 0x00000020, 0x00040017,
+    0x00000005, 0x00000004, 0x00000004, 0x00040020, 0x00000006, 0x00000003, 0x00000005, 0x0004003b,
+    0x00000006, 0x00000007, 0x00000003, 0x0004002b, 0x00000004, 0x00000008, 0x00000000, 0x0004002b,
+    0x00000004, 0x00000009, 0x3f800000, 0x0007002c, 0x00000005, 0x0000000a, 0x00000009, 0x00000009,
+    0x00000009, 0x00000009, 0x00050036, 0x00000002, 0x00000001, 0x00000000, 0x00000003, 0x000200f8,
+    0x0000000b, 0x0003003e, 0x00000007, 0x0000000a, 0x000100fd, 0x00010038,
+};
+
+// The renderer must not move while it exists.
+static renderer bench_renderer;
+
+// Headless, so the cases run without a display, and on lavapipe where there is no GPU.
+static bool create_bench_renderer(uint32_t recording_threads) {
+    renderer_config config = { .headless = true, .headless_width = 256, .headless_height = 256, .recording_threads = recording_threads };
+    if (create_renderer(NULL, &config, &bench_renderer) != RESULT_SUCCESS) {
+        destroy_renderer(&bench_renderer);
+        printf("  skipped: no Vulkan device; lavapipe serves on machines without a GPU\n");
+        return false;
+    }
+    return true;
+}
+
+static VkShaderModule create_bench_shader(const uint32_t* code, size_t size) {
+    VkShaderModuleCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = size,
+        .pCode = code,
+    };
+    VkShaderModule shader = VK_NULL_HANDLE;
+    if (vkCreateShaderModule(bench_renderer.device, &create_info, NULL, &shader) != VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    }
+    return shader;
+}
+
+// A pipeline for the renderer's render pass. variant picks one of PIPELINE_BENCH_VARIANTS
+// combinations of topology, cull mode, winding and blending, so each variant compiles apart.
+#define PIPELINE_BENCH_VARIANTS 64
+
+static pipeline_state make_bench_pipeline_state(VkShaderModule vertex_shader, VkShaderModule fragment_shader, VkPipelineLayout layout, uint32_t variant) {
+    static const VkPrimitiveTopology topologies[] = {
+        VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+        VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
+        VK_PRIMITIVE_TOPOLOGY_LINE_LIST,
+        VK_PRIMITIVE_TOPOLOGY_LINE_STRIP,
+    };
+    static const VkCullModeFlags cull_modes[] = { VK_CULL_MODE_NONE, VK_CULL_MODE_FRONT_BIT, VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_FRONT_AND_BACK };
+    pipeline_state state = { 0 };
+    state.vertex_shader = vertex_shader;
+    state.fragment_shader = fragment_shader;
+    state.layout = layout;
+    state.render_pass = bench_renderer.render_pass;
+    state.topology = topologies[variant % 4];
+    state.polygon_mode = VK_POLYGON_MODE_FILL;
+    state.cull_mode = cull_modes[(variant / 4) % 4];
+    state.front_face = (variant / 16) % 2 ? VK_FRONT_FACE_CLOCKWISE : VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    state.depth_compare = VK_COMPARE_OP_ALWAYS;
+    state.blend.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    if ((variant / 32) % 2) {
+        state.blend.blendEnable = VK_TRUE;
+        state.blend.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+        state.blend.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        state.blend.colorBlendOp = VK_BLEND_OP_ADD;
+        state.blend.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        state.blend.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+        state.blend.alphaBlendOp = VK_BLEND_OP_ADD;
+    }
+    return state;
+}
+
+// One renderer start: compiles every variant through get_graphics_pipeline, then destroys the
+// renderer, which saves the pipeline cache.
+static void run_pipeline_cache_start(const char* name) {
+    if (!create_bench_renderer(0)) {
+        return;
+    }
+    VkShaderModule vertex_shader = create_bench_shader(bench_vertex_shader, sizeof(bench_vertex_shader));
+    VkShaderModule fragment_shader = create_bench_shader(bench_fragment_shader, sizeof(bench_fragment_shader));
+    pipeline_layout_state layout_state = { 0 };
+    VkPipelineLayout layout = get_pipeline_layout(&bench_renderer, &layout_state);
+    uint32_t built = 0;
+    uint64_t start = get_time_nanoseconds();
+    for (uint32_t variant = 0; variant < PIPELINE_BENCH_VARIANTS && vertex_shader != VK_NULL_HANDLE && fragment_shader != VK_NULL_HANDLE && layout != VK_NULL_HANDLE; ++variant) {
+        pipeline_state state = make_bench_pipeline_state(vertex_shader, fragment_shader, layout, variant);
+        built += get_graphics_pipeline(&bench_renderer, &state) != VK_NULL_HANDLE;
+    }
+    uint64_t elapsed = get_time_nanoseconds() - start;
+    pipeline_state_stats stats;
+    get_pipeline_state_stats(&bench_renderer, &stats);
+    if (vertex_shader != VK_NULL_HANDLE) {
+        vkDestroyShaderModule(bench_renderer.device, vertex_shader, NULL);
+    }
+    if (fragment_shader != VK_NULL_HANDLE) {
+        vkDestroyShaderModule(bench_renderer.device, fragment_shader, NULL);
+    }
+    destroy_renderer(&bench_renderer);
+
+    const pipeline_cache_stats* cache = &bench_renderer.pipeline_cache_stats;
+    printf("  %-5s %u/%u pipelines in %.1f ms; compile_nanoseconds %.1f ms, slowest %.2f ms\n", name, built, PIPELINE_BENCH_VARIANTS, (double)elapsed / 1e6,
+           (double)stats.compile_nanoseconds / 1e6, (double)stats.max_compile_nanoseconds / 1e6);
+    printf("        cache %s %llu bytes in %.2f ms, creation feedback %u hits %u misses, saved %llu bytes\n", cache->loaded ? "loaded" : "not loaded",
+           (unsigned long long)cache->loaded_bytes, (double)cache->load_nanoseconds / 1e6, cache->hits, cache->misses, (unsigned long long)cache->saved_bytes);
+}
+
+// Renderer start-up with the pipeline cache file deleted, then with the file the first start
+// saved, compiling the same pipelines both times. An existing cache file is set aside and put
+// back afterwards.
+static void bench_pipeline_cache(void) {
+    const char* set_aside_path = PIPELINE_CACHE_PATH ".bench";
+    bool set_aside = rename(PIPELINE_CACHE_PATH, set_aside_path) == 0;
+    run_pipeline_cache_start("cold");
+    run_pipeline_cache_start("warm");
+    remove(PIPELINE_CACHE_PATH);
+    if (set_aside) {
+        rename(set_aside_path, PIPELINE_CACHE_PATH);
+    }
+}
+
+#define UPLOAD_BENCH_BUFFER_SIZE ((VkDeviceSize)64 * 1024 * 1024)
+
+typedef struct {
+    const char* name;
+    VkDeviceSize upload_size;
+    uint32_t upload_count;
+} upload_bench_pattern;
+
+static const upload_bench_pattern upload_bench_patterns[] = {
+    { "4 KiB x 4096", 4096, 4096 },
+    { "64 MiB x 4", UPLOAD_BENCH_BUFFER_SIZE, 4 },
+};
+
+// upload_buffer into one device local buffer, ending with a wait on the last ticket. Each
+// pattern gets its own renderer, since upload_stats only accumulate. The 64 MiB uploads are
+// twice the default staging ring, so they show the stalls of streaming through it.
+static void bench_uploads(void) {
+    uint8_t* data = malloc(UPLOAD_BENCH_BUFFER_SIZE);
+    if (data == NULL) {
+        printf("  out of memory\n");
+        return;
+    }
+    memset(data, 0x5a, UPLOAD_BENCH_BUFFER_SIZE);
+    printf("  %-14s %10s %12s %8s %8s %12s\n", "pattern", "MB/s", "stats MB/s", "submits", "stalls", "stalled");
+
+    for (uint32_t i = 0; i < sizeof(upload_bench_patterns) / sizeof(upload_bench_patterns[0]); ++i) {
+        const upload_bench_pattern* pattern = &upload_bench_patterns[i];
+        if (!create_bench_renderer(0)) {
+            break;
+        }
+        VkBufferCreateInfo buffer_info = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = UPLOAD_BENCH_BUFFER_SIZE,
+            .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        };
+        VkBuffer buffer = VK_NULL_HANDLE;
+        gpu_allocation_handle allocation = POOL_INVALID_HANDLE;
+        if (create_gpu_buffer(&bench_renderer, &buffer_info, GPU_MEMORY_DEVICE_LOCAL, &buffer, &allocation) != RESULT_SUCCESS) {
+            printf("  create_gpu_buffer failed\n");
+            destroy_renderer(&bench_renderer);
+            break;
+        }
+
+        bool correct = true;
+        upload_ticket ticket = 0;
+        uint64_t start = get_time_nanoseconds();
+        for (uint32_t upload = 0; upload < pattern->upload_count && correct; ++upload) {
+            VkDeviceSize offset = (upload * pattern->upload_size) % UPLOAD_BENCH_BUFFER_SIZE;
+            correct = upload_buffer(&bench_renderer, buffer, offset, data + offset, pattern->upload_size, &ticket) == RESULT_SUCCESS;
+        }
+        flush_uploads(&bench_renderer);
+        wait_for_upload(&bench_renderer, ticket);
+        uint64_t elapsed = get_time_nanoseconds() - start;
+
+        const upload_stats* stats = &bench_renderer.uploads.stats;
+        printf("  %-14s %10.0f %12.0f %8u %8u %9.2f ms%s\n", pattern->name, (double)stats->completed_bytes * 1000.0 / (double)elapsed,
+               stats->megabytes_per_second, stats->submits, stats->stalls, (double)stats->stall_nanoseconds / 1e6, correct ? "" : "  (upload failed)");
+        destroy_gpu_buffer(&bench_renderer, buffer, allocation);
+        destroy_renderer(&bench_renderer);
+    }
+    free(data);
+}
+
+#define DRAW_BENCH_MAX_DRAWS 100000
+#define DRAW_BENCH_MATERIALS 64
+#define DRAW_BENCH_MESHES 1024
+#define DRAW_BENCH_WARMUP_FRAMES 2
+#define DRAW_BENCH_FRAMES 8
+
+static const uint32_t draw_bench_counts[] = { 10000, 50000, DRAW_BENCH_MAX_DRAWS };
+
+typedef struct {
+    draw_list lists[MAX_RECORDING_THREADS];
+    VkCommandBuffer command_buffers[MAX_RECORDING_THREADS];
+    draw_tables tables;
+    uint32_t list_count;
+    uint32_t draw_count;
+    _Atomic bool failed;
+} draw_bench;
+
+static draw_bench bench_draws;
+
+// One secondary command buffer per list, each holding an even share of the frame's draws.
+// Keys are scattered over the materials and meshes so the sort has work to do.
+static void record_bench_draws(void* data, uint32_t begin, uint32_t end) {
+    draw_bench* bench = data;
+    static const float instance[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    for (uint32_t i = begin; i < end; ++i) {
+        VkCommandBuffer command_buffer = begin_secondary_command_buffer(&bench_renderer);
+        bench->command_buffers[i] = command_buffer;
+        if (command_buffer == VK_NULL_HANDLE) {
+            atomic_store(&bench->failed, true);
+            continue;
+        }
+        VkExtent2D extent = bench_renderer.swapchain_extent;
+        VkViewport viewport = { 0.0f, 0.0f, (float)extent.width, (float)extent.height, 0.0f, 1.0f };
+        VkRect2D scissor = { { 0, 0 }, extent };
+        vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+        vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+
+        draw_list* list = &bench->lists[i];
+        reset_draw_list(list);
+        uint32_t first = (uint32_t)((uint64_t)bench->draw_count * i / bench->list_count);
+        uint32_t last = (uint32_t)((uint64_t)bench->draw_count * (i + 1) / bench->list_count);
+        for (uint32_t draw = first; draw < last; ++draw) {
+            uint32_t hash = draw * 2654435761u;
+            uint64_t key = make_draw_key(0, (hash >> 26) % DRAW_BENCH_MATERIALS, (hash >> 10) % DRAW_BENCH_MESHES, draw);
+            if (!add_draw(list, key, instance)) {
+                atomic_store(&bench->failed, true);
+                break;
+            }
+        }
+        record_draw_list(&bench_renderer, list, &bench->tables, command_buffer);
+        end_secondary_command_buffer(&bench_renderer, command_buffer);
+    }
+}
+
+// Records 10k, 50k and 100k draws a frame through draw lists into secondary command buffers,
+// from one recording thread up to one per processor. Only the recording is timed; the frames
+// are still submitted so the command pools cycle as they do in a running game.
+static void bench_draw_recording(void) {
+    job_system* system = malloc(sizeof(job_system));
+    if (system == NULL || create_job_system(0, system) != RESULT_SUCCESS) {
+        printf("  out of memory or no job system\n");
+        free(system);
+        return;
+    }
+    uint32_t max_workers = system->worker_count < MAX_RECORDING_THREADS ? system->worker_count : MAX_RECORDING_THREADS;
+    destroy_job_system(system);
+    if (!create_bench_renderer(max_workers)) {
+        free(system);
+        return;
+    }
+
+    VkShaderModule vertex_shader = create_bench_shader(bench_vertex_shader, sizeof(bench_vertex_shader));
+    VkShaderModule fragment_shader = create_bench_shader(bench_fragment_shader, sizeof(bench_fragment_shader));
+    pipeline_layout_state layout_state = { 0 };
+    VkPipelineLayout layout = get_pipeline_layout(&bench_renderer, &layout_state);
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    if (vertex_shader != VK_NULL_HANDLE && fragment_shader != VK_NULL_HANDLE && layout != VK_NULL_HANDLE) {
+        pipeline_state state = make_bench_pipeline_state(vertex_shader, fragment_shader, layout, 0);
+        pipeline = get_graphics_pipeline(&bench_renderer, &state);
+    }
+
+    // Every mesh is the same degenerate triangle, so the GPU side of the frames stays cheap.
+    static const uint16_t indices[4] = { 0 };
+    VkBufferCreateInfo vertex_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = 64,
+        .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VkBufferCreateInfo index_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = sizeof(indices),
+        .usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VkBuffer vertex_buffer = VK_NULL_HANDLE;
+    VkBuffer index_buffer = VK_NULL_HANDLE;
+    gpu_allocation_handle vertex_allocation = POOL_INVALID_HANDLE;
+    gpu_allocation_handle index_allocation = POOL_INVALID_HANDLE;
+    upload_ticket ticket = 0;
+    bool ready = pipeline != VK_NULL_HANDLE &&
+                 create_gpu_buffer(&bench_renderer, &vertex_info, GPU_MEMORY_DEVICE_LOCAL, &vertex_buffer, &vertex_allocation) == RESULT_SUCCESS &&
+                 create_gpu_buffer(&bench_renderer, &index_info, GPU_MEMORY_DEVICE_LOCAL, &index_buffer, &index_allocation) == RESULT_SUCCESS &&
+                 upload_buffer(&bench_renderer, index_buffer, 0, indices, sizeof(indices), &ticket) == RESULT_SUCCESS;
+    if (ready) {
+        wait_for_upload(&bench_renderer, ticket);
+        frame_depends_on_upload(&bench_renderer, ticket);
+    }
+    else {
+        printf("  could not create the pipeline or the mesh buffers\n");
+    }
+
+    static draw_pipeline pipelines[1];
+    static draw_material materials[DRAW_BENCH_MATERIALS];
+    static draw_mesh meshes[DRAW_BENCH_MESHES];
+    pipelines[0] = (draw_pipeline){ pipeline, layout };
+    for (uint32_t i = 0; i < DRAW_BENCH_MESHES; ++i) {
+        meshes[i] = (draw_mesh){ vertex_buffer, index_buffer, VK_INDEX_TYPE_UINT16, 3, 0, 0 };
+    }
+    draw_bench* bench = &bench_draws;
+    bench->tables = (draw_tables){ pipelines, 1, materials, DRAW_BENCH_MATERIALS, meshes, DRAW_BENCH_MESHES };
+    printf("  %-8s %8s %12s %12s\n", "threads", "draws", "draws/ms", "draw calls");
+
+    for (uint32_t workers = 1; ready;) {
+        uint32_t created = 0;
+        uint32_t capacity = (DRAW_BENCH_MAX_DRAWS + workers - 1) / workers;
+        while (created < workers && create_draw_list(&bench_renderer, capacity, sizeof(float) * 4, &bench->lists[created]) == RESULT_SUCCESS) {
+            created++;
+        }
+        bool have_workers = created == workers && create_job_system(workers, system) == RESULT_SUCCESS;
+        if (!have_workers) {
+            printf("  could not create %u draw lists and workers\n", workers);
+            ready = false;
+        }
+        bench->list_count = workers;
+
+        for (uint32_t c = 0; c < sizeof(draw_bench_counts) / sizeof(draw_bench_counts[0]) && ready; ++c) {
+            bench->draw_count = draw_bench_counts[c];
+            atomic_store(&bench->failed, false);
+            uint64_t record_nanoseconds = 0;
+            uint32_t measured_frames = 0;
+            uint32_t draw_calls = 0;
+            for (uint32_t frame = 0; frame < DRAW_BENCH_WARMUP_FRAMES + DRAW_BENCH_FRAMES && ready; ++frame) {
+                VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+                if (!begin_frame(&bench_renderer, &command_buffer)) {
+                    continue;
+                }
+                uint64_t start = get_time_nanoseconds();
+                parallel_for(system, workers, record_bench_draws, bench);
+                uint64_t elapsed = get_time_nanoseconds() - start;
+                ready = !atomic_load(&bench->failed);
+                if (ready) {
+                    execute_secondary_command_buffers(&bench_renderer, bench->command_buffers, workers);
+                }
+                end_frame(&bench_renderer);
+                if (frame >= DRAW_BENCH_WARMUP_FRAMES) {
+                    record_nanoseconds += elapsed;
+                    measured_frames++;
+                }
+            }
+            for (uint32_t i = 0; i < workers; ++i) {
+                draw_calls += bench->lists[i].stats.draw_calls + bench->lists[i].stats.indirect_draw_calls;
+            }
+            if (ready && measured_frames > 0) {
+                printf("  %-8u %8u %12.0f %12u\n", workers, bench->draw_count, (double)bench->draw_count * measured_frames * 1e6 / (double)record_nanoseconds, draw_calls);
+            }
+            else {
+                printf("  %-8u %8u  recording failed\n", workers, bench->draw_count);
+            }
+        }
+
+        // The lists' buffers may still be read by frames in flight.
+        vkDeviceWaitIdle(bench_renderer.device);
+        for (uint32_t i = 0; i < created; ++i) {
+            destroy_draw_list(&bench_renderer, &bench->lists[i]);
+        }
+        if (have_workers) {
+            destroy_job_system(system);
+        }
+        if (workers == max_workers) {
+            break;
+        }
+        workers = workers * 2 < max_workers ? workers * 2 : max_workers;
+    }
+
+    vkDeviceWaitIdle(bench_renderer.device);
+    if (vertex_buffer != VK_NULL_HANDLE) {
+        destroy_gpu_buffer(&bench_renderer, vertex_buffer, vertex_allocation);
+    }
+    if (index_buffer != VK_NULL_HANDLE) {
+        destroy_gpu_buffer(&bench_renderer, index_buffer, index_allocation);
+    }
+    if (vertex_shader != VK_NULL_HANDLE) {
+        vkDestroyShaderModule(bench_renderer.device, vertex_shader, NULL);
+    }
+    if (fragment_shader != VK_NULL_HANDLE) {
+        vkDestroyShaderModule(bench_renderer.device, fragment_shader, NULL);
+    }
+    destroy_renderer(&bench_renderer);
+    free(system);
+}
+#endif
+
+static const bench_case bench_cases[] = {
+    { "input_latency", bench_input_latency },
+    { "frame_allocator", bench_frame_allocator },
+    { "jobs", bench_jobs },
+    { "locks", bench_locks },
+    { "profile_zones", bench_profile_zones },
+    { "file_loads", bench_file_loads },
+    { "io", bench_io },
+    { "asset_pack", bench_asset_pack },
+#if defined(BENCH_VULKAN)
+    { "pipeline_cache", bench_pipeline_cache },
+    { "uploads", bench_uploads },
+    { "draw_recording", bench_draw_recording },
+#endif
+};
+
+int main(int argc, char** argv) {
+    for (uint32_t i = 0; i < sizeof(bench_cases) / sizeof(bench_cases[0]); ++i) {
+        bool selected = argc < 2;
+        for (int argument = 1; argument < argc && !selected; ++argument) {
+            selected = strncmp(bench_cases[i].name, argv[argument], strlen(argv[argument])) == 0;
+        }
+        if (selected) {
+            printf("%s\n", bench_cases[i].name);
+            bench_cases[i].run();
+        }
+    }
+    return 0;
+}
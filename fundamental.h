@@ -1,9 +1,11 @@
 #ifndef FUNDAMENTAL_H
 #define FUNDAMENTAL_H
+#include <stddef.h>
 #include <stdint.h>
 #include <stdalign.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdatomic.h>
 
 // You can change how errors are logged by defining LOG(message) before including this header.
 #ifndef LOG
@@ -11,10 +13,13 @@
 #define LOG(message) fwrite(message, sizeof(char), sizeof(message) - 1, stderr); fflush(stderr);
 #endif
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 #if defined(NDEBUG)
 #define BREAKPOINT() (void)0
 #elif defined(_MSC_VER)
-#include <intrin.h>
 #define BREAKPOINT() __debugbreak()
 #elif defined(__GNUC__) || defined(__clang__)
 #define BREAKPOINT() __builtin_trap()
@@ -22,6 +27,12 @@
 #define BREAKPOINT() (void)0
 #endif
 
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
 #if defined(_MSC_VER)
 #define RESTRICT __restrict
 #elif defined(__GNUC__) || defined(__clang__)
@@ -30,6 +41,17 @@
 #define RESTRICT
 #endif
 
+#if defined(_MSC_VER)
+static inline uint32_t count_trailing_zeros64(uint64_t value) {
+    unsigned long index;
+    return _BitScanForward64(&index, value) ? (uint32_t)index : 64;
+}
+#elif defined(__GNUC__) || defined(__clang__)
+static inline uint32_t count_trailing_zeros64(uint64_t value) {
+    return value != 0 ? (uint32_t)__builtin_ctzll(value) : 64;
+}
+#endif
+
 #define STRINGIFY(x) #x
 #define TOSTRING(x) STRINGIFY(x)
 #define LOG_ERROR(message) LOG(__FILE__ ":" TOSTRING(__LINE__) " " message "\n")
@@ -58,6 +80,18 @@ typedef enum {
     RESULT_SUCCESS
 } result;
 
+#define FNV1A64_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV1A64_PRIME 0x100000001b3ull
+
+// 64-bit FNV-1a. Pass FNV1A64_OFFSET_BASIS as hash to start, or a previous result to continue.
+static inline uint64_t hash_fnv1a64(const void* data, size_t size, uint64_t hash) {
+    const uint8_t* bytes = data;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * FNV1A64_PRIME;
+    }
+    return hash;
+}
+
 #define DECLARE_CAPPED_ARRAY(element_type, name, capacity) \
     typedef struct { \
         element_type data[capacity]; \
@@ -115,4 +149,121 @@ typedef enum {
         return false; \
     }
 
+// Handles pack a slot index in the low POOL_HANDLE_INDEX_BITS bits and the slot's generation
+// above it. Generation 0 is never handed out, so a zeroed handle is always invalid.
+typedef uint32_t pool_handle;
+#define POOL_INVALID_HANDLE 0u
+#define POOL_HANDLE_INDEX_BITS 20
+#define POOL_HANDLE_INDEX_MASK ((1u << POOL_HANDLE_INDEX_BITS) - 1)
+#define POOL_HANDLE_GENERATION_MASK (UINT32_MAX >> POOL_HANDLE_INDEX_BITS)
+
+// Fixed-capacity pool. Live elements are kept densely packed in data[0..count) for iteration;
+// handles go through a slot table, so removing an element (which moves the last one into its
+// place) does not invalidate other handles. Free slots form an intrusive list through the same
+// table. A slot's generation is bumped when it is freed, so stale handles fail to resolve.
+// A zero-initialised pool is empty and ready to use.
+#define DECLARE_POOL(element_type, name, capacity) \
+    STATIC_ASSERT((capacity) <= POOL_HANDLE_INDEX_MASK, name##_capacity_exceeds_handle_index_bits) \
+    typedef struct { \
+        element_type data[capacity]; \
+        uint32_t dense_to_slot[capacity]; \
+        uint32_t slots[capacity]; \
+        uint16_t generations[capacity]; \
+        uint32_t count; \
+        uint32_t free_head; \
+        uint32_t used_slots; \
+    } name; \
+    element_type* name##_allocate(name* pool, pool_handle* out_handle); \
+    result name##_free(name* pool, pool_handle handle); \
+    static inline element_type* name##_get(name* pool, pool_handle handle) { \
+        uint32_t slot = handle & POOL_HANDLE_INDEX_MASK; \
+        if (slot >= pool->used_slots || pool->generations[slot] != (handle >> POOL_HANDLE_INDEX_BITS)) { \
+            return NULL; \
+        } \
+        return &pool->data[pool->slots[slot]]; \
+    } \
+    static inline pool_handle name##_handle_at(const name* pool, uint32_t dense_index) { \
+        uint32_t slot = pool->dense_to_slot[dense_index]; \
+        return ((uint32_t)pool->generations[slot] << POOL_HANDLE_INDEX_BITS) | slot; \
+    } \
+
+#define IMPLEMENT_POOL(element_type, name, capacity) \
+    element_type* name##_allocate(name* pool, pool_handle* out_handle) { \
+        uint32_t slot; \
+        if (pool->free_head != 0) { \
+            slot = pool->free_head - 1; \
+            pool->free_head = pool->slots[slot]; \
+        } \
+        else if (pool->used_slots < (capacity)) { \
+            slot = pool->used_slots++; \
+            pool->generations[slot] = 1; \
+        } \
+        else { \
+            ERROR_BREAKPOINT("Pool capacity exceeded"); \
+            return NULL; \
+        } \
+        uint32_t dense_index = pool->count++; \
+        pool->slots[slot] = dense_index; \
+        pool->dense_to_slot[dense_index] = slot; \
+        *out_handle = ((uint32_t)pool->generations[slot] << POOL_HANDLE_INDEX_BITS) | slot; \
+        return &pool->data[dense_index]; \
+    } \
+    result name##_free(name* pool, pool_handle handle) { \
+        if (name##_get(pool, handle) == NULL) { \
+            ERROR_BREAKPOINT("Stale or invalid pool handle"); \
+            return RESULT_FAILURE; \
+        } \
+        uint32_t slot = handle & POOL_HANDLE_INDEX_MASK; \
+        uint32_t dense_index = pool->slots[slot]; \
+        uint32_t last = --pool->count; \
+        if (dense_index != last) { \
+            memcpy(&pool->data[dense_index], &pool->data[last], sizeof(element_type)); \
+            uint32_t moved_slot = pool->dense_to_slot[last]; \
+            pool->dense_to_slot[dense_index] = moved_slot; \
+            pool->slots[moved_slot] = dense_index; \
+        } \
+        uint32_t generation = (pool->generations[slot] + 1) & POOL_HANDLE_GENERATION_MASK; \
+        pool->generations[slot] = (uint16_t)(generation != 0 ? generation : 1); \
+        pool->slots[slot] = pool->free_head; \
+        pool->free_head = slot + 1; \
+        return RESULT_SUCCESS; \
+    }
+
+// Bounded single-producer/single-consumer ring. One thread pushes and one thread pops,
+// without locks; head and tail live on separate cache lines so the two sides do not false share.
+#define DECLARE_SPSC_RING(element_type, name, capacity) \
+    STATIC_ASSERT(((capacity) & ((capacity) - 1)) == 0, name##_capacity_must_be_power_of_two) \
+    typedef struct { \
+        alignas(64) _Atomic uint32_t head; \
+        alignas(64) _Atomic uint32_t tail; \
+        alignas(64) element_type data[capacity]; \
+    } name; \
+    bool name##_push(name* ring, const element_type* value); \
+    bool name##_pop(name* ring, element_type* out); \
+    static inline uint32_t name##_count(name* ring) { \
+        return atomic_load_explicit(&ring->tail, memory_order_acquire) - atomic_load_explicit(&ring->head, memory_order_acquire); \
+    } \
+
+#define IMPLEMENT_SPSC_RING(element_type, name, capacity) \
+    bool name##_push(name* ring, const element_type* value) { \
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed); \
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire); \
+        if (tail - head == (capacity)) { \
+            return false; \
+        } \
+        memcpy(&ring->data[tail & ((capacity) - 1)], value, sizeof(element_type)); \
+        atomic_store_explicit(&ring->tail, tail + 1, memory_order_release); \
+        return true; \
+    } \
+    bool name##_pop(name* ring, element_type* out) { \
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed); \
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire); \
+        if (head == tail) { \
+            return false; \
+        } \
+        memcpy(out, &ring->data[head & ((capacity) - 1)], sizeof(element_type)); \
+        atomic_store_explicit(&ring->head, head + 1, memory_order_release); \
+        return true; \
+    }
+
 #endif // FUNDAMENTAL_H
\ No newline at end of file
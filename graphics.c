@@ -1,9 +1,13 @@
 #include "graphics.h"
+#include "profiler.h"
 #if defined (PLATFORM_WINDOWS)
 #define NOMINMAX
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <vulkan/vulkan_win32.h>
+#elif defined (PLATFORM_LINUX)
+#include <xcb/xcb.h>
+#include <vulkan/vulkan_xcb.h>
 #endif
 
 #define REQUIRED_DEVICE_EXTENSION_COUNT  1
@@ -11,6 +15,9 @@ const char* required_device_extensions[REQUIRED_DEVICE_EXTENSION_COUNT] = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 };
 
+// Required extensions plus every optional one the renderer may enable.
+#define MAX_DEVICE_EXTENSIONS 16
+
 #define REQUIRED_VALIDATION_LAYER_COUNT  1
 const char* required_validation_layers[REQUIRED_VALIDATION_LAYER_COUNT] = {
     "VK_LAYER_KHRONOS_validation",
@@ -20,18 +27,50 @@ const char* required_validation_layers[REQUIRED_VALIDATION_LAYER_COUNT] = {
 const char* required_surface_extensions[REQUIRED_SURFACE_EXTENSION_COUNT] = {
 #ifdef PLATFORM_WINDOWS
     VK_KHR_WIN32_SURFACE_EXTENSION_NAME,
+#elif defined(PLATFORM_LINUX)
+    VK_KHR_XCB_SURFACE_EXTENSION_NAME,
 #else
     #error "Unsupported platform for Vulkan surface extensions."
 #endif
     VK_KHR_SURFACE_EXTENSION_NAME,
 };
 
+#define PIPELINE_CACHE_FILE_MAGIC 0x43505947u // "YGPC"
+
+// Every stage a frame may read uploaded data from. Stages logically later in the graphics
+// pipeline are covered by DRAW_INDIRECT.
+#define UPLOAD_CONSUMER_STAGES (VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT)
+
+// Compute results are consumed at the same stages as uploads.
+#define COMPUTE_CONSUMER_STAGES UPLOAD_CONSUMER_STAGES
+
+IMPLEMENT_CAPPED_ARRAY(VkBufferMemoryBarrier, upload_buffer_barriers, MAX_UPLOAD_BARRIERS)
+IMPLEMENT_CAPPED_ARRAY(VkImageMemoryBarrier, upload_image_barriers, MAX_UPLOAD_BARRIERS)
+
+// Precedes the driver's cache data on disk. The driver's own header carries the vendor, device
+// and cache UUID as well, but some drivers crash on foreign data instead of rejecting it, so the
+// file is checked here before it reaches vkCreatePipelineCache.
+typedef struct {
+    uint32_t magic;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+    uint64_t data_size;
+} pipeline_cache_file_header;
+
 typedef struct {
     uint32_t graphics_queue_index;
     uint32_t transfer_queue_index;
+    // The graphics family when the device has no compute family without graphics.
+    uint32_t compute_queue_index;
+    // Queue within compute_queue_index. Compute and transfer share a family, and a queue
+    // unless the family has two, on devices with only one non-graphics family.
+    uint32_t compute_queue_slot;
 } queue_families;
 
-static VkInstance create_vulkan_instance(void) {
+// Headless instances enable no surface extensions, so they also work where no window system is installed.
+static VkInstance create_vulkan_instance(bool headless) {
     VkInstance instance;
     VkApplicationInfo app_info = {
         .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
@@ -39,14 +78,15 @@ static VkInstance create_vulkan_instance(void) {
         .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
         .pEngineName = "Yggdrasil Game Engine",
         .engineVersion = VK_MAKE_VERSION(1, 0, 0),
-        .apiVersion = VK_API_VERSION_1_0,
+        // 1.2 for core timeline semaphores.
+        .apiVersion = VK_API_VERSION_1_2,
     };
 
     VkInstanceCreateInfo create_info = {
         .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
         .pApplicationInfo = &app_info,
-        .enabledExtensionCount = REQUIRED_SURFACE_EXTENSION_COUNT,
-        .ppEnabledExtensionNames = required_surface_extensions,
+        .enabledExtensionCount = headless ? 0 : REQUIRED_SURFACE_EXTENSION_COUNT,
+        .ppEnabledExtensionNames = headless ? NULL : required_surface_extensions,
     };
 
 #ifdef NDEBUG
@@ -80,6 +120,12 @@ static VkSurfaceKHR create_window_surface(window* window, VkInstance instance) {
             .hinstance = GetModuleHandle(NULL),
             .hwnd = window->handle,
     }, NULL, & surface);
+#elif defined (PLATFORM_LINUX)
+    VkResult result = vkCreateXcbSurfaceKHR(instance, &(VkXcbSurfaceCreateInfoKHR){
+        .sType = VK_STRUCTURE_TYPE_XCB_SURFACE_CREATE_INFO_KHR,
+            .connection = window->connection,
+            .window = (xcb_window_t)(uintptr_t)window->handle,
+    }, NULL, &surface);
 #else
 #error "Unsupported platform for Vulkan surface creation."
 #endif
@@ -91,9 +137,10 @@ static VkSurfaceKHR create_window_surface(window* window, VkInstance instance) {
     return surface;
 }
 
+// Without a surface, the first graphics family is taken on trust and its present support is
+// checked once the window exists.
 static bool has_required_queue_family_details(VkPhysicalDevice device, VkSurfaceKHR window_surface, queue_families* out_queue_families) {
     ASSERT(device != VK_NULL_HANDLE, return false, "Physical device is NULL");
-    ASSERT(window_surface != VK_NULL_HANDLE, return false, "Window surface is NULL");
     ASSERT(out_queue_families != NULL, return false, "Output queue families structure is NULL");
 
     uint32_t queue_family_count = 0;
@@ -102,50 +149,106 @@ static bool has_required_queue_family_details(VkPhysicalDevice device, VkSurface
         return false;
     }
 
-    VkQueueFamilyProperties* queue_families = alloca(sizeof(VkQueueFamilyProperties) * queue_family_count);
+    scratch_arena scratch = begin_scratch(NULL, 0);
+    VkQueueFamilyProperties* queue_families = ARENA_ALLOCATE_ARRAY(scratch.arena, VkQueueFamilyProperties, queue_family_count);
+    if (queue_families == NULL) {
+        end_scratch(scratch);
+        return false;
+    }
     vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count, queue_families);
 
     bool graphics_found = false;
-    bool transfer_found = false;
+    // Transfer prefers a family that can do nothing else, and failing that one that is not
+    // also taken for async compute.
+    uint32_t dedicated_transfer = UINT32_MAX;
+    uint32_t compute_transfer = UINT32_MAX;
+    uint32_t async_compute = UINT32_MAX;
 
     for (uint32_t i = 0; i < queue_family_count; ++i) {
         if (queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
             // Also check for present support on the graphics family:
-            VkBool32 present_support = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, window_surface, &present_support);
-            if (present_support) {
+            VkBool32 present_support = window_surface == VK_NULL_HANDLE;
+            if (!present_support) {
+                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, window_surface, &present_support);
+            }
+            if (present_support && !graphics_found) {
                 out_queue_families->graphics_queue_index = i;
                 graphics_found = true;
-                continue;
             }
+            continue;
         }
 
-        if (queue_families[i].queueFlags & VK_QUEUE_TRANSFER_BIT) {
-            out_queue_families->transfer_queue_index = i;
-            transfer_found = true;
+        bool compute = queue_families[i].queueFlags & VK_QUEUE_COMPUTE_BIT;
+        if (compute && async_compute == UINT32_MAX) {
+            async_compute = i;
+        }
+        // Compute families support transfers whether or not they advertise it.
+        if (!compute && (queue_families[i].queueFlags & VK_QUEUE_TRANSFER_BIT)) {
+            dedicated_transfer = i;
+        }
+        else if (compute && (i != async_compute || compute_transfer == UINT32_MAX)) {
+            compute_transfer = i;
         }
     }
 
-    if (!transfer_found && graphics_found) {
-        out_queue_families->transfer_queue_index = out_queue_families->graphics_queue_index;
-        transfer_found = true;
+    if (graphics_found) {
+        uint32_t graphics = out_queue_families->graphics_queue_index;
+        out_queue_families->transfer_queue_index = dedicated_transfer != UINT32_MAX ? dedicated_transfer : compute_transfer != UINT32_MAX ? compute_transfer : graphics;
+        out_queue_families->compute_queue_index = async_compute != UINT32_MAX ? async_compute : graphics;
+        out_queue_families->compute_queue_slot = 0;
+        if (out_queue_families->compute_queue_index == out_queue_families->transfer_queue_index && async_compute != UINT32_MAX && queue_families[async_compute].queueCount > 1) {
+            out_queue_families->compute_queue_slot = 1;
+        }
     }
 
-    return graphics_found && transfer_found;
+    end_scratch(scratch);
+    return graphics_found;
 }
 
-static bool has_required_extensions(VkPhysicalDevice device) {
-    ASSERT(device != VK_NULL_HANDLE, return false, "Physical device is NULL");
+static bool has_device_extension(VkPhysicalDevice device, const char* name) {
     uint32_t extension_count = 0;
     vkEnumerateDeviceExtensionProperties(device, NULL, &extension_count, NULL);
-    if (extension_count < REQUIRED_DEVICE_EXTENSION_COUNT) {
+
+    scratch_arena scratch = begin_scratch(NULL, 0);
+    VkExtensionProperties* extensions = ARENA_ALLOCATE_ARRAY(scratch.arena, VkExtensionProperties, extension_count);
+    if (extensions == NULL) {
+        end_scratch(scratch);
         return false;
     }
+    vkEnumerateDeviceExtensionProperties(device, NULL, &extension_count, extensions);
+
+    bool found = false;
+    for (uint32_t i = 0; i < extension_count && !found; ++i) {
+        found = strcmp(extensions[i].extensionName, name) == 0;
+    }
+
+    end_scratch(scratch);
+    return found;
+}
+
+// Headless renderers never present, so they do without VK_KHR_swapchain.
+static bool is_device_extension_required(const char* name, bool headless) {
+    return !headless || strcmp(name, VK_KHR_SWAPCHAIN_EXTENSION_NAME) != 0;
+}
 
-    VkExtensionProperties* extensions = alloca(sizeof(VkExtensionProperties) * extension_count);
+static bool has_required_extensions(VkPhysicalDevice device, bool headless) {
+    ASSERT(device != VK_NULL_HANDLE, return false, "Physical device is NULL");
+    uint32_t extension_count = 0;
+    vkEnumerateDeviceExtensionProperties(device, NULL, &extension_count, NULL);
+
+    scratch_arena scratch = begin_scratch(NULL, 0);
+    VkExtensionProperties* extensions = ARENA_ALLOCATE_ARRAY(scratch.arena, VkExtensionProperties, extension_count);
+    if (extensions == NULL) {
+        end_scratch(scratch);
+        return false;
+    }
     vkEnumerateDeviceExtensionProperties(device, NULL, &extension_count, extensions);
 
-    for (uint32_t i = 0; i < REQUIRED_DEVICE_EXTENSION_COUNT; ++i) {
+    bool found_all = true;
+    for (uint32_t i = 0; i < REQUIRED_DEVICE_EXTENSION_COUNT && found_all; ++i) {
+        if (!is_device_extension_required(required_device_extensions[i], headless)) {
+            continue;
+        }
         bool found = false;
         for (uint32_t j = 0; j < extension_count; ++j) {
             if (strcmp(extensions[j].extensionName, required_device_extensions[i]) == 0) {
@@ -153,16 +256,32 @@ static bool has_required_extensions(VkPhysicalDevice device) {
                 break;
             }
         }
-        if (!found) {
-            return false;
-        }
+        found_all = found;
     }
 
-    return true;
+    end_scratch(scratch);
+    return found_all;
+}
+
+static bool has_required_features(VkPhysicalDevice device) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+    if (properties.apiVersion < VK_API_VERSION_1_2) {
+        return false;
+    }
+
+    VkPhysicalDeviceVulkan12Features vulkan12_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+    };
+    VkPhysicalDeviceFeatures2 features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &vulkan12_features,
+    };
+    vkGetPhysicalDeviceFeatures2(device, &features);
+    return vulkan12_features.timelineSemaphore == VK_TRUE;
 }
 
-static VkPhysicalDevice pick_physical_device(VkSurfaceKHR window_surface, VkInstance instance, queue_families* out_queue_families) {
-    ASSERT(window_surface != VK_NULL_HANDLE, return VK_NULL_HANDLE, "Window surface is NULL");
+static VkPhysicalDevice pick_physical_device(VkSurfaceKHR window_surface, VkInstance instance, bool headless, queue_families* out_queue_families) {
     ASSERT(instance != VK_NULL_HANDLE, return VK_NULL_HANDLE, "Vulkan instance is NULL");
     ASSERT(out_queue_families != NULL, return VK_NULL_HANDLE, "Output queue families structure is NULL");
 
@@ -173,14 +292,19 @@ static VkPhysicalDevice pick_physical_device(VkSurfaceKHR window_surface, VkInst
         return VK_NULL_HANDLE;
     }
 
-    VkPhysicalDevice* devices = alloca(sizeof(VkPhysicalDevice) * device_count);
+    scratch_arena scratch = begin_scratch(NULL, 0);
+    VkPhysicalDevice* devices = ARENA_ALLOCATE_ARRAY(scratch.arena, VkPhysicalDevice, device_count);
+    if (devices == NULL) {
+        end_scratch(scratch);
+        return VK_NULL_HANDLE;
+    }
     vkEnumeratePhysicalDevices(instance, &device_count, devices);
 
     VkPhysicalDevice best_device = VK_NULL_HANDLE;
     uint32_t score = 0;
 
     for (uint32_t i = 0; i < device_count; ++i) {
-        if (!has_required_extensions(devices[i])) {
+        if (!has_required_extensions(devices[i], headless) || !has_required_features(devices[i])) {
             continue;
         }
 
@@ -225,6 +349,8 @@ static VkPhysicalDevice pick_physical_device(VkSurfaceKHR window_surface, VkInst
         }
     }
 
+    end_scratch(scratch);
+
     if (best_device == VK_NULL_HANDLE) {
         ERROR_BREAKPOINT("No suitable Vulkan physical device found.");
         return VK_NULL_HANDLE;
@@ -233,13 +359,14 @@ static VkPhysicalDevice pick_physical_device(VkSurfaceKHR window_surface, VkInst
     return best_device;
 }
 
-static VkDevice create_logical_device(VkPhysicalDevice physical_device, queue_families queue_families, VkQueue* out_graphics_queue, VkQueue* out_transfer_queue) {
+static VkDevice create_logical_device(VkPhysicalDevice physical_device, queue_families queue_families, const VkPhysicalDeviceFeatures* features, const char* const* extensions, uint32_t extension_count, VkQueue* out_graphics_queue, VkQueue* out_transfer_queue, VkQueue* out_compute_queue) {
     ASSERT(physical_device != VK_NULL_HANDLE, return VK_NULL_HANDLE, "Physical device is NULL");
     ASSERT(out_graphics_queue != NULL, return VK_NULL_HANDLE, "Output graphics queue pointer is NULL");
     ASSERT(out_transfer_queue != NULL, return VK_NULL_HANDLE, "Output transfer queue pointer is NULL");
+    ASSERT(out_compute_queue != NULL, return VK_NULL_HANDLE, "Output compute queue pointer is NULL");
 
-    float queue_priority = 1.0f;
-    VkDeviceQueueCreateInfo queue_create_info[2] = { 0 };
+    float queue_priorities[2] = { 1.0f, 1.0f };
+    VkDeviceQueueCreateInfo queue_create_info[3] = { 0 };
     uint32_t queue_count = 0;
 
     if (queue_families.graphics_queue_index != UINT32_MAX) {
@@ -247,7 +374,7 @@ static VkDevice create_logical_device(VkPhysicalDevice physical_device, queue_fa
             .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
             .queueFamilyIndex = queue_families.graphics_queue_index,
             .queueCount = 1,
-            .pQueuePriorities = &queue_priority,
+            .pQueuePriorities = queue_priorities,
         };
     }
 
@@ -256,19 +383,37 @@ static VkDevice create_logical_device(VkPhysicalDevice physical_device, queue_fa
             .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
             .queueFamilyIndex = queue_families.transfer_queue_index,
             .queueCount = 1,
-            .pQueuePriorities = &queue_priority,
+            .pQueuePriorities = queue_priorities,
         };
     }
 
-    VkPhysicalDeviceFeatures device_features = { 0 };
+    if (queue_families.compute_queue_index != queue_families.graphics_queue_index) {
+        if (queue_families.compute_queue_index == queue_families.transfer_queue_index) {
+            queue_create_info[queue_count - 1].queueCount = queue_families.compute_queue_slot + 1;
+        }
+        else {
+            queue_create_info[queue_count++] = (VkDeviceQueueCreateInfo){
+                .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+                .queueFamilyIndex = queue_families.compute_queue_index,
+                .queueCount = 1,
+                .pQueuePriorities = queue_priorities,
+            };
+        }
+    }
+
+    VkPhysicalDeviceVulkan12Features vulkan12_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .timelineSemaphore = VK_TRUE,
+    };
 
     VkDeviceCreateInfo create_info = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = &vulkan12_features,
         .pQueueCreateInfos = queue_create_info,
         .queueCreateInfoCount = queue_count,
-        .pEnabledFeatures = &device_features,
-        .enabledExtensionCount = REQUIRED_DEVICE_EXTENSION_COUNT,
-        .ppEnabledExtensionNames = required_device_extensions,
+        .pEnabledFeatures = features,
+        .enabledExtensionCount = extension_count,
+        .ppEnabledExtensionNames = extensions,
     };
 
     VkDevice device = VK_NULL_HANDLE;
@@ -279,48 +424,3357 @@ static VkDevice create_logical_device(VkPhysicalDevice physical_device, queue_fa
 
     *out_graphics_queue = VK_NULL_HANDLE;
     *out_transfer_queue = VK_NULL_HANDLE;
+    *out_compute_queue = VK_NULL_HANDLE;
 
     vkGetDeviceQueue(device, queue_families.graphics_queue_index, 0, out_graphics_queue);
     vkGetDeviceQueue(device, queue_families.transfer_queue_index, 0, out_transfer_queue);
+    vkGetDeviceQueue(device, queue_families.compute_queue_index, queue_families.compute_queue_slot, out_compute_queue);
 
     return device;
 }
 
-result create_renderer(window* window, renderer* out_renderer) {
-    ASSERT(window != NULL, return RESULT_FAILURE, "Window pointer is NULL");
-    ASSERT(out_renderer != NULL, return RESULT_FAILURE, "Renderer pointer is NULL");
-    memset(out_renderer, 0, sizeof(renderer));
-    out_renderer->instance = create_vulkan_instance();
-    if (out_renderer->instance == VK_NULL_HANDLE) {
-        return RESULT_FAILURE;
+static bool is_pipeline_cache_file_valid(const file_mapping* mapping, const VkPhysicalDeviceProperties* properties) {
+    if (mapping->size < sizeof(pipeline_cache_file_header)) {
+        return false;
     }
 
-    out_renderer->window_surface = create_window_surface(window, out_renderer->instance);
-    if (out_renderer->window_surface == VK_NULL_HANDLE) {
-        return RESULT_FAILURE;
+    pipeline_cache_file_header header;
+    memcpy(&header, mapping->data, sizeof(header));
+    if (header.magic != PIPELINE_CACHE_FILE_MAGIC ||
+        header.vendor_id != properties->vendorID ||
+        header.device_id != properties->deviceID ||
+        header.driver_version != properties->driverVersion ||
+        memcmp(header.pipeline_cache_uuid, properties->pipelineCacheUUID, VK_UUID_SIZE) != 0 ||
+        header.data_size != mapping->size - sizeof(header)) {
+        return false;
     }
 
-    queue_families queue_families = { UINT32_MAX, UINT32_MAX };
-    out_renderer->physical_device = pick_physical_device(out_renderer->window_surface, out_renderer->instance, &queue_families);
-    if (out_renderer->physical_device == VK_NULL_HANDLE) {
-        return RESULT_FAILURE;
+    // The driver's header must agree with ours, or the file was stitched together.
+    VkPipelineCacheHeaderVersionOne driver_header;
+    if (header.data_size < sizeof(driver_header)) {
+        return false;
+    }
+    memcpy(&driver_header, (const uint8_t*)mapping->data + sizeof(header), sizeof(driver_header));
+    return driver_header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+        driver_header.headerSize >= sizeof(driver_header) &&
+        driver_header.vendorID == properties->vendorID &&
+        driver_header.deviceID == properties->deviceID &&
+        memcmp(driver_header.pipelineCacheUUID, properties->pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+static VkPipelineCache create_pipeline_cache(VkPhysicalDevice physical_device, VkDevice device, pipeline_cache_stats* out_stats) {
+    uint64_t start = get_time_nanoseconds();
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+    VkPipelineCacheCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+    };
+
+    // A missing or stale file is a cold start, not an error.
+    file_mapping mapping = { 0 };
+    bool mapped = create_file_mapping(PIPELINE_CACHE_PATH, &mapping) == RESULT_SUCCESS;
+    if (mapped && is_pipeline_cache_file_valid(&mapping, &properties)) {
+        create_info.initialDataSize = mapping.size - sizeof(pipeline_cache_file_header);
+        create_info.pInitialData = (const uint8_t*)mapping.data + sizeof(pipeline_cache_file_header);
     }
 
-    out_renderer->graphics_queue_family_index = queue_families.graphics_queue_index;
-    out_renderer->transfer_queue_family_index = queue_families.transfer_queue_index;
-    out_renderer->device = create_logical_device(out_renderer->physical_device, queue_families, &out_renderer->graphics_queue, &out_renderer->transfer_queue);
-    if (out_renderer->device == VK_NULL_HANDLE) {
-        return RESULT_FAILURE;
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+    VkResult result = vkCreatePipelineCache(device, &create_info, NULL, &pipeline_cache);
+    if (result != VK_SUCCESS && create_info.initialDataSize != 0) {
+        create_info.initialDataSize = 0;
+        create_info.pInitialData = NULL;
+        result = vkCreatePipelineCache(device, &create_info, NULL, &pipeline_cache);
+    }
+    if (result != VK_SUCCESS) {
+        if (mapped) {
+            destroy_file_mapping(&mapping);
+        }
+        ERROR_BREAKPOINT("Failed to create Vulkan pipeline cache.");
+        return VK_NULL_HANDLE;
+    }
+
+    out_stats->loaded = create_info.initialDataSize != 0;
+    out_stats->loaded_bytes = create_info.initialDataSize;
+    out_stats->loaded_hash = out_stats->loaded ? hash_fnv1a64(create_info.pInitialData, create_info.initialDataSize, FNV1A64_OFFSET_BASIS) : 0;
+    if (mapped) {
+        destroy_file_mapping(&mapping);
+    }
+    out_stats->load_nanoseconds = get_time_nanoseconds() - start;
+    return pipeline_cache;
+}
+
+static void save_pipeline_cache(const renderer* renderer, pipeline_cache_stats* stats) {
+    size_t data_size = 0;
+    if (vkGetPipelineCacheData(renderer->device, renderer->pipeline_cache, &data_size, NULL) != VK_SUCCESS || data_size == 0) {
+        return;
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(renderer->physical_device, &properties);
+
+    scratch_arena scratch = begin_scratch(NULL, 0);
+    uint8_t* file = arena_allocate(scratch.arena, sizeof(pipeline_cache_file_header) + data_size, alignof(pipeline_cache_file_header));
+    if (file == NULL) {
+        end_scratch(scratch);
+        return;
+    }
+
+    // Another thread can add pipelines between the two calls. VK_INCOMPLETE then means the
+    // buffer was too small, and a truncated cache is not worth keeping.
+    uint8_t* data = file + sizeof(pipeline_cache_file_header);
+    VkResult result = vkGetPipelineCacheData(renderer->device, renderer->pipeline_cache, &data_size, data);
+    // Nothing new was compiled since the load, so the file on disk is already up to date.
+    bool unchanged = result == VK_SUCCESS && stats->loaded && data_size == stats->loaded_bytes &&
+                     hash_fnv1a64(data, data_size, FNV1A64_OFFSET_BASIS) == stats->loaded_hash;
+    if (result == VK_SUCCESS && !unchanged) {
+        pipeline_cache_file_header header = {
+            .magic = PIPELINE_CACHE_FILE_MAGIC,
+            .vendor_id = properties.vendorID,
+            .device_id = properties.deviceID,
+            .driver_version = properties.driverVersion,
+            .data_size = data_size,
+        };
+        memcpy(header.pipeline_cache_uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+        memcpy(file, &header, sizeof(header));
+        if (write_file_atomically(PIPELINE_CACHE_PATH, file, sizeof(header) + data_size) == RESULT_SUCCESS) {
+            stats->saved_bytes = data_size;
+        }
+    }
+
+    end_scratch(scratch);
+}
+
+void record_pipeline_creation_feedback(renderer* renderer, const VkPipelineCreationFeedbackEXT* feedback) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    ASSERT(feedback != NULL, return, "Pipeline creation feedback pointer is NULL");
+    if (!(feedback->flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT)) {
+        return;
+    }
+    if (feedback->flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) {
+        renderer->pipeline_cache_stats.hits++;
+    }
+    else {
+        renderer->pipeline_cache_stats.misses++;
     }
+}
+
+STATIC_ASSERT(MAX_FRAMES_IN_FLIGHT <= MAX_FRAME_ALLOCATOR_FRAMES, frame_allocator_covers_every_frame_in_flight)
 
+// No padding means byte-wise hashing and comparison see only the fields.
+STATIC_ASSERT(sizeof(descriptor_set_layout_state) == sizeof(uint32_t) * (1 + 4 * MAX_DESCRIPTOR_SET_BINDINGS), descriptor_set_layout_state_has_padding)
+STATIC_ASSERT(sizeof(pipeline_layout_state) == sizeof(VkDescriptorSetLayout) * MAX_PIPELINE_SET_LAYOUTS + sizeof(uint32_t) * 4, pipeline_layout_state_has_padding)
+STATIC_ASSERT(sizeof(pipeline_state) == sizeof(VkShaderModule) * 4 + sizeof(uint32_t) * (3 + 3 * MAX_PIPELINE_VERTEX_BINDINGS + 4 * MAX_PIPELINE_VERTEX_ATTRIBUTES + 7 + 8), pipeline_state_has_padding)
+STATIC_ASSERT(sizeof(pipeline_key) == sizeof(uint32_t) * 2 + sizeof(pipeline_state), pipeline_key_has_padding)
+
+static result create_pipeline_state_cache(pipeline_state_cache* cache) {
+    memset(cache, 0, sizeof(pipeline_state_cache));
+    size_t reserve_size = sizeof(pipeline_entry) * PIPELINE_STATE_TABLE_CAPACITY + sizeof(pipeline_layout_entry) * PIPELINE_LAYOUT_TABLE_CAPACITY +
+                          sizeof(descriptor_set_layout_entry) * DESCRIPTOR_SET_LAYOUT_TABLE_CAPACITY + 3 * alignof(pipeline_entry);
+    if (create_arena_allocator(reserve_size, 0, &cache->arena) != RESULT_SUCCESS) {
+        return RESULT_FAILURE;
+    }
+    cache->pipelines = arena_allocate_zeroed(&cache->arena, sizeof(pipeline_entry) * PIPELINE_STATE_TABLE_CAPACITY, alignof(pipeline_entry));
+    cache->layouts = arena_allocate_zeroed(&cache->arena, sizeof(pipeline_layout_entry) * PIPELINE_LAYOUT_TABLE_CAPACITY, alignof(pipeline_layout_entry));
+    cache->set_layouts = arena_allocate_zeroed(&cache->arena, sizeof(descriptor_set_layout_entry) * DESCRIPTOR_SET_LAYOUT_TABLE_CAPACITY, alignof(descriptor_set_layout_entry));
+    if (cache->pipelines == NULL || cache->layouts == NULL || cache->set_layouts == NULL) {
+        ERROR_BREAKPOINT("Failed to allocate pipeline state tables.");
+        return RESULT_FAILURE;
+    }
+    create_mutex(&cache->lock_stats, &cache->lock);
+    for (uint32_t i = 0; i < PIPELINE_STATE_TABLE_CAPACITY; ++i) {
+        create_mutex(NULL, &cache->pipelines[i].compile_lock);
+    }
     return RESULT_SUCCESS;
 }
 
-void destroy_renderer(renderer* renderer) {
+// Call with the device idle.
+static void destroy_pipeline_state_cache(VkDevice device, pipeline_state_cache* cache) {
+    if (cache->arena.base == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < PIPELINE_STATE_TABLE_CAPACITY; ++i) {
+        vkDestroyPipeline(device, cache->pipelines[i].pipeline, NULL);
+    }
+    for (uint32_t i = 0; i < PIPELINE_LAYOUT_TABLE_CAPACITY; ++i) {
+        vkDestroyPipelineLayout(device, cache->layouts[i].layout, NULL);
+    }
+    for (uint32_t i = 0; i < DESCRIPTOR_SET_LAYOUT_TABLE_CAPACITY; ++i) {
+        vkDestroyDescriptorSetLayout(device, cache->set_layouts[i].layout, NULL);
+    }
+    destroy_arena_allocator(&cache->arena);
+    memset(cache, 0, sizeof(pipeline_state_cache));
+}
+
+static uint64_t hash_state(const void* state, size_t size) {
+    uint64_t hash = hash_fnv1a64(state, size, FNV1A64_OFFSET_BASIS);
+    return hash != 0 ? hash : 1;
+}
+
+// Linear probing over a table whose entries start with their hash and hold their state at
+// state_offset. Returns the slot holding state, or the empty slot where it belongs.
+static uint32_t find_state_slot(const void* entries, size_t entry_size, size_t state_offset, uint32_t capacity, uint64_t hash, const void* state, size_t state_size) {
+    const uint8_t* bytes = entries;
+    uint32_t mask = capacity - 1;
+    for (uint32_t slot = (uint32_t)hash & mask;; slot = (slot + 1) & mask) {
+        const uint8_t* entry = bytes + slot * entry_size;
+        uint64_t entry_hash;
+        memcpy(&entry_hash, entry, sizeof(uint64_t));
+        if (entry_hash == 0 || (entry_hash == hash && memcmp(entry + state_offset, state, state_size) == 0)) {
+            return slot;
+        }
+    }
+}
+
+static bool is_state_table_full(uint32_t count, uint32_t capacity) {
+    if (count >= capacity / 4 * 3) {
+        ERROR_BREAKPOINT("Pipeline state table is full; raise its capacity.");
+        return true;
+    }
+    return false;
+}
+
+VkDescriptorSetLayout get_descriptor_set_layout(renderer* renderer, const descriptor_set_layout_state* state) {
+    ASSERT(renderer != NULL, return VK_NULL_HANDLE, "Renderer pointer is NULL");
+    ASSERT(state != NULL && state->binding_count <= MAX_DESCRIPTOR_SET_BINDINGS, return VK_NULL_HANDLE, "Invalid descriptor set layout state");
+    pipeline_state_cache* cache = &renderer->pipeline_states;
+    uint64_t hash = hash_state(state, sizeof(descriptor_set_layout_state));
+
+    // Layouts are cheap to create, so they are created under the table lock.
+    lock_mutex(&cache->lock);
+    uint32_t slot = find_state_slot(cache->set_layouts, sizeof(descriptor_set_layout_entry), offsetof(descriptor_set_layout_entry, state), DESCRIPTOR_SET_LAYOUT_TABLE_CAPACITY, hash, state, sizeof(descriptor_set_layout_state));
+    descriptor_set_layout_entry* entry = &cache->set_layouts[slot];
+    if (entry->hash != 0) {
+        cache->stats.layout_hits++;
+        unlock_mutex(&cache->lock);
+        return entry->layout;
+    }
+    if (is_state_table_full(cache->set_layout_count, DESCRIPTOR_SET_LAYOUT_TABLE_CAPACITY)) {
+        unlock_mutex(&cache->lock);
+        return VK_NULL_HANDLE;
+    }
+
+    VkDescriptorSetLayoutBinding bindings[MAX_DESCRIPTOR_SET_BINDINGS];
+    for (uint32_t i = 0; i < state->binding_count; ++i) {
+        bindings[i] = (VkDescriptorSetLayoutBinding){
+            .binding = state->bindings[i].binding,
+            .descriptorType = state->bindings[i].type,
+            .descriptorCount = state->bindings[i].count,
+            .stageFlags = state->bindings[i].stages,
+        };
+    }
+    VkDescriptorSetLayoutCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = state->binding_count,
+        .pBindings = bindings,
+    };
+    VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+    if (vkCreateDescriptorSetLayout(renderer->device, &create_info, NULL, &layout) != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to create descriptor set layout.");
+        unlock_mutex(&cache->lock);
+        return VK_NULL_HANDLE;
+    }
+    entry->hash = hash;
+    entry->state = *state;
+    entry->layout = layout;
+    cache->set_layout_count++;
+    cache->stats.descriptor_set_layouts++;
+    unlock_mutex(&cache->lock);
+    return layout;
+}
+
+VkPipelineLayout get_pipeline_layout(renderer* renderer, const pipeline_layout_state* state) {
+    ASSERT(renderer != NULL, return VK_NULL_HANDLE, "Renderer pointer is NULL");
+    ASSERT(state != NULL && state->set_layout_count <= MAX_PIPELINE_SET_LAYOUTS, return VK_NULL_HANDLE, "Invalid pipeline layout state");
+    pipeline_state_cache* cache = &renderer->pipeline_states;
+    uint64_t hash = hash_state(state, sizeof(pipeline_layout_state));
+
+    lock_mutex(&cache->lock);
+    uint32_t slot = find_state_slot(cache->layouts, sizeof(pipeline_layout_entry), offsetof(pipeline_layout_entry, state), PIPELINE_LAYOUT_TABLE_CAPACITY, hash, state, sizeof(pipeline_layout_state));
+    pipeline_layout_entry* entry = &cache->layouts[slot];
+    if (entry->hash != 0) {
+        cache->stats.layout_hits++;
+        unlock_mutex(&cache->lock);
+        return entry->layout;
+    }
+    if (is_state_table_full(cache->layout_count, PIPELINE_LAYOUT_TABLE_CAPACITY)) {
+        unlock_mutex(&cache->lock);
+        return VK_NULL_HANDLE;
+    }
+
+    VkPipelineLayoutCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = state->set_layout_count,
+        .pSetLayouts = state->set_layouts,
+        .pushConstantRangeCount = state->push_constants.size > 0 ? 1 : 0,
+        .pPushConstantRanges = &state->push_constants,
+    };
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    if (vkCreatePipelineLayout(renderer->device, &create_info, NULL, &layout) != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to create pipeline layout.");
+        unlock_mutex(&cache->lock);
+        return VK_NULL_HANDLE;
+    }
+    entry->hash = hash;
+    entry->state = *state;
+    entry->layout = layout;
+    cache->layout_count++;
+    cache->stats.pipeline_layouts++;
+    unlock_mutex(&cache->lock);
+    return layout;
+}
+
+static VkPipeline compile_graphics_pipeline(renderer* renderer, const pipeline_state* state, VkPipelineCreationFeedbackEXT* out_feedback) {
+    VkPipelineShaderStageCreateInfo stages[2] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_VERTEX_BIT,
+            .module = state->vertex_shader,
+            .pName = "main",
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+            .module = state->fragment_shader,
+            .pName = "main",
+        },
+    };
+    VkPipelineVertexInputStateCreateInfo vertex_input = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .vertexBindingDescriptionCount = state->binding_count,
+        .pVertexBindingDescriptions = state->bindings,
+        .vertexAttributeDescriptionCount = state->attribute_count,
+        .pVertexAttributeDescriptions = state->attributes,
+    };
+    VkPipelineInputAssemblyStateCreateInfo input_assembly = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+        .topology = state->topology,
+    };
+    VkPipelineViewportStateCreateInfo viewport = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+        .viewportCount = 1,
+        .scissorCount = 1,
+    };
+    VkPipelineRasterizationStateCreateInfo rasterization = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+        .polygonMode = state->polygon_mode,
+        .cullMode = state->cull_mode,
+        .frontFace = state->front_face,
+        .lineWidth = 1.0f,
+    };
+    VkPipelineMultisampleStateCreateInfo multisample = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+    };
+    VkPipelineDepthStencilStateCreateInfo depth_stencil = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+        .depthTestEnable = state->depth_test,
+        .depthWriteEnable = state->depth_write,
+        .depthCompareOp = state->depth_compare,
+    };
+    VkPipelineColorBlendStateCreateInfo color_blend = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &state->blend,
+    };
+    // Dynamic so pipelines survive swapchain resizes.
+    VkDynamicState dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dynamic_state = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .dynamicStateCount = 2,
+        .pDynamicStates = dynamic_states,
+    };
+    VkPipelineCreationFeedbackCreateInfoEXT feedback_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT,
+        .pPipelineCreationFeedback = out_feedback,
+    };
+    VkGraphicsPipelineCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .pNext = renderer->pipeline_creation_feedback ? &feedback_info : NULL,
+        .stageCount = state->fragment_shader != VK_NULL_HANDLE ? 2 : 1,
+        .pStages = stages,
+        .pVertexInputState = &vertex_input,
+        .pInputAssemblyState = &input_assembly,
+        .pViewportState = &viewport,
+        .pRasterizationState = &rasterization,
+        .pMultisampleState = &multisample,
+        .pDepthStencilState = &depth_stencil,
+        .pColorBlendState = &color_blend,
+        .pDynamicState = &dynamic_state,
+        .layout = state->layout,
+        .renderPass = state->render_pass,
+        .subpass = state->subpass,
+        .basePipelineIndex = -1,
+    };
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    if (vkCreateGraphicsPipelines(renderer->device, renderer->pipeline_cache, 1, &create_info, NULL, &pipeline) != VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    }
+    return pipeline;
+}
+
+static VkPipeline compile_compute_pipeline(renderer* renderer, const compute_pipeline_state* state, VkPipelineCreationFeedbackEXT* out_feedback) {
+    VkPipelineCreationFeedbackCreateInfoEXT feedback_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT,
+        .pPipelineCreationFeedback = out_feedback,
+    };
+    VkComputePipelineCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .pNext = renderer->pipeline_creation_feedback ? &feedback_info : NULL,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = state->shader,
+            .pName = "main",
+        },
+        .layout = state->layout,
+        .basePipelineIndex = -1,
+    };
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    if (vkCreateComputePipelines(renderer->device, renderer->pipeline_cache, 1, &create_info, NULL, &pipeline) != VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    }
+    return pipeline;
+}
+
+static VkPipeline get_cached_pipeline(renderer* renderer, const pipeline_key* key) {
+    pipeline_state_cache* cache = &renderer->pipeline_states;
+    uint64_t hash = hash_state(key, sizeof(pipeline_key));
+
+    lock_mutex(&cache->lock);
+    cache->stats.requests++;
+    uint32_t slot = find_state_slot(cache->pipelines, sizeof(pipeline_entry), offsetof(pipeline_entry, key), PIPELINE_STATE_TABLE_CAPACITY, hash, key, sizeof(pipeline_key));
+    pipeline_entry* entry = &cache->pipelines[slot];
+    if (entry->hash != 0) {
+        cache->stats.hits++;
+        if (entry->status != PIPELINE_ENTRY_COMPILING) {
+            VkPipeline pipeline = entry->pipeline;
+            unlock_mutex(&cache->lock);
+            return pipeline;
+        }
+        // The compiling thread holds compile_lock until the entry is final. Entries never
+        // move, so it is safe to wait on it without the table lock.
+        cache->stats.waits++;
+        unlock_mutex(&cache->lock);
+        lock_mutex(&entry->compile_lock);
+        VkPipeline pipeline = entry->pipeline;
+        unlock_mutex(&entry->compile_lock);
+        return pipeline;
+    }
+    if (is_state_table_full(cache->pipeline_count, PIPELINE_STATE_TABLE_CAPACITY)) {
+        unlock_mutex(&cache->lock);
+        return VK_NULL_HANDLE;
+    }
+    entry->hash = hash;
+    entry->key = *key;
+    entry->status = PIPELINE_ENTRY_COMPILING;
+    cache->pipeline_count++;
+    lock_mutex(&entry->compile_lock);
+    unlock_mutex(&cache->lock);
+
+    PROFILE_BEGIN("compile_pipeline");
+    uint64_t start = get_time_nanoseconds();
+    VkPipelineCreationFeedbackEXT feedback = { 0 };
+    VkPipeline pipeline = key->bind_point == VK_PIPELINE_BIND_POINT_COMPUTE ? compile_compute_pipeline(renderer, &key->state.compute, &feedback)
+                                                                            : compile_graphics_pipeline(renderer, &key->state.graphics, &feedback);
+    uint64_t elapsed = get_time_nanoseconds() - start;
+    PROFILE_END();
+
+    lock_mutex(&cache->lock);
+    entry->pipeline = pipeline;
+    entry->status = pipeline != VK_NULL_HANDLE ? PIPELINE_ENTRY_READY : PIPELINE_ENTRY_FAILED;
+    cache->stats.compiles++;
+    cache->stats.compile_nanoseconds += elapsed;
+    if (elapsed > cache->stats.max_compile_nanoseconds) {
+        cache->stats.max_compile_nanoseconds = elapsed;
+    }
+    if (pipeline == VK_NULL_HANDLE) {
+        cache->stats.failures++;
+    }
+    else if (renderer->pipeline_creation_feedback) {
+        record_pipeline_creation_feedback(renderer, &feedback);
+    }
+    unlock_mutex(&cache->lock);
+    unlock_mutex(&entry->compile_lock);
+    if (pipeline == VK_NULL_HANDLE) {
+        ERROR_BREAKPOINT("Failed to create pipeline.");
+    }
+    return pipeline;
+}
+
+VkPipeline get_graphics_pipeline(renderer* renderer, const pipeline_state* state) {
+    ASSERT(renderer != NULL, return VK_NULL_HANDLE, "Renderer pointer is NULL");
+    ASSERT(state != NULL, return VK_NULL_HANDLE, "Pipeline state pointer is NULL");
+    ASSERT(state->binding_count <= MAX_PIPELINE_VERTEX_BINDINGS && state->attribute_count <= MAX_PIPELINE_VERTEX_ATTRIBUTES, return VK_NULL_HANDLE, "Too many vertex bindings or attributes");
+    pipeline_key key;
+    memset(&key, 0, sizeof(pipeline_key));
+    key.bind_point = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    key.state.graphics = *state;
+    return get_cached_pipeline(renderer, &key);
+}
+
+VkPipeline get_compute_pipeline(renderer* renderer, const compute_pipeline_state* state) {
+    ASSERT(renderer != NULL, return VK_NULL_HANDLE, "Renderer pointer is NULL");
+    ASSERT(state != NULL, return VK_NULL_HANDLE, "Pipeline state pointer is NULL");
+    // memset rather than an initialiser: the union's bytes past the compute state must be zero.
+    pipeline_key key;
+    memset(&key, 0, sizeof(pipeline_key));
+    key.bind_point = VK_PIPELINE_BIND_POINT_COMPUTE;
+    key.state.compute = *state;
+    return get_cached_pipeline(renderer, &key);
+}
+
+void get_pipeline_state_stats(renderer* renderer, pipeline_state_stats* out_stats) {
     ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    ASSERT(out_stats != NULL, return, "Stats pointer is NULL");
+    pipeline_state_cache* cache = &renderer->pipeline_states;
+    lock_mutex(&cache->lock);
+    *out_stats = cache->stats;
+    unlock_mutex(&cache->lock);
+    out_stats->hit_rate = out_stats->requests > 0 ? (double)out_stats->hits / (double)out_stats->requests : 0.0;
+}
 
-    vkDestroySurfaceKHR(renderer->instance, renderer->window_surface, NULL);
-    vkDestroyDevice(renderer->device, NULL);
-    vkDestroyInstance(renderer->instance, NULL);
+#if defined(PLATFORM_WINDOWS)
+#define HOST_TIME_DOMAIN VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT
+
+// Same conversion as get_time_nanoseconds applies to QueryPerformanceCounter.
+static uint64_t host_timestamp_to_nanoseconds(uint64_t counter) {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    uint64_t ticks_per_second = (uint64_t)frequency.QuadPart;
+    return counter / ticks_per_second * 1000000000ull + counter % ticks_per_second * 1000000000ull / ticks_per_second;
+}
+#else
+// get_time_nanoseconds reads CLOCK_MONOTONIC_RAW, which is already in nanoseconds.
+#define HOST_TIME_DOMAIN VK_TIME_DOMAIN_CLOCK_MONOTONIC_RAW_EXT
+
+static uint64_t host_timestamp_to_nanoseconds(uint64_t timestamp) {
+    return timestamp;
+}
+#endif
+
+// Returns 0 when the queue family cannot write timestamps.
+static uint32_t get_timestamp_valid_bits(VkPhysicalDevice physical_device, uint32_t queue_family_index) {
+    uint32_t queue_family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, NULL);
+    if (queue_family_index >= queue_family_count) {
+        return 0;
+    }
+    scratch_arena scratch = begin_scratch(NULL, 0);
+    VkQueueFamilyProperties* queue_families = ARENA_ALLOCATE_ARRAY(scratch.arena, VkQueueFamilyProperties, queue_family_count);
+    uint32_t valid_bits = 0;
+    if (queue_families != NULL) {
+        vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_families);
+        valid_bits = queue_families[queue_family_index].timestampValidBits;
+    }
+    end_scratch(scratch);
+    return valid_bits;
+}
+
+static bool has_calibrateable_host_domain(VkInstance instance, VkPhysicalDevice physical_device) {
+    PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT get_time_domains =
+        (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+    if (get_time_domains == NULL) {
+        return false;
+    }
+    VkTimeDomainEXT domains[8];
+    uint32_t domain_count = 8;
+    VkResult queried = get_time_domains(physical_device, &domain_count, domains);
+    if (queried != VK_SUCCESS && queried != VK_INCOMPLETE) {
+        return false;
+    }
+    bool has_device = false;
+    bool has_host = false;
+    for (uint32_t i = 0; i < domain_count; ++i) {
+        has_device |= domains[i] == VK_TIME_DOMAIN_DEVICE_EXT;
+        has_host |= domains[i] == HOST_TIME_DOMAIN;
+    }
+    return has_device && has_host;
+}
+
+// Without VK_EXT_calibrated_timestamps: time a single timestamp write against the CPU clock.
+// The pairing is only known to within half the submit's round trip, and it stalls the queue,
+// so it runs once at startup.
+static void calibrate_gpu_clock_with_submit(renderer* renderer) {
+    render_frame* frame = &renderer->frames[0];
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    vkBeginCommandBuffer(frame->command_buffer, &begin_info);
+    vkCmdResetQueryPool(frame->command_buffer, frame->timestamp_pool, 0, 1);
+    vkCmdWriteTimestamp(frame->command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame->timestamp_pool, 0);
+    vkEndCommandBuffer(frame->command_buffer);
+
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &frame->command_buffer,
+    };
+    uint64_t before = get_time_nanoseconds();
+    VkResult submitted = vkQueueSubmit(renderer->graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
+    if (submitted == VK_SUCCESS) {
+        vkQueueWaitIdle(renderer->graphics_queue);
+    }
+    uint64_t after = get_time_nanoseconds();
+
+    uint64_t timestamp = 0;
+    if (submitted == VK_SUCCESS &&
+        vkGetQueryPoolResults(renderer->device, frame->timestamp_pool, 0, 1, sizeof(uint64_t), &timestamp, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+        renderer->gpu_clock = (gpu_clock_calibration){
+            .gpu_timestamp = timestamp,
+            .cpu_nanoseconds = before + (after - before) / 2,
+            .max_deviation_nanoseconds = (after - before) / 2,
+            .frame_number = renderer->frame_stats.frame_number,
+        };
+    }
+    vkResetCommandPool(renderer->device, frame->command_pool, 0);
+}
+
+static void calibrate_gpu_clock(renderer* renderer) {
+    if (renderer->get_calibrated_timestamps == NULL) {
+        calibrate_gpu_clock_with_submit(renderer);
+        return;
+    }
+    VkCalibratedTimestampInfoEXT infos[2] = {
+        { .sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .timeDomain = VK_TIME_DOMAIN_DEVICE_EXT },
+        { .sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .timeDomain = HOST_TIME_DOMAIN },
+    };
+    uint64_t timestamps[2];
+    uint64_t max_deviation = 0;
+    if (renderer->get_calibrated_timestamps(renderer->device, 2, infos, timestamps, &max_deviation) == VK_SUCCESS) {
+        renderer->gpu_clock = (gpu_clock_calibration){
+            .gpu_timestamp = timestamps[0],
+            .cpu_nanoseconds = host_timestamp_to_nanoseconds(timestamps[1]),
+            .max_deviation_nanoseconds = max_deviation,
+            .frame_number = renderer->frame_stats.frame_number,
+        };
+    }
+}
+
+static uint64_t gpu_timestamp_to_nanoseconds(const renderer* renderer, uint64_t timestamp) {
+    // Timestamps wrap at timestamp_valid_bits, so the distance is sign-extended from there.
+    uint32_t unused_bits = 64 - renderer->timestamp_valid_bits;
+    int64_t ticks = (int64_t)((timestamp - renderer->gpu_clock.gpu_timestamp) << unused_bits) >> unused_bits;
+    return renderer->gpu_clock.cpu_nanoseconds + (uint64_t)(int64_t)((double)ticks * renderer->timestamp_period);
+}
+
+// Called once the frame's fence has signalled, so the results are ready and this never waits.
+static void read_gpu_timestamps(renderer* renderer, render_frame* frame) {
+    uint32_t count = frame->timestamp_count;
+    frame->timestamp_count = 0;
+    if (count == 0) {
+        return;
+    }
+    uint64_t timestamps[MAX_GPU_TIMESTAMPS];
+    if (vkGetQueryPoolResults(renderer->device, frame->timestamp_pool, 0, count, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+        return;
+    }
+    if (renderer->get_calibrated_timestamps != NULL && renderer->frame_stats.frame_number - renderer->gpu_clock.frame_number >= GPU_CALIBRATION_INTERVAL_FRAMES) {
+        calibrate_gpu_clock(renderer);
+    }
+
+    profile_event events[MAX_GPU_TIMESTAMPS];
+    for (uint32_t i = 0; i < count; ++i) {
+        events[i] = (profile_event){ gpu_timestamp_to_nanoseconds(renderer, timestamps[i]), frame->timestamp_names[i] };
+    }
+    // The first and last queries belong to the zone begin_frame opens around the frame.
+    renderer->frame_stats.gpu_frame_nanoseconds = events[count - 1].timestamp - events[0].timestamp;
+    PROFILE_TRACK_EVENTS(GPU_PROFILE_TRACK, events, count);
 }
 
+static void open_gpu_zone(renderer* renderer, render_frame* frame, VkCommandBuffer command_buffer, const char* name) {
+    if (renderer->timestamp_period == 0.0f) {
+        return;
+    }
+    // Keep a query back for the end of this zone and of every zone already open.
+    if (frame->skipped_gpu_zones > 0 || frame->timestamp_count + frame->open_gpu_zones + 2 > MAX_GPU_TIMESTAMPS) {
+        frame->skipped_gpu_zones++;
+        renderer->frame_stats.dropped_gpu_zones++;
+        return;
+    }
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame->timestamp_pool, frame->timestamp_count);
+    frame->timestamp_names[frame->timestamp_count++] = name;
+    frame->open_gpu_zones++;
+}
+
+static void close_gpu_zone(renderer* renderer, render_frame* frame, VkCommandBuffer command_buffer) {
+    if (renderer->timestamp_period == 0.0f) {
+        return;
+    }
+    if (frame->skipped_gpu_zones > 0) {
+        frame->skipped_gpu_zones--;
+        return;
+    }
+    ASSERT(frame->open_gpu_zones > 0, return, "No GPU zone is open");
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame->timestamp_pool, frame->timestamp_count);
+    frame->timestamp_names[frame->timestamp_count++] = NULL;
+    frame->open_gpu_zones--;
+}
+
+void begin_gpu_zone(renderer* renderer, VkCommandBuffer command_buffer, const char* name) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    ASSERT(name != NULL, return, "GPU zone name is NULL");
+    ASSERT(renderer->config.recording_threads == 0, return, "GPU zones cannot be recorded into a render pass of secondary command buffers");
+    open_gpu_zone(renderer, &renderer->frames[renderer->frame_index], command_buffer, name);
+}
+
+void end_gpu_zone(renderer* renderer, VkCommandBuffer command_buffer) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    ASSERT(renderer->config.recording_threads == 0, return, "GPU zones cannot be recorded into a render pass of secondary command buffers");
+    close_gpu_zone(renderer, &renderer->frames[renderer->frame_index], command_buffer);
+}
+
+static VkSemaphore create_timeline_semaphore(VkDevice device) {
+    VkSemaphoreTypeCreateInfo timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+    VkSemaphoreCreateInfo semaphore_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &timeline_info,
+    };
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    if (vkCreateSemaphore(device, &semaphore_info, NULL, &semaphore) != VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    }
+    return semaphore;
+}
+
+static result create_frame_resources(renderer* renderer) {
+    renderer->graphics_timeline = create_timeline_semaphore(renderer->device);
+    renderer->compute_timeline = create_timeline_semaphore(renderer->device);
+    if (renderer->graphics_timeline == VK_NULL_HANDLE || renderer->compute_timeline == VK_NULL_HANDLE) {
+        ERROR_BREAKPOINT("Failed to create frame timeline semaphores.");
+        return RESULT_FAILURE;
+    }
+    renderer->last_compute_ticket = 0;
+    renderer->frame_compute_wait = 0;
+
+    for (uint32_t i = 0; i < renderer->config.frames_in_flight; ++i) {
+        render_frame* frame = &renderer->frames[i];
+
+        VkCommandPoolCreateInfo pool_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = renderer->graphics_queue_family_index,
+        };
+        if (vkCreateCommandPool(renderer->device, &pool_info, NULL, &frame->command_pool) != VK_SUCCESS) {
+            ERROR_BREAKPOINT("Failed to create frame command pool.");
+            return RESULT_FAILURE;
+        }
+
+        VkCommandBufferAllocateInfo allocate_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = frame->command_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+        if (vkAllocateCommandBuffers(renderer->device, &allocate_info, &frame->command_buffer) != VK_SUCCESS) {
+            ERROR_BREAKPOINT("Failed to allocate frame command buffer.");
+            return RESULT_FAILURE;
+        }
+
+        // Signaled, so the first begin_frame on each slot does not wait for a submit that never happened.
+        VkFenceCreateInfo fence_info = {
+            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+            .flags = VK_FENCE_CREATE_SIGNALED_BIT,
+        };
+        VkSemaphoreCreateInfo semaphore_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        };
+        if (vkCreateFence(renderer->device, &fence_info, NULL, &frame->in_flight_fence) != VK_SUCCESS ||
+            vkCreateSemaphore(renderer->device, &semaphore_info, NULL, &frame->image_available) != VK_SUCCESS) {
+            ERROR_BREAKPOINT("Failed to create frame synchronization objects.");
+            return RESULT_FAILURE;
+        }
+
+        if (renderer->timestamp_period > 0.0f) {
+            VkQueryPoolCreateInfo query_info = {
+                .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                .queryType = VK_QUERY_TYPE_TIMESTAMP,
+                .queryCount = MAX_GPU_TIMESTAMPS,
+            };
+            if (vkCreateQueryPool(renderer->device, &query_info, NULL, &frame->timestamp_pool) != VK_SUCCESS) {
+                ERROR_BREAKPOINT("Failed to create timestamp query pool.");
+                return RESULT_FAILURE;
+            }
+        }
+
+        // Like secondary buffers, compute buffers are allocated on first use.
+        VkCommandPoolCreateInfo compute_pool_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = renderer->compute_queue_family_index,
+        };
+        if (vkCreateCommandPool(renderer->device, &compute_pool_info, NULL, &frame->compute_pool) != VK_SUCCESS) {
+            ERROR_BREAKPOINT("Failed to create compute command pool.");
+            return RESULT_FAILURE;
+        }
+
+        // Secondary buffers are allocated on first use, since most threads record few of them.
+        for (uint32_t j = 0; j < renderer->config.recording_threads; ++j) {
+            if (vkCreateCommandPool(renderer->device, &pool_info, NULL, &frame->thread_pools[j].command_pool) != VK_SUCCESS) {
+                ERROR_BREAKPOINT("Failed to create thread command pool.");
+                return RESULT_FAILURE;
+            }
+        }
+    }
+
+    return RESULT_SUCCESS;
+}
+
+static void destroy_frame_resources(renderer* renderer) {
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+        render_frame* frame = &renderer->frames[i];
+        vkDestroySemaphore(renderer->device, frame->image_available, NULL);
+        vkDestroyFence(renderer->device, frame->in_flight_fence, NULL);
+        vkDestroyCommandPool(renderer->device, frame->command_pool, NULL);
+        vkDestroyQueryPool(renderer->device, frame->timestamp_pool, NULL);
+        vkDestroyCommandPool(renderer->device, frame->compute_pool, NULL);
+        for (uint32_t j = 0; j < MAX_RECORDING_THREADS; ++j) {
+            vkDestroyCommandPool(renderer->device, frame->thread_pools[j].command_pool, NULL);
+        }
+    }
+    memset(renderer->frames, 0, sizeof(renderer->frames));
+    vkDestroySemaphore(renderer->device, renderer->graphics_timeline, NULL);
+    vkDestroySemaphore(renderer->device, renderer->compute_timeline, NULL);
+    renderer->graphics_timeline = VK_NULL_HANDLE;
+    renderer->compute_timeline = VK_NULL_HANDLE;
+}
+
+static VkSurfaceFormatKHR choose_surface_format(VkPhysicalDevice physical_device, VkSurfaceKHR surface) {
+    VkSurfaceFormatKHR chosen = { VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+    uint32_t format_count = 0;
+    vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &format_count, NULL);
+    if (format_count == 0) {
+        return chosen;
+    }
+
+    scratch_arena scratch = begin_scratch(NULL, 0);
+    VkSurfaceFormatKHR* formats = ARENA_ALLOCATE_ARRAY(scratch.arena, VkSurfaceFormatKHR, format_count);
+    if (formats == NULL) {
+        end_scratch(scratch);
+        return chosen;
+    }
+    vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &format_count, formats);
+
+    chosen = formats[0];
+    for (uint32_t i = 0; i < format_count; ++i) {
+        if (formats[i].format == VK_FORMAT_B8G8R8A8_SRGB && formats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+            chosen = formats[i];
+            break;
+        }
+    }
+
+    end_scratch(scratch);
+    return chosen;
+}
+
+static VkPresentModeKHR choose_present_mode(VkPhysicalDevice physical_device, VkSurfaceKHR surface, bool vsync) {
+    // FIFO is the only mode every implementation must support.
+    if (vsync) {
+        return VK_PRESENT_MODE_FIFO_KHR;
+    }
+
+    uint32_t mode_count = 0;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &mode_count, NULL);
+    scratch_arena scratch = begin_scratch(NULL, 0);
+    VkPresentModeKHR* modes = ARENA_ALLOCATE_ARRAY(scratch.arena, VkPresentModeKHR, mode_count);
+    if (modes == NULL) {
+        end_scratch(scratch);
+        return VK_PRESENT_MODE_FIFO_KHR;
+    }
+    vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &mode_count, modes);
+
+    VkPresentModeKHR chosen = VK_PRESENT_MODE_FIFO_KHR;
+    for (uint32_t i = 0; i < mode_count; ++i) {
+        if (modes[i] == VK_PRESENT_MODE_MAILBOX_KHR) {
+            chosen = VK_PRESENT_MODE_MAILBOX_KHR;
+            break;
+        }
+        if (modes[i] == VK_PRESENT_MODE_IMMEDIATE_KHR) {
+            chosen = VK_PRESENT_MODE_IMMEDIATE_KHR;
+        }
+    }
+
+    end_scratch(scratch);
+    return chosen;
+}
+
+// final_layout is PRESENT_SRC for a swapchain and TRANSFER_SRC for headless images, which
+// may be copied out for readback after the pass.
+static VkRenderPass create_render_pass(VkDevice device, VkFormat format, VkImageLayout final_layout) {
+    VkAttachmentDescription color_attachment = {
+        .format = format,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = final_layout,
+    };
+    VkAttachmentReference color_reference = {
+        .attachment = 0,
+        .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    };
+    VkSubpassDescription subpass = {
+        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &color_reference,
+    };
+    VkSubpassDependency dependencies[2] = {
+        // The layout transition must wait for the acquire semaphore, which is waited on at this stage.
+        {
+            .srcSubpass = VK_SUBPASS_EXTERNAL,
+            .dstSubpass = 0,
+            .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .srcAccessMask = 0,
+            .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        },
+        // Readback copies must see the pass's writes.
+        {
+            .srcSubpass = 0,
+            .dstSubpass = VK_SUBPASS_EXTERNAL,
+            .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        },
+    };
+    VkRenderPassCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &color_attachment,
+        .subpassCount = 1,
+        .pSubpasses = &subpass,
+        .dependencyCount = final_layout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL ? 2 : 1,
+        .pDependencies = dependencies,
+    };
+
+    VkRenderPass render_pass = VK_NULL_HANDLE;
+    if (vkCreateRenderPass(device, &create_info, NULL, &render_pass) != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to create render pass.");
+        return VK_NULL_HANDLE;
+    }
+    return render_pass;
+}
+
+static void destroy_swapchain_images(VkDevice device, uint32_t image_count, VkImageView* image_views, VkFramebuffer* framebuffers, VkSemaphore* render_finished) {
+    for (uint32_t i = 0; i < image_count; ++i) {
+        vkDestroyFramebuffer(device, framebuffers[i], NULL);
+        vkDestroyImageView(device, image_views[i], NULL);
+        vkDestroySemaphore(device, render_finished[i], NULL);
+        framebuffers[i] = VK_NULL_HANDLE;
+        image_views[i] = VK_NULL_HANDLE;
+        render_finished[i] = VK_NULL_HANDLE;
+    }
+}
+
+// With wait_for_all, the device is idled first and every retired swapchain goes; otherwise
+// only those no frame in flight can reference any more.
+static void release_retired_swapchains(renderer* renderer, bool wait_for_all) {
+    if (wait_for_all && renderer->retired_swapchain_count > 0) {
+        vkDeviceWaitIdle(renderer->device);
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < renderer->retired_swapchain_count; ++i) {
+        retired_swapchain* retired = &renderer->retired_swapchains[i];
+        // One frame of slack past the last fence that covered it, for the final present's
+        // semaphore wait, which no fence tracks.
+        if (!wait_for_all && renderer->frame_stats.frame_number < retired->retired_frame + renderer->config.frames_in_flight) {
+            renderer->retired_swapchains[kept++] = *retired;
+            continue;
+        }
+        destroy_swapchain_images(renderer->device, retired->image_count, retired->image_views, retired->framebuffers, retired->render_finished);
+        vkDestroySwapchainKHR(renderer->device, retired->swapchain, NULL);
+    }
+    renderer->retired_swapchain_count = kept;
+}
+
+static void retire_swapchain(renderer* renderer) {
+    if (renderer->swapchain == VK_NULL_HANDLE) {
+        return;
+    }
+    if (renderer->retired_swapchain_count == MAX_RETIRED_SWAPCHAINS) {
+        // Resizing faster than frames retire; fall back to a full wait.
+        release_retired_swapchains(renderer, true);
+    }
+
+    retired_swapchain* retired = &renderer->retired_swapchains[renderer->retired_swapchain_count++];
+    retired->swapchain = renderer->swapchain;
+    retired->image_count = renderer->swapchain_image_count;
+    memcpy(retired->image_views, renderer->swapchain_image_views, sizeof(retired->image_views));
+    memcpy(retired->framebuffers, renderer->framebuffers, sizeof(retired->framebuffers));
+    memcpy(retired->render_finished, renderer->render_finished, sizeof(retired->render_finished));
+    retired->retired_frame = renderer->frame_stats.frame_number;
+
+    renderer->swapchain = VK_NULL_HANDLE;
+    renderer->swapchain_image_count = 0;
+    memset(renderer->swapchain_images, 0, sizeof(renderer->swapchain_images));
+    memset(renderer->swapchain_image_views, 0, sizeof(renderer->swapchain_image_views));
+    memset(renderer->framebuffers, 0, sizeof(renderer->framebuffers));
+    memset(renderer->render_finished, 0, sizeof(renderer->render_finished));
+}
+
+// Views, framebuffers and, when presenting, render-finished semaphores for swapchain_images.
+static result create_render_targets(renderer* renderer) {
+    for (uint32_t i = 0; i < renderer->swapchain_image_count; ++i) {
+        VkImageViewCreateInfo view_info = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = renderer->swapchain_images[i],
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = renderer->swapchain_format.format,
+            .subresourceRange = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .levelCount = 1,
+                .layerCount = 1,
+            },
+        };
+        if (vkCreateImageView(renderer->device, &view_info, NULL, &renderer->swapchain_image_views[i]) != VK_SUCCESS) {
+            ERROR_BREAKPOINT("Failed to create swapchain image view.");
+            return RESULT_FAILURE;
+        }
+
+        VkFramebufferCreateInfo framebuffer_info = {
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .renderPass = renderer->render_pass,
+            .attachmentCount = 1,
+            .pAttachments = &renderer->swapchain_image_views[i],
+            .width = renderer->swapchain_extent.width,
+            .height = renderer->swapchain_extent.height,
+            .layers = 1,
+        };
+        if (vkCreateFramebuffer(renderer->device, &framebuffer_info, NULL, &renderer->framebuffers[i]) != VK_SUCCESS) {
+            ERROR_BREAKPOINT("Failed to create swapchain framebuffer.");
+            return RESULT_FAILURE;
+        }
+
+        if (renderer->config.headless) {
+            continue;
+        }
+        VkSemaphoreCreateInfo semaphore_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        };
+        if (vkCreateSemaphore(renderer->device, &semaphore_info, NULL, &renderer->render_finished[i]) != VK_SUCCESS) {
+            ERROR_BREAKPOINT("Failed to create swapchain semaphore.");
+            return RESULT_FAILURE;
+        }
+    }
+
+    return RESULT_SUCCESS;
+}
+
+static uint32_t clamp_uint32(uint32_t value, uint32_t minimum, uint32_t maximum) {
+    return value < minimum ? minimum : (value > maximum ? maximum : value);
+}
+
+static result create_swapchain_images(renderer* renderer) {
+    uint32_t image_count = 0;
+    vkGetSwapchainImagesKHR(renderer->device, renderer->swapchain, &image_count, NULL);
+    if (image_count > MAX_SWAPCHAIN_IMAGES) {
+        ERROR_BREAKPOINT("Swapchain has more images than MAX_SWAPCHAIN_IMAGES.");
+        return RESULT_FAILURE;
+    }
+    vkGetSwapchainImagesKHR(renderer->device, renderer->swapchain, &image_count, renderer->swapchain_images);
+    renderer->swapchain_image_count = image_count;
+    return create_render_targets(renderer);
+}
+
+static uint32_t find_memory_type(const VkPhysicalDeviceMemoryProperties* properties, uint32_t type_bits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) {
+    uint32_t fallback = UINT32_MAX;
+    for (uint32_t i = 0; i < properties->memoryTypeCount; ++i) {
+        VkMemoryPropertyFlags flags = properties->memoryTypes[i].propertyFlags;
+        if (!(type_bits & (1u << i)) || (flags & required) != required) {
+            continue;
+        }
+        if ((flags & preferred) == preferred) {
+            return i;
+        }
+        if (fallback == UINT32_MAX) {
+            fallback = i;
+        }
+    }
+    return fallback;
+}
+
+static VkDeviceMemory allocate_memory(renderer* renderer, VkMemoryRequirements requirements, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) {
+    uint32_t memory_type = find_memory_type(&renderer->memory.memory_properties, requirements.memoryTypeBits, required, preferred);
+    if (memory_type == UINT32_MAX) {
+        ERROR_BREAKPOINT("No suitable Vulkan memory type.");
+        return VK_NULL_HANDLE;
+    }
+
+    VkMemoryAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = requirements.size,
+        .memoryTypeIndex = memory_type,
+    };
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    if (vkAllocateMemory(renderer->device, &allocate_info, NULL, &memory) != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to allocate Vulkan memory.");
+        return VK_NULL_HANDLE;
+    }
+    return memory;
+}
+
+static result create_offscreen_images(renderer* renderer) {
+    renderer->swapchain_image_count = renderer->config.frames_in_flight;
+    for (uint32_t i = 0; i < renderer->swapchain_image_count; ++i) {
+        VkImageCreateInfo image_info = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = renderer->swapchain_format.format,
+            .extent = { renderer->swapchain_extent.width, renderer->swapchain_extent.height, 1 },
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        };
+        if (vkCreateImage(renderer->device, &image_info, NULL, &renderer->swapchain_images[i]) != VK_SUCCESS) {
+            ERROR_BREAKPOINT("Failed to create offscreen image.");
+            return RESULT_FAILURE;
+        }
+
+        VkMemoryRequirements requirements;
+        vkGetImageMemoryRequirements(renderer->device, renderer->swapchain_images[i], &requirements);
+        renderer->offscreen_memory[i] = allocate_memory(renderer, requirements, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        if (renderer->offscreen_memory[i] == VK_NULL_HANDLE ||
+            vkBindImageMemory(renderer->device, renderer->swapchain_images[i], renderer->offscreen_memory[i], 0) != VK_SUCCESS) {
+            ERROR_BREAKPOINT("Failed to bind offscreen image memory.");
+            return RESULT_FAILURE;
+        }
+    }
+    return create_render_targets(renderer);
+}
+
+static void destroy_offscreen_images(renderer* renderer) {
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+        vkDestroyImage(renderer->device, renderer->swapchain_images[i], NULL);
+        vkFreeMemory(renderer->device, renderer->offscreen_memory[i], NULL);
+        renderer->swapchain_images[i] = VK_NULL_HANDLE;
+        renderer->offscreen_memory[i] = VK_NULL_HANDLE;
+    }
+}
+
+static result create_readback_slots(renderer* renderer) {
+    VkDeviceSize size = (VkDeviceSize)renderer->swapchain_extent.width * renderer->swapchain_extent.height * 4;
+    for (uint32_t i = 0; i < MAX_FRAME_READBACKS; ++i) {
+        frame_readback_slot* slot = &renderer->readbacks[i];
+        VkBufferCreateInfo buffer_info = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = size,
+            .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        };
+        if (vkCreateBuffer(renderer->device, &buffer_info, NULL, &slot->buffer) != VK_SUCCESS) {
+            ERROR_BREAKPOINT("Failed to create readback buffer.");
+            return RESULT_FAILURE;
+        }
+
+        // Cached memory makes the CPU's reads of the copied frame fast; it is often not coherent.
+        VkMemoryRequirements requirements;
+        vkGetBufferMemoryRequirements(renderer->device, slot->buffer, &requirements);
+        const VkPhysicalDeviceMemoryProperties* properties = &renderer->memory.memory_properties;
+        uint32_t memory_type = find_memory_type(properties, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+        slot->coherent = memory_type != UINT32_MAX && (properties->memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+        slot->memory = allocate_memory(renderer, requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+        if (slot->memory == VK_NULL_HANDLE ||
+            vkBindBufferMemory(renderer->device, slot->buffer, slot->memory, 0) != VK_SUCCESS ||
+            vkMapMemory(renderer->device, slot->memory, 0, VK_WHOLE_SIZE, 0, &slot->mapped) != VK_SUCCESS) {
+            ERROR_BREAKPOINT("Failed to map readback memory.");
+            return RESULT_FAILURE;
+        }
+        slot->state = FRAME_READBACK_FREE;
+    }
+    return RESULT_SUCCESS;
+}
+
+static void destroy_readback_slots(renderer* renderer) {
+    for (uint32_t i = 0; i < MAX_FRAME_READBACKS; ++i) {
+        frame_readback_slot* slot = &renderer->readbacks[i];
+        vkDestroyBuffer(renderer->device, slot->buffer, NULL);
+        // Freeing mapped memory unmaps it.
+        vkFreeMemory(renderer->device, slot->memory, NULL);
+    }
+    memset(renderer->readbacks, 0, sizeof(renderer->readbacks));
+}
+
+IMPLEMENT_POOL(gpu_allocation, gpu_allocation_pool, MAX_GPU_ALLOCATIONS)
+
+#define GPU_MEMORY_NODE_COUNT ((1u << GPU_MEMORY_ORDER_COUNT) - 1)
+#define GPU_MEMORY_NODE_WORDS ((GPU_MEMORY_NODE_COUNT + 63) / 64)
+#define GPU_MEMORY_ARENA_RESERVE_SIZE ((size_t)64 * 1024 * 1024)
+
+STATIC_ASSERT((GPU_MEMORY_MIN_ALLOCATION << (GPU_MEMORY_ORDER_COUNT - 1)) == GPU_MEMORY_BLOCK_SIZE, gpu_memory_orders_must_span_a_block)
+
+static uint64_t order_size(uint32_t order) {
+    return GPU_MEMORY_MIN_ALLOCATION << order;
+}
+
+// Index of the first node of an order's tree level.
+static uint32_t first_node_of_order(uint32_t order) {
+    return (1u << (GPU_MEMORY_ORDER_COUNT - 1 - order)) - 1;
+}
+
+static bool is_node_free(const gpu_memory_block* block, uint32_t node) {
+    return (block->free_nodes[node / 64] >> (node % 64)) & 1;
+}
+
+static void set_node_free(gpu_memory_block* block, uint32_t node, uint32_t order, bool free) {
+    if (free) {
+        block->free_nodes[node / 64] |= 1ull << (node % 64);
+        block->free_counts[order]++;
+    }
+    else {
+        block->free_nodes[node / 64] &= ~(1ull << (node % 64));
+        block->free_counts[order]--;
+    }
+}
+
+static uint32_t find_free_node(const gpu_memory_block* block, uint32_t order) {
+    uint32_t end = first_node_of_order(order) * 2 + 1;
+    for (uint32_t node = first_node_of_order(order); node < end;) {
+        uint32_t span = 64 - node % 64;
+        uint64_t bits = block->free_nodes[node / 64] >> (node % 64);
+        if (end - node < span) {
+            span = end - node;
+            bits &= (1ull << span) - 1;
+        }
+        if (bits != 0) {
+            return node + count_trailing_zeros64(bits);
+        }
+        node += span;
+    }
+    return UINT32_MAX;
+}
+
+// Splits the smallest free range that fits down to the requested order. Returns the range's
+// offset in the block, or UINT64_MAX when the block has no room.
+static uint64_t buddy_allocate(gpu_memory_block* block, uint32_t order) {
+    uint32_t found = order;
+    while (found < GPU_MEMORY_ORDER_COUNT && block->free_counts[found] == 0) {
+        ++found;
+    }
+    if (found == GPU_MEMORY_ORDER_COUNT) {
+        return UINT64_MAX;
+    }
+
+    uint32_t node = find_free_node(block, found);
+    set_node_free(block, node, found, false);
+    while (found > order) {
+        --found;
+        // Keep the left half and free the right one.
+        node = node * 2 + 1;
+        set_node_free(block, node + 1, found, true);
+    }
+    block->used_bytes += order_size(order);
+    block->allocation_count++;
+    return (uint64_t)(node - first_node_of_order(order)) * order_size(order);
+}
+
+// Frees a range and merges it with its buddy for as long as the buddy is free too.
+static void buddy_free(gpu_memory_block* block, uint64_t offset, uint32_t order) {
+    block->used_bytes -= order_size(order);
+    block->allocation_count--;
+    uint32_t node = first_node_of_order(order) + (uint32_t)(offset / order_size(order));
+    while (node != 0) {
+        uint32_t buddy = (node & 1) ? node + 1 : node - 1;
+        if (!is_node_free(block, buddy)) {
+            break;
+        }
+        set_node_free(block, buddy, order, false);
+        node = (node - 1) / 2;
+        ++order;
+    }
+    set_node_free(block, node, order, true);
+}
+
+static uint64_t largest_free_range(const gpu_memory_block* block) {
+    for (uint32_t order = GPU_MEMORY_ORDER_COUNT; order > 0; --order) {
+        if (block->free_counts[order - 1] != 0) {
+            return order_size(order - 1);
+        }
+    }
+    return 0;
+}
+
+static void get_heap_budgets(renderer* renderer, uint64_t* out_usage, uint64_t* out_budget) {
+    const gpu_allocator* allocator = &renderer->memory;
+    uint32_t heap_count = allocator->memory_properties.memoryHeapCount;
+    if (renderer->memory_budget) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+        };
+        VkPhysicalDeviceMemoryProperties2 properties = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+            .pNext = &budget,
+        };
+        vkGetPhysicalDeviceMemoryProperties2(renderer->physical_device, &properties);
+        for (uint32_t i = 0; i < heap_count; ++i) {
+            out_usage[i] = budget.heapUsage[i];
+            out_budget[i] = budget.heapBudget[i];
+        }
+        return;
+    }
+    for (uint32_t i = 0; i < heap_count; ++i) {
+        out_usage[i] = allocator->heap_allocated_bytes[i];
+        out_budget[i] = allocator->memory_properties.memoryHeaps[i].size / 10 * 8;
+    }
+}
+
+// vkAllocateMemory with the allocation count limit and the heap budget checked first.
+// Exceeding either is an expected condition, so it fails quietly.
+static VkDeviceMemory allocate_device_memory(renderer* renderer, uint32_t memory_type, VkDeviceSize size, const void* next) {
+    gpu_allocator* allocator = &renderer->memory;
+    if (allocator->device_allocation_count >= allocator->max_allocation_count) {
+        return VK_NULL_HANDLE;
+    }
+    uint32_t heap = allocator->memory_properties.memoryTypes[memory_type].heapIndex;
+    uint64_t usage[VK_MAX_MEMORY_HEAPS];
+    uint64_t budget[VK_MAX_MEMORY_HEAPS];
+    get_heap_budgets(renderer, usage, budget);
+    if (usage[heap] + size > budget[heap]) {
+        return VK_NULL_HANDLE;
+    }
+
+    VkMemoryAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = next,
+        .allocationSize = size,
+        .memoryTypeIndex = memory_type,
+    };
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    if (vkAllocateMemory(renderer->device, &allocate_info, NULL, &memory) != VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    }
+    allocator->device_allocation_count++;
+    allocator->heap_allocated_bytes[heap] += size;
+    return memory;
+}
+
+static void free_device_memory(renderer* renderer, VkDeviceMemory memory, uint32_t memory_type, VkDeviceSize size) {
+    gpu_allocator* allocator = &renderer->memory;
+    vkFreeMemory(renderer->device, memory, NULL);
+    allocator->device_allocation_count--;
+    allocator->heap_allocated_bytes[allocator->memory_properties.memoryTypes[memory_type].heapIndex] -= size;
+}
+
+static bool is_host_visible(const gpu_allocator* allocator, uint32_t memory_type) {
+    return allocator->memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+}
+
+static uint32_t find_gpu_memory_type(const gpu_allocator* allocator, uint32_t type_bits, gpu_memory_usage usage) {
+    switch (usage) {
+    case GPU_MEMORY_UPLOAD:
+        return find_memory_type(&allocator->memory_properties, type_bits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    case GPU_MEMORY_READBACK:
+        return find_memory_type(&allocator->memory_properties, type_bits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+    case GPU_MEMORY_DEVICE_LOCAL:
+    default:
+        return find_memory_type(&allocator->memory_properties, type_bits, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    }
+}
+
+// Blocks only separate resource kinds when a granularity page can span two allocations.
+static gpu_resource_kind block_kind(const gpu_allocator* allocator, gpu_resource_kind kind) {
+    return allocator->buffer_image_granularity > GPU_MEMORY_MIN_ALLOCATION ? kind : GPU_RESOURCE_LINEAR;
+}
+
+static uint32_t create_gpu_memory_block(renderer* renderer, uint32_t memory_type, gpu_resource_kind kind) {
+    gpu_allocator* allocator = &renderer->memory;
+    uint32_t index = 0;
+    while (index < allocator->block_slots && allocator->blocks[index].memory != VK_NULL_HANDLE) {
+        ++index;
+    }
+    if (index == MAX_GPU_MEMORY_BLOCKS) {
+        ERROR_BREAKPOINT("Out of GPU memory block slots.");
+        return UINT32_MAX;
+    }
+
+    gpu_memory_block* block = &allocator->blocks[index];
+    // Slots keep their node bitmap when a block is released, so the arena only grows with the
+    // peak block count.
+    if (block->free_nodes == NULL) {
+        block->free_nodes = arena_allocate(&allocator->arena, GPU_MEMORY_NODE_WORDS * sizeof(uint64_t), alignof(uint64_t));
+        if (block->free_nodes == NULL) {
+            return UINT32_MAX;
+        }
+    }
+    VkDeviceMemory memory = allocate_device_memory(renderer, memory_type, GPU_MEMORY_BLOCK_SIZE, NULL);
+    if (memory == VK_NULL_HANDLE) {
+        return UINT32_MAX;
+    }
+
+    void* mapped = NULL;
+    if (is_host_visible(allocator, memory_type) && vkMapMemory(renderer->device, memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS) {
+        free_device_memory(renderer, memory, memory_type, GPU_MEMORY_BLOCK_SIZE);
+        ERROR_BREAKPOINT("Failed to map GPU memory block.");
+        return UINT32_MAX;
+    }
+
+    uint64_t* free_nodes = block->free_nodes;
+    memset(free_nodes, 0, GPU_MEMORY_NODE_WORDS * sizeof(uint64_t));
+    *block = (gpu_memory_block){
+        .memory = memory,
+        .mapped = mapped,
+        .memory_type = memory_type,
+        .kind = kind,
+        .free_nodes = free_nodes,
+    };
+    set_node_free(block, 0, GPU_MEMORY_ORDER_COUNT - 1, true);
+    if (index == allocator->block_slots) {
+        allocator->block_slots++;
+    }
+    return index;
+}
+
+static void release_gpu_memory_block(renderer* renderer, uint32_t index) {
+    gpu_memory_block* block = &renderer->memory.blocks[index];
+    free_device_memory(renderer, block->memory, block->memory_type, GPU_MEMORY_BLOCK_SIZE);
+    block->memory = VK_NULL_HANDLE;
+    block->mapped = NULL;
+}
+
+static bool has_other_block(const gpu_allocator* allocator, uint32_t index) {
+    const gpu_memory_block* block = &allocator->blocks[index];
+    for (uint32_t i = 0; i < allocator->block_slots; ++i) {
+        const gpu_memory_block* other = &allocator->blocks[i];
+        if (i != index && other->memory != VK_NULL_HANDLE && other->memory_type == block->memory_type && other->kind == block->kind) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static result allocate_gpu_memory_for(renderer* renderer, const VkMemoryRequirements* requirements, gpu_memory_usage usage, gpu_resource_kind kind, bool dedicated,
+                                      const VkMemoryDedicatedAllocateInfo* dedicated_info, gpu_allocation_handle* out_allocation) {
+    gpu_allocator* allocator = &renderer->memory;
+    uint32_t memory_type = find_gpu_memory_type(allocator, requirements->memoryTypeBits, usage);
+    if (memory_type == UINT32_MAX) {
+        ERROR_BREAKPOINT("No memory type suits the resource and usage.");
+        return RESULT_FAILURE;
+    }
+
+    gpu_allocation record = {
+        .size = requirements->size,
+        .memory_type = memory_type,
+        .block = GPU_DEDICATED_BLOCK,
+    };
+    if (dedicated || requirements->size >= GPU_DEDICATED_ALLOCATION_THRESHOLD) {
+        record.memory = allocate_device_memory(renderer, memory_type, requirements->size, dedicated_info);
+        if (record.memory == VK_NULL_HANDLE) {
+            return RESULT_FAILURE;
+        }
+        if (is_host_visible(allocator, memory_type) && vkMapMemory(renderer->device, record.memory, 0, VK_WHOLE_SIZE, 0, &record.mapped) != VK_SUCCESS) {
+            free_device_memory(renderer, record.memory, memory_type, requirements->size);
+            ERROR_BREAKPOINT("Failed to map dedicated GPU memory.");
+            return RESULT_FAILURE;
+        }
+    }
+    else {
+        // Buddy ranges are aligned to their own size, which covers the resource's alignment.
+        VkDeviceSize span = requirements->size > requirements->alignment ? requirements->size : requirements->alignment;
+        while (order_size(record.order) < span) {
+            record.order++;
+        }
+        gpu_resource_kind wanted_kind = block_kind(allocator, kind);
+        uint64_t offset = UINT64_MAX;
+        for (uint32_t i = 0; i < allocator->block_slots && offset == UINT64_MAX; ++i) {
+            gpu_memory_block* block = &allocator->blocks[i];
+            if (block->memory != VK_NULL_HANDLE && block->memory_type == memory_type && block->kind == wanted_kind) {
+                offset = buddy_allocate(block, record.order);
+                record.block = i;
+            }
+        }
+        if (offset == UINT64_MAX) {
+            record.block = create_gpu_memory_block(renderer, memory_type, wanted_kind);
+            if (record.block == UINT32_MAX) {
+                return RESULT_FAILURE;
+            }
+            offset = buddy_allocate(&allocator->blocks[record.block], record.order);
+        }
+        gpu_memory_block* block = &allocator->blocks[record.block];
+        record.memory = block->memory;
+        record.offset = offset;
+        record.mapped = block->mapped != NULL ? block->mapped + offset : NULL;
+    }
+
+    gpu_allocation* allocation = gpu_allocation_pool_allocate(allocator->allocations, out_allocation);
+    if (allocation == NULL) {
+        if (record.block == GPU_DEDICATED_BLOCK) {
+            free_device_memory(renderer, record.memory, memory_type, record.size);
+        }
+        else {
+            buddy_free(&allocator->blocks[record.block], record.offset, record.order);
+        }
+        return RESULT_FAILURE;
+    }
+    *allocation = record;
+    return RESULT_SUCCESS;
+}
+
+static result create_gpu_allocator(renderer* renderer) {
+    gpu_allocator* allocator = &renderer->memory;
+    if (create_arena_allocator(GPU_MEMORY_ARENA_RESERVE_SIZE, 0, &allocator->arena) != RESULT_SUCCESS) {
+        return RESULT_FAILURE;
+    }
+    allocator->allocations = arena_allocate_zeroed(&allocator->arena, sizeof(gpu_allocation_pool), alignof(gpu_allocation_pool));
+    if (allocator->allocations == NULL) {
+        ERROR_BREAKPOINT("Failed to allocate the GPU allocation pool.");
+        return RESULT_FAILURE;
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(renderer->physical_device, &properties);
+    vkGetPhysicalDeviceMemoryProperties(renderer->physical_device, &allocator->memory_properties);
+    allocator->buffer_image_granularity = properties.limits.bufferImageGranularity;
+    allocator->max_allocation_count = properties.limits.maxMemoryAllocationCount;
+    return RESULT_SUCCESS;
+}
+
+static void destroy_gpu_allocator(renderer* renderer) {
+    gpu_allocator* allocator = &renderer->memory;
+    if (allocator->allocations != NULL) {
+        for (uint32_t i = 0; i < allocator->allocations->count; ++i) {
+            const gpu_allocation* allocation = &allocator->allocations->data[i];
+            if (allocation->block == GPU_DEDICATED_BLOCK) {
+                vkFreeMemory(renderer->device, allocation->memory, NULL);
+            }
+        }
+    }
+    for (uint32_t i = 0; i < allocator->block_slots; ++i) {
+        vkFreeMemory(renderer->device, allocator->blocks[i].memory, NULL);
+    }
+    if (allocator->arena.base != NULL) {
+        destroy_arena_allocator(&allocator->arena);
+    }
+    memset(allocator, 0, sizeof(*allocator));
+}
+
+static result create_upload_batch(renderer* renderer, upload_batch* batch) {
+    VkCommandPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = renderer->transfer_queue_family_index,
+    };
+    VkCommandBufferAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    if (vkCreateCommandPool(renderer->device, &pool_info, NULL, &batch->command_pool) != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to create upload command pool.");
+        return RESULT_FAILURE;
+    }
+    allocate_info.commandPool = batch->command_pool;
+    if (vkAllocateCommandBuffers(renderer->device, &allocate_info, &batch->command_buffer) != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to allocate upload command buffer.");
+        return RESULT_FAILURE;
+    }
+    if (!renderer->uploads.ownership_transfer) {
+        return RESULT_SUCCESS;
+    }
+
+    pool_info.queueFamilyIndex = renderer->graphics_queue_family_index;
+    if (vkCreateCommandPool(renderer->device, &pool_info, NULL, &batch->acquire_pool) != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to create upload acquire command pool.");
+        return RESULT_FAILURE;
+    }
+    allocate_info.commandPool = batch->acquire_pool;
+    if (vkAllocateCommandBuffers(renderer->device, &allocate_info, &batch->acquire_buffer) != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to allocate upload acquire command buffer.");
+        return RESULT_FAILURE;
+    }
+    return RESULT_SUCCESS;
+}
+
+static result create_upload_manager(renderer* renderer) {
+    upload_manager* uploads = &renderer->uploads;
+    uploads->capacity = renderer->config.upload_staging_size != 0 ? renderer->config.upload_staging_size : UPLOAD_DEFAULT_STAGING_SIZE;
+    uploads->ownership_transfer = renderer->transfer_queue_family_index != renderer->graphics_queue_family_index;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(renderer->physical_device, &properties);
+    // Image copies need texel-aligned source offsets; 16 covers every uncompressed format.
+    uploads->copy_alignment = properties.limits.optimalBufferCopyOffsetAlignment > 16 ? properties.limits.optimalBufferCopyOffsetAlignment : 16;
+    uploads->capacity = (uploads->capacity + uploads->copy_alignment - 1) / uploads->copy_alignment * uploads->copy_alignment;
+
+    VkBufferCreateInfo buffer_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = uploads->capacity,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    if (vkCreateBuffer(renderer->device, &buffer_info, NULL, &uploads->staging_buffer) != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to create upload staging buffer.");
+        return RESULT_FAILURE;
+    }
+
+    // The CPU only writes staging memory, sequentially, so write-combined coherent memory is ideal.
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(renderer->device, uploads->staging_buffer, &requirements);
+    const VkPhysicalDeviceMemoryProperties* memory_properties = &renderer->memory.memory_properties;
+    uint32_t memory_type = find_memory_type(memory_properties, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    uploads->coherent = memory_type != UINT32_MAX && (memory_properties->memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    void* mapped = NULL;
+    uploads->staging_memory = allocate_memory(renderer, requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    if (uploads->staging_memory == VK_NULL_HANDLE ||
+        vkBindBufferMemory(renderer->device, uploads->staging_buffer, uploads->staging_memory, 0) != VK_SUCCESS ||
+        vkMapMemory(renderer->device, uploads->staging_memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to map upload staging memory.");
+        return RESULT_FAILURE;
+    }
+    uploads->staging = mapped;
+
+    VkSemaphoreTypeCreateInfo timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+    VkSemaphoreCreateInfo semaphore_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &timeline_info,
+    };
+    if (vkCreateSemaphore(renderer->device, &semaphore_info, NULL, &uploads->timeline) != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to create upload timeline semaphore.");
+        return RESULT_FAILURE;
+    }
+
+    for (uint32_t i = 0; i < MAX_UPLOAD_BATCHES; ++i) {
+        if (create_upload_batch(renderer, &uploads->batches[i]) != RESULT_SUCCESS) {
+            return RESULT_FAILURE;
+        }
+    }
+    return RESULT_SUCCESS;
+}
+
+static void destroy_upload_manager(renderer* renderer) {
+    upload_manager* uploads = &renderer->uploads;
+    for (uint32_t i = 0; i < MAX_UPLOAD_BATCHES; ++i) {
+        vkDestroyCommandPool(renderer->device, uploads->batches[i].command_pool, NULL);
+        vkDestroyCommandPool(renderer->device, uploads->batches[i].acquire_pool, NULL);
+    }
+    vkDestroySemaphore(renderer->device, uploads->timeline, NULL);
+    vkDestroyBuffer(renderer->device, uploads->staging_buffer, NULL);
+    vkFreeMemory(renderer->device, uploads->staging_memory, NULL);
+    memset(uploads, 0, sizeof(*uploads));
+}
+
+// Builds a swapchain for the window's current size. The previous one is handed to the driver
+// as oldSwapchain and retired, not destroyed, so frames still in flight can finish with it
+// and no device-wide idle is needed. Returns false while the window has no area.
+static bool recreate_swapchain(renderer* renderer) {
+    PROFILE_BEGIN("recreate_swapchain");
+    uint32_t window_width = renderer->window->input.width;
+    uint32_t window_height = renderer->window->input.height;
+
+    VkSurfaceCapabilitiesKHR capabilities;
+    if (vkGetPhysicalDeviceSurfaceCapabilitiesKHR(renderer->physical_device, renderer->window_surface, &capabilities) != VK_SUCCESS) {
+        PROFILE_END();
+        ERROR_BREAKPOINT("Failed to query surface capabilities.");
+        return false;
+    }
+
+    VkExtent2D extent = capabilities.currentExtent;
+    if (extent.width == UINT32_MAX) {
+        // The surface takes its size from the swapchain.
+        extent.width = clamp_uint32(window_width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
+        extent.height = clamp_uint32(window_height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
+    }
+    if (extent.width == 0 || extent.height == 0) {
+        PROFILE_END();
+        return false;
+    }
+
+    uint32_t image_count = capabilities.minImageCount + 1;
+    if (capabilities.maxImageCount != 0 && image_count > capabilities.maxImageCount) {
+        image_count = capabilities.maxImageCount;
+    }
+    if (image_count > MAX_SWAPCHAIN_IMAGES) {
+        image_count = MAX_SWAPCHAIN_IMAGES;
+    }
+
+    VkCompositeAlphaFlagBitsKHR composite_alpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    if (!(capabilities.supportedCompositeAlpha & composite_alpha)) {
+        composite_alpha = (VkCompositeAlphaFlagBitsKHR)(capabilities.supportedCompositeAlpha & -capabilities.supportedCompositeAlpha);
+    }
+
+    VkSwapchainCreateInfoKHR create_info = {
+        .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+        .surface = renderer->window_surface,
+        .minImageCount = image_count,
+        .imageFormat = renderer->swapchain_format.format,
+        .imageColorSpace = renderer->swapchain_format.colorSpace,
+        .imageExtent = extent,
+        .imageArrayLayers = 1,
+        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .preTransform = capabilities.currentTransform,
+        .compositeAlpha = composite_alpha,
+        .presentMode = renderer->present_mode,
+        .clipped = VK_TRUE,
+        .oldSwapchain = renderer->swapchain,
+    };
+
+    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+    VkResult created = vkCreateSwapchainKHR(renderer->device, &create_info, NULL, &swapchain);
+    // The old swapchain is retired even if creation failed: once passed as oldSwapchain it
+    // can no longer acquire images.
+    retire_swapchain(renderer);
+    if (created != VK_SUCCESS) {
+        PROFILE_END();
+        ERROR_BREAKPOINT("Failed to create swapchain.");
+        return false;
+    }
+
+    renderer->swapchain = swapchain;
+    renderer->swapchain_extent = extent;
+    renderer->swapchain_window_width = window_width;
+    renderer->swapchain_window_height = window_height;
+    renderer->swapchain_dirty = false;
+    renderer->frame_stats.swapchain_recreations++;
+    bool usable = create_swapchain_images(renderer) == RESULT_SUCCESS;
+    PROFILE_END();
+    return usable;
+}
+
+static uint64_t begin_init_stage(const char* name) {
+    PROFILE_BEGIN(name);
+    return get_time_nanoseconds();
+}
+
+static void end_init_stage(renderer* renderer, renderer_init_stage stage, uint64_t start) {
+    renderer->init_timings.stage_nanoseconds[stage] = get_time_nanoseconds() - start;
+    PROFILE_END();
+}
+
+// Everything up to the pipeline cache. window_surface may be VK_NULL_HANDLE, in which case
+// present support is left for initialize_surface to confirm.
+static result initialize_device(renderer* out_renderer, VkSurfaceKHR window_surface) {
+    uint64_t start = begin_init_stage("pick_physical_device");
+    queue_families queue_families = { UINT32_MAX, UINT32_MAX, UINT32_MAX, 0 };
+    bool headless = out_renderer->config.headless;
+    out_renderer->physical_device = pick_physical_device(window_surface, out_renderer->instance, headless, &queue_families);
+    end_init_stage(out_renderer, RENDERER_INIT_STAGE_PHYSICAL_DEVICE, start);
+    if (out_renderer->physical_device == VK_NULL_HANDLE) {
+        return RESULT_FAILURE;
+    }
+
+    out_renderer->graphics_queue_family_index = queue_families.graphics_queue_index;
+    out_renderer->transfer_queue_family_index = queue_families.transfer_queue_index;
+    out_renderer->compute_queue_family_index = queue_families.compute_queue_index;
+    const char* extensions[MAX_DEVICE_EXTENSIONS];
+    uint32_t extension_count = 0;
+    for (uint32_t i = 0; i < REQUIRED_DEVICE_EXTENSION_COUNT; ++i) {
+        if (is_device_extension_required(required_device_extensions[i], headless)) {
+            extensions[extension_count++] = required_device_extensions[i];
+        }
+    }
+    out_renderer->pipeline_creation_feedback = has_device_extension(out_renderer->physical_device, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+    if (out_renderer->pipeline_creation_feedback) {
+        extensions[extension_count++] = VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME;
+    }
+    out_renderer->memory_budget = has_device_extension(out_renderer->physical_device, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (out_renderer->memory_budget) {
+        extensions[extension_count++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(out_renderer->physical_device, &properties);
+    out_renderer->timestamp_valid_bits = get_timestamp_valid_bits(out_renderer->physical_device, queue_families.graphics_queue_index);
+    out_renderer->timestamp_period = out_renderer->timestamp_valid_bits > 0 ? properties.limits.timestampPeriod : 0.0f;
+    out_renderer->get_calibrated_timestamps = NULL;
+    bool calibrated_timestamps = out_renderer->timestamp_period > 0.0f &&
+                                 has_device_extension(out_renderer->physical_device, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME) &&
+                                 has_calibrateable_host_domain(out_renderer->instance, out_renderer->physical_device);
+    if (calibrated_timestamps) {
+        extensions[extension_count++] = VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME;
+    }
+
+    VkPhysicalDeviceFeatures supported_features;
+    vkGetPhysicalDeviceFeatures(out_renderer->physical_device, &supported_features);
+    VkPhysicalDeviceFeatures features = {
+        .multiDrawIndirect = supported_features.multiDrawIndirect,
+        .drawIndirectFirstInstance = supported_features.drawIndirectFirstInstance,
+    };
+    out_renderer->max_draw_indirect_count = features.multiDrawIndirect == VK_TRUE && properties.limits.maxDrawIndirectCount > 1 ? properties.limits.maxDrawIndirectCount : 1;
+    out_renderer->draw_indirect_first_instance = features.drawIndirectFirstInstance == VK_TRUE;
+
+    start = begin_init_stage("create_logical_device");
+    out_renderer->device = create_logical_device(out_renderer->physical_device, queue_families, &features, extensions, extension_count, &out_renderer->graphics_queue, &out_renderer->transfer_queue, &out_renderer->compute_queue);
+    end_init_stage(out_renderer, RENDERER_INIT_STAGE_LOGICAL_DEVICE, start);
+    if (out_renderer->device == VK_NULL_HANDLE) {
+        return RESULT_FAILURE;
+    }
+    if (calibrated_timestamps) {
+        out_renderer->get_calibrated_timestamps = (PFN_vkGetCalibratedTimestampsEXT)vkGetDeviceProcAddr(out_renderer->device, "vkGetCalibratedTimestampsEXT");
+    }
+
+    start = begin_init_stage("create_pipeline_cache");
+    out_renderer->pipeline_cache = create_pipeline_cache(out_renderer->physical_device, out_renderer->device, &out_renderer->pipeline_cache_stats);
+    end_init_stage(out_renderer, RENDERER_INIT_STAGE_PIPELINE_CACHE, start);
+    if (out_renderer->pipeline_cache == VK_NULL_HANDLE) {
+        return RESULT_FAILURE;
+    }
+
+    start = begin_init_stage("create_frame_resources");
+    result created = create_pipeline_state_cache(&out_renderer->pipeline_states);
+    if (created == RESULT_SUCCESS) {
+        created = create_frame_resources(out_renderer);
+    }
+    if (created == RESULT_SUCCESS) {
+        created = create_gpu_allocator(out_renderer);
+    }
+    if (created == RESULT_SUCCESS) {
+        created = create_upload_manager(out_renderer);
+    }
+    if (created == RESULT_SUCCESS && out_renderer->timestamp_period > 0.0f) {
+        calibrate_gpu_clock(out_renderer);
+    }
+    end_init_stage(out_renderer, RENDERER_INIT_STAGE_FRAME_RESOURCES, start);
+    return created;
+}
+
+static result initialize_instance(renderer* out_renderer) {
+    uint64_t start = begin_init_stage("create_vulkan_instance");
+    out_renderer->instance = create_vulkan_instance(out_renderer->config.headless);
+    end_init_stage(out_renderer, RENDERER_INIT_STAGE_INSTANCE, start);
+    return out_renderer->instance != VK_NULL_HANDLE ? RESULT_SUCCESS : RESULT_FAILURE;
+}
+
+static result initialize_surface(renderer* out_renderer, window* window) {
+    uint64_t start = begin_init_stage("create_window_surface");
+    out_renderer->window_surface = create_window_surface(window, out_renderer->instance);
+    end_init_stage(out_renderer, RENDERER_INIT_STAGE_SURFACE, start);
+    if (out_renderer->window_surface == VK_NULL_HANDLE) {
+        return RESULT_FAILURE;
+    }
+
+    start = begin_init_stage("check_present_support");
+    VkBool32 present_support = VK_FALSE;
+    vkGetPhysicalDeviceSurfaceSupportKHR(out_renderer->physical_device, out_renderer->graphics_queue_family_index, out_renderer->window_surface, &present_support);
+    end_init_stage(out_renderer, RENDERER_INIT_STAGE_PRESENT_CHECK, start);
+    if (!present_support) {
+        // Rare: the device was chosen before the surface existed and its graphics family cannot
+        // present to it. Start the device over, this time filtering on the surface.
+        destroy_upload_manager(out_renderer);
+        destroy_gpu_allocator(out_renderer);
+        destroy_frame_resources(out_renderer);
+        destroy_pipeline_state_cache(out_renderer->device, &out_renderer->pipeline_states);
+        vkDestroyPipelineCache(out_renderer->device, out_renderer->pipeline_cache, NULL);
+        vkDestroyDevice(out_renderer->device, NULL);
+        out_renderer->pipeline_cache = VK_NULL_HANDLE;
+        out_renderer->device = VK_NULL_HANDLE;
+        if (initialize_device(out_renderer, out_renderer->window_surface) != RESULT_SUCCESS) {
+            return RESULT_FAILURE;
+        }
+    }
+
+    start = begin_init_stage("create_swapchain");
+    out_renderer->window = window;
+    out_renderer->swapchain_format = choose_surface_format(out_renderer->physical_device, out_renderer->window_surface);
+    out_renderer->present_mode = choose_present_mode(out_renderer->physical_device, out_renderer->window_surface, out_renderer->config.vsync);
+    out_renderer->render_pass = create_render_pass(out_renderer->device, out_renderer->swapchain_format.format, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    if (out_renderer->render_pass != VK_NULL_HANDLE) {
+        // A minimised window gets its swapchain on the first begin_frame with a non-zero size.
+        out_renderer->swapchain_dirty = !recreate_swapchain(out_renderer);
+        out_renderer->frame_stats.swapchain_recreations = 0;
+    }
+    end_init_stage(out_renderer, RENDERER_INIT_STAGE_SWAPCHAIN, start);
+    return out_renderer->render_pass != VK_NULL_HANDLE ? RESULT_SUCCESS : RESULT_FAILURE;
+}
+
+static result initialize_offscreen(renderer* out_renderer) {
+    uint64_t start = begin_init_stage("create_offscreen_images");
+    out_renderer->swapchain_format = (VkSurfaceFormatKHR){ VK_FORMAT_R8G8B8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+    out_renderer->swapchain_extent = (VkExtent2D){ out_renderer->config.headless_width, out_renderer->config.headless_height };
+    out_renderer->requested_readback = UINT32_MAX;
+    out_renderer->render_pass = create_render_pass(out_renderer->device, out_renderer->swapchain_format.format, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    result created = RESULT_FAILURE;
+    if (out_renderer->render_pass != VK_NULL_HANDLE && create_offscreen_images(out_renderer) == RESULT_SUCCESS) {
+        created = create_readback_slots(out_renderer);
+    }
+    end_init_stage(out_renderer, RENDERER_INIT_STAGE_SWAPCHAIN, start);
+    return created;
+}
+
+static result initialize_presentation(renderer* out_renderer, window* window) {
+    if (out_renderer->config.headless) {
+        return initialize_offscreen(out_renderer);
+    }
+    ASSERT(window != NULL, return RESULT_FAILURE, "Window pointer is NULL");
+    return initialize_surface(out_renderer, window);
+}
+
+static void apply_renderer_config(renderer* out_renderer, const renderer_config* config) {
+    if (config != NULL) {
+        out_renderer->config = *config;
+    }
+    if (out_renderer->config.frames_in_flight == 0) {
+        out_renderer->config.frames_in_flight = RENDERER_DEFAULT_FRAMES_IN_FLIGHT;
+    }
+    if (out_renderer->config.frames_in_flight > MAX_FRAMES_IN_FLIGHT) {
+        out_renderer->config.frames_in_flight = MAX_FRAMES_IN_FLIGHT;
+    }
+    if (out_renderer->config.recording_threads > MAX_RECORDING_THREADS) {
+        out_renderer->config.recording_threads = MAX_RECORDING_THREADS;
+    }
+    if (out_renderer->config.headless && (out_renderer->config.headless_width == 0 || out_renderer->config.headless_height == 0)) {
+        out_renderer->config.headless_width = 1280;
+        out_renderer->config.headless_height = 720;
+    }
+}
+
+static void renderer_initialization_main(void* data) {
+    renderer_initialization* initialization = data;
+    PROFILE_THREAD_NAME("renderer initialization");
+    PROFILE_BEGIN("renderer_background_initialization");
+    initialization->background_result = initialize_instance(initialization->renderer);
+    if (initialization->background_result == RESULT_SUCCESS) {
+        initialization->background_result = initialize_device(initialization->renderer, VK_NULL_HANDLE);
+    }
+    initialization->renderer->init_timings.background_nanoseconds = get_time_nanoseconds() - initialization->start;
+    PROFILE_END();
+}
+
+result start_renderer_initialization(const renderer_config* config, renderer* out_renderer, renderer_initialization* out_initialization) {
+    ASSERT(out_renderer != NULL, return RESULT_FAILURE, "Renderer pointer is NULL");
+    ASSERT(out_initialization != NULL, return RESULT_FAILURE, "Renderer initialization pointer is NULL");
+    memset(out_renderer, 0, sizeof(renderer));
+    apply_renderer_config(out_renderer, config);
+    memset(out_initialization, 0, sizeof(renderer_initialization));
+    out_initialization->renderer = out_renderer;
+    out_initialization->start = get_time_nanoseconds();
+    return create_thread(renderer_initialization_main, out_initialization, &out_initialization->worker);
+}
+
+result finish_renderer_initialization(renderer_initialization* initialization, window* window) {
+    ASSERT(initialization != NULL, return RESULT_FAILURE, "Renderer initialization pointer is NULL");
+
+    uint64_t join_start = get_time_nanoseconds();
+    PROFILE_BEGIN("join_renderer_initialization");
+    destroy_thread(&initialization->worker);
+    PROFILE_END();
+    renderer* renderer = initialization->renderer;
+    renderer->init_timings.join_wait_nanoseconds = get_time_nanoseconds() - join_start;
+
+    if (initialization->background_result != RESULT_SUCCESS) {
+        return RESULT_FAILURE;
+    }
+    result initialized = initialize_presentation(renderer, window);
+    renderer->init_timings.total_nanoseconds = get_time_nanoseconds() - initialization->start;
+    return initialized;
+}
+
+result create_renderer(window* window, const renderer_config* config, renderer* out_renderer) {
+    ASSERT(out_renderer != NULL, return RESULT_FAILURE, "Renderer pointer is NULL");
+    memset(out_renderer, 0, sizeof(renderer));
+    apply_renderer_config(out_renderer, config);
+    uint64_t start = get_time_nanoseconds();
+    PROFILE_BEGIN("create_renderer");
+    result created = initialize_instance(out_renderer);
+    if (created == RESULT_SUCCESS) {
+        created = initialize_device(out_renderer, VK_NULL_HANDLE);
+    }
+    if (created == RESULT_SUCCESS) {
+        created = initialize_presentation(out_renderer, window);
+    }
+    PROFILE_END();
+    out_renderer->init_timings.total_nanoseconds = get_time_nanoseconds() - start;
+    return created;
+}
+
+void destroy_renderer(renderer* renderer) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+
+    // A failed initialization leaves a partial renderer, so every object is checked.
+    if (renderer->device != VK_NULL_HANDLE) {
+        vkDeviceWaitIdle(renderer->device);
+        release_retired_swapchains(renderer, true);
+        destroy_swapchain_images(renderer->device, renderer->swapchain_image_count, renderer->swapchain_image_views, renderer->framebuffers, renderer->render_finished);
+        if (renderer->config.headless) {
+            destroy_offscreen_images(renderer);
+            destroy_readback_slots(renderer);
+        }
+        else {
+            vkDestroySwapchainKHR(renderer->device, renderer->swapchain, NULL);
+        }
+        vkDestroyRenderPass(renderer->device, renderer->render_pass, NULL);
+        destroy_upload_manager(renderer);
+        destroy_gpu_allocator(renderer);
+        destroy_frame_resources(renderer);
+        destroy_pipeline_state_cache(renderer->device, &renderer->pipeline_states);
+    }
+    if (renderer->pipeline_cache != VK_NULL_HANDLE) {
+        save_pipeline_cache(renderer, &renderer->pipeline_cache_stats);
+        vkDestroyPipelineCache(renderer->device, renderer->pipeline_cache, NULL);
+    }
+    if (renderer->instance != VK_NULL_HANDLE) {
+        vkDestroySurfaceKHR(renderer->instance, renderer->window_surface, NULL);
+    }
+    vkDestroyDevice(renderer->device, NULL);
+    vkDestroyInstance(renderer->instance, NULL);
+}
+
+// Recreates the swapchain when needed and acquires the next image. Returns false when the frame
+// must be skipped.
+static bool acquire_swapchain_image(renderer* renderer, render_frame* frame) {
+    release_retired_swapchains(renderer, false);
+
+    const user_input* input = &renderer->window->input;
+    if (renderer->swapchain_dirty || renderer->swapchain == VK_NULL_HANDLE ||
+        input->width != renderer->swapchain_window_width || input->height != renderer->swapchain_window_height) {
+        if (!recreate_swapchain(renderer)) {
+            renderer->swapchain_dirty = true;
+            return false;
+        }
+    }
+
+    VkResult acquired = vkAcquireNextImageKHR(renderer->device, renderer->swapchain, UINT64_MAX, frame->image_available, VK_NULL_HANDLE, &renderer->image_index);
+    if (acquired == VK_ERROR_OUT_OF_DATE_KHR) {
+        renderer->swapchain_dirty = true;
+        return false;
+    }
+    if (acquired == VK_SUBOPTIMAL_KHR) {
+        // The image is acquired and its semaphore will signal, so this frame still goes out.
+        renderer->swapchain_dirty = true;
+    }
+    else if (acquired != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to acquire swapchain image.");
+        return false;
+    }
+    return true;
+}
+
+bool begin_frame(renderer* renderer, VkCommandBuffer* out_command_buffer) {
+    ASSERT(renderer != NULL, return false, "Renderer pointer is NULL");
+    ASSERT(out_command_buffer != NULL, return false, "Command buffer pointer is NULL");
+    render_frame* frame = &renderer->frames[renderer->frame_index];
+    renderer_frame_stats* stats = &renderer->frame_stats;
+
+    uint64_t wait_start = get_time_nanoseconds();
+    PROFILE_BEGIN("wait_for_frame_fence");
+    vkWaitForFences(renderer->device, 1, &frame->in_flight_fence, VK_TRUE, UINT64_MAX);
+    PROFILE_END();
+    stats->cpu_wait_nanoseconds = get_time_nanoseconds() - wait_start;
+    stats->total_cpu_wait_nanoseconds += stats->cpu_wait_nanoseconds;
+    if (stats->cpu_wait_nanoseconds > stats->max_cpu_wait_nanoseconds) {
+        stats->max_cpu_wait_nanoseconds = stats->cpu_wait_nanoseconds;
+    }
+    read_gpu_timestamps(renderer, frame);
+
+    if (renderer->config.headless) {
+        // Offscreen images are owned one per frame slot, so the fence already guards reuse.
+        renderer->image_index = renderer->frame_index;
+    }
+    else if (!acquire_swapchain_image(renderer, frame)) {
+        stats->skipped_frames++;
+        return false;
+    }
+
+    // Only reset once a submit is certain to follow, or the next wait on this slot would hang.
+    vkResetFences(renderer->device, 1, &frame->in_flight_fence);
+    vkResetCommandPool(renderer->device, frame->command_pool, 0);
+    for (uint32_t i = 0; i < renderer->config.recording_threads; ++i) {
+        thread_command_pool* pool = &frame->thread_pools[i];
+        if (pool->used_count > 0) {
+            vkResetCommandPool(renderer->device, pool->command_pool, 0);
+            pool->used_count = 0;
+        }
+    }
+    if (frame->compute_used_count > 0) {
+        // Compute submitted during this slot's last use may still run after its frame fence.
+        wait_for_compute(renderer, frame->compute_value);
+        vkResetCommandPool(renderer->device, frame->compute_pool, 0);
+        frame->compute_used_count = 0;
+    }
+
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    vkBeginCommandBuffer(frame->command_buffer, &begin_info);
+    if (renderer->timestamp_period > 0.0f) {
+        vkCmdResetQueryPool(frame->command_buffer, frame->timestamp_pool, 0, MAX_GPU_TIMESTAMPS);
+        frame->open_gpu_zones = 0;
+        frame->skipped_gpu_zones = 0;
+    }
+    open_gpu_zone(renderer, frame, frame->command_buffer, "frame");
+
+    VkClearValue clear_value = { .color = renderer->clear_color };
+    VkRenderPassBeginInfo pass_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+        .renderPass = renderer->render_pass,
+        .framebuffer = renderer->framebuffers[renderer->image_index],
+        .renderArea = { { 0, 0 }, renderer->swapchain_extent },
+        .clearValueCount = 1,
+        .pClearValues = &clear_value,
+    };
+    VkSubpassContents contents = renderer->config.recording_threads > 0 ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE;
+    vkCmdBeginRenderPass(frame->command_buffer, &pass_info, contents);
+
+    *out_command_buffer = frame->command_buffer;
+    return true;
+}
+
+void end_frame(renderer* renderer) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    render_frame* frame = &renderer->frames[renderer->frame_index];
+    renderer_frame_stats* stats = &renderer->frame_stats;
+
+    stats->secondary_command_buffers = 0;
+    for (uint32_t i = 0; i < renderer->config.recording_threads; ++i) {
+        stats->secondary_command_buffers += frame->thread_pools[i].used_count;
+    }
+
+    vkCmdEndRenderPass(frame->command_buffer);
+    if (renderer->requested_readback != UINT32_MAX) {
+        // The render pass left the image in TRANSFER_SRC and its outgoing dependency orders this copy.
+        VkBufferImageCopy region = {
+            .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+            .imageExtent = { renderer->swapchain_extent.width, renderer->swapchain_extent.height, 1 },
+        };
+        vkCmdCopyImageToBuffer(frame->command_buffer, renderer->swapchain_images[renderer->image_index], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                               renderer->readbacks[renderer->requested_readback].buffer, 1, &region);
+        // The fence only covers device-side completion; this makes the copied bytes visible
+        // to host reads of the mapped buffer once it signals.
+        VkMemoryBarrier host_barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        };
+        vkCmdPipelineBarrier(frame->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &host_barrier, 0, NULL, 0, NULL);
+        renderer->requested_readback = UINT32_MAX;
+    }
+    close_gpu_zone(renderer, frame, frame->command_buffer);
+    vkEndCommandBuffer(frame->command_buffer);
+
+    flush_uploads(renderer);
+
+    VkSemaphore wait_semaphores[3];
+    uint64_t wait_values[3];
+    VkPipelineStageFlags wait_stages[3];
+    uint32_t wait_count = 0;
+    if (!renderer->config.headless) {
+        wait_semaphores[wait_count] = frame->image_available;
+        wait_values[wait_count] = 0;
+        wait_stages[wait_count++] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    }
+    if (renderer->frame_upload_wait > renderer->uploads.completed) {
+        wait_semaphores[wait_count] = renderer->uploads.timeline;
+        wait_values[wait_count] = renderer->frame_upload_wait;
+        wait_stages[wait_count++] = UPLOAD_CONSUMER_STAGES;
+    }
+    if (renderer->frame_compute_wait > 0) {
+        wait_semaphores[wait_count] = renderer->compute_timeline;
+        wait_values[wait_count] = renderer->frame_compute_wait;
+        wait_stages[wait_count++] = COMPUTE_CONSUMER_STAGES;
+    }
+    renderer->frame_upload_wait = 0;
+    renderer->frame_compute_wait = 0;
+
+    // Binary semaphores ignore their value; graphics_timeline is always signalled so compute
+    // submitted in later frames can wait on this one.
+    VkSemaphore signal_semaphores[2];
+    uint64_t signal_values[2];
+    uint32_t signal_count = 0;
+    if (!renderer->config.headless) {
+        signal_semaphores[signal_count] = renderer->render_finished[renderer->image_index];
+        signal_values[signal_count++] = 0;
+    }
+    signal_semaphores[signal_count] = renderer->graphics_timeline;
+    signal_values[signal_count++] = stats->frame_number + 1;
+
+    VkTimelineSemaphoreSubmitInfo timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount = wait_count,
+        .pWaitSemaphoreValues = wait_values,
+        .signalSemaphoreValueCount = signal_count,
+        .pSignalSemaphoreValues = signal_values,
+    };
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timeline_info,
+        .waitSemaphoreCount = wait_count,
+        .pWaitSemaphores = wait_semaphores,
+        .pWaitDstStageMask = wait_stages,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &frame->command_buffer,
+        .signalSemaphoreCount = signal_count,
+        .pSignalSemaphores = signal_semaphores,
+    };
+    uint64_t submit_start = get_time_nanoseconds();
+    if (vkQueueSubmit(renderer->graphics_queue, 1, &submit_info, frame->in_flight_fence) != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to submit frame.");
+    }
+    stats->submit_nanoseconds = get_time_nanoseconds() - submit_start;
+    stats->total_submit_nanoseconds += stats->submit_nanoseconds;
+    frame->submitted_frame = stats->frame_number;
+
+    if (!renderer->config.headless) {
+        VkPresentInfoKHR present_info = {
+            .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+            .waitSemaphoreCount = 1,
+            .pWaitSemaphores = &renderer->render_finished[renderer->image_index],
+            .swapchainCount = 1,
+            .pSwapchains = &renderer->swapchain,
+            .pImageIndices = &renderer->image_index,
+        };
+        VkResult presented = vkQueuePresentKHR(renderer->graphics_queue, &present_info);
+        if (presented == VK_ERROR_OUT_OF_DATE_KHR || presented == VK_SUBOPTIMAL_KHR) {
+            renderer->swapchain_dirty = true;
+        }
+        else if (presented != VK_SUCCESS) {
+            ERROR_BREAKPOINT("Failed to present frame.");
+        }
+    }
+
+    renderer->frame_index = (renderer->frame_index + 1) % renderer->config.frames_in_flight;
+    stats->frame_number++;
+}
+
+bool request_frame_readback(renderer* renderer) {
+    ASSERT(renderer != NULL, return false, "Renderer pointer is NULL");
+    ASSERT(renderer->config.headless, return false, "Readback requires a headless renderer");
+    if (renderer->requested_readback != UINT32_MAX) {
+        return true;
+    }
+    for (uint32_t i = 0; i < MAX_FRAME_READBACKS; ++i) {
+        frame_readback_slot* slot = &renderer->readbacks[i];
+        if (slot->state == FRAME_READBACK_FREE) {
+            slot->state = FRAME_READBACK_PENDING;
+            slot->frame_number = renderer->frame_stats.frame_number;
+            slot->frame_index = renderer->frame_index;
+            renderer->requested_readback = i;
+            return true;
+        }
+    }
+    // Every slot is in flight or held by the caller; the frame is rendered without a copy.
+    return false;
+}
+
+// The slot's frame is done once its fence signals or the frame slot has since been reused,
+// which begin_frame only allows after waiting on that fence.
+static bool is_readback_complete(renderer* renderer, const frame_readback_slot* slot) {
+    const render_frame* frame = &renderer->frames[slot->frame_index];
+    if (frame->submitted_frame != slot->frame_number) {
+        return true;
+    }
+    return vkGetFenceStatus(renderer->device, frame->in_flight_fence) == VK_SUCCESS;
+}
+
+bool poll_frame_readback(renderer* renderer, frame_readback* out_readback) {
+    ASSERT(renderer != NULL, return false, "Renderer pointer is NULL");
+    ASSERT(out_readback != NULL, return false, "Readback pointer is NULL");
+
+    uint32_t oldest = UINT32_MAX;
+    for (uint32_t i = 0; i < MAX_FRAME_READBACKS; ++i) {
+        const frame_readback_slot* slot = &renderer->readbacks[i];
+        if (slot->state == FRAME_READBACK_PENDING && i != renderer->requested_readback &&
+            (oldest == UINT32_MAX || slot->frame_number < renderer->readbacks[oldest].frame_number)) {
+            oldest = i;
+        }
+    }
+    if (oldest == UINT32_MAX || !is_readback_complete(renderer, &renderer->readbacks[oldest])) {
+        return false;
+    }
+
+    frame_readback_slot* slot = &renderer->readbacks[oldest];
+    if (!slot->coherent) {
+        VkMappedMemoryRange range = {
+            .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+            .memory = slot->memory,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE,
+        };
+        vkInvalidateMappedMemoryRanges(renderer->device, 1, &range);
+    }
+    slot->state = FRAME_READBACK_READY;
+
+    *out_readback = (frame_readback){
+        .data = slot->mapped,
+        .width = renderer->swapchain_extent.width,
+        .height = renderer->swapchain_extent.height,
+        .row_pitch = renderer->swapchain_extent.width * 4,
+        .frame_number = slot->frame_number,
+        .slot = oldest,
+    };
+    return true;
+}
+
+void release_frame_readback(renderer* renderer, const frame_readback* readback) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    ASSERT(readback != NULL && readback->slot < MAX_FRAME_READBACKS, return, "Readback is invalid");
+    renderer->readbacks[readback->slot].state = FRAME_READBACK_FREE;
+}
+
+static upload_batch* current_upload_batch(upload_manager* uploads) {
+    return &uploads->batches[(uploads->first_batch + uploads->batches_in_flight) % MAX_UPLOAD_BATCHES];
+}
+
+// Reclaims the staging space of every batch the GPU has finished with.
+static void retire_upload_batches(renderer* renderer) {
+    upload_manager* uploads = &renderer->uploads;
+    if (uploads->batches_in_flight == 0) {
+        return;
+    }
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(renderer->device, uploads->timeline, &value);
+    if (value > uploads->completed) {
+        uploads->completed = value;
+    }
+
+    while (uploads->batches_in_flight > 0) {
+        upload_batch* batch = &uploads->batches[uploads->first_batch];
+        if (batch->ticket > uploads->completed) {
+            break;
+        }
+        uploads->tail = batch->staging_end;
+        uploads->stats.completed_bytes += batch->bytes;
+        uploads->first_batch = (uploads->first_batch + 1) % MAX_UPLOAD_BATCHES;
+        uploads->batches_in_flight--;
+    }
+
+    if (uploads->batches_in_flight == 0) {
+        upload_stats* stats = &uploads->stats;
+        stats->busy_nanoseconds += get_time_nanoseconds() - uploads->busy_start;
+        if (stats->busy_nanoseconds > 0) {
+            stats->megabytes_per_second = (double)stats->completed_bytes * 1000.0 / (double)stats->busy_nanoseconds;
+        }
+    }
+}
+
+static void wait_for_upload_value(renderer* renderer, upload_ticket ticket) {
+    VkSemaphoreWaitInfo wait_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &renderer->uploads.timeline,
+        .pValues = &ticket,
+    };
+    PROFILE_BEGIN("wait_for_upload");
+    vkWaitSemaphores(renderer->device, &wait_info, UINT64_MAX);
+    PROFILE_END();
+    retire_upload_batches(renderer);
+}
+
+// Reserves size bytes of staging space, waiting for in-flight batches when the ring is full.
+// Returns the offset into the staging buffer, or UINT64_MAX if size can never fit.
+static uint64_t allocate_staging(renderer* renderer, uint64_t size) {
+    upload_manager* uploads = &renderer->uploads;
+    if (size > uploads->capacity) {
+        ERROR_BREAKPOINT("Upload is larger than the staging ring.");
+        return UINT64_MAX;
+    }
+
+    uint64_t stall_start = 0;
+    for (;;) {
+        uint64_t start = (uploads->head + uploads->copy_alignment - 1) / uploads->copy_alignment * uploads->copy_alignment;
+        // An upload never wraps, since a copy reads one contiguous range.
+        if (start / uploads->capacity != (start + size - 1) / uploads->capacity) {
+            start = (start / uploads->capacity + 1) * uploads->capacity;
+        }
+        if (start + size - uploads->tail <= uploads->capacity) {
+            uploads->head = start + size;
+            if (stall_start != 0) {
+                uploads->stats.stall_nanoseconds += get_time_nanoseconds() - stall_start;
+            }
+            return start % uploads->capacity;
+        }
+
+        if (stall_start == 0) {
+            stall_start = get_time_nanoseconds();
+            uploads->stats.stalls++;
+        }
+        // Submitting happens before head moves, so the open batch never owns the new range.
+        if (uploads->recording && current_upload_batch(uploads)->upload_count > 0) {
+            flush_uploads(renderer);
+        }
+        if (uploads->batches_in_flight > 0) {
+            wait_for_upload_value(renderer, uploads->batches[uploads->first_batch].ticket);
+        }
+        else {
+            // Nothing reads the ring any more; restart it at a wrap boundary.
+            uploads->head = (uploads->head + uploads->capacity - 1) / uploads->capacity * uploads->capacity;
+            uploads->tail = uploads->head;
+        }
+    }
+}
+
+static upload_batch* begin_upload_batch(renderer* renderer) {
+    upload_manager* uploads = &renderer->uploads;
+    if (uploads->recording) {
+        return current_upload_batch(uploads);
+    }
+
+    retire_upload_batches(renderer);
+    if (uploads->batches_in_flight == MAX_UPLOAD_BATCHES) {
+        wait_for_upload_value(renderer, uploads->batches[uploads->first_batch].ticket);
+    }
+
+    upload_batch* batch = current_upload_batch(uploads);
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    vkResetCommandPool(renderer->device, batch->command_pool, 0);
+    vkBeginCommandBuffer(batch->command_buffer, &begin_info);
+    if (uploads->ownership_transfer) {
+        vkResetCommandPool(renderer->device, batch->acquire_pool, 0);
+        vkBeginCommandBuffer(batch->acquire_buffer, &begin_info);
+    }
+    // The transfer submit signals ticket - 1 and the acquire submit ticket when ownership moves.
+    batch->ticket = uploads->last_signaled + (uploads->ownership_transfer ? 2 : 1);
+    batch->bytes = 0;
+    batch->upload_count = 0;
+    uploads->recording = true;
+    return batch;
+}
+
+// Opens a batch with room for one more acquire barrier and staging space for size bytes.
+static upload_batch* reserve_upload(renderer* renderer, uint64_t size, uint64_t* out_staging_offset) {
+    upload_manager* uploads = &renderer->uploads;
+    if (uploads->buffer_acquires.count == MAX_UPLOAD_BARRIERS || uploads->image_acquires.count == MAX_UPLOAD_BARRIERS) {
+        flush_uploads(renderer);
+    }
+    *out_staging_offset = allocate_staging(renderer, size);
+    if (*out_staging_offset == UINT64_MAX) {
+        return NULL;
+    }
+    return begin_upload_batch(renderer);
+}
+
+static void record_upload(upload_manager* uploads, upload_batch* batch, uint64_t size) {
+    batch->bytes += size;
+    batch->upload_count++;
+    uploads->stats.uploads++;
+}
+
+result upload_buffer(renderer* renderer, VkBuffer dst, VkDeviceSize dst_offset, const void* data, VkDeviceSize size, upload_ticket* out_ticket) {
+    ASSERT(renderer != NULL, return RESULT_FAILURE, "Renderer pointer is NULL");
+    ASSERT(data != NULL || size == 0, return RESULT_FAILURE, "Upload data pointer is NULL");
+    ASSERT(out_ticket != NULL, return RESULT_FAILURE, "Upload ticket pointer is NULL");
+    upload_manager* uploads = &renderer->uploads;
+
+    // Quarter-ring chunks let a large upload stream: the GPU copies early chunks while the
+    // CPU fills later ones.
+    uint64_t chunk_limit = uploads->capacity / 4;
+    const uint8_t* source = data;
+    *out_ticket = 0;
+    for (VkDeviceSize done = 0; done < size;) {
+        VkDeviceSize chunk = size - done < chunk_limit ? size - done : chunk_limit;
+        uint64_t staging_offset;
+        upload_batch* batch = reserve_upload(renderer, chunk, &staging_offset);
+        if (batch == NULL) {
+            return RESULT_FAILURE;
+        }
+        memcpy(uploads->staging + staging_offset, source + done, chunk);
+
+        VkBufferCopy region = {
+            .srcOffset = staging_offset,
+            .dstOffset = dst_offset + done,
+            .size = chunk,
+        };
+        vkCmdCopyBuffer(batch->command_buffer, uploads->staging_buffer, dst, 1, &region);
+        if (uploads->ownership_transfer) {
+            VkBufferMemoryBarrier release = {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = 0,
+                .srcQueueFamilyIndex = renderer->transfer_queue_family_index,
+                .dstQueueFamilyIndex = renderer->graphics_queue_family_index,
+                .buffer = dst,
+                .offset = dst_offset + done,
+                .size = chunk,
+            };
+            vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 1, &release, 0, NULL);
+            release.srcAccessMask = 0;
+            upload_buffer_barriers_append(&uploads->buffer_acquires, release);
+        }
+        record_upload(uploads, batch, chunk);
+        *out_ticket = batch->ticket;
+        done += chunk;
+    }
+    return RESULT_SUCCESS;
+}
+
+result upload_image(renderer* renderer, VkImage dst, VkExtent3D extent, const void* data, VkDeviceSize size, VkImageLayout final_layout, upload_ticket* out_ticket) {
+    ASSERT(renderer != NULL, return RESULT_FAILURE, "Renderer pointer is NULL");
+    ASSERT(data != NULL, return RESULT_FAILURE, "Upload data pointer is NULL");
+    ASSERT(out_ticket != NULL, return RESULT_FAILURE, "Upload ticket pointer is NULL");
+    upload_manager* uploads = &renderer->uploads;
+
+    uint64_t staging_offset;
+    upload_batch* batch = reserve_upload(renderer, size, &staging_offset);
+    if (batch == NULL) {
+        return RESULT_FAILURE;
+    }
+    memcpy(uploads->staging + staging_offset, data, size);
+
+    VkImageMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = 0,
+        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = dst,
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+    };
+    vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+
+    VkBufferImageCopy region = {
+        .bufferOffset = staging_offset,
+        .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+        .imageExtent = extent,
+    };
+    vkCmdCopyBufferToImage(batch->command_buffer, uploads->staging_buffer, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    // The final layout transition doubles as the release when ownership moves. The timeline
+    // semaphore makes the write visible to the frames that wait on it.
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = final_layout;
+    if (uploads->ownership_transfer) {
+        barrier.srcQueueFamilyIndex = renderer->transfer_queue_family_index;
+        barrier.dstQueueFamilyIndex = renderer->graphics_queue_family_index;
+    }
+    vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+    if (uploads->ownership_transfer) {
+        barrier.srcAccessMask = 0;
+        upload_image_barriers_append(&uploads->image_acquires, barrier);
+    }
+
+    record_upload(uploads, batch, size);
+    *out_ticket = batch->ticket;
+    return RESULT_SUCCESS;
+}
+
+void flush_uploads(renderer* renderer) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    upload_manager* uploads = &renderer->uploads;
+    retire_upload_batches(renderer);
+    if (!uploads->recording || current_upload_batch(uploads)->upload_count == 0) {
+        return;
+    }
+
+    PROFILE_BEGIN("flush_uploads");
+    upload_batch* batch = current_upload_batch(uploads);
+    vkEndCommandBuffer(batch->command_buffer);
+    if (!uploads->coherent) {
+        VkMappedMemoryRange range = {
+            .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+            .memory = uploads->staging_memory,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE,
+        };
+        vkFlushMappedMemoryRanges(renderer->device, 1, &range);
+    }
+
+    uint64_t transfer_value = uploads->ownership_transfer ? batch->ticket - 1 : batch->ticket;
+    VkTimelineSemaphoreSubmitInfo timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &transfer_value,
+    };
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timeline_info,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &batch->command_buffer,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &uploads->timeline,
+    };
+    if (vkQueueSubmit(renderer->transfer_queue, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to submit uploads.");
+    }
+
+    if (uploads->ownership_transfer) {
+        vkCmdPipelineBarrier(batch->acquire_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL,
+                             uploads->buffer_acquires.count, uploads->buffer_acquires.data, uploads->image_acquires.count, uploads->image_acquires.data);
+        vkEndCommandBuffer(batch->acquire_buffer);
+        uploads->buffer_acquires.count = 0;
+        uploads->image_acquires.count = 0;
+
+        VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        VkTimelineSemaphoreSubmitInfo acquire_timeline_info = {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount = 1,
+            .pWaitSemaphoreValues = &transfer_value,
+            .signalSemaphoreValueCount = 1,
+            .pSignalSemaphoreValues = &batch->ticket,
+        };
+        VkSubmitInfo acquire_info = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = &acquire_timeline_info,
+            .waitSemaphoreCount = 1,
+            .pWaitSemaphores = &uploads->timeline,
+            .pWaitDstStageMask = &wait_stage,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &batch->acquire_buffer,
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores = &uploads->timeline,
+        };
+        if (vkQueueSubmit(renderer->graphics_queue, 1, &acquire_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+            ERROR_BREAKPOINT("Failed to submit upload ownership acquire.");
+        }
+    }
+    PROFILE_END();
+
+    uploads->last_signaled = batch->ticket;
+    batch->staging_end = uploads->head;
+    uploads->stats.submits++;
+    uploads->stats.submitted_bytes += batch->bytes;
+    if (uploads->batches_in_flight == 0) {
+        uploads->busy_start = get_time_nanoseconds();
+    }
+    uploads->batches_in_flight++;
+    uploads->recording = false;
+}
+
+bool is_upload_complete(renderer* renderer, upload_ticket ticket) {
+    ASSERT(renderer != NULL, return false, "Renderer pointer is NULL");
+    if (ticket <= renderer->uploads.completed) {
+        return true;
+    }
+    if (ticket > renderer->uploads.last_signaled) {
+        return false;
+    }
+    retire_upload_batches(renderer);
+    return ticket <= renderer->uploads.completed;
+}
+
+void wait_for_upload(renderer* renderer, upload_ticket ticket) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    if (ticket <= renderer->uploads.completed) {
+        return;
+    }
+    if (ticket > renderer->uploads.last_signaled) {
+        flush_uploads(renderer);
+    }
+    wait_for_upload_value(renderer, ticket);
+}
+
+void frame_depends_on_upload(renderer* renderer, upload_ticket ticket) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    if (ticket > renderer->frame_upload_wait) {
+        renderer->frame_upload_wait = ticket;
+    }
+}
+
+result allocate_gpu_memory(renderer* renderer, const VkMemoryRequirements* requirements, gpu_memory_usage usage, gpu_resource_kind kind, bool dedicated, gpu_allocation_handle* out_allocation) {
+    ASSERT(renderer != NULL, return RESULT_FAILURE, "Renderer pointer is NULL");
+    ASSERT(requirements != NULL, return RESULT_FAILURE, "Memory requirements pointer is NULL");
+    ASSERT(out_allocation != NULL, return RESULT_FAILURE, "Allocation handle pointer is NULL");
+    return allocate_gpu_memory_for(renderer, requirements, usage, kind, dedicated, NULL, out_allocation);
+}
+
+void free_gpu_memory(renderer* renderer, gpu_allocation_handle allocation) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    gpu_allocator* allocator = &renderer->memory;
+    gpu_allocation* record = gpu_allocation_pool_get(allocator->allocations, allocation);
+    if (record == NULL) {
+        ERROR_BREAKPOINT("Stale or invalid GPU allocation handle.");
+        return;
+    }
+
+    if (record->block == GPU_DEDICATED_BLOCK) {
+        free_device_memory(renderer, record->memory, record->memory_type, record->size);
+    }
+    else {
+        gpu_memory_block* block = &allocator->blocks[record->block];
+        buddy_free(block, record->offset, record->order);
+        // One empty block per memory type stays around so alloc/free cycles don't churn vkAllocateMemory.
+        if (block->allocation_count == 0 && has_other_block(allocator, record->block)) {
+            release_gpu_memory_block(renderer, record->block);
+        }
+    }
+    gpu_allocation_pool_free(allocator->allocations, allocation);
+}
+
+const gpu_allocation* get_gpu_allocation(renderer* renderer, gpu_allocation_handle allocation) {
+    ASSERT(renderer != NULL, return NULL, "Renderer pointer is NULL");
+    return gpu_allocation_pool_get(renderer->memory.allocations, allocation);
+}
+
+result create_gpu_buffer(renderer* renderer, const VkBufferCreateInfo* create_info, gpu_memory_usage usage, VkBuffer* out_buffer, gpu_allocation_handle* out_allocation) {
+    ASSERT(renderer != NULL, return RESULT_FAILURE, "Renderer pointer is NULL");
+    ASSERT(create_info != NULL, return RESULT_FAILURE, "Buffer create info pointer is NULL");
+    ASSERT(out_buffer != NULL && out_allocation != NULL, return RESULT_FAILURE, "Output pointer is NULL");
+
+    VkBuffer buffer = VK_NULL_HANDLE;
+    if (vkCreateBuffer(renderer->device, create_info, NULL, &buffer) != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to create buffer.");
+        return RESULT_FAILURE;
+    }
+
+    VkMemoryDedicatedRequirements dedicated_requirements = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS,
+    };
+    VkMemoryRequirements2 requirements = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+        .pNext = &dedicated_requirements,
+    };
+    VkBufferMemoryRequirementsInfo2 requirements_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2,
+        .buffer = buffer,
+    };
+    vkGetBufferMemoryRequirements2(renderer->device, &requirements_info, &requirements);
+
+    VkMemoryDedicatedAllocateInfo dedicated_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+        .buffer = buffer,
+    };
+    bool dedicated = dedicated_requirements.prefersDedicatedAllocation || dedicated_requirements.requiresDedicatedAllocation;
+    if (allocate_gpu_memory_for(renderer, &requirements.memoryRequirements, usage, GPU_RESOURCE_LINEAR, dedicated, &dedicated_info, out_allocation) != RESULT_SUCCESS) {
+        vkDestroyBuffer(renderer->device, buffer, NULL);
+        return RESULT_FAILURE;
+    }
+
+    const gpu_allocation* allocation = get_gpu_allocation(renderer, *out_allocation);
+    if (vkBindBufferMemory(renderer->device, buffer, allocation->memory, allocation->offset) != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to bind buffer memory.");
+        free_gpu_memory(renderer, *out_allocation);
+        vkDestroyBuffer(renderer->device, buffer, NULL);
+        return RESULT_FAILURE;
+    }
+    *out_buffer = buffer;
+    return RESULT_SUCCESS;
+}
+
+result create_gpu_image(renderer* renderer, const VkImageCreateInfo* create_info, gpu_memory_usage usage, VkImage* out_image, gpu_allocation_handle* out_allocation) {
+    ASSERT(renderer != NULL, return RESULT_FAILURE, "Renderer pointer is NULL");
+    ASSERT(create_info != NULL, return RESULT_FAILURE, "Image create info pointer is NULL");
+    ASSERT(out_image != NULL && out_allocation != NULL, return RESULT_FAILURE, "Output pointer is NULL");
+
+    VkImage image = VK_NULL_HANDLE;
+    if (vkCreateImage(renderer->device, create_info, NULL, &image) != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to create image.");
+        return RESULT_FAILURE;
+    }
+
+    VkMemoryDedicatedRequirements dedicated_requirements = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS,
+    };
+    VkMemoryRequirements2 requirements = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+        .pNext = &dedicated_requirements,
+    };
+    VkImageMemoryRequirementsInfo2 requirements_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2,
+        .image = image,
+    };
+    vkGetImageMemoryRequirements2(renderer->device, &requirements_info, &requirements);
+
+    VkMemoryDedicatedAllocateInfo dedicated_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+        .image = image,
+    };
+    bool dedicated = dedicated_requirements.prefersDedicatedAllocation || dedicated_requirements.requiresDedicatedAllocation;
+    gpu_resource_kind kind = create_info->tiling == VK_IMAGE_TILING_LINEAR ? GPU_RESOURCE_LINEAR : GPU_RESOURCE_OPTIMAL;
+    if (allocate_gpu_memory_for(renderer, &requirements.memoryRequirements, usage, kind, dedicated, &dedicated_info, out_allocation) != RESULT_SUCCESS) {
+        vkDestroyImage(renderer->device, image, NULL);
+        return RESULT_FAILURE;
+    }
+
+    const gpu_allocation* allocation = get_gpu_allocation(renderer, *out_allocation);
+    if (vkBindImageMemory(renderer->device, image, allocation->memory, allocation->offset) != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to bind image memory.");
+        free_gpu_memory(renderer, *out_allocation);
+        vkDestroyImage(renderer->device, image, NULL);
+        return RESULT_FAILURE;
+    }
+    *out_image = image;
+    return RESULT_SUCCESS;
+}
+
+void destroy_gpu_buffer(renderer* renderer, VkBuffer buffer, gpu_allocation_handle allocation) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    vkDestroyBuffer(renderer->device, buffer, NULL);
+    free_gpu_memory(renderer, allocation);
+}
+
+void destroy_gpu_image(renderer* renderer, VkImage image, gpu_allocation_handle allocation) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    vkDestroyImage(renderer->device, image, NULL);
+    free_gpu_memory(renderer, allocation);
+}
+
+void get_gpu_memory_stats(renderer* renderer, gpu_memory_stats* out_stats) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    ASSERT(out_stats != NULL, return, "Stats pointer is NULL");
+    const gpu_allocator* allocator = &renderer->memory;
+    *out_stats = (gpu_memory_stats){ .heap_count = allocator->memory_properties.memoryHeapCount };
+
+    uint64_t largest_free_bytes = 0;
+    for (uint32_t i = 0; i < allocator->block_slots; ++i) {
+        const gpu_memory_block* block = &allocator->blocks[i];
+        if (block->memory == VK_NULL_HANDLE) {
+            continue;
+        }
+        out_stats->block_count++;
+        out_stats->allocated_bytes += GPU_MEMORY_BLOCK_SIZE;
+        out_stats->free_bytes += GPU_MEMORY_BLOCK_SIZE - block->used_bytes;
+        largest_free_bytes += largest_free_range(block);
+    }
+    for (uint32_t i = 0; i < allocator->allocations->count; ++i) {
+        const gpu_allocation* allocation = &allocator->allocations->data[i];
+        out_stats->used_bytes += allocation->size;
+        if (allocation->block == GPU_DEDICATED_BLOCK) {
+            out_stats->dedicated_count++;
+            out_stats->allocated_bytes += allocation->size;
+        }
+    }
+    out_stats->allocation_count = allocator->allocations->count;
+    // Per block, since a range can never span two blocks.
+    out_stats->fragmentation = out_stats->free_bytes > 0 ? 1.0f - (float)((double)largest_free_bytes / (double)out_stats->free_bytes) : 0.0f;
+
+    memcpy(out_stats->heap_allocated_bytes, allocator->heap_allocated_bytes, sizeof(out_stats->heap_allocated_bytes));
+    get_heap_budgets(renderer, out_stats->heap_usage_bytes, out_stats->heap_budget_bytes);
+}
+
+uint32_t begin_gpu_defragmentation(renderer* renderer, gpu_defragmentation_move* out_moves, uint32_t max_moves) {
+    ASSERT(renderer != NULL, return 0, "Renderer pointer is NULL");
+    ASSERT(out_moves != NULL || max_moves == 0, return 0, "Moves pointer is NULL");
+    gpu_allocator* allocator = &renderer->memory;
+
+    uint32_t move_count = 0;
+    for (uint32_t source = 0; source < allocator->block_slots && move_count < max_moves; ++source) {
+        gpu_memory_block* source_block = &allocator->blocks[source];
+        if (source_block->memory == VK_NULL_HANDLE || source_block->allocation_count == 0) {
+            continue;
+        }
+
+        // Only the emptiest block of each memory type and kind is drained; the others, fullest
+        // first, take its allocations.
+        uint32_t targets[MAX_GPU_MEMORY_BLOCKS];
+        uint32_t target_count = 0;
+        bool emptiest = true;
+        for (uint32_t i = 0; i < allocator->block_slots && emptiest; ++i) {
+            const gpu_memory_block* block = &allocator->blocks[i];
+            if (i == source || block->memory == VK_NULL_HANDLE || block->memory_type != source_block->memory_type || block->kind != source_block->kind) {
+                continue;
+            }
+            emptiest = block->used_bytes > source_block->used_bytes || (block->used_bytes == source_block->used_bytes && i > source);
+            uint32_t at = target_count++;
+            while (at > 0 && allocator->blocks[targets[at - 1]].used_bytes < block->used_bytes) {
+                targets[at] = targets[at - 1];
+                --at;
+            }
+            targets[at] = i;
+        }
+        if (!emptiest || target_count == 0) {
+            continue;
+        }
+
+        for (uint32_t i = 0; i < allocator->allocations->count && move_count < max_moves; ++i) {
+            const gpu_allocation* allocation = &allocator->allocations->data[i];
+            if (allocation->block != source) {
+                continue;
+            }
+            for (uint32_t t = 0; t < target_count; ++t) {
+                gpu_memory_block* target_block = &allocator->blocks[targets[t]];
+                uint64_t offset = buddy_allocate(target_block, allocation->order);
+                if (offset == UINT64_MAX) {
+                    continue;
+                }
+                out_moves[move_count++] = (gpu_defragmentation_move){
+                    .allocation = gpu_allocation_pool_handle_at(allocator->allocations, i),
+                    .src_memory = allocation->memory,
+                    .src_offset = allocation->offset,
+                    .dst_memory = target_block->memory,
+                    .dst_offset = offset,
+                    .size = allocation->size,
+                    .order = allocation->order,
+                    .src_block = source,
+                    .dst_block = targets[t],
+                };
+                break;
+            }
+        }
+    }
+    return move_count;
+}
+
+void end_gpu_defragmentation(renderer* renderer, const gpu_defragmentation_move* moves, uint32_t move_count) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    ASSERT(moves != NULL || move_count == 0, return, "Moves pointer is NULL");
+    gpu_allocator* allocator = &renderer->memory;
+
+    for (uint32_t i = 0; i < move_count; ++i) {
+        const gpu_defragmentation_move* move = &moves[i];
+        gpu_allocation* allocation = gpu_allocation_pool_get(allocator->allocations, move->allocation);
+        gpu_memory_block* source_block = &allocator->blocks[move->src_block];
+        gpu_memory_block* target_block = &allocator->blocks[move->dst_block];
+        if (allocation == NULL) {
+            // free_gpu_memory already returned the source range; only the reservation is left.
+            buddy_free(target_block, move->dst_offset, move->order);
+            if (target_block->allocation_count == 0 && has_other_block(allocator, move->dst_block)) {
+                release_gpu_memory_block(renderer, move->dst_block);
+            }
+            continue;
+        }
+        buddy_free(source_block, move->src_offset, allocation->order);
+        allocation->memory = move->dst_memory;
+        allocation->offset = move->dst_offset;
+        allocation->block = move->dst_block;
+        allocation->mapped = target_block->mapped != NULL ? target_block->mapped + move->dst_offset : NULL;
+        if (source_block->allocation_count == 0 && source_block->memory != VK_NULL_HANDLE) {
+            release_gpu_memory_block(renderer, move->src_block);
+        }
+    }
+}
+
+VkCommandBuffer begin_secondary_command_buffer(renderer* renderer) {
+    ASSERT(renderer != NULL, return VK_NULL_HANDLE, "Renderer pointer is NULL");
+    uint32_t worker = get_job_worker_index();
+    // Pools are per worker and unsynchronised; a foreign thread would share worker 0's.
+    ASSERT(worker != UINT32_MAX, return VK_NULL_HANDLE, "Secondary command buffers must be recorded on a job worker");
+    ASSERT(worker < renderer->config.recording_threads, return VK_NULL_HANDLE, "Job worker has no recording command pool");
+
+    thread_command_pool* pool = &renderer->frames[renderer->frame_index].thread_pools[worker];
+    if (pool->used_count == pool->allocated_count) {
+        if (pool->allocated_count == MAX_SECONDARY_COMMAND_BUFFERS) {
+            ERROR_BREAKPOINT("Thread used up its secondary command buffers.");
+            return VK_NULL_HANDLE;
+        }
+        VkCommandBufferAllocateInfo allocate_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = pool->command_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+            .commandBufferCount = 1,
+        };
+        if (vkAllocateCommandBuffers(renderer->device, &allocate_info, &pool->secondary_buffers[pool->allocated_count]) != VK_SUCCESS) {
+            ERROR_BREAKPOINT("Failed to allocate secondary command buffer.");
+            return VK_NULL_HANDLE;
+        }
+        pool->allocated_count++;
+    }
+
+    VkCommandBuffer command_buffer = pool->secondary_buffers[pool->used_count++];
+    VkCommandBufferInheritanceInfo inheritance_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .renderPass = renderer->render_pass,
+        .subpass = 0,
+        .framebuffer = renderer->framebuffers[renderer->image_index],
+    };
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inheritance_info,
+    };
+    vkBeginCommandBuffer(command_buffer, &begin_info);
+    return command_buffer;
+}
+
+void end_secondary_command_buffer(renderer* renderer, VkCommandBuffer command_buffer) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    ASSERT(command_buffer != VK_NULL_HANDLE, return, "Command buffer is NULL");
+    vkEndCommandBuffer(command_buffer);
+}
+
+void execute_secondary_command_buffers(renderer* renderer, const VkCommandBuffer* command_buffers, uint32_t count) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    ASSERT(command_buffers != NULL || count == 0, return, "Command buffers pointer is NULL");
+    if (count > 0) {
+        vkCmdExecuteCommands(renderer->frames[renderer->frame_index].command_buffer, count, command_buffers);
+    }
+}
+
+VkCommandBuffer begin_compute(renderer* renderer) {
+    ASSERT(renderer != NULL, return VK_NULL_HANDLE, "Renderer pointer is NULL");
+    render_frame* frame = &renderer->frames[renderer->frame_index];
+    if (frame->compute_used_count == frame->compute_allocated_count) {
+        if (frame->compute_allocated_count == MAX_COMPUTE_SUBMITS_PER_FRAME) {
+            ERROR_BREAKPOINT("Frame used up its compute command buffers.");
+            return VK_NULL_HANDLE;
+        }
+        VkCommandBufferAllocateInfo allocate_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = frame->compute_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+        if (vkAllocateCommandBuffers(renderer->device, &allocate_info, &frame->compute_buffers[frame->compute_allocated_count]) != VK_SUCCESS) {
+            ERROR_BREAKPOINT("Failed to allocate compute command buffer.");
+            return VK_NULL_HANDLE;
+        }
+        frame->compute_allocated_count++;
+    }
+
+    VkCommandBuffer command_buffer = frame->compute_buffers[frame->compute_used_count++];
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    vkBeginCommandBuffer(command_buffer, &begin_info);
+    return command_buffer;
+}
+
+void dispatch_compute(VkCommandBuffer command_buffer, VkPipeline pipeline, VkPipelineLayout layout, VkDescriptorSet descriptor_set,
+                      const void* push_constants, uint32_t push_constant_size, uint32_t group_count_x, uint32_t group_count_y, uint32_t group_count_z) {
+    ASSERT(command_buffer != VK_NULL_HANDLE, return, "Command buffer is NULL");
+    ASSERT(pipeline != VK_NULL_HANDLE, return, "Compute pipeline is NULL");
+    ASSERT(push_constants != NULL || push_constant_size == 0, return, "Push constants pointer is NULL");
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    if (descriptor_set != VK_NULL_HANDLE) {
+        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1, &descriptor_set, 0, NULL);
+    }
+    if (push_constant_size > 0) {
+        vkCmdPushConstants(command_buffer, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, push_constant_size, push_constants);
+    }
+    vkCmdDispatch(command_buffer, group_count_x, group_count_y, group_count_z);
+}
+
+compute_ticket submit_compute(renderer* renderer, VkCommandBuffer command_buffer, bool after_previous_frame) {
+    ASSERT(renderer != NULL, return 0, "Renderer pointer is NULL");
+    ASSERT(command_buffer != VK_NULL_HANDLE, return 0, "Command buffer is NULL");
+    vkEndCommandBuffer(command_buffer);
+
+    compute_ticket ticket = renderer->last_compute_ticket + 1;
+    uint64_t previous_frame = renderer->frame_stats.frame_number;
+    bool waits_on_frame = after_previous_frame && previous_frame > 0;
+    // The previous frame's results feed compute shaders as well as transfers and indirect
+    // dispatch arguments, which are all valid stages on a compute-only queue.
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+    VkTimelineSemaphoreSubmitInfo timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount = waits_on_frame ? 1 : 0,
+        .pWaitSemaphoreValues = &previous_frame,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &ticket,
+    };
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timeline_info,
+        .waitSemaphoreCount = waits_on_frame ? 1 : 0,
+        .pWaitSemaphores = &renderer->graphics_timeline,
+        .pWaitDstStageMask = &wait_stage,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &command_buffer,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &renderer->compute_timeline,
+    };
+    if (vkQueueSubmit(renderer->compute_queue, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+        ERROR_BREAKPOINT("Failed to submit compute work.");
+        return 0;
+    }
+    renderer->last_compute_ticket = ticket;
+    renderer->frames[renderer->frame_index].compute_value = ticket;
+    return ticket;
+}
+
+bool is_compute_complete(renderer* renderer, compute_ticket ticket) {
+    ASSERT(renderer != NULL, return false, "Renderer pointer is NULL");
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(renderer->device, renderer->compute_timeline, &value);
+    return value >= ticket;
+}
+
+void wait_for_compute(renderer* renderer, compute_ticket ticket) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    if (ticket == 0) {
+        return;
+    }
+    VkSemaphoreWaitInfo wait_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &renderer->compute_timeline,
+        .pValues = &ticket,
+    };
+    PROFILE_BEGIN("wait_for_compute");
+    vkWaitSemaphores(renderer->device, &wait_info, UINT64_MAX);
+    PROFILE_END();
+}
+
+void frame_depends_on_compute(renderer* renderer, compute_ticket ticket) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    if (ticket > renderer->frame_compute_wait) {
+        renderer->frame_compute_wait = ticket;
+    }
+}
+
+result create_draw_list(renderer* renderer, uint32_t capacity, uint32_t instance_stride, draw_list* out_list) {
+    ASSERT(renderer != NULL, return RESULT_FAILURE, "Renderer pointer is NULL");
+    ASSERT(out_list != NULL, return RESULT_FAILURE, "Draw list pointer is NULL");
+    ASSERT(capacity > 0 && instance_stride > 0, return RESULT_FAILURE, "Draw list capacity and instance stride must be non-zero");
+    memset(out_list, 0, sizeof(draw_list));
+    out_list->capacity = capacity;
+    out_list->instance_stride = instance_stride;
+
+    size_t item_bytes = 2 * (sizeof(uint64_t) + sizeof(uint32_t)) + instance_stride;
+    if (create_arena_allocator((size_t)capacity * item_bytes + 4 * alignof(uint64_t), 0, &out_list->arena) != RESULT_SUCCESS) {
+        return RESULT_FAILURE;
+    }
+    out_list->keys = ARENA_ALLOCATE_ARRAY(&out_list->arena, uint64_t, capacity);
+    out_list->scratch_keys = ARENA_ALLOCATE_ARRAY(&out_list->arena, uint64_t, capacity);
+    out_list->items = ARENA_ALLOCATE_ARRAY(&out_list->arena, uint32_t, capacity);
+    out_list->scratch_items = ARENA_ALLOCATE_ARRAY(&out_list->arena, uint32_t, capacity);
+    out_list->instance_data = ARENA_ALLOCATE_ARRAY(&out_list->arena, uint8_t, (size_t)capacity * instance_stride);
+    if (out_list->keys == NULL || out_list->scratch_keys == NULL || out_list->items == NULL || out_list->scratch_items == NULL || out_list->instance_data == NULL) {
+        ERROR_BREAKPOINT("Failed to allocate draw list storage.");
+        return RESULT_FAILURE;
+    }
+
+    VkBufferCreateInfo instance_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = (VkDeviceSize)capacity * instance_stride,
+        .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VkBufferCreateInfo indirect_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = (VkDeviceSize)capacity * sizeof(VkDrawIndexedIndirectCommand),
+        .usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    for (uint32_t i = 0; i < renderer->config.frames_in_flight; ++i) {
+        if (create_gpu_buffer(renderer, &instance_info, GPU_MEMORY_UPLOAD, &out_list->instance_buffers[i], &out_list->instance_allocations[i]) != RESULT_SUCCESS ||
+            create_gpu_buffer(renderer, &indirect_info, GPU_MEMORY_UPLOAD, &out_list->indirect_buffers[i], &out_list->indirect_allocations[i]) != RESULT_SUCCESS) {
+            return RESULT_FAILURE;
+        }
+    }
+    return RESULT_SUCCESS;
+}
+
+void destroy_draw_list(renderer* renderer, draw_list* list) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    ASSERT(list != NULL, return, "Draw list pointer is NULL");
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+        if (list->instance_buffers[i] != VK_NULL_HANDLE) {
+            destroy_gpu_buffer(renderer, list->instance_buffers[i], list->instance_allocations[i]);
+        }
+        if (list->indirect_buffers[i] != VK_NULL_HANDLE) {
+            destroy_gpu_buffer(renderer, list->indirect_buffers[i], list->indirect_allocations[i]);
+        }
+    }
+    if (list->arena.base != NULL) {
+        destroy_arena_allocator(&list->arena);
+    }
+    memset(list, 0, sizeof(draw_list));
+}
+
+void reset_draw_list(draw_list* list) {
+    ASSERT(list != NULL, return, "Draw list pointer is NULL");
+    list->count = 0;
+}
+
+bool add_draw(draw_list* list, uint64_t key, const void* instance_data) {
+    ASSERT(list != NULL, return false, "Draw list pointer is NULL");
+    ASSERT(instance_data != NULL, return false, "Instance data pointer is NULL");
+    if (list->count == list->capacity) {
+        return false;
+    }
+    uint32_t index = list->count++;
+    list->keys[index] = key;
+    list->items[index] = index;
+    memcpy(list->instance_data + (size_t)index * list->instance_stride, instance_data, list->instance_stride);
+    return true;
+}
+
+// LSD radix sort of keys, carrying items along, one byte per pass. Passes where every key
+// has the same byte are skipped, so lists that use few key bits sort in few passes.
+static void radix_sort_draw_keys(draw_list* list) {
+    uint32_t count = list->count;
+    uint32_t histograms[8][256] = { 0 };
+    for (uint32_t i = 0; i < count; ++i) {
+        uint64_t key = list->keys[i];
+        for (uint32_t pass = 0; pass < 8; ++pass) {
+            histograms[pass][(key >> (pass * 8)) & 0xFF]++;
+        }
+    }
+
+    uint64_t* keys = list->keys;
+    uint32_t* items = list->items;
+    uint64_t* scratch_keys = list->scratch_keys;
+    uint32_t* scratch_items = list->scratch_items;
+    for (uint32_t pass = 0; pass < 8; ++pass) {
+        uint32_t* histogram = histograms[pass];
+        if (histogram[(keys[0] >> (pass * 8)) & 0xFF] == count) {
+            continue;
+        }
+        uint32_t offset = 0;
+        for (uint32_t digit = 0; digit < 256; ++digit) {
+            uint32_t digit_count = histogram[digit];
+            histogram[digit] = offset;
+            offset += digit_count;
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t destination = histogram[(keys[i] >> (pass * 8)) & 0xFF]++;
+            scratch_keys[destination] = keys[i];
+            scratch_items[destination] = items[i];
+        }
+        uint64_t* swap_keys = keys;
+        keys = scratch_keys;
+        scratch_keys = swap_keys;
+        uint32_t* swap_items = items;
+        items = scratch_items;
+        scratch_items = swap_items;
+    }
+
+    // The arrays swap roles rather than copying back.
+    list->keys = keys;
+    list->items = items;
+    list->scratch_keys = scratch_keys;
+    list->scratch_items = scratch_items;
+}
+
+#define DRAW_KEY_MESH_SHIFT DRAW_KEY_ORDER_BITS
+#define DRAW_KEY_MATERIAL_SHIFT (DRAW_KEY_MESH_SHIFT + DRAW_KEY_MESH_BITS)
+#define DRAW_KEY_PIPELINE_SHIFT (DRAW_KEY_MATERIAL_SHIFT + DRAW_KEY_MATERIAL_BITS)
+
+static uint32_t draw_key_field(uint64_t key, uint32_t shift, uint32_t bits) {
+    return (uint32_t)(key >> shift) & ((1u << bits) - 1);
+}
+
+// Records commands[first, end) as multi-draws of at most max_draw_indirect_count commands,
+// one indirect draw per command without multiDrawIndirect, or a direct draw when there is only one.
+static void record_draw_group(renderer* renderer, VkCommandBuffer command_buffer, VkBuffer indirect_buffer, const VkDrawIndexedIndirectCommand* commands, uint32_t first, uint32_t end, draw_list_stats* stats) {
+    uint32_t group_size = end - first;
+    if (group_size == 1) {
+        const VkDrawIndexedIndirectCommand* command = &commands[first];
+        vkCmdDrawIndexed(command_buffer, command->indexCount, command->instanceCount, command->firstIndex, command->vertexOffset, command->firstInstance);
+        stats->draw_calls++;
+        return;
+    }
+    for (uint32_t i = first; i < end;) {
+        uint32_t draw_count = end - i < renderer->max_draw_indirect_count ? end - i : renderer->max_draw_indirect_count;
+        vkCmdDrawIndexedIndirect(command_buffer, indirect_buffer, i * sizeof(VkDrawIndexedIndirectCommand), draw_count, sizeof(VkDrawIndexedIndirectCommand));
+        stats->indirect_draw_calls++;
+        i += draw_count;
+    }
+}
+
+static void flush_mapped_allocation(renderer* renderer, const gpu_allocation* allocation) {
+    if (renderer->memory.memory_properties.memoryTypes[allocation->memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+        return;
+    }
+    VkMappedMemoryRange range = {
+        .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+        .memory = allocation->memory,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE,
+    };
+    vkFlushMappedMemoryRanges(renderer->device, 1, &range);
+}
+
+void record_draw_list(renderer* renderer, draw_list* list, const draw_tables* tables, VkCommandBuffer command_buffer) {
+    ASSERT(renderer != NULL, return, "Renderer pointer is NULL");
+    ASSERT(list != NULL, return, "Draw list pointer is NULL");
+    ASSERT(tables != NULL, return, "Draw tables pointer is NULL");
+    draw_list_stats* stats = &list->stats;
+    *stats = (draw_list_stats){ .items = list->count };
+    if (list->count == 0) {
+        return;
+    }
+
+    PROFILE_BEGIN("sort_draw_list");
+    uint64_t sort_start = get_time_nanoseconds();
+    radix_sort_draw_keys(list);
+    stats->sort_nanoseconds = get_time_nanoseconds() - sort_start;
+    PROFILE_END();
+
+    PROFILE_BEGIN("record_draw_list");
+    uint64_t record_start = get_time_nanoseconds();
+    const gpu_allocation* instance_allocation = get_gpu_allocation(renderer, list->instance_allocations[renderer->frame_index]);
+    const gpu_allocation* indirect_allocation = get_gpu_allocation(renderer, list->indirect_allocations[renderer->frame_index]);
+    uint8_t* instances = instance_allocation->mapped;
+    VkDrawIndexedIndirectCommand* commands = indirect_allocation->mapped;
+    VkBuffer indirect_buffer = list->indirect_buffers[renderer->frame_index];
+    bool use_indirect = renderer->draw_indirect_first_instance;
+
+    VkDeviceSize instance_offset = 0;
+    vkCmdBindVertexBuffers(command_buffer, DRAW_INSTANCE_BINDING, 1, &list->instance_buffers[renderer->frame_index], &instance_offset);
+    for (uint32_t i = 0; i < list->count; ++i) {
+        memcpy(instances + (size_t)i * list->instance_stride, list->instance_data + (size_t)list->items[i] * list->instance_stride, list->instance_stride);
+    }
+
+    uint32_t bound_pipeline = UINT32_MAX;
+    uint32_t bound_material = UINT32_MAX;
+    const draw_mesh* bound_mesh = NULL;
+    uint32_t command_count = 0;
+    uint32_t group_start = 0;
+    // Instanced draws are gathered into groups that share pipeline, material and buffers; a
+    // group of more than one goes out as a single indirect draw.
+    for (uint32_t run_start = 0; run_start < list->count;) {
+        uint64_t run_key = list->keys[run_start] >> DRAW_KEY_MESH_SHIFT;
+        uint32_t run_end = run_start + 1;
+        while (run_end < list->count && (list->keys[run_end] >> DRAW_KEY_MESH_SHIFT) == run_key) {
+            ++run_end;
+        }
+        stats->instanced_draws++;
+
+        uint64_t key = list->keys[run_start];
+        uint32_t pipeline = draw_key_field(key, DRAW_KEY_PIPELINE_SHIFT, DRAW_KEY_PIPELINE_BITS);
+        uint32_t material = draw_key_field(key, DRAW_KEY_MATERIAL_SHIFT, DRAW_KEY_MATERIAL_BITS);
+        uint32_t mesh_index = draw_key_field(key, DRAW_KEY_MESH_SHIFT, DRAW_KEY_MESH_BITS);
+        if (pipeline >= tables->pipeline_count || material >= tables->material_count || mesh_index >= tables->mesh_count) {
+            ERROR_BREAKPOINT("Draw key refers past the end of a draw table.");
+            run_start = run_end;
+            continue;
+        }
+        const draw_mesh* mesh = &tables->meshes[mesh_index];
+
+        bool same_state = pipeline == bound_pipeline && material == bound_material && bound_mesh != NULL &&
+                          mesh->vertex_buffer == bound_mesh->vertex_buffer && mesh->index_buffer == bound_mesh->index_buffer && mesh->index_type == bound_mesh->index_type;
+        if (!same_state) {
+            // Close the previous group before any state changes.
+            record_draw_group(renderer, command_buffer, indirect_buffer, commands, group_start, command_count, stats);
+            group_start = command_count;
+
+            if (pipeline != bound_pipeline) {
+                vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, tables->pipelines[pipeline].pipeline);
+                bound_pipeline = pipeline;
+                bound_material = UINT32_MAX;
+                stats->pipeline_binds++;
+            }
+            if (material != bound_material) {
+                VkDescriptorSet descriptor_set = tables->materials[material].descriptor_set;
+                if (descriptor_set != VK_NULL_HANDLE) {
+                    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, tables->pipelines[pipeline].layout, 0, 1, &descriptor_set, 0, NULL);
+                    stats->descriptor_binds++;
+                }
+                bound_material = material;
+            }
+            if (bound_mesh == NULL || mesh->vertex_buffer != bound_mesh->vertex_buffer || mesh->index_buffer != bound_mesh->index_buffer || mesh->index_type != bound_mesh->index_type) {
+                VkDeviceSize vertex_offset = 0;
+                vkCmdBindVertexBuffers(command_buffer, 0, 1, &mesh->vertex_buffer, &vertex_offset);
+                vkCmdBindIndexBuffer(command_buffer, mesh->index_buffer, 0, mesh->index_type);
+                stats->buffer_binds++;
+            }
+            bound_mesh = mesh;
+        }
+
+        commands[command_count++] = (VkDrawIndexedIndirectCommand){
+            .indexCount = mesh->index_count,
+            .instanceCount = run_end - run_start,
+            .firstIndex = mesh->first_index,
+            .vertexOffset = mesh->vertex_offset,
+            .firstInstance = run_start,
+        };
+        // Without drawIndirectFirstInstance every instanced draw is recorded directly.
+        if (!use_indirect) {
+            vkCmdDrawIndexed(command_buffer, mesh->index_count, run_end - run_start, mesh->first_index, mesh->vertex_offset, run_start);
+            stats->draw_calls++;
+            group_start = command_count;
+        }
+        run_start = run_end;
+    }
+
+    record_draw_group(renderer, command_buffer, indirect_buffer, commands, group_start, command_count, stats);
+    flush_mapped_allocation(renderer, instance_allocation);
+    flush_mapped_allocation(renderer, indirect_allocation);
+    stats->record_nanoseconds = get_time_nanoseconds() - record_start;
+    PROFILE_END();
+}
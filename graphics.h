@@ -5,26 +5,801 @@
 #include "fundamental.h"
 #include "platform.h"
 
+#define PIPELINE_CACHE_PATH "pipeline_cache.bin"
+
+typedef struct {
+    // True when the cache file passed validation and seeded the pipeline cache.
+    bool loaded;
+    uint64_t loaded_bytes;
+    // Hash of the loaded data. A save whose data matches it in size and hash is skipped.
+    uint64_t loaded_hash;
+    // Stays zero when nothing was written, including when the cache did not change.
+    uint64_t saved_bytes;
+    uint64_t load_nanoseconds;
+    // Counted by record_pipeline_creation_feedback. Stays zero when the device lacks
+    // VK_EXT_pipeline_creation_feedback.
+    uint32_t hits;
+    uint32_t misses;
+} pipeline_cache_stats;
+
+typedef enum {
+    RENDERER_INIT_STAGE_INSTANCE,
+    RENDERER_INIT_STAGE_PHYSICAL_DEVICE,
+    RENDERER_INIT_STAGE_LOGICAL_DEVICE,
+    RENDERER_INIT_STAGE_PIPELINE_CACHE,
+    RENDERER_INIT_STAGE_FRAME_RESOURCES,
+    RENDERER_INIT_STAGE_SURFACE,
+    RENDERER_INIT_STAGE_PRESENT_CHECK,
+    RENDERER_INIT_STAGE_SWAPCHAIN,
+    RENDERER_INIT_STAGE_COUNT,
+} renderer_init_stage;
+
+typedef struct {
+    uint64_t stage_nanoseconds[RENDERER_INIT_STAGE_COUNT];
+    // Asynchronous initialization only. The time saved on the way to the first frame is
+    // background_nanoseconds - join_wait_nanoseconds: the part that overlapped the caller.
+    uint64_t background_nanoseconds;
+    uint64_t join_wait_nanoseconds;
+    // From the start of initialization until the renderer is usable.
+    uint64_t total_nanoseconds;
+} renderer_init_timings;
+
+#define RENDERER_DEFAULT_FRAMES_IN_FLIGHT 2
+#define MAX_FRAMES_IN_FLIGHT 4
+#define MAX_SWAPCHAIN_IMAGES 8
+// Swapchains replaced by a resize wait here until no frame in flight can still reference them.
+#define MAX_RETIRED_SWAPCHAINS 4
+
+typedef struct {
+    // How many frames the CPU may record ahead of the GPU. 0 selects
+    // RENDERER_DEFAULT_FRAMES_IN_FLIGHT; at most MAX_FRAMES_IN_FLIGHT.
+    uint32_t frames_in_flight;
+    // FIFO presentation when set; otherwise mailbox, or immediate where mailbox is missing.
+    bool vsync;
+    // Renders into headless_width x headless_height offscreen images instead of a swapchain.
+    // No window or surface is needed, so this runs on display-less machines and on lavapipe.
+    bool headless;
+    uint32_t headless_width;
+    uint32_t headless_height;
+    // Size of the upload staging ring. 0 selects UPLOAD_DEFAULT_STAGING_SIZE.
+    uint64_t upload_staging_size;
+    // Job workers that record secondary command buffers, each with its own command pool per
+    // frame; at most MAX_RECORDING_THREADS. When non-zero the render pass takes its contents
+    // from secondary buffers only, so the primary buffer from begin_frame may just execute them.
+    uint32_t recording_threads;
+} renderer_config;
+
+#define MAX_RECORDING_THREADS 32
+// Secondary command buffers one recording thread can use per frame.
+#define MAX_SECONDARY_COMMAND_BUFFERS 16
+
+// Owned by one job worker for one frame slot, so recording needs no locks. The pool is reset
+// in bulk once the frame's fence signals and its buffers are begun again the next time round.
+typedef struct {
+    VkCommandPool command_pool;
+    VkCommandBuffer secondary_buffers[MAX_SECONDARY_COMMAND_BUFFERS];
+    uint32_t allocated_count;
+    uint32_t used_count;
+} thread_command_pool;
+
+// Compute command buffers one frame can submit.
+#define MAX_COMPUTE_SUBMITS_PER_FRAME 8
+
+// compute_timeline value a compute submit signals on completion. Zero is never handed out.
+typedef uint64_t compute_ticket;
+
+// Timestamp queries per frame in flight; each GPU zone takes two.
+#define MAX_GPU_TIMESTAMPS 128
+// Frames between clock recalibrations when VK_EXT_calibrated_timestamps is available.
+#define GPU_CALIBRATION_INTERVAL_FRAMES 600
+// The profiler trace row GPU zones are written to.
+#define GPU_PROFILE_TRACK "GPU"
+
+// Resources of one frame in flight. The command buffer is recorded by the CPU while the GPU
+// may still be executing the other frames' buffers.
+typedef struct {
+    VkCommandPool command_pool;
+    VkCommandBuffer command_buffer;
+    VkFence in_flight_fence;
+    VkSemaphore image_available;
+    // frame_stats.frame_number of the last submit that signals in_flight_fence.
+    uint64_t submitted_frame;
+    thread_command_pool thread_pools[MAX_RECORDING_THREADS];
+    // Query i holds the begin of zone timestamp_names[i], or an end where the name is NULL.
+    // Read back when the slot comes round again, after its fence has signalled.
+    VkQueryPool timestamp_pool;
+    const char* timestamp_names[MAX_GPU_TIMESTAMPS];
+    uint32_t timestamp_count;
+    uint32_t open_gpu_zones;
+    // Zones dropped for lack of queries, still open.
+    uint32_t skipped_gpu_zones;
+    // On the compute family. Compute work is not covered by the frame fence, so the pool is
+    // reset once compute_timeline reaches compute_value.
+    VkCommandPool compute_pool;
+    VkCommandBuffer compute_buffers[MAX_COMPUTE_SUBMITS_PER_FRAME];
+    uint32_t compute_allocated_count;
+    uint32_t compute_used_count;
+    compute_ticket compute_value;
+} render_frame;
+
+// Maps GPU timestamp ticks onto get_time_nanoseconds.
+typedef struct {
+    uint64_t gpu_timestamp;
+    uint64_t cpu_nanoseconds;
+    // Uncertainty of the pairing: the driver's maximum deviation with calibrated timestamps,
+    // or half the round trip of the fallback submit.
+    uint64_t max_deviation_nanoseconds;
+    uint64_t frame_number;
+} gpu_clock_calibration;
+
+// Host-visible buffers that headless frames are copied into. A slot is pending from
+// request_frame_readback until its frame completes, then owned by the caller from
+// poll_frame_readback until release_frame_readback.
+#define MAX_FRAME_READBACKS 4
+
+typedef enum {
+    FRAME_READBACK_FREE,
+    FRAME_READBACK_PENDING,
+    FRAME_READBACK_READY,
+} frame_readback_state;
+
+typedef struct {
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    void* mapped;
+    bool coherent;
+    frame_readback_state state;
+    uint64_t frame_number;
+    uint32_t frame_index;
+} frame_readback_slot;
+
+typedef struct {
+    // Tightly packed rows of swapchain_format.format pixels.
+    const void* data;
+    uint32_t width;
+    uint32_t height;
+    uint32_t row_pitch;
+    uint64_t frame_number;
+    uint32_t slot;
+} frame_readback;
+
+#define UPLOAD_DEFAULT_STAGING_SIZE (32ull * 1024 * 1024)
+// Submitted upload batches whose staging space is not yet reclaimed.
+#define MAX_UPLOAD_BATCHES 4
+// Ownership acquires a batch can carry before it is submitted early.
+#define MAX_UPLOAD_BARRIERS 256
+
+// Value of the upload timeline semaphore that signals once an upload is usable by the
+// graphics queue. 0 is always complete.
+typedef uint64_t upload_ticket;
+
+DECLARE_CAPPED_ARRAY(VkBufferMemoryBarrier, upload_buffer_barriers, MAX_UPLOAD_BARRIERS)
+DECLARE_CAPPED_ARRAY(VkImageMemoryBarrier, upload_image_barriers, MAX_UPLOAD_BARRIERS)
+
+typedef struct {
+    VkCommandPool command_pool;
+    VkCommandBuffer command_buffer;
+    // Graphics queue half of the queue family ownership transfer; unused when the transfer
+    // and graphics families are the same.
+    VkCommandPool acquire_pool;
+    VkCommandBuffer acquire_buffer;
+    upload_ticket ticket;
+    // Staging ring position after this batch's data; the ring tail moves here once it retires.
+    uint64_t staging_end;
+    uint64_t bytes;
+    uint32_t upload_count;
+} upload_batch;
+
+typedef struct {
+    uint64_t uploads;
+    uint64_t submitted_bytes;
+    uint64_t completed_bytes;
+    uint32_t submits;
+    // Uploads that found the staging ring full and waited for the GPU to free space.
+    uint32_t stalls;
+    uint64_t stall_nanoseconds;
+    // Wall time with at least one batch in flight. Completion is only noticed when uploads
+    // are polled, so a measurement should end with wait_for_upload.
+    uint64_t busy_nanoseconds;
+    // completed_bytes over busy_nanoseconds.
+    double megabytes_per_second;
+} upload_stats;
+
+// Uploads are copied into a persistently mapped staging ring and recorded into a batch on the
+// transfer queue. flush_uploads submits the batch; end_frame does so for every frame. Batch
+// completion is tracked on one timeline semaphore, so a frame waits only for the tickets
+// passed to frame_depends_on_upload.
+typedef struct {
+    VkBuffer staging_buffer;
+    VkDeviceMemory staging_memory;
+    uint8_t* staging;
+    bool coherent;
+    uint64_t capacity;
+    // Monotonic ring positions; head % capacity is where the next upload's data goes.
+    uint64_t head;
+    uint64_t tail;
+    VkDeviceSize copy_alignment;
+
+    VkSemaphore timeline;
+    upload_ticket last_signaled;
+    upload_ticket completed;
+    bool ownership_transfer;
+
+    upload_batch batches[MAX_UPLOAD_BATCHES];
+    uint32_t first_batch;
+    uint32_t batches_in_flight;
+    bool recording;
+    upload_buffer_barriers buffer_acquires;
+    upload_image_barriers image_acquires;
+
+    uint64_t busy_start;
+    upload_stats stats;
+} upload_manager;
+
+// Device memory is allocated in GPU_MEMORY_BLOCK_SIZE blocks per memory type and handed out
+// by a buddy allocator in power-of-two ranges of at least GPU_MEMORY_MIN_ALLOCATION bytes.
+#define GPU_MEMORY_BLOCK_SIZE (64ull * 1024 * 1024)
+#define GPU_MEMORY_MIN_ALLOCATION 1024ull
+// Orders 0 (GPU_MEMORY_MIN_ALLOCATION) up to GPU_MEMORY_BLOCK_SIZE.
+#define GPU_MEMORY_ORDER_COUNT 17
+#define MAX_GPU_MEMORY_BLOCKS 64
+#define MAX_GPU_ALLOCATIONS 16384
+// Resources at least this large get their own VkDeviceMemory instead of a block range.
+#define GPU_DEDICATED_ALLOCATION_THRESHOLD (GPU_MEMORY_BLOCK_SIZE / 4)
+
+typedef enum {
+    GPU_MEMORY_DEVICE_LOCAL,
+    // Host-visible and persistently mapped; written by the CPU, read by the GPU.
+    GPU_MEMORY_UPLOAD,
+    // Host-visible and persistently mapped, cached where possible; written by the GPU.
+    GPU_MEMORY_READBACK,
+} gpu_memory_usage;
+
+// Linear resources (buffers, linear images) and optimal images must not share a
+// bufferImageGranularity page. When the device's granularity is coarser than
+// GPU_MEMORY_MIN_ALLOCATION the two kinds live in separate blocks.
+typedef enum {
+    GPU_RESOURCE_LINEAR,
+    GPU_RESOURCE_OPTIMAL,
+} gpu_resource_kind;
+
+typedef struct {
+    VkDeviceMemory memory;
+    // Host-visible blocks only.
+    uint8_t* mapped;
+    uint32_t memory_type;
+    gpu_resource_kind kind;
+    uint64_t used_bytes;
+    uint32_t allocation_count;
+    // One bit per buddy tree node, set while the node is a free range. The root is node 0
+    // and node n has children 2n + 1 and 2n + 2.
+    uint64_t* free_nodes;
+    uint32_t free_counts[GPU_MEMORY_ORDER_COUNT];
+} gpu_memory_block;
+
+#define GPU_DEDICATED_BLOCK UINT32_MAX
+
+typedef struct {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    // As requested; the range reserved is 1 << order times GPU_MEMORY_MIN_ALLOCATION.
+    VkDeviceSize size;
+    // NULL unless the memory is host-visible.
+    void* mapped;
+    // GPU_DEDICATED_BLOCK for dedicated allocations.
+    uint32_t block;
+    uint32_t order;
+    uint32_t memory_type;
+} gpu_allocation;
+
+DECLARE_POOL(gpu_allocation, gpu_allocation_pool, MAX_GPU_ALLOCATIONS)
+typedef pool_handle gpu_allocation_handle;
+
+typedef struct {
+    // Block metadata and the allocation pool, which are too large for the renderer itself.
+    arena_allocator arena;
+    gpu_allocation_pool* allocations;
+    gpu_memory_block blocks[MAX_GPU_MEMORY_BLOCKS];
+    // Slots past this are unused; a released block leaves a slot with a NULL memory handle.
+    uint32_t block_slots;
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    VkDeviceSize buffer_image_granularity;
+    uint32_t max_allocation_count;
+    uint32_t device_allocation_count;
+    // Bytes of VkDeviceMemory this allocator holds per heap.
+    uint64_t heap_allocated_bytes[VK_MAX_MEMORY_HEAPS];
+} gpu_allocator;
+
+typedef struct {
+    uint32_t block_count;
+    uint32_t dedicated_count;
+    uint32_t allocation_count;
+    // Bytes in VkDeviceMemory objects, and the part of it handed to resources as requested.
+    // The difference is buddy rounding plus free block space.
+    uint64_t allocated_bytes;
+    uint64_t used_bytes;
+    uint64_t free_bytes;
+    // 1 - (sum of each block's largest free range) / free bytes. 0 when every block's free
+    // space is one range.
+    float fragmentation;
+    uint32_t heap_count;
+    uint64_t heap_allocated_bytes[VK_MAX_MEMORY_HEAPS];
+    // Process-wide usage and budget from VK_EXT_memory_budget. Without the extension, usage is
+    // this allocator's own and the budget is 80% of the heap size.
+    uint64_t heap_usage_bytes[VK_MAX_MEMORY_HEAPS];
+    uint64_t heap_budget_bytes[VK_MAX_MEMORY_HEAPS];
+} gpu_memory_stats;
+
+// A range end_gpu_defragmentation will move an allocation to. The caller copies size bytes
+// from src to dst on the GPU, binding a new resource at dst where needed.
+typedef struct {
+    gpu_allocation_handle allocation;
+    VkDeviceMemory src_memory;
+    VkDeviceSize src_offset;
+    VkDeviceMemory dst_memory;
+    VkDeviceSize dst_offset;
+    VkDeviceSize size;
+    // Buddy order of the reserved destination range.
+    uint32_t order;
+    uint32_t src_block;
+    uint32_t dst_block;
+} gpu_defragmentation_move;
+
+// Draw items are sorted by a 64-bit key, from the most significant field down:
+// pipeline | material | mesh | order. order is free for the caller, e.g. quantised depth; it
+// sorts draws within a mesh but does not stop them from being merged into one instanced draw.
+#define DRAW_KEY_PIPELINE_BITS 12
+#define DRAW_KEY_MATERIAL_BITS 16
+#define DRAW_KEY_MESH_BITS 16
+#define DRAW_KEY_ORDER_BITS 20
+// Vertex buffer binding that receives the per-instance data of a draw list.
+#define DRAW_INSTANCE_BINDING 1
+
+typedef struct {
+    VkPipeline pipeline;
+    VkPipelineLayout layout;
+} draw_pipeline;
+
+typedef struct {
+    // Bound as set 0 with the pipeline's layout. VK_NULL_HANDLE binds nothing.
+    VkDescriptorSet descriptor_set;
+} draw_material;
+
+typedef struct {
+    VkBuffer vertex_buffer;
+    VkBuffer index_buffer;
+    VkIndexType index_type;
+    uint32_t index_count;
+    uint32_t first_index;
+    int32_t vertex_offset;
+} draw_mesh;
+
+// The tables the ids in draw keys index into. Meshes that share vertex and index buffers can
+// be merged into one indirect draw.
+typedef struct {
+    const draw_pipeline* pipelines;
+    uint32_t pipeline_count;
+    const draw_material* materials;
+    uint32_t material_count;
+    const draw_mesh* meshes;
+    uint32_t mesh_count;
+} draw_tables;
+
+typedef struct {
+    uint32_t items;
+    // One per distinct pipeline, material and mesh run after sorting.
+    uint32_t instanced_draws;
+    // vkCmdDrawIndexed and vkCmdDrawIndexedIndirect calls actually recorded.
+    uint32_t draw_calls;
+    uint32_t indirect_draw_calls;
+    uint32_t pipeline_binds;
+    uint32_t descriptor_binds;
+    uint32_t buffer_binds;
+    uint64_t sort_nanoseconds;
+    uint64_t record_nanoseconds;
+} draw_list_stats;
+
+// Collects draws for one frame, then sorts and records them with as few state changes and
+// draw calls as possible. Instance data is copied in sorted order into a per-frame buffer, so
+// each run of equal keys becomes one instanced draw.
+typedef struct {
+    arena_allocator arena;
+    uint32_t capacity;
+    uint32_t instance_stride;
+    uint32_t count;
+    uint64_t* keys;
+    uint32_t* items;
+    uint64_t* scratch_keys;
+    uint32_t* scratch_items;
+    uint8_t* instance_data;
+    VkBuffer instance_buffers[MAX_FRAMES_IN_FLIGHT];
+    gpu_allocation_handle instance_allocations[MAX_FRAMES_IN_FLIGHT];
+    VkBuffer indirect_buffers[MAX_FRAMES_IN_FLIGHT];
+    gpu_allocation_handle indirect_allocations[MAX_FRAMES_IN_FLIGHT];
+    draw_list_stats stats;
+} draw_list;
+
+static inline uint64_t make_draw_key(uint32_t pipeline, uint32_t material, uint32_t mesh, uint32_t order) {
+    return ((uint64_t)pipeline << (DRAW_KEY_MATERIAL_BITS + DRAW_KEY_MESH_BITS + DRAW_KEY_ORDER_BITS)) |
+           ((uint64_t)material << (DRAW_KEY_MESH_BITS + DRAW_KEY_ORDER_BITS)) |
+           ((uint64_t)mesh << DRAW_KEY_ORDER_BITS) |
+           (order & ((1u << DRAW_KEY_ORDER_BITS) - 1));
+}
+
+#define MAX_PIPELINE_VERTEX_BINDINGS 4
+#define MAX_PIPELINE_VERTEX_ATTRIBUTES 16
+#define MAX_PIPELINE_SET_LAYOUTS 4
+#define MAX_DESCRIPTOR_SET_BINDINGS 16
+// Open-addressed table sizes, powers of two. Tables are not allowed past three quarters full.
+#define PIPELINE_STATE_TABLE_CAPACITY 1024
+#define PIPELINE_LAYOUT_TABLE_CAPACITY 256
+#define DESCRIPTOR_SET_LAYOUT_TABLE_CAPACITY 256
+
+// The *_state descriptors below are hashed and compared as raw bytes. They have no padding,
+// but zero-initialise them so unused array entries compare equal.
+typedef struct {
+    uint32_t binding;
+    VkDescriptorType type;
+    uint32_t count;
+    VkShaderStageFlags stages;
+} descriptor_binding_state;
+
+typedef struct {
+    uint32_t binding_count;
+    descriptor_binding_state bindings[MAX_DESCRIPTOR_SET_BINDINGS];
+} descriptor_set_layout_state;
+
+typedef struct {
+    VkDescriptorSetLayout set_layouts[MAX_PIPELINE_SET_LAYOUTS];
+    uint32_t set_layout_count;
+    // A size of zero means no push constants.
+    VkPushConstantRange push_constants;
+} pipeline_layout_state;
+
+typedef struct {
+    VkShaderModule vertex_shader;
+    // VK_NULL_HANDLE for depth-only pipelines. Both shaders use the entry point "main".
+    VkShaderModule fragment_shader;
+    VkPipelineLayout layout;
+    // Any render pass compatible with this one can use the pipeline.
+    VkRenderPass render_pass;
+    uint32_t subpass;
+    uint32_t binding_count;
+    VkVertexInputBindingDescription bindings[MAX_PIPELINE_VERTEX_BINDINGS];
+    uint32_t attribute_count;
+    VkVertexInputAttributeDescription attributes[MAX_PIPELINE_VERTEX_ATTRIBUTES];
+    VkPrimitiveTopology topology;
+    VkPolygonMode polygon_mode;
+    VkCullModeFlags cull_mode;
+    VkFrontFace front_face;
+    VkBool32 depth_test;
+    VkBool32 depth_write;
+    VkCompareOp depth_compare;
+    VkPipelineColorBlendAttachmentState blend;
+} pipeline_state;
+
+typedef struct {
+    // Entry point "main".
+    VkShaderModule shader;
+    VkPipelineLayout layout;
+} compute_pipeline_state;
+
+// Graphics and compute pipelines share one table; the bind point keeps their states apart.
+typedef struct {
+    VkPipelineBindPoint bind_point;
+    uint32_t reserved;
+    union {
+        pipeline_state graphics;
+        compute_pipeline_state compute;
+    } state;
+} pipeline_key;
+
+typedef enum {
+    PIPELINE_ENTRY_EMPTY,
+    PIPELINE_ENTRY_COMPILING,
+    PIPELINE_ENTRY_READY,
+    // Failed compiles stay in the table so the same state is not retried every frame.
+    PIPELINE_ENTRY_FAILED,
+} pipeline_entry_status;
+
+typedef struct {
+    // Zero marks an empty slot; hashes of zero are stored as one.
+    uint64_t hash;
+    pipeline_entry_status status;
+    // Held by the thread compiling the pipeline. Other requests for the same state sleep on
+    // it rather than compiling a second copy.
+    mutex compile_lock;
+    VkPipeline pipeline;
+    pipeline_key key;
+} pipeline_entry;
+
+typedef struct {
+    uint64_t hash;
+    pipeline_layout_state state;
+    VkPipelineLayout layout;
+} pipeline_layout_entry;
+
+typedef struct {
+    uint64_t hash;
+    descriptor_set_layout_state state;
+    VkDescriptorSetLayout layout;
+} descriptor_set_layout_entry;
+
+typedef struct {
+    uint64_t requests;
+    uint64_t hits;
+    // Hits that found the pipeline still compiling on another thread and waited for it.
+    uint64_t waits;
+    // hits / requests.
+    double hit_rate;
+    uint32_t compiles;
+    uint32_t failures;
+    uint64_t compile_nanoseconds;
+    uint64_t max_compile_nanoseconds;
+    uint32_t pipeline_layouts;
+    uint32_t descriptor_set_layouts;
+    // Layout requests answered from the tables, both kinds.
+    uint64_t layout_hits;
+} pipeline_state_stats;
+
+// Builds each distinct pipeline, pipeline layout and descriptor set layout once. Pipelines
+// compile outside the table lock, so requests for other states are not held up by a compile.
+typedef struct {
+    arena_allocator arena;
+    mutex lock;
+    lock_stats lock_stats;
+    pipeline_entry* pipelines;
+    uint32_t pipeline_count;
+    pipeline_layout_entry* layouts;
+    uint32_t layout_count;
+    descriptor_set_layout_entry* set_layouts;
+    uint32_t set_layout_count;
+    pipeline_state_stats stats;
+} pipeline_state_cache;
+
+typedef struct {
+    VkSwapchainKHR swapchain;
+    uint32_t image_count;
+    VkImageView image_views[MAX_SWAPCHAIN_IMAGES];
+    VkFramebuffer framebuffers[MAX_SWAPCHAIN_IMAGES];
+    VkSemaphore render_finished[MAX_SWAPCHAIN_IMAGES];
+    uint64_t retired_frame;
+} retired_swapchain;
+
+typedef struct {
+    uint64_t frame_number;
+    // Time begin_frame spent waiting for the GPU to release the frame's resources.
+    uint64_t cpu_wait_nanoseconds;
+    uint64_t total_cpu_wait_nanoseconds;
+    uint64_t max_cpu_wait_nanoseconds;
+    // CPU time spent inside vkQueueSubmit.
+    uint64_t submit_nanoseconds;
+    uint64_t total_submit_nanoseconds;
+    uint32_t swapchain_recreations;
+    uint32_t skipped_frames;
+    // Secondary command buffers recorded for the last frame, over all threads.
+    uint32_t secondary_command_buffers;
+    // GPU time of the newest frame whose timestamps have been read back, frames_in_flight
+    // frames behind. Zero without timestamp support.
+    uint64_t gpu_frame_nanoseconds;
+    uint32_t dropped_gpu_zones;
+} renderer_frame_stats;
+
 typedef struct {
     VkInstance instance;
     VkPhysicalDevice physical_device;
     VkDevice device;
     VkSurfaceKHR window_surface;
+    window* window;
+    renderer_config config;
 
     uint32_t graphics_queue_family_index;
     uint32_t transfer_queue_family_index;
+    // Equal to graphics_queue_family_index when the device has no separate compute family.
+    uint32_t compute_queue_family_index;
     VkQueue graphics_queue;
     VkQueue transfer_queue;
+    // May be the graphics or the transfer queue. Submit to it only from the thread that calls
+    // begin_frame and flush_uploads.
+    VkQueue compute_queue;
+    // Each frame's submit signals frame_number + 1, so compute work can wait on a frame.
+    VkSemaphore graphics_timeline;
+    VkSemaphore compute_timeline;
+    compute_ticket last_compute_ticket;
+    // Highest ticket the frame being recorded must wait for.
+    compute_ticket frame_compute_wait;
+
+    VkPipelineCache pipeline_cache;
+    bool pipeline_creation_feedback;
+    // VK_EXT_memory_budget is enabled.
+    bool memory_budget;
+    // Optional features draw lists use to merge draws into indirect batches. Draws per
+    // indirect call: maxDrawIndirectCount with multiDrawIndirect, otherwise 1.
+    uint32_t max_draw_indirect_count;
+    bool draw_indirect_first_instance;
+    // Nanoseconds per timestamp tick of the picked device. Zero when the graphics queue does
+    // not support timestamps, which turns GPU zones off.
+    float timestamp_period;
+    uint32_t timestamp_valid_bits;
+    // NULL without VK_EXT_calibrated_timestamps or a host time domain matching the CPU clock.
+    PFN_vkGetCalibratedTimestampsEXT get_calibrated_timestamps;
+    gpu_clock_calibration gpu_clock;
+    pipeline_cache_stats pipeline_cache_stats;
+    pipeline_state_cache pipeline_states;
+    renderer_init_timings init_timings;
 
     VkSwapchainKHR swapchain;
+    VkSurfaceFormatKHR swapchain_format;
+    VkPresentModeKHR present_mode;
+    VkExtent2D swapchain_extent;
+    // The window size the swapchain was built for; it differs from swapchain_extent where
+    // the surface dictates its own extent.
+    uint32_t swapchain_window_width;
+    uint32_t swapchain_window_height;
+    uint32_t swapchain_image_count;
+    VkImage swapchain_images[MAX_SWAPCHAIN_IMAGES];
+    VkImageView swapchain_image_views[MAX_SWAPCHAIN_IMAGES];
+    VkFramebuffer framebuffers[MAX_SWAPCHAIN_IMAGES];
+    // Per image rather than per frame: the presentation engine holds it until the image is
+    // shown, which is not tied to any frame's fence.
+    VkSemaphore render_finished[MAX_SWAPCHAIN_IMAGES];
+    bool swapchain_dirty;
+    retired_swapchain retired_swapchains[MAX_RETIRED_SWAPCHAINS];
+    uint32_t retired_swapchain_count;
+
     VkRenderPass render_pass;
     VkPipeline graphics_pipeline;
-    VkCommandPool command_pool;
-    VkCommandBuffer command_buffer;
-    VkFramebuffer framebuffer;
+    VkClearColorValue clear_color;
+
+    // Headless only: one offscreen image per frame in flight, in swapchain_images.
+    VkDeviceMemory offscreen_memory[MAX_FRAMES_IN_FLIGHT];
+    frame_readback_slot readbacks[MAX_FRAME_READBACKS];
+    uint32_t requested_readback;
+
+    gpu_allocator memory;
+    upload_manager uploads;
+    // Highest ticket the frame being recorded must wait for.
+    upload_ticket frame_upload_wait;
+
+    render_frame frames[MAX_FRAMES_IN_FLIGHT];
+    uint32_t frame_index;
+    uint32_t image_index;
+    renderer_frame_stats frame_stats;
 } renderer;
 
-result create_renderer(window* window, renderer* out_renderer);
+// config may be NULL for the defaults. window may be NULL for a headless renderer.
+result create_renderer(window* window, const renderer_config* config, renderer* out_renderer);
+
+// Asynchronous alternative to create_renderer. Start it before create_window: the instance,
+// physical device, logical device and pipeline cache are created on a background thread,
+// and finish joins it and creates the window surface. The renderer and the initialization
+// struct must not move or be read in between.
+typedef struct {
+    renderer* renderer;
+    thread worker;
+    result background_result;
+    uint64_t start;
+} renderer_initialization;
+
+result start_renderer_initialization(const renderer_config* config, renderer* out_renderer, renderer_initialization* out_initialization);
+// On failure the renderer is partially created and must still be passed to destroy_renderer.
+// window may be NULL for a headless renderer.
+result finish_renderer_initialization(renderer_initialization* initialization, window* window);
+// Writes the pipeline cache back to PIPELINE_CACHE_PATH before tearing the device down.
 void destroy_renderer(renderer* renderer);
 
+// Waits for the frame's previous use to retire, recreates the swapchain if the window was
+// resized, acquires an image and begins the render pass on the frame's command buffer.
+// Returns false when there is nothing to render into (minimised window, out-of-date
+// swapchain); skip end_frame for that frame.
+bool begin_frame(renderer* renderer, VkCommandBuffer* out_command_buffer);
+// Ends the render pass, submits the frame and queues it for presentation.
+void end_frame(renderer* renderer);
+
+// With recording_threads set, call between begin_frame and end_frame from a job worker (or
+// the thread that created the job system) to record part of the render pass. Returns
+// VK_NULL_HANDLE on any other thread, when the worker index is out of range or when the
+// thread's buffers are used up.
+VkCommandBuffer begin_secondary_command_buffer(renderer* renderer);
+void end_secondary_command_buffer(renderer* renderer, VkCommandBuffer command_buffer);
+// On the thread that called begin_frame, once the secondaries are ended. They run in the
+// order given.
+void execute_secondary_command_buffers(renderer* renderer, const VkCommandBuffer* command_buffers, uint32_t count);
+
+// Async compute, recorded between begin_frame and end_frame on the thread that calls them.
+// Resources both queues use should be created with VK_SHARING_MODE_CONCURRENT over the
+// graphics and compute families; no queue ownership transfers are recorded. Returns
+// VK_NULL_HANDLE once the frame has used MAX_COMPUTE_SUBMITS_PER_FRAME buffers.
+VkCommandBuffer begin_compute(renderer* renderer);
+// Binds pipeline and descriptor_set (at set 0, unless VK_NULL_HANDLE), pushes
+// push_constant_size bytes at offset 0 and dispatches the given group counts.
+void dispatch_compute(VkCommandBuffer command_buffer, VkPipeline pipeline, VkPipelineLayout layout, VkDescriptorSet descriptor_set,
+                      const void* push_constants, uint32_t push_constant_size, uint32_t group_count_x, uint32_t group_count_y, uint32_t group_count_z);
+// Ends and submits command_buffer. With after_previous_frame it waits for the previous
+// frame's graphics work, e.g. to read what that frame rendered. Returns 0 on failure.
+compute_ticket submit_compute(renderer* renderer, VkCommandBuffer command_buffer, bool after_previous_frame);
+bool is_compute_complete(renderer* renderer, compute_ticket ticket);
+void wait_for_compute(renderer* renderer, compute_ticket ticket);
+// The frame being recorded waits for ticket before its indirect draws, shaders and transfers.
+void frame_depends_on_compute(renderer* renderer, compute_ticket ticket);
+
+// Time GPU work recorded on the frame's primary command buffer between begin_frame and
+// end_frame. Zones nest, and begin_frame opens one around the whole frame. The results reach
+// the profiler trace on the GPU_PROFILE_TRACK row frames_in_flight frames later, without
+// waiting on the GPU. Not available with recording_threads, whose render pass only takes
+// secondary command buffers.
+void begin_gpu_zone(renderer* renderer, VkCommandBuffer command_buffer, const char* name);
+void end_gpu_zone(renderer* renderer, VkCommandBuffer command_buffer);
+
+// Headless only. Call between begin_frame and end_frame to copy the frame into a readback
+// slot once it is rendered. Returns false when every slot is pending or still held.
+bool request_frame_readback(renderer* renderer);
+// Hands out the oldest readback whose frame has completed, without waiting for the GPU.
+bool poll_frame_readback(renderer* renderer, frame_readback* out_readback);
+void release_frame_readback(renderer* renderer, const frame_readback* readback);
+
+// Sub-allocates memory for requirements, or gives it a dedicated VkDeviceMemory when it is
+// large or dedicated is set. Fails without a breakpoint when a new block would exceed the
+// heap budget, so callers can evict and retry.
+result allocate_gpu_memory(renderer* renderer, const VkMemoryRequirements* requirements, gpu_memory_usage usage, gpu_resource_kind kind, bool dedicated, gpu_allocation_handle* out_allocation);
+void free_gpu_memory(renderer* renderer, gpu_allocation_handle allocation);
+// NULL for a stale handle. The pointer is invalidated by the next allocation or free.
+const gpu_allocation* get_gpu_allocation(renderer* renderer, gpu_allocation_handle allocation);
+// Create the resource and bind it to new memory, honouring the driver's dedicated
+// allocation preference.
+result create_gpu_buffer(renderer* renderer, const VkBufferCreateInfo* create_info, gpu_memory_usage usage, VkBuffer* out_buffer, gpu_allocation_handle* out_allocation);
+result create_gpu_image(renderer* renderer, const VkImageCreateInfo* create_info, gpu_memory_usage usage, VkImage* out_image, gpu_allocation_handle* out_allocation);
+void destroy_gpu_buffer(renderer* renderer, VkBuffer buffer, gpu_allocation_handle allocation);
+void destroy_gpu_image(renderer* renderer, VkImage image, gpu_allocation_handle allocation);
+void get_gpu_memory_stats(renderer* renderer, gpu_memory_stats* out_stats);
+// Plans moves out of the emptiest block of each memory type into fuller ones and reserves
+// their destinations. Returns the number of moves written, at most max_moves.
+uint32_t begin_gpu_defragmentation(renderer* renderer, gpu_defragmentation_move* out_moves, uint32_t max_moves);
+// Call once the copies for the moves have completed on the GPU and the old resources are
+// gone. Points the allocations at their new ranges and releases blocks left empty. A move
+// whose allocation was freed in the meantime gives its reserved destination back.
+void end_gpu_defragmentation(renderer* renderer, const gpu_defragmentation_move* moves, uint32_t move_count);
+
+// Return the object for state, creating it on first use. They stay alive until the renderer is
+// destroyed and return VK_NULL_HANDLE if creation failed. Safe to call from any thread.
+VkDescriptorSetLayout get_descriptor_set_layout(renderer* renderer, const descriptor_set_layout_state* state);
+VkPipelineLayout get_pipeline_layout(renderer* renderer, const pipeline_layout_state* state);
+// Viewport and scissor are dynamic state. Concurrent requests for a state that is not built
+// yet wait for a single compile.
+VkPipeline get_graphics_pipeline(renderer* renderer, const pipeline_state* state);
+VkPipeline get_compute_pipeline(renderer* renderer, const compute_pipeline_state* state);
+void get_pipeline_state_stats(renderer* renderer, pipeline_state_stats* out_stats);
+
+// instance_stride bytes of instance data go with every draw. The list's buffers come from the
+// renderer's GPU allocator, one set per frame in flight.
+result create_draw_list(renderer* renderer, uint32_t capacity, uint32_t instance_stride, draw_list* out_list);
+void destroy_draw_list(renderer* renderer, draw_list* list);
+// Call once per frame before adding draws.
+void reset_draw_list(draw_list* list);
+// Returns false when the list is full.
+bool add_draw(draw_list* list, uint64_t key, const void* instance_data);
+// Sorts the list and records it into command_buffer, inside the frame's render pass. Uses the
+// current frame's buffers, so call it at most once per list per frame.
+void record_draw_list(renderer* renderer, draw_list* list, const draw_tables* tables, VkCommandBuffer command_buffer);
+
+// Copies data into dst at dst_offset. Buffers larger than the staging ring are split over
+// several batches. dst must use exclusive sharing; its ownership is handed to the graphics
+// queue family when the transfer queue belongs to another family.
+result upload_buffer(renderer* renderer, VkBuffer dst, VkDeviceSize dst_offset, const void* data, VkDeviceSize size, upload_ticket* out_ticket);
+// Fills mip 0 of a 2D color image with tightly packed texels and leaves it in final_layout.
+// The whole image must fit in the staging ring.
+result upload_image(renderer* renderer, VkImage dst, VkExtent3D extent, const void* data, VkDeviceSize size, VkImageLayout final_layout, upload_ticket* out_ticket);
+// Submits the uploads recorded since the last flush.
+void flush_uploads(renderer* renderer);
+bool is_upload_complete(renderer* renderer, upload_ticket ticket);
+// Blocks the calling thread until the ticket's upload has completed.
+void wait_for_upload(renderer* renderer, upload_ticket ticket);
+// Makes the next end_frame submit wait on the GPU for the ticket, from the first stages that
+// can read uploaded data. Frames that name no ticket never wait on uploads.
+void frame_depends_on_upload(renderer* renderer, upload_ticket ticket);
+
+// Pipeline creation chains a VkPipelineCreationFeedbackCreateInfoEXT when
+// renderer->pipeline_creation_feedback is set and passes the pipeline's feedback here.
+void record_pipeline_creation_feedback(renderer* renderer, const VkPipelineCreationFeedbackEXT* feedback);
+
 #endif // GRAPHICS_H
\ No newline at end of file
@@ -1,17 +1,61 @@
 #include "fundamental.h"
 #include "platform.h"
 #include "graphics.h"
+#include "profiler.h"
 
 static window main_window;
+
+// Collects the frame's input events into frame memory, then handles them in order.
+static bool handle_frame_events(window* window, arena_allocator* frame_arena) {
+    input_event* events = arena_allocate(frame_arena, INPUT_EVENT_QUEUE_CAPACITY * sizeof(input_event), alignof(input_event));
+    if (events == NULL) {
+        return true;
+    }
+    uint32_t count = 0;
+    while (count < INPUT_EVENT_QUEUE_CAPACITY && poll_window_event(window, &events[count])) {
+        count++;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        if (events[i].type == INPUT_EVENT_KEY_DOWN && events[i].key == KEY_ESCAPE) {
+            return false;
+        }
+    }
+    return true;
+}
+
 int main() {
-    create_window("Main Window", 800, 600, WINDOW_MODE_WINDOWED, &main_window);
+    start_profiler("trace.json");
     renderer main_renderer = { 0 };
-    create_renderer(&main_window, &main_renderer);
+    renderer_initialization initialization = { 0 };
+    renderer_config config = { .frames_in_flight = 2, .vsync = false };
+    start_renderer_initialization(&config, &main_renderer, &initialization);
+    create_window("Main Window", 800, 600, WINDOW_MODE_WINDOWED, WINDOW_FLAG_NONE, &main_window);
+    finish_renderer_initialization(&initialization, &main_window);
+    enable_window_events(&main_window, true);
+    frame_allocator frame_memory = { 0 };
+    create_frame_allocator(main_renderer.config.frames_in_flight, 16 * 1024 * 1024, &frame_memory);
+    frame_pacer pacer = { 0 };
+    create_frame_pacer(1000000000ull / 60, 1000000ull, &pacer);
 
-    while (!main_window.input.closed_window) {
+    bool running = true;
+    while (running && !main_window.input.closed_window) {
+        PROFILE_BEGIN("frame");
         update_window_input(&main_window);
+        VkCommandBuffer command_buffer;
+        if (begin_frame(&main_renderer, &command_buffer)) {
+            // begin_frame has waited on this slot's fence, so nothing still reads the slot's
+            // previous frame memory.
+            arena_allocator* frame_arena = begin_frame_allocator(&frame_memory, main_renderer.frame_index);
+            running = handle_frame_events(&main_window, frame_arena);
+            end_frame(&main_renderer);
+        }
+        PROFILE_END();
+        wait_for_next_frame(&pacer);
     }
+    destroy_frame_pacer(&pacer);
+    destroy_frame_allocator(&frame_memory);
     destroy_renderer(&main_renderer);
     destroy_window(&main_window);
+    stop_profiler();
     return 0;
 }
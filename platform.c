@@ -3,25 +3,301 @@
 #define NO_MINMAX
 #include <Windows.h>
 #include <windowsx.h>
+#include <intrin.h>
+#elif defined(__linux__)
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <linux/futex.h>
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <cpuid.h>
+#include <xcb/xcb.h>
 #endif
 #include "platform.h"
+#include "profiler.h"
+#include <math.h>
 
 IMPLEMENT_CAPPED_ARRAY(wchar_t, typed_characters, MAX_TYPED_CHARACTERS)
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define KEY_BITSET_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define KEY_BITSET_SSE2
+#endif
+
+IMPLEMENT_SPSC_RING(input_event, input_event_queue, INPUT_EVENT_QUEUE_CAPACITY)
+
+// Whole-set operations on key_bitset. Unaligned loads are used because windows may live in
+// memory that does not honour the 32-byte alignment of the struct.
+static inline void key_bitset_and(key_bitset* out, const key_bitset* a, const key_bitset* b) {
+#if defined(KEY_BITSET_AVX2)
+    __m256i result = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)a->words), _mm256_loadu_si256((const __m256i*)b->words));
+    _mm256_storeu_si256((__m256i*)out->words, result);
+#elif defined(KEY_BITSET_SSE2)
+    for (uint32_t i = 0; i < KEY_BITSET_WORDS; i += 2) {
+        __m128i result = _mm_and_si128(_mm_loadu_si128((const __m128i*)&a->words[i]), _mm_loadu_si128((const __m128i*)&b->words[i]));
+        _mm_storeu_si128((__m128i*)&out->words[i], result);
+    }
+#else
+    for (uint32_t i = 0; i < KEY_BITSET_WORDS; ++i) {
+        out->words[i] = a->words[i] & b->words[i];
+    }
+#endif
+}
+
+static inline void key_bitset_xor(key_bitset* out, const key_bitset* a, const key_bitset* b) {
+#if defined(KEY_BITSET_AVX2)
+    __m256i result = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)a->words), _mm256_loadu_si256((const __m256i*)b->words));
+    _mm256_storeu_si256((__m256i*)out->words, result);
+#elif defined(KEY_BITSET_SSE2)
+    for (uint32_t i = 0; i < KEY_BITSET_WORDS; i += 2) {
+        __m128i result = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&a->words[i]), _mm_loadu_si128((const __m128i*)&b->words[i]));
+        _mm_storeu_si128((__m128i*)&out->words[i], result);
+    }
+#else
+    for (uint32_t i = 0; i < KEY_BITSET_WORDS; ++i) {
+        out->words[i] = a->words[i] ^ b->words[i];
+    }
+#endif
+}
+
+static inline void key_bitset_clear(key_bitset* bits) {
+#if defined(KEY_BITSET_AVX2)
+    _mm256_storeu_si256((__m256i*)bits->words, _mm256_setzero_si256());
+#elif defined(KEY_BITSET_SSE2)
+    for (uint32_t i = 0; i < KEY_BITSET_WORDS; i += 2) {
+        _mm_storeu_si128((__m128i*)&bits->words[i], _mm_setzero_si128());
+    }
+#else
+    for (uint32_t i = 0; i < KEY_BITSET_WORDS; ++i) {
+        bits->words[i] = 0;
+    }
+#endif
+}
+
+static inline bool key_bitset_any(const key_bitset* bits) {
+#if defined(KEY_BITSET_AVX2)
+    __m256i value = _mm256_loadu_si256((const __m256i*)bits->words);
+    return !_mm256_testz_si256(value, value);
+#elif defined(KEY_BITSET_SSE2)
+    __m128i value = _mm_or_si128(_mm_loadu_si128((const __m128i*)&bits->words[0]), _mm_loadu_si128((const __m128i*)&bits->words[2]));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(value, _mm_setzero_si128())) != 0xFFFF;
+#else
+    uint64_t any = 0;
+    for (uint32_t i = 0; i < KEY_BITSET_WORDS; ++i) {
+        any |= bits->words[i];
+    }
+    return any != 0;
+#endif
+}
+
+STATIC_ASSERT(KEY_BITSET_WORDS == 4, key_bitset_is_one_avx2_register);
+
+bool input_any_pressed(const user_input* input) {
+    ASSERT(input != NULL, return false, "Input pointer is null");
+    return key_bitset_any(&input->keys.pressed);
+}
+
+bool input_any_released(const user_input* input) {
+    ASSERT(input != NULL, return false, "Input pointer is null");
+    return key_bitset_any(&input->keys.released);
+}
+
+bool input_any_down(const user_input* input) {
+    ASSERT(input != NULL, return false, "Input pointer is null");
+    return key_bitset_any(&input->keys.current);
+}
+
+key_iterator input_iterate_pressed(const user_input* input) {
+    key_iterator iterator = { input->keys.pressed, 0 };
+    return iterator;
+}
+
+key_iterator input_iterate_released(const user_input* input) {
+    key_iterator iterator = { input->keys.released, 0 };
+    return iterator;
+}
+
+key_iterator input_iterate_changed(const user_input* input) {
+    key_iterator iterator = { 0 };
+    key_bitset_xor(&iterator.remaining, &input->keys.current, &input->keys.previous);
+    return iterator;
+}
+
+static void set_key(user_input* input, keyboard_key key, bool down) {
+    if (key == KEY_NONE || (uint32_t)key >= KEY_COUNT) {
+        return;
+    }
+
+    uint64_t bit = 1ull << ((uint32_t)key % 64);
+    uint32_t word = (uint32_t)key / 64;
+    if (down) {
+        input->keys.current.words[word] |= bit;
+        input->keys.pressed.words[word] |= bit;
+    }
+    else {
+        input->keys.current.words[word] &= ~bit;
+        input->keys.released.words[word] |= bit;
+    }
+}
+
+static void apply_input_event(user_input* input, const input_event* event) {
+    switch (event->type) {
+    case INPUT_EVENT_KEY_DOWN:
+    case INPUT_EVENT_BUTTON_DOWN:
+        set_key(input, event->key, true);
+        break;
+    case INPUT_EVENT_KEY_UP:
+    case INPUT_EVENT_BUTTON_UP:
+        set_key(input, event->key, false);
+        break;
+    case INPUT_EVENT_CHARACTER:
+        typed_characters_append(&input->typed_characters, event->character);
+        break;
+    case INPUT_EVENT_MOUSE_MOTION:
+        input->mouse.x = event->motion.x;
+        input->mouse.y = event->motion.y;
+        break;
+    case INPUT_EVENT_MOUSE_WHEEL:
+        input->mouse.scroll_delta += event->wheel_delta;
+        break;
+    case INPUT_EVENT_RESIZE:
+        if (input->width != event->size.width || input->height != event->size.height) {
+            input->width = event->size.width;
+            input->height = event->size.height;
+            input->resized = true;
+        }
+        break;
+    case INPUT_EVENT_CLOSE:
+        input->closed_window = true;
+        break;
+    }
+}
+
+// Nothing in user_input is cleared wholesale: the key sets are rotated with a handful of
+// vector stores and everything else is reset field by field.
+static void begin_input_frame(user_input* input) {
+    input->keys.previous = input->keys.current;
+    key_bitset_clear(&input->keys.pressed);
+    key_bitset_clear(&input->keys.released);
+    input->typed_characters.count = 0;
+    input->mouse.scroll_delta = 0;
+    input->resized = false;
+    input->closed_window = false;
+}
+
+static void end_input_frame(user_input* input) {
+    key_bitset_and(&input->keys.held, &input->keys.current, &input->keys.previous);
+}
+
+static void deliver_input_event(window* window, const input_event* event, uint64_t now) {
+    apply_input_event(&window->input, event);
+    if (window->events_enabled && !input_event_queue_push(&window->events, event)) {
+        atomic_fetch_add_explicit(&window->dropped_events, 1, memory_order_relaxed);
+    }
+
+    uint64_t latency = now > event->timestamp ? now - event->timestamp : 0;
+    window->input_latency.event_count++;
+    window->input_latency.total_nanoseconds += latency;
+    if (latency > window->input_latency.max_nanoseconds) {
+        window->input_latency.max_nanoseconds = latency;
+    }
+}
+
+// The offset is relearned over two rolling epochs, so it follows drift between the OS clock
+// and ours instead of keeping a minimum from long ago.
+#define OS_CLOCK_EPOCH_NANOSECONDS 10000000000ll
+
+// OS event times count milliseconds on a clock of their own (X server time, GetTickCount).
+// The offset to get_time_nanoseconds is the smallest gap seen between an event's time and the
+// moment it was read, so the least-delayed event counts as handed over instantly and every
+// other one is measured against it.
+static uint64_t os_event_time_to_nanoseconds(window* window, uint32_t milliseconds, uint64_t now) {
+    if (!window->os_clock_synced) {
+        window->os_event_milliseconds = milliseconds;
+    }
+    else {
+        // Extends the 32-bit time across wrap-around; X server time wraps every 49 days.
+        window->os_event_milliseconds += (uint64_t)(int64_t)(int32_t)(milliseconds - (uint32_t)window->os_event_milliseconds);
+    }
+    int64_t event_time = (int64_t)window->os_event_milliseconds * 1000000;
+    int64_t offset = (int64_t)now - event_time;
+
+    if (!window->os_clock_synced) {
+        window->os_clock_offset = offset;
+        window->os_clock_epoch_offset = offset;
+        window->os_clock_epoch_start = now;
+        window->os_clock_synced = true;
+    }
+    else if (now - window->os_clock_epoch_start > OS_CLOCK_EPOCH_NANOSECONDS) {
+        window->os_clock_offset = window->os_clock_epoch_offset < offset ? window->os_clock_epoch_offset : offset;
+        window->os_clock_epoch_offset = offset;
+        window->os_clock_epoch_start = now;
+    }
+    if (offset < window->os_clock_epoch_offset) {
+        window->os_clock_epoch_offset = offset;
+    }
+    if (offset < window->os_clock_offset) {
+        window->os_clock_offset = offset;
+    }
+    return (uint64_t)(event_time + window->os_clock_offset);
+}
+
+// Called by the backend for every translated OS event. On a pump thread the event is only
+// handed over through the channel; window->input belongs to the thread calling update_window_input.
+static void push_input_event(window* window, input_event event) {
+    event.timestamp = window->os_event_timestamp != 0 ? window->os_event_timestamp : get_time_nanoseconds();
+    if (window->flags & WINDOW_FLAG_PUMP_THREAD) {
+        if (!input_event_queue_push(&window->pump_events, &event)) {
+            atomic_fetch_add_explicit(&window->dropped_events, 1, memory_order_relaxed);
+        }
+        return;
+    }
+    deliver_input_event(window, &event, get_time_nanoseconds());
+}
+
+void enable_window_events(window* window, bool enabled) {
+    ASSERT(window != NULL, return, "Window pointer is null");
+    window->events_enabled = enabled;
+}
+
+bool poll_window_event(window* window, input_event* out_event) {
+    ASSERT(window != NULL, return false, "Window pointer is null");
+    ASSERT(out_event != NULL, return false, "Event pointer is null");
+    return input_event_queue_pop(&window->events, out_event);
+}
+
+#if defined(PLATFORM_WINDOWS)
 const char* window_class_name = "MyWindowClass";
 
 static LRESULT window_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
-    user_input* input = (user_input*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+    window* window = (void*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+    if (window != NULL) {
+        // GetMessageTime is only meaningful for posted input; sent messages would report a stale time.
+        bool is_input = (msg >= WM_KEYFIRST && msg <= WM_KEYLAST) || (msg >= WM_MOUSEFIRST && msg <= WM_MOUSELAST);
+        window->os_event_timestamp = is_input ? os_event_time_to_nanoseconds(window, (uint32_t)GetMessageTime(), get_time_nanoseconds()) : 0;
+    }
     switch (msg) {
     case WM_CREATE:
         CREATESTRUCT* pCreate = (CREATESTRUCT*)(lParam);
-        input = (user_input*)(pCreate->lpCreateParams);
+        window = pCreate->lpCreateParams;
         // store the pointer in the instance data of the window
         // so it could always be retrieved by using GetWindowLongPtr(hwnd, GWLP_USERDATA) 
-        SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)input);
+        SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)window);
         break;
     case WM_CLOSE: {
-        input->closed_window = true;
+        push_input_event(window, (input_event){ .type = INPUT_EVENT_CLOSE });
         return 0;
     }
     case WM_DESTROY: {
@@ -38,46 +314,48 @@ static LRESULT window_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
     case WM_CHAR: {
         wchar_t character = (wchar_t)wParam;
         if (character != 0) {
-            typed_characters_append(&input->typed_characters, character);
+            push_input_event(window, (input_event){ .type = INPUT_EVENT_CHARACTER, .character = character });
         }
         break;
     }
     case WM_KEYDOWN: {
         int key = (int)wParam;
         if (key < 256) {
-            input->keys[key].down = true;
+            push_input_event(window, (input_event){ .type = INPUT_EVENT_KEY_DOWN, .key = (keyboard_key)key });
         }
     } break;
     case WM_KEYUP: {
         int key = (int)wParam;
         if (key < 256) {
-            input->keys[key].up = true;
+            push_input_event(window, (input_event){ .type = INPUT_EVENT_KEY_UP, .key = (keyboard_key)key });
         }
     } break;
     case WM_MOUSEMOVE: {
-        input->mouse.x = GET_X_LPARAM(lParam);
-        input->mouse.y = GET_Y_LPARAM(lParam);
+        push_input_event(window, (input_event){ .type = INPUT_EVENT_MOUSE_MOTION, .motion = { GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) } });
     } break;
     case WM_MOUSEWHEEL: {
-        input->mouse.scroll_delta = GET_WHEEL_DELTA_WPARAM(wParam);
+        push_input_event(window, (input_event){ .type = INPUT_EVENT_MOUSE_WHEEL, .wheel_delta = GET_WHEEL_DELTA_WPARAM(wParam) });
+    } break;
+    case WM_SIZE: {
+        push_input_event(window, (input_event){ .type = INPUT_EVENT_RESIZE, .size = { LOWORD(lParam), HIWORD(lParam) } });
     } break;
     case WM_LBUTTONDOWN: {
-        input->keys[KEY_LEFT_MOUSE].down = true;
+        push_input_event(window, (input_event){ .type = INPUT_EVENT_BUTTON_DOWN, .key = KEY_LEFT_MOUSE });
     } break;
     case WM_LBUTTONUP: {
-        input->keys[KEY_LEFT_MOUSE].up = true;
+        push_input_event(window, (input_event){ .type = INPUT_EVENT_BUTTON_UP, .key = KEY_LEFT_MOUSE });
     } break;
     case WM_RBUTTONDOWN: {
-        input->keys[KEY_RIGHT_MOUSE].down = true;
+        push_input_event(window, (input_event){ .type = INPUT_EVENT_BUTTON_DOWN, .key = KEY_RIGHT_MOUSE });
     } break;
     case WM_RBUTTONUP: {
-        input->keys[KEY_RIGHT_MOUSE].up = true;
+        push_input_event(window, (input_event){ .type = INPUT_EVENT_BUTTON_UP, .key = KEY_RIGHT_MOUSE });
     } break;
     case WM_MBUTTONDOWN: {
-        input->keys[KEY_MIDDLE_MOUSE].down = true;
+        push_input_event(window, (input_event){ .type = INPUT_EVENT_BUTTON_DOWN, .key = KEY_MIDDLE_MOUSE });
     } break;
     case WM_MBUTTONUP: {
-        input->keys[KEY_MIDDLE_MOUSE].up = true;
+        push_input_event(window, (input_event){ .type = INPUT_EVENT_BUTTON_UP, .key = KEY_MIDDLE_MOUSE });
     } break;
     }
     return DefWindowProc(hwnd, msg, wParam, lParam);
@@ -85,14 +363,7 @@ static LRESULT window_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
 
 STATIC_ASSERT(sizeof(void*) == sizeof(HANDLE), window_handle_size_mismatch);
 
-result create_window(const char* title, uint32_t width, uint32_t height, window_mode mode, window* out_window) {
-    if (!out_window) {
-        ERROR_BREAKPOINT("Window pointer is null");
-        return RESULT_FAILURE;
-    }
-
-    memset(out_window, 0, sizeof(window));
-
+static result create_native_window(const char* title, uint32_t width, uint32_t height, window_mode mode, window* out_window) {
     int32_t style = 0;
     if (mode == WINDOW_MODE_FULLSCREEN) {
         width = GetSystemMetrics(SM_CXSCREEN);
@@ -128,7 +399,7 @@ result create_window(const char* title, uint32_t width, uint32_t height, window_
         NULL,
         NULL,
         GetModuleHandle(NULL),
-        &out_window->input
+        out_window
     );
 
     if (!hwnd) {
@@ -147,42 +418,2767 @@ result create_window(const char* title, uint32_t width, uint32_t height, window_
         out_window->input.mouse.y = point.y;
     }
 
+    RECT client_rect = { 0 };
+    GetClientRect(hwnd, &client_rect);
+    out_window->input.width = (uint32_t)(client_rect.right - client_rect.left);
+    out_window->input.height = (uint32_t)(client_rect.bottom - client_rect.top);
     out_window->handle = hwnd;
     return RESULT_SUCCESS;
 }
 
-void update_window_input(window* window) {
-    if (window == NULL) {
-        ERROR_BREAKPOINT("Window pointer is null");
-        return;
-    }
-
-    if (window->handle == NULL) {
-        ERROR_BREAKPOINT("Window handle is null");
-        return;
-    }
-
-    int32_t old_cursor_x = window->input.mouse.x;
-    int32_t old_cursor_y = window->input.mouse.y;
-    memset(&window->input, 0, sizeof(window->input));
-    window->input.mouse.x = old_cursor_x;
-    window->input.mouse.y = old_cursor_y;
-
+static void pump_native_events(window* window) {
+    PROFILE_BEGIN("pump_native_events");
     MSG msg = { 0 };
     while (PeekMessage(&msg, window->handle, 0, 0, PM_REMOVE)) {
         TranslateMessage(&msg);
         DispatchMessage(&msg);
     }
+    PROFILE_END();
 }
 
-void destroy_window(window* window) {
-    if (window == NULL) {
-        ERROR_BREAKPOINT("Window pointer is null");
-        return;
+// Blocks until the thread's queue has something, then dispatches everything queued.
+static void wait_native_events(window* window) {
+    (void)window;
+    WaitMessage();
+    PROFILE_BEGIN("dispatch_native_events");
+    MSG msg = { 0 };
+    while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
     }
+    PROFILE_END();
+}
 
+// Posts to the pump thread's queue rather than to the window, whose handle the pump clears
+// once it sees the window stopping.
+static void wake_native_pump(window* window) {
+    PostThreadMessage(GetThreadId(window->pump_thread.handle), WM_NULL, 0, 0);
+}
+
+static void destroy_native_window(window* window) {
     if (window->handle != NULL) {
         DestroyWindow(window->handle);
         window->handle = NULL;
     }
-}
\ No newline at end of file
+}
+
+static void yield_thread(void) {
+    SwitchToThread();
+}
+
+static DWORD WINAPI thread_start(LPVOID data) {
+    thread* thread = data;
+    thread->function(thread->data);
+    release_scratch_arenas();
+    return 0;
+}
+
+result create_thread(thread_function function, void* data, thread* out_thread) {
+    ASSERT(function != NULL, return RESULT_FAILURE, "Thread function is null");
+    ASSERT(out_thread != NULL, return RESULT_FAILURE, "Thread pointer is null");
+    out_thread->function = function;
+    out_thread->data = data;
+    out_thread->handle = CreateThread(NULL, 0, thread_start, out_thread, 0, NULL);
+    if (out_thread->handle == NULL) {
+        ERROR_BREAKPOINT("Failed to create thread");
+        return RESULT_FAILURE;
+    }
+    return RESULT_SUCCESS;
+}
+
+void destroy_thread(thread* thread) {
+    ASSERT(thread != NULL, return, "Thread pointer is null");
+    if (thread->handle != NULL) {
+        WaitForSingleObject(thread->handle, INFINITE);
+        CloseHandle(thread->handle);
+        thread->handle = NULL;
+    }
+}
+#elif defined(PLATFORM_LINUX)
+
+#define XCB_WHEEL_DELTA 120
+#define XCB_MAX_KEYCODES 256
+
+// Keysym values from X11/keysymdef.h, kept local so only libxcb is needed.
+#define XK_BACKSPACE 0xff08
+#define XK_TAB 0xff09
+#define XK_RETURN 0xff0d
+#define XK_PAUSE 0xff13
+#define XK_SCROLL_LOCK 0xff14
+#define XK_ESCAPE 0xff1b
+#define XK_HOME 0xff50
+#define XK_LEFT 0xff51
+#define XK_UP 0xff52
+#define XK_RIGHT 0xff53
+#define XK_DOWN 0xff54
+#define XK_PAGE_UP 0xff55
+#define XK_PAGE_DOWN 0xff56
+#define XK_END 0xff57
+#define XK_SELECT 0xff60
+#define XK_PRINT 0xff61
+#define XK_EXECUTE 0xff62
+#define XK_INSERT 0xff63
+#define XK_MENU 0xff67
+#define XK_HELP 0xff6a
+#define XK_NUM_LOCK 0xff7f
+#define XK_KP_ENTER 0xff8d
+#define XK_KP_MULTIPLY 0xffaa
+#define XK_KP_DIVIDE 0xffaf
+#define XK_KP_0 0xffb0
+#define XK_KP_9 0xffb9
+#define XK_F1 0xffbe
+#define XK_F24 0xffd5
+#define XK_SHIFT_L 0xffe1
+#define XK_SHIFT_R 0xffe2
+#define XK_CONTROL_L 0xffe3
+#define XK_CONTROL_R 0xffe4
+#define XK_CAPS_LOCK 0xffe5
+#define XK_ALT_L 0xffe9
+#define XK_ALT_R 0xffea
+#define XK_SUPER_L 0xffeb
+#define XK_SUPER_R 0xffec
+#define XK_DELETE 0xffff
+
+STATIC_ASSERT(WINDOW_KEYCODE_COUNT == XCB_MAX_KEYCODES, window_keycode_table_must_cover_every_keycode)
+
+static keyboard_key keysym_to_key(xcb_keysym_t keysym) {
+    if (keysym >= 'a' && keysym <= 'z') {
+        return (keyboard_key)(KEY_A + (keysym - 'a'));
+    }
+    if (keysym >= 'A' && keysym <= 'Z') {
+        return (keyboard_key)(KEY_A + (keysym - 'A'));
+    }
+    if (keysym >= '0' && keysym <= '9') {
+        return (keyboard_key)(KEY_0 + (keysym - '0'));
+    }
+    if (keysym >= XK_F1 && keysym <= XK_F24) {
+        return (keyboard_key)(KEY_F1 + (keysym - XK_F1));
+    }
+    if (keysym >= XK_KP_0 && keysym <= XK_KP_9) {
+        return (keyboard_key)(KEY_NUMPAD_0 + (keysym - XK_KP_0));
+    }
+    if (keysym >= XK_KP_MULTIPLY && keysym <= XK_KP_DIVIDE) {
+        // KP_Multiply, KP_Add, KP_Separator, KP_Subtract, KP_Decimal, KP_Divide share the Win32 order.
+        return (keyboard_key)(KEY_MULTIPLY + (keysym - XK_KP_MULTIPLY));
+    }
+
+    switch (keysym) {
+    case ' ': return KEY_SPACE;
+    case XK_BACKSPACE: return KEY_BACKSPACE;
+    case XK_TAB: return KEY_TAB;
+    case XK_RETURN: return KEY_ENTER;
+    case XK_KP_ENTER: return KEY_ENTER;
+    case XK_PAUSE: return KEY_PAUSE;
+    case XK_SCROLL_LOCK: return KEY_SCROLL_LOCK;
+    case XK_ESCAPE: return KEY_ESCAPE;
+    case XK_HOME: return KEY_HOME;
+    case XK_LEFT: return KEY_LEFT;
+    case XK_UP: return KEY_UP;
+    case XK_RIGHT: return KEY_RIGHT;
+    case XK_DOWN: return KEY_DOWN;
+    case XK_PAGE_UP: return KEY_PAGE_UP;
+    case XK_PAGE_DOWN: return KEY_PAGE_DOWN;
+    case XK_END: return KEY_END;
+    case XK_SELECT: return KEY_SELECT;
+    case XK_PRINT: return KEY_PRINT_SCREEN;
+    case XK_EXECUTE: return KEY_EXEC;
+    case XK_INSERT: return KEY_INSERT;
+    case XK_MENU: return KEY_APPLICATION;
+    case XK_HELP: return KEY_HELP;
+    case XK_NUM_LOCK: return KEY_NUM_LOCK;
+    case XK_SHIFT_L: return KEY_SHIFT;
+    case XK_SHIFT_R: return KEY_SHIFT;
+    case XK_CONTROL_L: return KEY_CTRL;
+    case XK_CONTROL_R: return KEY_CTRL;
+    case XK_CAPS_LOCK: return KEY_CAPS_LOCK;
+    case XK_ALT_L: return KEY_ALT;
+    case XK_ALT_R: return KEY_ALT;
+    case XK_SUPER_L: return KEY_LEFT_WINDOWS;
+    case XK_SUPER_R: return KEY_RIGHT_WINDOWS;
+    case XK_DELETE: return KEY_DELETE;
+    default: return KEY_NONE;
+    }
+}
+
+// Returns the character a keysym types, or 0 if it does not type one.
+// Matches WM_CHAR, which also reports backspace, tab and enter as characters.
+static wchar_t keysym_to_character(xcb_keysym_t keysym) {
+    if ((keysym >= 0x20 && keysym <= 0x7e) || (keysym >= 0xa0 && keysym <= 0xff)) {
+        return (wchar_t)keysym;
+    }
+    if ((keysym & 0xff000000) == 0x01000000) {
+        return (wchar_t)(keysym & 0x00ffffff);
+    }
+
+    switch (keysym) {
+    case XK_BACKSPACE: return L'\b';
+    case XK_TAB: return L'\t';
+    case XK_RETURN: return L'\r';
+    case XK_KP_ENTER: return L'\r';
+    default: return 0;
+    }
+}
+
+// Each window has its own connection, so each keeps its own copy of the mapping; a copy
+// shared between windows would be rewritten by one pump thread while another reads it.
+static result load_keyboard_mapping(xcb_connection_t* connection, window* window) {
+    const xcb_setup_t* setup = xcb_get_setup(connection);
+    uint8_t count = (uint8_t)(setup->max_keycode - setup->min_keycode + 1);
+    xcb_get_keyboard_mapping_reply_t* reply = xcb_get_keyboard_mapping_reply(connection,
+        xcb_get_keyboard_mapping(connection, setup->min_keycode, count), NULL);
+    if (reply == NULL) {
+        ERROR_BREAKPOINT("Failed to get keyboard mapping");
+        return RESULT_FAILURE;
+    }
+
+    const xcb_keysym_t* keysyms = xcb_get_keyboard_mapping_keysyms(reply);
+    uint32_t per_keycode = reply->keysyms_per_keycode;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t keycode = setup->min_keycode + i;
+        xcb_keysym_t unshifted = per_keycode > 0 ? keysyms[i * per_keycode] : 0;
+        xcb_keysym_t shifted = per_keycode > 1 ? keysyms[i * per_keycode + 1] : 0;
+        window->keycode_keysyms[keycode][0] = unshifted;
+        window->keycode_keysyms[keycode][1] = shifted != 0 ? shifted : unshifted;
+        window->keycode_to_key[keycode] = (uint8_t)keysym_to_key(unshifted);
+    }
+
+    free(reply);
+    return RESULT_SUCCESS;
+}
+
+static wchar_t keycode_to_character(const window* window, xcb_keycode_t keycode, uint16_t modifier_state) {
+    bool shift = (modifier_state & XCB_MOD_MASK_SHIFT) != 0;
+    xcb_keysym_t unshifted = window->keycode_keysyms[keycode][0];
+    if ((modifier_state & XCB_MOD_MASK_LOCK) && unshifted >= 'a' && unshifted <= 'z') {
+        shift = !shift;
+    }
+    return keysym_to_character(window->keycode_keysyms[keycode][shift ? 1 : 0]);
+}
+
+static xcb_atom_t reply_to_atom(xcb_connection_t* connection, xcb_intern_atom_cookie_t cookie) {
+    xcb_intern_atom_reply_t* reply = xcb_intern_atom_reply(connection, cookie, NULL);
+    if (reply == NULL) {
+        return XCB_ATOM_NONE;
+    }
+    xcb_atom_t atom = reply->atom;
+    free(reply);
+    return atom;
+}
+
+#define INTERN_ATOM(connection, name) xcb_intern_atom(connection, 0, sizeof(name) - 1, name)
+
+static result create_native_window(const char* title, uint32_t width, uint32_t height, window_mode mode, window* out_window) {
+    int screen_index = 0;
+    xcb_connection_t* connection = xcb_connect(NULL, &screen_index);
+    if (xcb_connection_has_error(connection)) {
+        xcb_disconnect(connection);
+        ERROR_BREAKPOINT("Failed to connect to the X server");
+        return RESULT_FAILURE;
+    }
+
+    xcb_screen_iterator_t screens = xcb_setup_roots_iterator(xcb_get_setup(connection));
+    for (int i = 0; i < screen_index && screens.rem > 0; ++i) {
+        xcb_screen_next(&screens);
+    }
+    xcb_screen_t* screen = screens.data;
+
+    if (mode == WINDOW_MODE_FULLSCREEN) {
+        width = screen->width_in_pixels;
+        height = screen->height_in_pixels;
+    }
+    else {
+        DEBUG_ASSERT(mode == WINDOW_MODE_WINDOWED || mode == WINDOW_MODE_BORDERLESS, , "Window mode not supported");
+    }
+
+    // Send every atom request up front so they resolve in one round trip.
+    xcb_intern_atom_cookie_t protocols_cookie = INTERN_ATOM(connection, "WM_PROTOCOLS");
+    xcb_intern_atom_cookie_t delete_cookie = INTERN_ATOM(connection, "WM_DELETE_WINDOW");
+    xcb_intern_atom_cookie_t state_cookie = INTERN_ATOM(connection, "_NET_WM_STATE");
+    xcb_intern_atom_cookie_t fullscreen_cookie = INTERN_ATOM(connection, "_NET_WM_STATE_FULLSCREEN");
+    xcb_intern_atom_cookie_t motif_hints_cookie = INTERN_ATOM(connection, "_MOTIF_WM_HINTS");
+
+    xcb_window_t handle = xcb_generate_id(connection);
+    uint32_t value_mask = XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK;
+    uint32_t values[2] = {
+        screen->white_pixel,
+        XCB_EVENT_MASK_KEY_PRESS | XCB_EVENT_MASK_KEY_RELEASE |
+        XCB_EVENT_MASK_BUTTON_PRESS | XCB_EVENT_MASK_BUTTON_RELEASE |
+        XCB_EVENT_MASK_POINTER_MOTION | XCB_EVENT_MASK_STRUCTURE_NOTIFY,
+    };
+    xcb_create_window(connection, XCB_COPY_FROM_PARENT, handle, screen->root,
+        0, 0, (uint16_t)width, (uint16_t)height, 0,
+        XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual, value_mask, values);
+
+    xcb_change_property(connection, XCB_PROP_MODE_REPLACE, handle, XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8, (uint32_t)strlen(title), title);
+
+    xcb_atom_t protocols_atom = reply_to_atom(connection, protocols_cookie);
+    xcb_atom_t delete_atom = reply_to_atom(connection, delete_cookie);
+    xcb_atom_t state_atom = reply_to_atom(connection, state_cookie);
+    xcb_atom_t fullscreen_atom = reply_to_atom(connection, fullscreen_cookie);
+    xcb_atom_t motif_hints_atom = reply_to_atom(connection, motif_hints_cookie);
+
+    // Without WM_DELETE_WINDOW the window manager kills the connection instead of asking us to close.
+    xcb_change_property(connection, XCB_PROP_MODE_REPLACE, handle, protocols_atom, XCB_ATOM_ATOM, 32, 1, &delete_atom);
+
+    if (mode == WINDOW_MODE_FULLSCREEN) {
+        xcb_change_property(connection, XCB_PROP_MODE_REPLACE, handle, state_atom, XCB_ATOM_ATOM, 32, 1, &fullscreen_atom);
+    }
+    else if (mode == WINDOW_MODE_BORDERLESS) {
+        // flags, functions, decorations, input mode, status: only the decorations hint is set.
+        uint32_t motif_hints[5] = { 2, 0, 0, 0, 0 };
+        xcb_change_property(connection, XCB_PROP_MODE_REPLACE, handle, motif_hints_atom, motif_hints_atom, 32, 5, motif_hints);
+    }
+
+    if (load_keyboard_mapping(connection, out_window) != RESULT_SUCCESS) {
+        xcb_destroy_window(connection, handle);
+        xcb_disconnect(connection);
+        return RESULT_FAILURE;
+    }
+
+    xcb_map_window(connection, handle);
+
+    xcb_query_pointer_reply_t* pointer = xcb_query_pointer_reply(connection, xcb_query_pointer(connection, handle), NULL);
+    if (pointer != NULL) {
+        if (pointer->same_screen) {
+            out_window->input.mouse.x = pointer->win_x;
+            out_window->input.mouse.y = pointer->win_y;
+        }
+        free(pointer);
+    }
+
+    if (xcb_connection_has_error(connection)) {
+        xcb_disconnect(connection);
+        ERROR_BREAKPOINT("Failed to create window");
+        return RESULT_FAILURE;
+    }
+
+    out_window->handle = (void*)(uintptr_t)handle;
+    out_window->input.width = width;
+    out_window->input.height = height;
+    out_window->connection = connection;
+    out_window->delete_window_atom = delete_atom;
+    return RESULT_SUCCESS;
+}
+
+static keyboard_key button_to_key(xcb_button_t button) {
+    switch (button) {
+    case XCB_BUTTON_INDEX_1: return KEY_LEFT_MOUSE;
+    case XCB_BUTTON_INDEX_2: return KEY_MIDDLE_MOUSE;
+    case XCB_BUTTON_INDEX_3: return KEY_RIGHT_MOUSE;
+    default: return KEY_NONE;
+    }
+}
+
+// X reports auto-repeat as a release immediately followed by a press with the same
+// timestamp. Win32 only repeats WM_KEYDOWN, so the synthetic release is dropped here.
+static bool is_auto_repeat_release(const xcb_key_release_event_t* release, const xcb_generic_event_t* next) {
+    if (next == NULL || (next->response_type & ~0x80) != XCB_KEY_PRESS) {
+        return false;
+    }
+    const xcb_key_press_event_t* press = (const xcb_key_press_event_t*)next;
+    return press->detail == release->detail && press->time == release->time;
+}
+
+// Key, button and motion events share the layout up to their server time field.
+static uint64_t native_event_timestamp(window* window, const xcb_generic_event_t* event) {
+    switch (event->response_type & ~0x80) {
+    case XCB_KEY_PRESS:
+    case XCB_KEY_RELEASE:
+    case XCB_BUTTON_PRESS:
+    case XCB_BUTTON_RELEASE:
+    case XCB_MOTION_NOTIFY:
+        return os_event_time_to_nanoseconds(window, ((const xcb_key_press_event_t*)event)->time, get_time_nanoseconds());
+    default:
+        return 0;
+    }
+}
+
+static void handle_event(window* window, const xcb_generic_event_t* event, const xcb_generic_event_t* next) {
+    switch (event->response_type & ~0x80) {
+    case XCB_KEY_PRESS: {
+        const xcb_key_press_event_t* press = (const xcb_key_press_event_t*)event;
+        keyboard_key key = (keyboard_key)window->keycode_to_key[press->detail];
+        if (key != KEY_NONE) {
+            push_input_event(window, (input_event){ .type = INPUT_EVENT_KEY_DOWN, .key = key });
+        }
+        wchar_t character = keycode_to_character(window, press->detail, press->state);
+        if (character != 0 && !(press->state & XCB_MOD_MASK_CONTROL)) {
+            push_input_event(window, (input_event){ .type = INPUT_EVENT_CHARACTER, .character = character });
+        }
+    } break;
+    case XCB_KEY_RELEASE: {
+        const xcb_key_release_event_t* release = (const xcb_key_release_event_t*)event;
+        keyboard_key key = (keyboard_key)window->keycode_to_key[release->detail];
+        if (key != KEY_NONE && !is_auto_repeat_release(release, next)) {
+            push_input_event(window, (input_event){ .type = INPUT_EVENT_KEY_UP, .key = key });
+        }
+    } break;
+    case XCB_BUTTON_PRESS: {
+        const xcb_button_press_event_t* press = (const xcb_button_press_event_t*)event;
+        if (press->detail == XCB_BUTTON_INDEX_4) {
+            push_input_event(window, (input_event){ .type = INPUT_EVENT_MOUSE_WHEEL, .wheel_delta = XCB_WHEEL_DELTA });
+        }
+        else if (press->detail == XCB_BUTTON_INDEX_5) {
+            push_input_event(window, (input_event){ .type = INPUT_EVENT_MOUSE_WHEEL, .wheel_delta = -XCB_WHEEL_DELTA });
+        }
+        else if (button_to_key(press->detail) != KEY_NONE) {
+            push_input_event(window, (input_event){ .type = INPUT_EVENT_BUTTON_DOWN, .key = button_to_key(press->detail) });
+        }
+    } break;
+    case XCB_BUTTON_RELEASE: {
+        const xcb_button_release_event_t* release = (const xcb_button_release_event_t*)event;
+        if (button_to_key(release->detail) != KEY_NONE) {
+            push_input_event(window, (input_event){ .type = INPUT_EVENT_BUTTON_UP, .key = button_to_key(release->detail) });
+        }
+    } break;
+    case XCB_MOTION_NOTIFY: {
+        const xcb_motion_notify_event_t* motion = (const xcb_motion_notify_event_t*)event;
+        push_input_event(window, (input_event){ .type = INPUT_EVENT_MOUSE_MOTION, .motion = { motion->event_x, motion->event_y } });
+    } break;
+    case XCB_CONFIGURE_NOTIFY: {
+        // Also sent for moves and restacking; apply_input_event ignores an unchanged size.
+        const xcb_configure_notify_event_t* configure = (const xcb_configure_notify_event_t*)event;
+        push_input_event(window, (input_event){ .type = INPUT_EVENT_RESIZE, .size = { configure->width, configure->height } });
+    } break;
+    case XCB_CLIENT_MESSAGE: {
+        const xcb_client_message_event_t* message = (const xcb_client_message_event_t*)event;
+        if (message->data.data32[0] == window->delete_window_atom) {
+            push_input_event(window, (input_event){ .type = INPUT_EVENT_CLOSE });
+        }
+    } break;
+    case XCB_MAPPING_NOTIFY: {
+        const xcb_mapping_notify_event_t* mapping = (const xcb_mapping_notify_event_t*)event;
+        if (mapping->request == XCB_MAPPING_KEYBOARD) {
+            load_keyboard_mapping(window->connection, window);
+        }
+    } break;
+    }
+}
+
+static void drain_native_events(window* window, xcb_generic_event_t* event) {
+    PROFILE_BEGIN("drain_native_events");
+    xcb_connection_t* connection = window->connection;
+    while (event != NULL) {
+        xcb_generic_event_t* next = xcb_poll_for_queued_event(connection);
+        window->os_event_timestamp = native_event_timestamp(window, event);
+        handle_event(window, event, next);
+        free(event);
+        event = next;
+    }
+    window->os_event_timestamp = 0;
+
+    if (xcb_connection_has_error(connection)) {
+        push_input_event(window, (input_event){ .type = INPUT_EVENT_CLOSE });
+    }
+    PROFILE_END();
+}
+
+static void pump_native_events(window* window) {
+    if (xcb_flush(window->connection) <= 0) {
+        push_input_event(window, (input_event){ .type = INPUT_EVENT_CLOSE });
+        return;
+    }
+
+    // One socket read pulls in everything the server has sent; the rest of the batch is
+    // drained from libxcb's queue without touching the socket again.
+    drain_native_events(window, xcb_poll_for_event(window->connection));
+}
+
+static void wait_native_events(window* window) {
+    xcb_generic_event_t* event = xcb_wait_for_event(window->connection);
+    if (event == NULL) {
+        // The connection is gone; report it once and stop pumping.
+        push_input_event(window, (input_event){ .type = INPUT_EVENT_CLOSE });
+        atomic_store_explicit(&window->pump_state, WINDOW_PUMP_STOPPING, memory_order_release);
+        return;
+    }
+    drain_native_events(window, event);
+}
+
+// Sends the window a client message that handle_event ignores, only to return the pump
+// thread from xcb_wait_for_event.
+static void wake_native_pump(window* window) {
+    xcb_client_message_event_t message = { 0 };
+    message.response_type = XCB_CLIENT_MESSAGE;
+    message.format = 32;
+    message.window = (xcb_window_t)(uintptr_t)window->handle;
+    message.type = XCB_ATOM_NONE;
+    xcb_send_event(window->connection, 0, message.window, XCB_EVENT_MASK_NO_EVENT, (const char*)&message);
+    xcb_flush(window->connection);
+}
+
+static void destroy_native_window(window* window) {
+    if (window->connection != NULL) {
+        if (window->handle != NULL) {
+            xcb_destroy_window(window->connection, (xcb_window_t)(uintptr_t)window->handle);
+            window->handle = NULL;
+        }
+        xcb_disconnect(window->connection);
+        window->connection = NULL;
+    }
+}
+
+static void yield_thread(void) {
+    sched_yield();
+}
+
+static void* thread_start(void* data) {
+    thread* thread = data;
+    thread->function(thread->data);
+    release_scratch_arenas();
+    return NULL;
+}
+
+STATIC_ASSERT(sizeof(pthread_t) <= sizeof(void*), thread_handle_size_mismatch);
+
+result create_thread(thread_function function, void* data, thread* out_thread) {
+    ASSERT(function != NULL, return RESULT_FAILURE, "Thread function is null");
+    ASSERT(out_thread != NULL, return RESULT_FAILURE, "Thread pointer is null");
+    out_thread->function = function;
+    out_thread->data = data;
+    pthread_t handle;
+    if (pthread_create(&handle, NULL, thread_start, out_thread) != 0) {
+        out_thread->handle = NULL;
+        ERROR_BREAKPOINT("Failed to create thread");
+        return RESULT_FAILURE;
+    }
+    out_thread->handle = (void*)(uintptr_t)handle;
+    return RESULT_SUCCESS;
+}
+
+void destroy_thread(thread* thread) {
+    ASSERT(thread != NULL, return, "Thread pointer is null");
+    if (thread->handle != NULL) {
+        pthread_join((pthread_t)(uintptr_t)thread->handle, NULL);
+        thread->handle = NULL;
+    }
+}
+#endif
+
+typedef struct {
+    window* window;
+    const char* title;
+    uint32_t width;
+    uint32_t height;
+    window_mode mode;
+} window_creation;
+
+static void window_pump_thread(void* data) {
+    // creation lives on the stack of create_window, which only waits until the state leaves STARTING.
+    window_creation* creation = data;
+    window* window = creation->window;
+    PROFILE_THREAD_NAME("window pump");
+    if (create_native_window(creation->title, creation->width, creation->height, creation->mode, window) != RESULT_SUCCESS) {
+        atomic_store_explicit(&window->pump_state, WINDOW_PUMP_FAILED, memory_order_release);
+        return;
+    }
+    atomic_store_explicit(&window->pump_state, WINDOW_PUMP_RUNNING, memory_order_release);
+
+    while (atomic_load_explicit(&window->pump_state, memory_order_acquire) == WINDOW_PUMP_RUNNING) {
+        wait_native_events(window);
+    }
+
+#if defined(PLATFORM_WINDOWS)
+    // Win32 only lets the creating thread destroy a window. Elsewhere destroy_window tears the
+    // window down after the join, because wake_native_pump may still be using the connection.
+    destroy_native_window(window);
+#endif
+}
+
+result create_window(const char* title, uint32_t width, uint32_t height, window_mode mode, window_flags flags, window* out_window) {
+    if (!out_window) {
+        ERROR_BREAKPOINT("Window pointer is null");
+        return RESULT_FAILURE;
+    }
+
+    memset(out_window, 0, sizeof(window));
+    out_window->flags = flags;
+
+    if (!(flags & WINDOW_FLAG_PUMP_THREAD)) {
+        return create_native_window(title, width, height, mode, out_window);
+    }
+
+    // Win32 ties a window's messages to the thread that created it, so the pump thread creates it.
+    window_creation creation = { out_window, title, width, height, mode };
+    atomic_store_explicit(&out_window->pump_state, WINDOW_PUMP_STARTING, memory_order_relaxed);
+    if (create_thread(window_pump_thread, &creation, &out_window->pump_thread) != RESULT_SUCCESS) {
+        return RESULT_FAILURE;
+    }
+
+    while (atomic_load_explicit(&out_window->pump_state, memory_order_acquire) == WINDOW_PUMP_STARTING) {
+        yield_thread();
+    }
+
+    if (atomic_load_explicit(&out_window->pump_state, memory_order_acquire) == WINDOW_PUMP_FAILED) {
+        destroy_thread(&out_window->pump_thread);
+        return RESULT_FAILURE;
+    }
+
+    return RESULT_SUCCESS;
+}
+
+void update_window_input(window* window) {
+    if (window == NULL) {
+        ERROR_BREAKPOINT("Window pointer is null");
+        return;
+    }
+
+    if (!(window->flags & WINDOW_FLAG_PUMP_THREAD)) {
+        if (window->handle == NULL) {
+            ERROR_BREAKPOINT("Window handle is null");
+            return;
+        }
+        begin_input_frame(&window->input);
+        pump_native_events(window);
+        end_input_frame(&window->input);
+        return;
+    }
+
+    // The pump thread owns the native window; this side only reads the channel.
+    PROFILE_BEGIN("drain_pump_events");
+    begin_input_frame(&window->input);
+    uint64_t now = get_time_nanoseconds();
+    input_event event;
+    while (input_event_queue_pop(&window->pump_events, &event)) {
+        deliver_input_event(window, &event, now);
+    }
+    end_input_frame(&window->input);
+    PROFILE_END();
+}
+
+void destroy_window(window* window) {
+    if (window == NULL) {
+        ERROR_BREAKPOINT("Window pointer is null");
+        return;
+    }
+
+    if (!(window->flags & WINDOW_FLAG_PUMP_THREAD)) {
+        destroy_native_window(window);
+        return;
+    }
+
+    if (window->pump_thread.handle != NULL) {
+        int running = WINDOW_PUMP_RUNNING;
+        if (atomic_compare_exchange_strong(&window->pump_state, &running, WINDOW_PUMP_STOPPING)) {
+            wake_native_pump(window);
+        }
+        destroy_thread(&window->pump_thread);
+    }
+    destroy_native_window(window);
+}
+
+#if defined(PLATFORM_WINDOWS)
+static size_t get_page_size(void) {
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    return system_info.dwPageSize;
+}
+
+static void* reserve_memory(size_t size) {
+    return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+}
+
+static bool commit_memory(void* address, size_t size) {
+    return VirtualAlloc(address, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+}
+
+static void decommit_memory(void* address, size_t size) {
+    VirtualFree(address, size, MEM_DECOMMIT);
+}
+
+static void release_memory(void* address, size_t size) {
+    (void)size;
+    VirtualFree(address, 0, MEM_RELEASE);
+}
+#elif defined(PLATFORM_LINUX)
+static size_t get_page_size(void) {
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static void* reserve_memory(size_t size) {
+    void* address = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return address == MAP_FAILED ? NULL : address;
+}
+
+static bool commit_memory(void* address, size_t size) {
+    return mprotect(address, size, PROT_READ | PROT_WRITE) == 0;
+}
+
+static void decommit_memory(void* address, size_t size) {
+    // Drop the pages first so the kernel reclaims them, then fence the range off again.
+    madvise(address, size, MADV_DONTNEED);
+    mprotect(address, size, PROT_NONE);
+}
+
+static void release_memory(void* address, size_t size) {
+    munmap(address, size);
+}
+#endif
+
+// alignment must be a power of two.
+static size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+result create_arena_allocator(size_t reserve_size, size_t commit_chunk_size, arena_allocator* out_arena) {
+    ASSERT(out_arena != NULL, return RESULT_FAILURE, "Arena pointer is null");
+    ASSERT(reserve_size != 0, return RESULT_FAILURE, "Arena reserve size is zero");
+    memset(out_arena, 0, sizeof(arena_allocator));
+
+    size_t page_size = get_page_size();
+    if (commit_chunk_size == 0) {
+        commit_chunk_size = ARENA_DEFAULT_COMMIT_CHUNK_SIZE;
+    }
+    reserve_size = align_up(reserve_size, page_size);
+    commit_chunk_size = align_up(commit_chunk_size, page_size);
+
+    void* base = reserve_memory(reserve_size);
+    if (base == NULL) {
+        ERROR_BREAKPOINT("Failed to reserve arena address space");
+        return RESULT_FAILURE;
+    }
+
+    out_arena->base = base;
+    out_arena->reserved_size = reserve_size;
+    out_arena->commit_chunk_size = commit_chunk_size;
+    return RESULT_SUCCESS;
+}
+
+void destroy_arena_allocator(arena_allocator* arena) {
+    ASSERT(arena != NULL, return, "Arena pointer is null");
+    if (arena->base != NULL) {
+        release_memory(arena->base, arena->reserved_size);
+    }
+    memset(arena, 0, sizeof(arena_allocator));
+}
+
+void* arena_allocate(arena_allocator* arena, size_t size, size_t alignment) {
+    ASSERT(arena != NULL && arena->base != NULL, return NULL, "Arena is not created");
+    DEBUG_ASSERT(alignment != 0 && (alignment & (alignment - 1)) == 0, return NULL, "Alignment must be a power of two");
+
+    size_t start = align_up(arena->used, alignment);
+    if (start < arena->used || start > arena->reserved_size || size > arena->reserved_size - start) {
+        ERROR_BREAKPOINT("Arena reservation exhausted");
+        return NULL;
+    }
+
+    size_t end = start + size;
+    if (end > arena->committed_size) {
+        // The chunk size is a whole number of pages but not necessarily a power of two.
+        size_t chunk = arena->commit_chunk_size;
+        size_t commit_end = (end + chunk - 1) / chunk * chunk;
+        if (commit_end > arena->reserved_size) {
+            commit_end = arena->reserved_size;
+        }
+        if (!commit_memory(arena->base + arena->committed_size, commit_end - arena->committed_size)) {
+            ERROR_BREAKPOINT("Failed to commit arena memory");
+            return NULL;
+        }
+        arena->committed_size = commit_end;
+    }
+
+    arena->used = end;
+    return arena->base + start;
+}
+
+void* arena_allocate_zeroed(arena_allocator* arena, size_t size, size_t alignment) {
+    void* memory = arena_allocate(arena, size, alignment);
+    if (memory != NULL) {
+        memset(memory, 0, size);
+    }
+    return memory;
+}
+
+void* arena_copy(arena_allocator* arena, const void* source, size_t size, size_t alignment) {
+    ASSERT(source != NULL || size == 0, return NULL, "Source pointer is null");
+    void* memory = arena_allocate(arena, size, alignment);
+    if (memory != NULL && size != 0) {
+        memcpy(memory, source, size);
+    }
+    return memory;
+}
+
+void arena_restore(arena_allocator* arena, arena_marker marker) {
+    ASSERT(arena != NULL, return, "Arena pointer is null");
+    DEBUG_ASSERT(marker.used <= arena->used, return, "Arena marker is newer than the arena position");
+    arena->used = marker.used;
+}
+
+void arena_reset(arena_allocator* arena, bool decommit) {
+    ASSERT(arena != NULL, return, "Arena pointer is null");
+    arena->used = 0;
+    if (decommit && arena->committed_size != 0) {
+        decommit_memory(arena->base, arena->committed_size);
+        arena->committed_size = 0;
+    }
+}
+
+static THREAD_LOCAL arena_allocator scratch_arenas[SCRATCH_ARENA_COUNT];
+
+scratch_arena begin_scratch(arena_allocator* const* conflicts, uint32_t conflict_count) {
+    scratch_arena scratch = { 0 };
+    for (uint32_t i = 0; i < SCRATCH_ARENA_COUNT; ++i) {
+        arena_allocator* candidate = &scratch_arenas[i];
+        bool conflicting = false;
+        for (uint32_t j = 0; j < conflict_count; ++j) {
+            if (conflicts[j] == candidate) {
+                conflicting = true;
+                break;
+            }
+        }
+        if (conflicting) {
+            continue;
+        }
+
+        if (candidate->base == NULL && create_arena_allocator(SCRATCH_ARENA_RESERVE_SIZE, 0, candidate) != RESULT_SUCCESS) {
+            return scratch;
+        }
+        scratch.arena = candidate;
+        scratch.marker = arena_save(candidate);
+        return scratch;
+    }
+
+    ERROR_BREAKPOINT("Every scratch arena is in the conflict list");
+    return scratch;
+}
+
+void end_scratch(scratch_arena scratch) {
+    if (scratch.arena != NULL) {
+        arena_restore(scratch.arena, scratch.marker);
+    }
+}
+
+void release_scratch_arenas(void) {
+    for (uint32_t i = 0; i < SCRATCH_ARENA_COUNT; ++i) {
+        if (scratch_arenas[i].base != NULL) {
+            destroy_arena_allocator(&scratch_arenas[i]);
+        }
+    }
+}
+
+result create_frame_allocator(uint32_t frame_count, size_t reserve_size_per_frame, frame_allocator* out_allocator) {
+    ASSERT(out_allocator != NULL, return RESULT_FAILURE, "Frame allocator pointer is null");
+    ASSERT(frame_count != 0 && frame_count <= MAX_FRAME_ALLOCATOR_FRAMES, return RESULT_FAILURE, "Frame count is out of range");
+    memset(out_allocator, 0, sizeof(frame_allocator));
+    out_allocator->frame_count = frame_count;
+    for (uint32_t i = 0; i < frame_count; ++i) {
+        if (create_arena_allocator(reserve_size_per_frame, 0, &out_allocator->arenas[i]) != RESULT_SUCCESS) {
+            destroy_frame_allocator(out_allocator);
+            return RESULT_FAILURE;
+        }
+    }
+    return RESULT_SUCCESS;
+}
+
+void destroy_frame_allocator(frame_allocator* allocator) {
+    ASSERT(allocator != NULL, return, "Frame allocator pointer is null");
+    for (uint32_t i = 0; i < allocator->frame_count; ++i) {
+        if (allocator->arenas[i].base != NULL) {
+            destroy_arena_allocator(&allocator->arenas[i]);
+        }
+    }
+}
+
+arena_allocator* begin_frame_allocator(frame_allocator* allocator, uint32_t frame_slot) {
+    ASSERT(allocator != NULL, return NULL, "Frame allocator pointer is null");
+    ASSERT(frame_slot < allocator->frame_count, return NULL, "Frame slot is out of range");
+    arena_allocator* arena = &allocator->arenas[frame_slot];
+    arena_reset(arena, false);
+    return arena;
+}
+
+#define FILE_PATH_CAPACITY 4096
+
+#if defined(PLATFORM_WINDOWS)
+result create_file_mapping(const char* path, file_mapping* out_mapping) {
+    ASSERT(path != NULL, return RESULT_FAILURE, "File path is null");
+    ASSERT(out_mapping != NULL, return RESULT_FAILURE, "File mapping pointer is null");
+    memset(out_mapping, 0, sizeof(file_mapping));
+
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return RESULT_FAILURE;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        ERROR_BREAKPOINT("Failed to query the file size");
+        return RESULT_FAILURE;
+    }
+    if (size.QuadPart == 0) {
+        CloseHandle(file);
+        return RESULT_SUCCESS;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL) {
+        ERROR_BREAKPOINT("Failed to create the file mapping");
+        return RESULT_FAILURE;
+    }
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (data == NULL) {
+        ERROR_BREAKPOINT("Failed to map the file");
+        return RESULT_FAILURE;
+    }
+
+    out_mapping->data = data;
+    out_mapping->size = (size_t)size.QuadPart;
+    return RESULT_SUCCESS;
+}
+
+void destroy_file_mapping(file_mapping* mapping) {
+    ASSERT(mapping != NULL, return, "File mapping pointer is null");
+    if (mapping->data != NULL) {
+        UnmapViewOfFile(mapping->data);
+    }
+    memset(mapping, 0, sizeof(file_mapping));
+}
+
+result write_file_atomically(const char* path, const void* data, size_t size) {
+    ASSERT(path != NULL, return RESULT_FAILURE, "File path is null");
+    ASSERT(data != NULL || size == 0, return RESULT_FAILURE, "File data is null");
+
+    char temporary_path[FILE_PATH_CAPACITY];
+    if (snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path) >= (int)sizeof(temporary_path)) {
+        ERROR_BREAKPOINT("File path is too long");
+        return RESULT_FAILURE;
+    }
+
+    HANDLE file = CreateFileA(temporary_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        ERROR_BREAKPOINT("Failed to create the temporary file");
+        return RESULT_FAILURE;
+    }
+
+    const uint8_t* bytes = data;
+    bool written = true;
+    while (size > 0 && written) {
+        DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+        DWORD chunk_written = 0;
+        written = WriteFile(file, bytes, chunk, &chunk_written, NULL) && chunk_written == chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+    written = written && FlushFileBuffers(file);
+    CloseHandle(file);
+
+    if (!written || !MoveFileExA(temporary_path, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        DeleteFileA(temporary_path);
+        ERROR_BREAKPOINT("Failed to write the file");
+        return RESULT_FAILURE;
+    }
+    return RESULT_SUCCESS;
+}
+#elif defined(PLATFORM_LINUX)
+result create_file_mapping(const char* path, file_mapping* out_mapping) {
+    ASSERT(path != NULL, return RESULT_FAILURE, "File path is null");
+    ASSERT(out_mapping != NULL, return RESULT_FAILURE, "File mapping pointer is null");
+    memset(out_mapping, 0, sizeof(file_mapping));
+
+    int descriptor = open(path, O_RDONLY | O_CLOEXEC);
+    if (descriptor < 0) {
+        return RESULT_FAILURE;
+    }
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0) {
+        close(descriptor);
+        ERROR_BREAKPOINT("Failed to query the file size");
+        return RESULT_FAILURE;
+    }
+    if (status.st_size == 0) {
+        close(descriptor);
+        return RESULT_SUCCESS;
+    }
+
+    void* data = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (data == MAP_FAILED) {
+        ERROR_BREAKPOINT("Failed to map the file");
+        return RESULT_FAILURE;
+    }
+
+    out_mapping->data = data;
+    out_mapping->size = (size_t)status.st_size;
+    return RESULT_SUCCESS;
+}
+
+void destroy_file_mapping(file_mapping* mapping) {
+    ASSERT(mapping != NULL, return, "File mapping pointer is null");
+    if (mapping->data != NULL) {
+        munmap((void*)mapping->data, mapping->size);
+    }
+    memset(mapping, 0, sizeof(file_mapping));
+}
+
+result write_file_atomically(const char* path, const void* data, size_t size) {
+    ASSERT(path != NULL, return RESULT_FAILURE, "File path is null");
+    ASSERT(data != NULL || size == 0, return RESULT_FAILURE, "File data is null");
+
+    char temporary_path[FILE_PATH_CAPACITY];
+    if (snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path) >= (int)sizeof(temporary_path)) {
+        ERROR_BREAKPOINT("File path is too long");
+        return RESULT_FAILURE;
+    }
+
+    int descriptor = open(temporary_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (descriptor < 0) {
+        ERROR_BREAKPOINT("Failed to create the temporary file");
+        return RESULT_FAILURE;
+    }
+
+    const uint8_t* bytes = data;
+    bool written = true;
+    while (size > 0) {
+        ssize_t chunk = write(descriptor, bytes, size);
+        if (chunk < 0 && errno == EINTR) {
+            continue;
+        }
+        if (chunk <= 0) {
+            written = false;
+            break;
+        }
+        bytes += chunk;
+        size -= (size_t)chunk;
+    }
+    written = written && fsync(descriptor) == 0;
+    close(descriptor);
+
+    if (!written || rename(temporary_path, path) != 0) {
+        unlink(temporary_path);
+        ERROR_BREAKPOINT("Failed to write the file");
+        return RESULT_FAILURE;
+    }
+
+    // The rename itself is only durable once the directory entry is flushed.
+    char directory_path[FILE_PATH_CAPACITY];
+    memcpy(directory_path, path, strlen(path) + 1);
+    char* separator = strrchr(directory_path, '/');
+    if (separator == directory_path) {
+        separator[1] = '\0';
+    }
+    else if (separator != NULL) {
+        separator[0] = '\0';
+    }
+    else {
+        memcpy(directory_path, ".", 2);
+    }
+    int directory = open(directory_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directory >= 0) {
+        fsync(directory);
+        close(directory);
+    }
+    return RESULT_SUCCESS;
+}
+#endif
+
+#if defined(PLATFORM_WINDOWS)
+// Views must start on an allocation granularity boundary, usually 64 KiB.
+static uint64_t get_mapping_granularity(void) {
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    return system_info.dwAllocationGranularity;
+}
+
+result open_mapped_file(const char* path, bool writable, mapped_file* out_file) {
+    ASSERT(path != NULL, return RESULT_FAILURE, "File path is null");
+    ASSERT(out_file != NULL, return RESULT_FAILURE, "Mapped file pointer is null");
+    memset(out_file, 0, sizeof(mapped_file));
+
+    DWORD access = writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ;
+    HANDLE file = CreateFileA(path, access, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return RESULT_FAILURE;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        ERROR_BREAKPOINT("Failed to query the file size");
+        return RESULT_FAILURE;
+    }
+    // Empty files cannot have a mapping object; they simply have no views.
+    if (size.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) {
+            CloseHandle(file);
+            ERROR_BREAKPOINT("Failed to create the file mapping");
+            return RESULT_FAILURE;
+        }
+        out_file->handle = mapping;
+    }
+
+    out_file->file_handle = file;
+    out_file->size = (uint64_t)size.QuadPart;
+    out_file->writable = writable;
+    return RESULT_SUCCESS;
+}
+
+void close_mapped_file(mapped_file* file) {
+    ASSERT(file != NULL, return, "Mapped file pointer is null");
+    if (file->handle != NULL) {
+        CloseHandle(file->handle);
+    }
+    if (file->file_handle != NULL) {
+        CloseHandle(file->file_handle);
+    }
+    memset(file, 0, sizeof(mapped_file));
+}
+
+static void* map_file_range(const mapped_file* file, uint64_t offset, size_t size, uint32_t flags) {
+    DWORD access = (flags & FILE_VIEW_WRITABLE) ? FILE_MAP_WRITE : FILE_MAP_READ;
+    return MapViewOfFile(file->handle, access, (DWORD)(offset >> 32), (DWORD)offset, size);
+}
+
+static void unmap_file_range(void* base, size_t size) {
+    (void)size;
+    UnmapViewOfFile(base);
+}
+
+// There is no way to prefetch file pages that are not mapped; the next view faults them in.
+static void prefetch_file_range(const mapped_file* file, uint64_t offset, size_t size) {
+    (void)file;
+    (void)offset;
+    (void)size;
+}
+
+void advise_file_view(const file_view* view, uint32_t flags) {
+    ASSERT(view != NULL, return, "File view pointer is null");
+    // Only read-ahead has an equivalent; the access pattern and page size hints are ignored.
+    if (view->base != NULL && (flags & (FILE_VIEW_WILLNEED | FILE_VIEW_POPULATE))) {
+        WIN32_MEMORY_RANGE_ENTRY range = { view->base, view->mapped_size };
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+    }
+}
+
+result flush_file_view(const mapped_file* file, const file_view* view, bool wait) {
+    ASSERT(file != NULL, return RESULT_FAILURE, "Mapped file pointer is null");
+    ASSERT(view != NULL, return RESULT_FAILURE, "File view pointer is null");
+    if (view->base == NULL) {
+        return RESULT_SUCCESS;
+    }
+    // FlushViewOfFile only queues the writes; the file handle flush waits for them.
+    if (!FlushViewOfFile(view->base, view->mapped_size) || (wait && !FlushFileBuffers(file->file_handle))) {
+        ERROR_BREAKPOINT("Failed to flush the file view");
+        return RESULT_FAILURE;
+    }
+    return RESULT_SUCCESS;
+}
+#elif defined(PLATFORM_LINUX)
+static uint64_t get_mapping_granularity(void) {
+    return (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+result open_mapped_file(const char* path, bool writable, mapped_file* out_file) {
+    ASSERT(path != NULL, return RESULT_FAILURE, "File path is null");
+    ASSERT(out_file != NULL, return RESULT_FAILURE, "Mapped file pointer is null");
+    memset(out_file, 0, sizeof(mapped_file));
+    out_file->descriptor = -1;
+
+    int descriptor = open(path, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (descriptor < 0) {
+        return RESULT_FAILURE;
+    }
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0) {
+        close(descriptor);
+        ERROR_BREAKPOINT("Failed to query the file size");
+        return RESULT_FAILURE;
+    }
+
+    out_file->descriptor = descriptor;
+    out_file->size = (uint64_t)status.st_size;
+    out_file->writable = writable;
+    return RESULT_SUCCESS;
+}
+
+void close_mapped_file(mapped_file* file) {
+    ASSERT(file != NULL, return, "Mapped file pointer is null");
+    if (file->descriptor >= 0) {
+        close(file->descriptor);
+    }
+    memset(file, 0, sizeof(mapped_file));
+    file->descriptor = -1;
+}
+
+static void* map_file_range(const mapped_file* file, uint64_t offset, size_t size, uint32_t flags) {
+    int protection = (flags & FILE_VIEW_WRITABLE) ? PROT_READ | PROT_WRITE : PROT_READ;
+    int map_flags = (flags & FILE_VIEW_WRITABLE) ? MAP_SHARED : MAP_PRIVATE;
+    if (flags & FILE_VIEW_POPULATE) {
+        map_flags |= MAP_POPULATE;
+    }
+    void* base = mmap(NULL, size, protection, map_flags, file->descriptor, (off_t)offset);
+    return base == MAP_FAILED ? NULL : base;
+}
+
+static void unmap_file_range(void* base, size_t size) {
+    munmap(base, size);
+}
+
+// Pulls the range into the page cache in the background, so a later view maps it without
+// waiting on the disk.
+static void prefetch_file_range(const mapped_file* file, uint64_t offset, size_t size) {
+    readahead(file->descriptor, (off64_t)offset, size);
+}
+
+void advise_file_view(const file_view* view, uint32_t flags) {
+    ASSERT(view != NULL, return, "File view pointer is null");
+    if (view->base == NULL) {
+        return;
+    }
+    if (flags & FILE_VIEW_SEQUENTIAL) {
+        madvise(view->base, view->mapped_size, MADV_SEQUENTIAL);
+    }
+    else if (flags & FILE_VIEW_RANDOM) {
+        madvise(view->base, view->mapped_size, MADV_RANDOM);
+    }
+    if (flags & FILE_VIEW_WILLNEED) {
+        madvise(view->base, view->mapped_size, MADV_WILLNEED);
+    }
+#if defined(MADV_HUGEPAGE)
+    // Fails harmlessly on kernels or filesystems without huge pages for file mappings.
+    if (flags & FILE_VIEW_HUGEPAGE) {
+        madvise(view->base, view->mapped_size, MADV_HUGEPAGE);
+    }
+#endif
+}
+
+result flush_file_view(const mapped_file* file, const file_view* view, bool wait) {
+    ASSERT(file != NULL, return RESULT_FAILURE, "Mapped file pointer is null");
+    ASSERT(view != NULL, return RESULT_FAILURE, "File view pointer is null");
+    if (view->base == NULL) {
+        return RESULT_SUCCESS;
+    }
+    if (msync(view->base, view->mapped_size, wait ? MS_SYNC : MS_ASYNC) != 0) {
+        ERROR_BREAKPOINT("Failed to flush the file view");
+        return RESULT_FAILURE;
+    }
+    return RESULT_SUCCESS;
+}
+#endif
+
+result map_file_view(const mapped_file* file, uint64_t offset, size_t size, uint32_t flags, file_view* out_view) {
+    ASSERT(file != NULL, return RESULT_FAILURE, "Mapped file pointer is null");
+    ASSERT(out_view != NULL, return RESULT_FAILURE, "File view pointer is null");
+    ASSERT(!(flags & FILE_VIEW_WRITABLE) || file->writable, return RESULT_FAILURE, "Writable view of a read-only file");
+    ASSERT(offset <= file->size, return RESULT_FAILURE, "File view starts past the end of the file");
+    memset(out_view, 0, sizeof(file_view));
+    if (size == 0) {
+        size = (size_t)(file->size - offset);
+    }
+    ASSERT(size <= file->size - offset, return RESULT_FAILURE, "File view extends past the end of the file");
+    out_view->offset = offset;
+    out_view->flags = flags;
+    if (size == 0) {
+        return RESULT_SUCCESS;
+    }
+
+    uint64_t aligned_offset = offset & ~(get_mapping_granularity() - 1);
+    size_t mapped_size = (size_t)(offset - aligned_offset) + size;
+    void* base = map_file_range(file, aligned_offset, mapped_size, flags);
+    if (base == NULL) {
+        ERROR_BREAKPOINT("Failed to map the file view");
+        return RESULT_FAILURE;
+    }
+
+    out_view->base = base;
+    out_view->mapped_size = mapped_size;
+    out_view->data = (uint8_t*)base + (offset - aligned_offset);
+    out_view->size = size;
+    advise_file_view(out_view, flags);
+    return RESULT_SUCCESS;
+}
+
+void unmap_file_view(file_view* view) {
+    ASSERT(view != NULL, return, "File view pointer is null");
+    if (view->base != NULL) {
+        unmap_file_range(view->base, view->mapped_size);
+    }
+    memset(view, 0, sizeof(file_view));
+}
+
+void create_file_window(const mapped_file* file, size_t window_size, uint32_t flags, file_window* out_window) {
+    ASSERT(file != NULL, return, "Mapped file pointer is null");
+    ASSERT(out_window != NULL, return, "File window pointer is null");
+    ASSERT(window_size > 0, return, "File window size is zero");
+    memset(out_window, 0, sizeof(file_window));
+    out_window->file = file;
+    out_window->window_size = align_up(window_size, (size_t)get_mapping_granularity());
+    out_window->flags = flags;
+}
+
+void destroy_file_window(file_window* window) {
+    ASSERT(window != NULL, return, "File window pointer is null");
+    unmap_file_view(&window->view);
+    memset(window, 0, sizeof(file_window));
+}
+
+void* slide_file_window(file_window* window, uint64_t offset, size_t size) {
+    ASSERT(window != NULL, return NULL, "File window pointer is null");
+    const mapped_file* file = window->file;
+    if (size == 0 || size > window->window_size || offset > file->size || size > file->size - offset) {
+        return NULL;
+    }
+    file_view* view = &window->view;
+    if (view->base != NULL && offset >= view->offset && offset - view->offset + size <= view->size) {
+        return (uint8_t*)view->data + (offset - view->offset);
+    }
+
+    unmap_file_view(view);
+    // A range straddling the window's end gets a view stretched by less than one granule,
+    // rather than failing.
+    uint64_t start = offset & ~(get_mapping_granularity() - 1);
+    uint64_t wanted = offset - start + size;
+    if (wanted < window->window_size) {
+        wanted = window->window_size;
+    }
+    if (wanted > file->size - start) {
+        wanted = file->size - start;
+    }
+    if (map_file_view(file, start, (size_t)wanted, window->flags, view) != RESULT_SUCCESS) {
+        return NULL;
+    }
+    window->remap_count++;
+    if ((window->flags & FILE_VIEW_SEQUENTIAL) && start + wanted < file->size) {
+        prefetch_file_range(file, start + wanted, window->window_size);
+    }
+    return (uint8_t*)view->data + (offset - start);
+}
+
+#if defined(PLATFORM_WINDOWS)
+// Processors the process may run on, which a job object or start /affinity can restrict.
+static DWORD_PTR get_process_affinity(void) {
+    DWORD_PTR process_mask = 0;
+    DWORD_PTR system_mask = 0;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask) || process_mask == 0) {
+        return 1;
+    }
+    return process_mask;
+}
+
+static uint32_t get_processor_count(void) {
+    DWORD_PTR mask = get_process_affinity();
+    uint32_t count = 0;
+    for (; mask != 0; mask &= mask - 1) {
+        count++;
+    }
+    return count;
+}
+
+// processor counts only the processors the process may run on.
+static bool pin_thread_to_processor(thread* thread, uint32_t processor) {
+    DWORD_PTR allowed = get_process_affinity();
+    processor %= get_processor_count();
+    for (uint32_t i = 0; i < processor; ++i) {
+        allowed &= allowed - 1;
+    }
+    return SetThreadAffinityMask(thread->handle, allowed & (~allowed + 1)) != 0;
+}
+
+// Sleeps while *address == expected. Spurious wake-ups are possible; callers re-check.
+static void wait_on_address(_Atomic uint32_t* address, uint32_t expected) {
+    WaitOnAddress((volatile void*)address, &expected, sizeof(expected), INFINITE);
+}
+
+static void wake_address(_Atomic uint32_t* address, uint32_t count) {
+    if (count == 1) {
+        WakeByAddressSingle((void*)address);
+    }
+    else {
+        WakeByAddressAll((void*)address);
+    }
+}
+#elif defined(PLATFORM_LINUX)
+// Processors the process may run on; containers and taskset restrict this below the online count.
+static uint32_t get_processor_count(void) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+        return (uint32_t)CPU_COUNT(&set);
+    }
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+}
+
+// processor counts only the processors the process may run on.
+static bool pin_thread_to_processor(thread* thread, uint32_t processor) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+        return false;
+    }
+    processor %= (uint32_t)CPU_COUNT(&allowed);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (uint32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed) && processor-- == 0) {
+            CPU_SET(cpu, &set);
+            break;
+        }
+    }
+    return pthread_setaffinity_np((pthread_t)(uintptr_t)thread->handle, sizeof(set), &set) == 0;
+}
+
+static void wait_on_address(_Atomic uint32_t* address, uint32_t expected) {
+    syscall(SYS_futex, (uint32_t*)address, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void wake_address(_Atomic uint32_t* address, uint32_t count) {
+    syscall(SYS_futex, (uint32_t*)address, FUTEX_WAKE_PRIVATE, count > INT32_MAX ? INT32_MAX : (int)count, NULL, NULL, 0);
+}
+#endif
+
+static inline void cpu_relax(void) {
+#if defined(_MSC_VER)
+    YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static THREAD_LOCAL job_system* current_job_system = NULL;
+static THREAD_LOCAL uint32_t current_job_worker = UINT32_MAX;
+static THREAD_LOCAL uint32_t steal_seed = 0;
+
+#define JOB_DEQUE_MASK (JOB_DEQUE_CAPACITY - 1)
+#define JOB_IDLE_SPIN_COUNT 64
+
+// Owner only.
+static bool push_job(job_deque* deque, job* job) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (bottom - top >= JOB_DEQUE_CAPACITY) {
+        return false;
+    }
+    atomic_store_explicit(&deque->entries[bottom & JOB_DEQUE_MASK], job, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return true;
+}
+
+// Owner only. Takes the most recently pushed job, racing thieves for the last one.
+static job* pop_job(job_deque* deque) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    job* result = NULL;
+    if (top <= bottom) {
+        result = atomic_load_explicit(&deque->entries[bottom & JOB_DEQUE_MASK], memory_order_relaxed);
+        if (top == bottom) {
+            if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+                result = NULL;
+            }
+            atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        }
+    }
+    else {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return result;
+}
+
+// Any thread. Takes the oldest job, or NULL if the deque is empty or another thief won.
+static job* steal_job(job_deque* deque) {
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom) {
+        return NULL;
+    }
+
+    job* result = atomic_load_explicit(&deque->entries[top & JOB_DEQUE_MASK], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+    return result;
+}
+
+static void execute_job(job* job) {
+    job->function(job->data, job->begin, job->end);
+    atomic_fetch_sub_explicit(job->counter, 1, memory_order_acq_rel);
+}
+
+static job* find_job(job_system* system, uint32_t worker_index) {
+    job* found = pop_job(&system->workers[worker_index].deque);
+    if (found != NULL || system->worker_count < 2) {
+        return found;
+    }
+
+    // xorshift32 picks where to start so thieves spread out instead of all hitting worker 0.
+    uint32_t seed = steal_seed != 0 ? steal_seed : worker_index * 2654435761u + 1;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    steal_seed = seed;
+
+    for (uint32_t i = 0; i < system->worker_count; ++i) {
+        uint32_t victim = (seed + i) % system->worker_count;
+        if (victim == worker_index) {
+            continue;
+        }
+        found = steal_job(&system->workers[victim].deque);
+        if (found != NULL) {
+            return found;
+        }
+    }
+    return NULL;
+}
+
+static void job_worker_main(void* data) {
+    job_worker* worker = data;
+    job_system* system = worker->system;
+    current_job_system = system;
+    current_job_worker = worker->index;
+
+    uint32_t idle_spins = 0;
+    while (atomic_load_explicit(&system->running, memory_order_acquire)) {
+        job* found = find_job(system, worker->index);
+        if (found != NULL) {
+            execute_job(found);
+            idle_spins = 0;
+            continue;
+        }
+
+        if (++idle_spins < JOB_IDLE_SPIN_COUNT) {
+            cpu_relax();
+            continue;
+        }
+
+        // Announce the sleep before the last look, so a push that lands in between sees
+        // sleeping_workers and bumps wake_signal, which makes the wait return immediately.
+        // The fence pairs with the one in wake_job_workers: the deque loads below cannot move
+        // above the increment, so either this worker sees the job or the pusher sees the sleeper.
+        uint32_t signal = atomic_load_explicit(&system->wake_signal, memory_order_acquire);
+        atomic_fetch_add_explicit(&system->sleeping_workers, 1, memory_order_seq_cst);
+        atomic_thread_fence(memory_order_seq_cst);
+        found = find_job(system, worker->index);
+        if (found == NULL && atomic_load_explicit(&system->running, memory_order_acquire)) {
+            wait_on_address(&system->wake_signal, signal);
+        }
+        atomic_fetch_sub_explicit(&system->sleeping_workers, 1, memory_order_relaxed);
+        if (found != NULL) {
+            execute_job(found);
+        }
+        idle_spins = 0;
+    }
+}
+
+static void wake_job_workers(job_system* system, uint32_t count) {
+    // Orders the deque stores of push_job, which are only release, before the load of sleeping_workers.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&system->sleeping_workers, memory_order_seq_cst) != 0) {
+        atomic_fetch_add_explicit(&system->wake_signal, 1, memory_order_release);
+        wake_address(&system->wake_signal, count);
+    }
+}
+
+result create_job_system(uint32_t worker_count, job_system* out_system) {
+    ASSERT(out_system != NULL, return RESULT_FAILURE, "Job system pointer is null");
+    ASSERT(current_job_system == NULL, return RESULT_FAILURE, "The calling thread already belongs to a job system");
+    memset(out_system, 0, sizeof(job_system));
+
+    if (worker_count == 0) {
+        worker_count = get_processor_count();
+    }
+    if (worker_count > MAX_JOB_WORKERS) {
+        worker_count = MAX_JOB_WORKERS;
+    }
+
+    if (create_arena_allocator(sizeof(job_worker) * worker_count + 4096, 0, &out_system->memory) != RESULT_SUCCESS) {
+        return RESULT_FAILURE;
+    }
+    out_system->workers = arena_allocate_zeroed(&out_system->memory, sizeof(job_worker) * worker_count, alignof(job_worker));
+    if (out_system->workers == NULL) {
+        destroy_arena_allocator(&out_system->memory);
+        return RESULT_FAILURE;
+    }
+
+    // Every deque exists before any thread starts, so thieves can scan all of them from the outset.
+    out_system->worker_count = worker_count;
+    for (uint32_t i = 0; i < worker_count; ++i) {
+        out_system->workers[i].system = out_system;
+        out_system->workers[i].index = i;
+    }
+    atomic_store_explicit(&out_system->running, true, memory_order_release);
+    current_job_system = out_system;
+    current_job_worker = 0;
+
+    for (uint32_t i = 1; i < worker_count; ++i) {
+        job_worker* worker = &out_system->workers[i];
+        if (create_thread(job_worker_main, worker, &worker->thread) != RESULT_SUCCESS) {
+            destroy_job_system(out_system);
+            return RESULT_FAILURE;
+        }
+        if (!pin_thread_to_processor(&worker->thread, i)) {
+            LOG_ERROR("Could not pin a job worker to a processor; it runs unpinned");
+        }
+    }
+
+    return RESULT_SUCCESS;
+}
+
+void destroy_job_system(job_system* system) {
+    ASSERT(system != NULL, return, "Job system pointer is null");
+    atomic_store_explicit(&system->running, false, memory_order_release);
+    atomic_fetch_add_explicit(&system->wake_signal, 1, memory_order_release);
+    wake_address(&system->wake_signal, UINT32_MAX);
+    for (uint32_t i = 1; i < system->worker_count; ++i) {
+        destroy_thread(&system->workers[i].thread);
+    }
+
+    if (current_job_system == system) {
+        current_job_system = NULL;
+        current_job_worker = UINT32_MAX;
+    }
+    destroy_arena_allocator(&system->memory);
+    memset(system, 0, sizeof(job_system));
+}
+
+void run_jobs(job_system* system, job* jobs, uint32_t count, job_counter* counter) {
+    ASSERT(system != NULL && jobs != NULL && counter != NULL, return, "Job system, jobs and counter must not be null");
+    ASSERT(current_job_system == system, return, "Jobs can only be submitted from a worker of this job system");
+
+    atomic_fetch_add_explicit(counter, count, memory_order_relaxed);
+    job_deque* deque = &system->workers[current_job_worker].deque;
+    for (uint32_t i = 0; i < count; ++i) {
+        jobs[i].counter = counter;
+        if (!push_job(deque, &jobs[i])) {
+            execute_job(&jobs[i]);
+        }
+    }
+    wake_job_workers(system, count);
+}
+
+void wait_for_counter(job_system* system, job_counter* counter) {
+    ASSERT(system != NULL && counter != NULL, return, "Job system and counter must not be null");
+    ASSERT(current_job_system == system, return, "Only workers of this job system can wait on its counters");
+
+    uint32_t idle_spins = 0;
+    while (atomic_load_explicit(counter, memory_order_acquire) != 0) {
+        job* found = find_job(system, current_job_worker);
+        if (found != NULL) {
+            execute_job(found);
+            idle_spins = 0;
+        }
+        else if (++idle_spins < JOB_IDLE_SPIN_COUNT) {
+            cpu_relax();
+        }
+        else {
+            // The remaining jobs are running elsewhere; give their threads the core.
+            yield_thread();
+        }
+    }
+}
+
+void parallel_for(job_system* system, uint32_t count, job_function function, void* data) {
+    ASSERT(system != NULL && function != NULL, return, "Job system and function must not be null");
+    if (count == 0) {
+        return;
+    }
+
+    uint32_t chunk_count = system->worker_count * 4;
+    if (chunk_count > count) {
+        chunk_count = count;
+    }
+    uint32_t chunk_size = (count + chunk_count - 1) / chunk_count;
+    chunk_count = (count + chunk_size - 1) / chunk_size;
+
+    scratch_arena scratch = begin_scratch(NULL, 0);
+    job* jobs = ARENA_ALLOCATE_ARRAY(scratch.arena, job, chunk_count);
+    if (jobs == NULL) {
+        end_scratch(scratch);
+        function(data, 0, count);
+        return;
+    }
+
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+        uint32_t begin = i * chunk_size;
+        uint32_t end = begin + chunk_size < count ? begin + chunk_size : count;
+        jobs[i] = (job){ function, data, begin, end, NULL };
+    }
+
+    job_counter counter = 0;
+    run_jobs(system, jobs, chunk_count, &counter);
+    wait_for_counter(system, &counter);
+    end_scratch(scratch);
+}
+
+uint32_t get_job_worker_index(void) {
+    return current_job_worker;
+}
+
+IMPLEMENT_SPSC_RING(io_completion, io_completion_queue, MAX_IO_QUEUE_DEPTH)
+
+// Completes the io_uring shutdown no-op rather than a request.
+#define IO_SHUTDOWN_TAG UINT64_MAX
+
+#if defined(PLATFORM_WINDOWS)
+static intptr_t open_io_file_handle(const char* path, bool direct, uint64_t* out_size) {
+    DWORD flags = direct ? FILE_FLAG_NO_BUFFERING : FILE_ATTRIBUTE_NORMAL;
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return -1;
+    }
+    *out_size = (uint64_t)size.QuadPart;
+    return (intptr_t)file;
+}
+
+static void close_io_file_handle(intptr_t file) {
+    CloseHandle((HANDLE)file);
+}
+
+// A synchronous handle reads at the OVERLAPPED offset without touching the file pointer, so
+// several threads can read one handle at once.
+static int32_t read_io_file(intptr_t file, void* buffer, uint32_t size, uint64_t offset) {
+    OVERLAPPED overlapped = { 0 };
+    overlapped.Offset = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+    DWORD bytes_read = 0;
+    if (!ReadFile((HANDLE)file, buffer, size, &bytes_read, &overlapped) && GetLastError() != ERROR_HANDLE_EOF) {
+        return -(int32_t)GetLastError();
+    }
+    return (int32_t)bytes_read;
+}
+#elif defined(PLATFORM_LINUX)
+STATIC_ASSERT(sizeof(io_buffer) == sizeof(struct iovec) && offsetof(io_buffer, size) == offsetof(struct iovec, iov_len), io_buffer_must_match_iovec)
+
+static intptr_t open_io_file_handle(const char* path, bool direct, uint64_t* out_size) {
+    int descriptor = open(path, O_RDONLY | O_CLOEXEC | (direct ? O_DIRECT : 0));
+    if (descriptor < 0) {
+        return -1;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0) {
+        close(descriptor);
+        return -1;
+    }
+    *out_size = (uint64_t)status.st_size;
+    return descriptor;
+}
+
+static void close_io_file_handle(intptr_t file) {
+    close((int)file);
+}
+
+static int32_t read_io_file(intptr_t file, void* buffer, uint32_t size, uint64_t offset) {
+    uint32_t total = 0;
+    while (total < size) {
+        ssize_t chunk = pread((int)file, (uint8_t*)buffer + total, size - total, (off_t)(offset + total));
+        if (chunk < 0 && errno == EINTR) {
+            continue;
+        }
+        if (chunk < 0) {
+            return -errno;
+        }
+        if (chunk == 0) {
+            break;
+        }
+        total += (uint32_t)chunk;
+    }
+    return (int32_t)total;
+}
+
+static int io_uring_setup(uint32_t entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int descriptor, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    return (int)syscall(__NR_io_uring_enter, descriptor, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int descriptor, uint32_t opcode, const void* arguments, uint32_t count) {
+    return (int)syscall(__NR_io_uring_register, descriptor, opcode, arguments, count);
+}
+
+static void destroy_io_uring(io_uring_rings* uring) {
+    if (uring->entries != NULL) {
+        munmap(uring->entries, uring->entries_size);
+    }
+    if (uring->completion_ring != NULL && uring->completion_ring != uring->submission_ring) {
+        munmap(uring->completion_ring, uring->completion_ring_size);
+    }
+    if (uring->submission_ring != NULL) {
+        munmap(uring->submission_ring, uring->submission_ring_size);
+    }
+    if (uring->descriptor >= 0) {
+        close(uring->descriptor);
+    }
+    memset(uring, 0, sizeof(io_uring_rings));
+    uring->descriptor = -1;
+}
+
+// Fails quietly, since the caller falls back to threads.
+static result create_io_uring(uint32_t depth, io_uring_rings* out_uring) {
+    memset(out_uring, 0, sizeof(io_uring_rings));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    out_uring->descriptor = io_uring_setup(depth, &params);
+    if (out_uring->descriptor < 0) {
+        out_uring->descriptor = -1;
+        return RESULT_FAILURE;
+    }
+
+    out_uring->submission_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    out_uring->completion_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mapping = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mapping && out_uring->completion_ring_size > out_uring->submission_ring_size) {
+        out_uring->submission_ring_size = out_uring->completion_ring_size;
+    }
+    void* submission_ring = mmap(NULL, out_uring->submission_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, out_uring->descriptor, IORING_OFF_SQ_RING);
+    if (submission_ring == MAP_FAILED) {
+        destroy_io_uring(out_uring);
+        return RESULT_FAILURE;
+    }
+    out_uring->submission_ring = submission_ring;
+    void* completion_ring = submission_ring;
+    if (!single_mapping) {
+        completion_ring = mmap(NULL, out_uring->completion_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, out_uring->descriptor, IORING_OFF_CQ_RING);
+        if (completion_ring == MAP_FAILED) {
+            destroy_io_uring(out_uring);
+            return RESULT_FAILURE;
+        }
+    }
+    out_uring->completion_ring = completion_ring;
+    out_uring->entries_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* entries = mmap(NULL, out_uring->entries_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, out_uring->descriptor, IORING_OFF_SQES);
+    if (entries == MAP_FAILED) {
+        destroy_io_uring(out_uring);
+        return RESULT_FAILURE;
+    }
+    out_uring->entries = entries;
+
+    uint8_t* submission = submission_ring;
+    uint8_t* completion = completion_ring;
+    out_uring->submission_tail = (_Atomic uint32_t*)(submission + params.sq_off.tail);
+    out_uring->submission_array = (uint32_t*)(submission + params.sq_off.array);
+    out_uring->submission_mask = *(uint32_t*)(submission + params.sq_off.ring_mask);
+    out_uring->completion_head = (_Atomic uint32_t*)(completion + params.cq_off.head);
+    out_uring->completion_tail = (_Atomic uint32_t*)(completion + params.cq_off.tail);
+    out_uring->completions = completion + params.cq_off.cqes;
+    out_uring->completion_mask = *(uint32_t*)(completion + params.cq_off.ring_mask);
+
+    // A sparse table that open_io_file fills in; without it reads use plain descriptors.
+    int descriptors[MAX_IO_FILES];
+    for (uint32_t i = 0; i < MAX_IO_FILES; ++i) {
+        descriptors[i] = -1;
+    }
+    out_uring->files_registered = io_uring_register(out_uring->descriptor, IORING_REGISTER_FILES, descriptors, MAX_IO_FILES) == 0;
+    return RESULT_SUCCESS;
+}
+
+// Called with submit_lock held; the kernel consumes every entry during io_uring_enter, so the
+// ring never holds more than one batch.
+static void push_io_uring_read(io_queue* queue, uint32_t slot) {
+    io_uring_rings* uring = &queue->uring;
+    io_request* request = &queue->requests[slot];
+    const io_read* read = &request->read;
+    uint32_t tail = atomic_load_explicit(uring->submission_tail, memory_order_relaxed);
+    uint32_t index = tail & uring->submission_mask;
+    struct io_uring_sqe* entry = &((struct io_uring_sqe*)uring->entries)[index];
+    memset(entry, 0, sizeof(struct io_uring_sqe));
+
+    if (read->buffer_index != IO_UNREGISTERED_BUFFER && uring->buffers_registered) {
+        entry->opcode = IORING_OP_READ_FIXED;
+        entry->addr = (uint64_t)(uintptr_t)read->buffer;
+        entry->len = read->size;
+        entry->buf_index = (uint16_t)read->buffer_index;
+    }
+    else {
+        request->vector.base = read->buffer;
+        request->vector.size = read->size;
+        entry->opcode = IORING_OP_READV;
+        entry->addr = (uint64_t)(uintptr_t)&request->vector;
+        entry->len = 1;
+    }
+    if (uring->files_registered) {
+        entry->fd = (int32_t)read->file;
+        entry->flags = IOSQE_FIXED_FILE;
+    }
+    else {
+        entry->fd = (int32_t)queue->files[read->file];
+    }
+    entry->off = read->offset;
+    entry->user_data = slot;
+    uring->submission_array[index] = index;
+    atomic_store_explicit(uring->submission_tail, tail + 1, memory_order_release);
+}
+
+// Submits the last count entries pushed. Returns how many of them a hard error left
+// unsubmitted, with the errno value in out_error; those are taken back off the ring, so no
+// later submission picks them up.
+static uint32_t submit_io_uring_entries(io_uring_rings* uring, uint32_t count, int* out_error) {
+    while (count > 0) {
+        int submitted = io_uring_enter(uring->descriptor, count, 0, 0);
+        if (submitted > 0) {
+            count -= (uint32_t)submitted;
+        }
+        else if (submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            *out_error = errno;
+            uint32_t tail = atomic_load_explicit(uring->submission_tail, memory_order_relaxed);
+            atomic_store_explicit(uring->submission_tail, tail - count, memory_order_release);
+            ERROR_BREAKPOINT("Failed to submit io_uring entries");
+            return count;
+        }
+        else if (submitted < 0 && errno != EINTR) {
+            // Out of kernel resources until the completion thread reaps.
+            yield_thread();
+        }
+    }
+    return 0;
+}
+#endif
+
+static void release_io_request(io_queue* queue, uint32_t slot) {
+    lock_mutex(&queue->submit_lock);
+    queue->requests[slot].next_free = queue->first_free;
+    queue->first_free = slot;
+    queue->used_count--;
+    unlock_mutex(&queue->submit_lock);
+}
+
+static void complete_io_request(io_queue* queue, uint32_t slot, int32_t result) {
+    io_request* request = &queue->requests[slot];
+    const io_read* read = &request->read;
+    io_completion completion = {
+        .user_data = read->user_data,
+        .buffer = read->buffer,
+        .offset = read->offset,
+        .size = read->size,
+        .result = result,
+        .latency_nanoseconds = get_time_nanoseconds() - request->submit_time,
+    };
+
+    io_stats* stats = &queue->stats;
+    atomic_fetch_add_explicit(&stats->completed, 1, memory_order_relaxed);
+    if (result < 0) {
+        atomic_fetch_add_explicit(&stats->failed, 1, memory_order_relaxed);
+    }
+    else {
+        atomic_fetch_add_explicit(&stats->bytes_read, (uint64_t)result, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&stats->total_latency_nanoseconds, completion.latency_nanoseconds, memory_order_relaxed);
+    uint64_t max_latency = atomic_load_explicit(&stats->max_latency_nanoseconds, memory_order_relaxed);
+    while (completion.latency_nanoseconds > max_latency &&
+           !atomic_compare_exchange_weak_explicit(&stats->max_latency_nanoseconds, &max_latency, completion.latency_nanoseconds, memory_order_relaxed, memory_order_relaxed)) {
+    }
+
+    if (read->callback != NULL || read->counter != NULL) {
+        io_callback callback = read->callback;
+        job_counter* counter = read->counter;
+        release_io_request(queue, slot);
+        if (callback != NULL) {
+            callback(&completion);
+        }
+        if (counter != NULL) {
+            atomic_fetch_sub_explicit(counter, 1, memory_order_acq_rel);
+        }
+    }
+    else {
+        // Counted against the depth before the slot is freed, so the ring cannot overflow.
+        atomic_fetch_add_explicit(&queue->queued_events, 1, memory_order_relaxed);
+        release_io_request(queue, slot);
+        lock_mutex(&queue->completion_lock);
+        io_completion_queue_push(&queue->completions, &completion);
+        unlock_mutex(&queue->completion_lock);
+    }
+    atomic_fetch_sub_explicit(&queue->reads_in_flight, 1, memory_order_release);
+}
+
+#if defined(PLATFORM_LINUX)
+static void io_uring_completion_main(void* data) {
+    io_queue* queue = data;
+    io_uring_rings* uring = &queue->uring;
+    bool stopping = false;
+    while (!stopping) {
+        if (io_uring_enter(uring->descriptor, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            ERROR_BREAKPOINT("Failed to wait for io_uring completions");
+            return;
+        }
+        uint32_t head = atomic_load_explicit(uring->completion_head, memory_order_relaxed);
+        uint32_t tail = atomic_load_explicit(uring->completion_tail, memory_order_acquire);
+        for (; head != tail; ++head) {
+            const struct io_uring_cqe* entry = &((const struct io_uring_cqe*)uring->completions)[head & uring->completion_mask];
+            if (entry->user_data == IO_SHUTDOWN_TAG) {
+                stopping = true;
+            }
+            else {
+                complete_io_request(queue, (uint32_t)entry->user_data, entry->res);
+            }
+        }
+        atomic_store_explicit(uring->completion_head, head, memory_order_release);
+    }
+}
+#endif
+
+static void io_fallback_worker_main(void* data) {
+    io_queue* queue = data;
+    while (true) {
+        wait_semaphore(&queue->pending_signal);
+        lock_mutex(&queue->submit_lock);
+        if (queue->pending_count == 0) {
+            // Only destroy_io_queue signals without queueing a read.
+            unlock_mutex(&queue->submit_lock);
+            return;
+        }
+        uint32_t slot = queue->pending[queue->pending_head];
+        queue->pending_head = (queue->pending_head + 1) % MAX_IO_QUEUE_DEPTH;
+        queue->pending_count--;
+        const io_read* read = &queue->requests[slot].read;
+        intptr_t file = queue->files[read->file];
+        unlock_mutex(&queue->submit_lock);
+
+        complete_io_request(queue, slot, read_io_file(file, read->buffer, read->size, read->offset));
+    }
+}
+
+result create_io_queue(uint32_t depth, bool force_threads, io_queue* out_queue) {
+    ASSERT(out_queue != NULL, return RESULT_FAILURE, "I/O queue pointer is null");
+    memset(out_queue, 0, sizeof(io_queue));
+    out_queue->depth = depth == 0 || depth > MAX_IO_QUEUE_DEPTH ? MAX_IO_QUEUE_DEPTH : depth;
+    create_mutex(NULL, &out_queue->submit_lock);
+    create_mutex(NULL, &out_queue->completion_lock);
+    create_semaphore(0, NULL, &out_queue->pending_signal);
+    for (uint32_t i = 0; i < MAX_IO_FILES; ++i) {
+        out_queue->files[i] = -1;
+    }
+    for (uint32_t i = 0; i < out_queue->depth; ++i) {
+        out_queue->requests[i].next_free = i + 1;
+    }
+    atomic_store_explicit(&out_queue->running, true, memory_order_relaxed);
+
+    out_queue->backend = IO_BACKEND_THREADS;
+#if defined(PLATFORM_LINUX)
+    out_queue->uring.descriptor = -1;
+    if (!force_threads && create_io_uring(out_queue->depth, &out_queue->uring) == RESULT_SUCCESS) {
+        if (create_thread(io_uring_completion_main, out_queue, &out_queue->completion_thread) != RESULT_SUCCESS) {
+            destroy_io_uring(&out_queue->uring);
+            return RESULT_FAILURE;
+        }
+        out_queue->backend = IO_BACKEND_URING;
+        return RESULT_SUCCESS;
+    }
+#else
+    (void)force_threads;
+#endif
+
+    for (uint32_t i = 0; i < IO_FALLBACK_THREAD_COUNT; ++i) {
+        if (create_thread(io_fallback_worker_main, out_queue, &out_queue->workers[i]) != RESULT_SUCCESS) {
+            destroy_io_queue(out_queue);
+            return RESULT_FAILURE;
+        }
+    }
+    return RESULT_SUCCESS;
+}
+
+void destroy_io_queue(io_queue* queue) {
+    ASSERT(queue != NULL, return, "I/O queue pointer is null");
+    if (!atomic_exchange_explicit(&queue->running, false, memory_order_relaxed)) {
+        return;
+    }
+    while (atomic_load_explicit(&queue->reads_in_flight, memory_order_acquire) != 0) {
+        yield_thread();
+    }
+
+#if defined(PLATFORM_LINUX)
+    if (queue->backend == IO_BACKEND_URING) {
+        // Every read has completed, so the no-op is the last completion the thread sees.
+        io_uring_rings* uring = &queue->uring;
+        uint32_t tail = atomic_load_explicit(uring->submission_tail, memory_order_relaxed);
+        uint32_t index = tail & uring->submission_mask;
+        struct io_uring_sqe* entry = &((struct io_uring_sqe*)uring->entries)[index];
+        memset(entry, 0, sizeof(struct io_uring_sqe));
+        entry->opcode = IORING_OP_NOP;
+        entry->user_data = IO_SHUTDOWN_TAG;
+        uring->submission_array[index] = index;
+        atomic_store_explicit(uring->submission_tail, tail + 1, memory_order_release);
+        // Without the no-op the thread never wakes, so it and the ring it waits on are leaked
+        // rather than unmapped under it.
+        int error = 0;
+        if (submit_io_uring_entries(uring, 1, &error) == 0) {
+            destroy_thread(&queue->completion_thread);
+            destroy_io_uring(uring);
+        }
+    }
+#endif
+    if (queue->backend == IO_BACKEND_THREADS) {
+        signal_semaphore(&queue->pending_signal, IO_FALLBACK_THREAD_COUNT);
+        for (uint32_t i = 0; i < IO_FALLBACK_THREAD_COUNT; ++i) {
+            if (queue->workers[i].handle != NULL) {
+                destroy_thread(&queue->workers[i]);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < MAX_IO_FILES; ++i) {
+        if (queue->files[i] != -1) {
+            close_io_file_handle(queue->files[i]);
+        }
+    }
+}
+
+uint32_t open_io_file(io_queue* queue, const char* path, bool direct, uint64_t* out_size) {
+    ASSERT(queue != NULL, return UINT32_MAX, "I/O queue pointer is null");
+    ASSERT(path != NULL && out_size != NULL, return UINT32_MAX, "File path and size pointer must not be null");
+    lock_mutex(&queue->submit_lock);
+    uint32_t file = 0;
+    while (file < MAX_IO_FILES && queue->files[file] != -1) {
+        file++;
+    }
+    intptr_t handle = file < MAX_IO_FILES ? open_io_file_handle(path, direct, out_size) : -1;
+    if (handle == -1) {
+        unlock_mutex(&queue->submit_lock);
+        return UINT32_MAX;
+    }
+    queue->files[file] = handle;
+#if defined(PLATFORM_LINUX)
+    io_uring_rings* uring = &queue->uring;
+    if (queue->backend == IO_BACKEND_URING && uring->files_registered) {
+        int descriptor = (int)handle;
+        struct io_uring_files_update update = { .offset = file, .fds = (uint64_t)(uintptr_t)&descriptor };
+        if (io_uring_register(uring->descriptor, IORING_REGISTER_FILES_UPDATE, &update, 1) != 1) {
+            // Plain descriptors stay valid for every file, registered or not.
+            uring->files_registered = false;
+        }
+    }
+#endif
+    unlock_mutex(&queue->submit_lock);
+    return file;
+}
+
+void close_io_file(io_queue* queue, uint32_t file) {
+    ASSERT(queue != NULL, return, "I/O queue pointer is null");
+    ASSERT(file < MAX_IO_FILES && queue->files[file] != -1, return, "I/O file is not open");
+    lock_mutex(&queue->submit_lock);
+#if defined(PLATFORM_LINUX)
+    io_uring_rings* uring = &queue->uring;
+    if (queue->backend == IO_BACKEND_URING && uring->files_registered) {
+        int descriptor = -1;
+        struct io_uring_files_update update = { .offset = file, .fds = (uint64_t)(uintptr_t)&descriptor };
+        io_uring_register(uring->descriptor, IORING_REGISTER_FILES_UPDATE, &update, 1);
+    }
+#endif
+    close_io_file_handle(queue->files[file]);
+    queue->files[file] = -1;
+    unlock_mutex(&queue->submit_lock);
+}
+
+result register_io_buffers(io_queue* queue, const io_buffer* buffers, uint32_t count) {
+    ASSERT(queue != NULL, return RESULT_FAILURE, "I/O queue pointer is null");
+    ASSERT(buffers != NULL || count == 0, return RESULT_FAILURE, "I/O buffers pointer is null");
+    ASSERT(count <= MAX_IO_BUFFERS, return RESULT_FAILURE, "Too many I/O buffers");
+    lock_mutex(&queue->submit_lock);
+    memcpy(queue->buffers, buffers, sizeof(io_buffer) * count);
+    queue->buffer_count = count;
+    result registered = RESULT_SUCCESS;
+#if defined(PLATFORM_LINUX)
+    io_uring_rings* uring = &queue->uring;
+    if (queue->backend == IO_BACKEND_URING) {
+        if (uring->buffers_registered) {
+            io_uring_register(uring->descriptor, IORING_UNREGISTER_BUFFERS, NULL, 0);
+            uring->buffers_registered = false;
+        }
+        if (count > 0) {
+            uring->buffers_registered = io_uring_register(uring->descriptor, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+            registered = uring->buffers_registered ? RESULT_SUCCESS : RESULT_FAILURE;
+        }
+    }
+#endif
+    unlock_mutex(&queue->submit_lock);
+    return registered;
+}
+
+static bool is_io_read_valid(const io_queue* queue, const io_read* read) {
+    if (read->file >= MAX_IO_FILES || queue->files[read->file] == -1) {
+        return false;
+    }
+    if (read->buffer_index == IO_UNREGISTERED_BUFFER) {
+        return true;
+    }
+    if (read->buffer_index >= queue->buffer_count) {
+        return false;
+    }
+    const io_buffer* buffer = &queue->buffers[read->buffer_index];
+    const uint8_t* base = buffer->base;
+    return (const uint8_t*)read->buffer >= base && (const uint8_t*)read->buffer + read->size <= base + buffer->size;
+}
+
+uint32_t submit_io_reads(io_queue* queue, const io_read* reads, uint32_t count) {
+    ASSERT(queue != NULL, return 0, "I/O queue pointer is null");
+    ASSERT(reads != NULL || count == 0, return 0, "I/O reads pointer is null");
+
+    uint64_t now = get_time_nanoseconds();
+    lock_mutex(&queue->submit_lock);
+    uint32_t queued_events = atomic_load_explicit(&queue->queued_events, memory_order_relaxed);
+    uint32_t available = queue->depth - queue->used_count;
+    available = queued_events < available ? available - queued_events : 0;
+    uint32_t accepted = count < available ? count : available;
+    uint32_t invalid = 0;
+    uint32_t slots[MAX_IO_QUEUE_DEPTH];
+
+    for (uint32_t i = 0; i < accepted; ++i) {
+        const io_read* read = &reads[i];
+        if (!is_io_read_valid(queue, read)) {
+            ERROR_BREAKPOINT("I/O read names a closed file or lies outside its registered buffer");
+            invalid = count - i;
+            accepted = i;
+            break;
+        }
+
+        uint32_t slot = queue->first_free;
+        slots[i] = slot;
+        io_request* request = &queue->requests[slot];
+        queue->first_free = request->next_free;
+        queue->used_count++;
+        request->read = *read;
+        request->submit_time = now;
+        if (read->counter != NULL) {
+            atomic_fetch_add_explicit(read->counter, 1, memory_order_relaxed);
+        }
+        atomic_fetch_add_explicit(&queue->reads_in_flight, 1, memory_order_relaxed);
+#if defined(PLATFORM_LINUX)
+        if (queue->backend == IO_BACKEND_URING) {
+            push_io_uring_read(queue, slot);
+            continue;
+        }
+#endif
+        queue->pending[(queue->pending_head + queue->pending_count) % MAX_IO_QUEUE_DEPTH] = slot;
+        queue->pending_count++;
+    }
+
+    uint32_t unsubmitted = 0;
+    int error = 0;
+#if defined(PLATFORM_LINUX)
+    if (queue->backend == IO_BACKEND_URING && accepted > 0) {
+        unsubmitted = submit_io_uring_entries(&queue->uring, accepted, &error);
+    }
+#endif
+    unlock_mutex(&queue->submit_lock);
+    if (queue->backend == IO_BACKEND_THREADS && accepted > 0) {
+        signal_semaphore(&queue->pending_signal, accepted);
+    }
+
+    atomic_fetch_add_explicit(&queue->stats.submitted, accepted, memory_order_relaxed);
+    atomic_fetch_add_explicit(&queue->stats.rejected, count - accepted - invalid, memory_order_relaxed);
+    atomic_fetch_add_explicit(&queue->stats.invalid, invalid, memory_order_relaxed);
+    // The kernel refused the end of the batch. Those reads stay accepted and fail here, after
+    // submit_lock is released, so destroy_io_queue does not wait on them forever.
+    for (uint32_t i = accepted - unsubmitted; i < accepted; ++i) {
+        complete_io_request(queue, slots[i], -error);
+    }
+    return accepted;
+}
+
+bool poll_io_completion(io_queue* queue, io_completion* out_completion) {
+    ASSERT(queue != NULL && out_completion != NULL, return false, "I/O queue and completion pointers must not be null");
+    if (!io_completion_queue_pop(&queue->completions, out_completion)) {
+        return false;
+    }
+    atomic_fetch_sub_explicit(&queue->queued_events, 1, memory_order_relaxed);
+    return true;
+}
+
+#define MUTEX_UNLOCKED 0
+#define MUTEX_LOCKED 1
+#define MUTEX_LOCKED_WITH_WAITERS 2
+#define MUTEX_MAX_SPIN 1000
+#define SPIN_LOCK_MAX_BACKOFF 1024
+#define RW_LOCK_WRITER 0x80000000u
+
+static void record_acquisition(lock_stats* stats) {
+    if (stats != NULL) {
+        atomic_fetch_add_explicit(&stats->acquisitions, 1, memory_order_relaxed);
+    }
+}
+
+static void record_contended_acquisition(lock_stats* stats, uint64_t wait_start) {
+    if (stats != NULL) {
+        atomic_fetch_add_explicit(&stats->acquisitions, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->contended_acquisitions, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->wait_nanoseconds, get_time_nanoseconds() - wait_start, memory_order_relaxed);
+    }
+}
+
+static uint64_t begin_contended_wait(lock_stats* stats) {
+    return stats != NULL ? get_time_nanoseconds() : 0;
+}
+
+void create_mutex(lock_stats* stats, mutex* out_mutex) {
+    ASSERT(out_mutex != NULL, return, "Mutex pointer is null");
+    atomic_init(&out_mutex->state, MUTEX_UNLOCKED);
+    atomic_init(&out_mutex->spin_limit, 100);
+    out_mutex->stats = stats;
+}
+
+bool try_lock_mutex(mutex* mutex) {
+    uint32_t expected = MUTEX_UNLOCKED;
+    if (atomic_compare_exchange_strong_explicit(&mutex->state, &expected, MUTEX_LOCKED, memory_order_acquire, memory_order_relaxed)) {
+        record_acquisition(mutex->stats);
+        return true;
+    }
+    return false;
+}
+
+void lock_mutex(mutex* mutex) {
+    uint32_t expected = MUTEX_UNLOCKED;
+    if (atomic_compare_exchange_strong_explicit(&mutex->state, &expected, MUTEX_LOCKED, memory_order_acquire, memory_order_relaxed)) {
+        record_acquisition(mutex->stats);
+        return;
+    }
+
+    uint64_t wait_start = begin_contended_wait(mutex->stats);
+
+    // Spin up to twice the learned limit, then move the limit an eighth of the way towards
+    // what this acquisition needed, so locks held briefly keep spinning and others go to sleep.
+    uint32_t spin_limit = atomic_load_explicit(&mutex->spin_limit, memory_order_relaxed);
+    uint32_t max_spins = spin_limit * 2 + 10 < MUTEX_MAX_SPIN ? spin_limit * 2 + 10 : MUTEX_MAX_SPIN;
+    for (uint32_t spins = 0; spins < max_spins; ++spins) {
+        expected = MUTEX_UNLOCKED;
+        if (atomic_load_explicit(&mutex->state, memory_order_relaxed) == MUTEX_UNLOCKED &&
+            atomic_compare_exchange_weak_explicit(&mutex->state, &expected, MUTEX_LOCKED, memory_order_acquire, memory_order_relaxed)) {
+            atomic_store_explicit(&mutex->spin_limit, spin_limit + ((int32_t)spins - (int32_t)spin_limit) / 8, memory_order_relaxed);
+            record_contended_acquisition(mutex->stats, wait_start);
+            return;
+        }
+        cpu_relax();
+    }
+    atomic_store_explicit(&mutex->spin_limit, spin_limit + ((int32_t)max_spins - (int32_t)spin_limit) / 8, memory_order_relaxed);
+
+    // Marking the lock as having waiters makes the eventual unlock issue a wake.
+    while (atomic_exchange_explicit(&mutex->state, MUTEX_LOCKED_WITH_WAITERS, memory_order_acquire) != MUTEX_UNLOCKED) {
+        wait_on_address(&mutex->state, MUTEX_LOCKED_WITH_WAITERS);
+    }
+    record_contended_acquisition(mutex->stats, wait_start);
+}
+
+void unlock_mutex(mutex* mutex) {
+    if (atomic_exchange_explicit(&mutex->state, MUTEX_UNLOCKED, memory_order_release) == MUTEX_LOCKED_WITH_WAITERS) {
+        wake_address(&mutex->state, 1);
+    }
+}
+
+void create_spin_lock(lock_stats* stats, spin_lock* out_lock) {
+    ASSERT(out_lock != NULL, return, "Spin lock pointer is null");
+    atomic_init(&out_lock->next_ticket, 0);
+    atomic_init(&out_lock->now_serving, 0);
+    out_lock->stats = stats;
+}
+
+void lock_spin_lock(spin_lock* lock) {
+    uint32_t ticket = atomic_fetch_add_explicit(&lock->next_ticket, 1, memory_order_relaxed);
+    if (atomic_load_explicit(&lock->now_serving, memory_order_acquire) == ticket) {
+        record_acquisition(lock->stats);
+        return;
+    }
+
+    uint64_t wait_start = begin_contended_wait(lock->stats);
+    uint32_t backoff = 1;
+    while (atomic_load_explicit(&lock->now_serving, memory_order_acquire) != ticket) {
+        if (backoff == SPIN_LOCK_MAX_BACKOFF) {
+            // A ticket holder that was preempted stalls everyone behind it, so stop burning
+            // the core it may be waiting for.
+            yield_thread();
+            continue;
+        }
+        for (uint32_t i = 0; i < backoff; ++i) {
+            cpu_relax();
+        }
+        backoff *= 2;
+    }
+    record_contended_acquisition(lock->stats, wait_start);
+}
+
+void unlock_spin_lock(spin_lock* lock) {
+    uint32_t serving = atomic_load_explicit(&lock->now_serving, memory_order_relaxed);
+    atomic_store_explicit(&lock->now_serving, serving + 1, memory_order_release);
+}
+
+void create_rw_lock(lock_stats* stats, rw_lock* out_lock) {
+    ASSERT(out_lock != NULL, return, "Reader-writer lock pointer is null");
+    atomic_init(&out_lock->state, 0);
+    atomic_init(&out_lock->waiters, 0);
+    atomic_init(&out_lock->writers_waiting, 0);
+    atomic_init(&out_lock->sequence, 0);
+    out_lock->stats = stats;
+}
+
+// Sleeps until an unlock after sequence was read. Waiting on the state instead would miss a
+// writer that locks and unlocks in between, leaving the state as observed. The waiter count is
+// raised before the sequence is re-read, so an unlock either sees the waiter or is seen by it.
+static void wait_rw_lock(rw_lock* lock, uint32_t sequence) {
+    atomic_fetch_add_explicit(&lock->waiters, 1, memory_order_seq_cst);
+    if (atomic_load_explicit(&lock->sequence, memory_order_seq_cst) == sequence) {
+        wait_on_address(&lock->sequence, sequence);
+    }
+    atomic_fetch_sub_explicit(&lock->waiters, 1, memory_order_relaxed);
+}
+
+static void wake_rw_lock(rw_lock* lock) {
+    atomic_fetch_add_explicit(&lock->sequence, 1, memory_order_seq_cst);
+    if (atomic_load_explicit(&lock->waiters, memory_order_seq_cst) != 0) {
+        wake_address(&lock->sequence, UINT32_MAX);
+    }
+}
+
+void lock_rw_lock_shared(rw_lock* lock) {
+    uint64_t wait_start = 0;
+    bool contended = false;
+    for (;;) {
+        // Read before the state, so an unlock after the state was read always moves it on.
+        uint32_t sequence = atomic_load_explicit(&lock->sequence, memory_order_acquire);
+        uint32_t state = atomic_load_explicit(&lock->state, memory_order_relaxed);
+        if (!(state & RW_LOCK_WRITER) && atomic_load_explicit(&lock->writers_waiting, memory_order_relaxed) == 0) {
+            if (atomic_compare_exchange_weak_explicit(&lock->state, &state, state + 1, memory_order_acquire, memory_order_relaxed)) {
+                break;
+            }
+            continue;
+        }
+
+        if (!contended) {
+            contended = true;
+            wait_start = begin_contended_wait(lock->stats);
+        }
+        wait_rw_lock(lock, sequence);
+    }
+
+    if (contended) {
+        record_contended_acquisition(lock->stats, wait_start);
+    }
+    else {
+        record_acquisition(lock->stats);
+    }
+}
+
+void unlock_rw_lock_shared(rw_lock* lock) {
+    if (atomic_fetch_sub_explicit(&lock->state, 1, memory_order_seq_cst) == 1) {
+        wake_rw_lock(lock);
+    }
+}
+
+void lock_rw_lock_exclusive(rw_lock* lock) {
+    uint32_t expected = 0;
+    if (atomic_compare_exchange_strong_explicit(&lock->state, &expected, RW_LOCK_WRITER, memory_order_acquire, memory_order_relaxed)) {
+        record_acquisition(lock->stats);
+        return;
+    }
+
+    uint64_t wait_start = begin_contended_wait(lock->stats);
+    atomic_fetch_add_explicit(&lock->writers_waiting, 1, memory_order_seq_cst);
+    for (;;) {
+        uint32_t sequence = atomic_load_explicit(&lock->sequence, memory_order_acquire);
+        expected = 0;
+        if (atomic_compare_exchange_weak_explicit(&lock->state, &expected, RW_LOCK_WRITER, memory_order_acquire, memory_order_relaxed)) {
+            break;
+        }
+        if (expected != 0) {
+            wait_rw_lock(lock, sequence);
+        }
+    }
+    atomic_fetch_sub_explicit(&lock->writers_waiting, 1, memory_order_seq_cst);
+    record_contended_acquisition(lock->stats, wait_start);
+}
+
+void unlock_rw_lock_exclusive(rw_lock* lock) {
+    atomic_store_explicit(&lock->state, 0, memory_order_seq_cst);
+    wake_rw_lock(lock);
+}
+
+void create_semaphore(uint32_t initial_count, lock_stats* stats, semaphore* out_semaphore) {
+    ASSERT(out_semaphore != NULL, return, "Semaphore pointer is null");
+    atomic_init(&out_semaphore->count, initial_count);
+    atomic_init(&out_semaphore->waiters, 0);
+    out_semaphore->stats = stats;
+}
+
+void signal_semaphore(semaphore* semaphore, uint32_t count) {
+    atomic_fetch_add_explicit(&semaphore->count, count, memory_order_seq_cst);
+    if (atomic_load_explicit(&semaphore->waiters, memory_order_seq_cst) != 0) {
+        wake_address(&semaphore->count, count);
+    }
+}
+
+bool try_wait_semaphore(semaphore* semaphore) {
+    uint32_t count = atomic_load_explicit(&semaphore->count, memory_order_relaxed);
+    while (count != 0) {
+        if (atomic_compare_exchange_weak_explicit(&semaphore->count, &count, count - 1, memory_order_acquire, memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void wait_semaphore(semaphore* semaphore) {
+    if (try_wait_semaphore(semaphore)) {
+        record_acquisition(semaphore->stats);
+        return;
+    }
+
+    uint64_t wait_start = begin_contended_wait(semaphore->stats);
+    for (;;) {
+        atomic_fetch_add_explicit(&semaphore->waiters, 1, memory_order_seq_cst);
+        if (atomic_load_explicit(&semaphore->count, memory_order_seq_cst) == 0) {
+            wait_on_address(&semaphore->count, 0);
+        }
+        atomic_fetch_sub_explicit(&semaphore->waiters, 1, memory_order_relaxed);
+        if (try_wait_semaphore(semaphore)) {
+            break;
+        }
+    }
+    record_contended_acquisition(semaphore->stats, wait_start);
+}
+
+void create_auto_reset_event(bool signaled, lock_stats* stats, auto_reset_event* out_event) {
+    ASSERT(out_event != NULL, return, "Event pointer is null");
+    atomic_init(&out_event->signaled, signaled ? 1 : 0);
+    atomic_init(&out_event->waiters, 0);
+    out_event->stats = stats;
+}
+
+void signal_auto_reset_event(auto_reset_event* event) {
+    atomic_store_explicit(&event->signaled, 1, memory_order_seq_cst);
+    if (atomic_load_explicit(&event->waiters, memory_order_seq_cst) != 0) {
+        wake_address(&event->signaled, 1);
+    }
+}
+
+void wait_auto_reset_event(auto_reset_event* event) {
+    if (atomic_exchange_explicit(&event->signaled, 0, memory_order_acquire) == 1) {
+        record_acquisition(event->stats);
+        return;
+    }
+
+    uint64_t wait_start = begin_contended_wait(event->stats);
+    for (;;) {
+        atomic_fetch_add_explicit(&event->waiters, 1, memory_order_seq_cst);
+        if (atomic_load_explicit(&event->signaled, memory_order_seq_cst) == 0) {
+            wait_on_address(&event->signaled, 0);
+        }
+        atomic_fetch_sub_explicit(&event->waiters, 1, memory_order_relaxed);
+        if (atomic_exchange_explicit(&event->signaled, 0, memory_order_acquire) == 1) {
+            break;
+        }
+    }
+    record_contended_acquisition(event->stats, wait_start);
+}
+
+#if defined(PLATFORM_WINDOWS)
+static uint64_t read_os_nanoseconds(void) {
+    static LARGE_INTEGER frequency = { 0 };
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    uint64_t seconds = (uint64_t)(counter.QuadPart / frequency.QuadPart);
+    uint64_t remainder = (uint64_t)(counter.QuadPart % frequency.QuadPart);
+    return seconds * 1000000000ull + remainder * 1000000000ull / (uint64_t)frequency.QuadPart;
+}
+
+static bool has_invariant_cpu_timestamp(void) {
+    int registers[4];
+    __cpuid(registers, 0x80000000);
+    if ((unsigned)registers[0] < 0x80000007u) {
+        return false;
+    }
+    __cpuid(registers, 0x80000007);
+    return (registers[3] & (1 << 8)) != 0;
+}
+
+static void sleep_nanoseconds(frame_pacer* pacer, uint64_t nanoseconds) {
+    // Negative due times are relative, in 100ns units.
+    LARGE_INTEGER due_time;
+    due_time.QuadPart = -(LONGLONG)(nanoseconds / 100);
+    if (pacer->timer != NULL && SetWaitableTimer(pacer->timer, &due_time, 0, NULL, NULL, FALSE)) {
+        WaitForSingleObject(pacer->timer, INFINITE);
+    }
+    else {
+        Sleep((DWORD)(nanoseconds / 1000000));
+    }
+}
+
+static void* create_sleep_timer(void) {
+    return CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+}
+
+static void destroy_sleep_timer(void* timer) {
+    CloseHandle(timer);
+}
+#elif defined(PLATFORM_LINUX)
+static uint64_t read_os_nanoseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static bool has_invariant_cpu_timestamp(void) {
+#if defined(CPU_TIMESTAMP_AVAILABLE)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return (edx & (1u << 8)) != 0;
+#else
+    return false;
+#endif
+}
+
+static void sleep_nanoseconds(frame_pacer* pacer, uint64_t nanoseconds) {
+    (void)pacer;
+    struct timespec duration = { (time_t)(nanoseconds / 1000000000ull), (long)(nanoseconds % 1000000000ull) };
+    while (nanosleep(&duration, &duration) != 0) {
+    }
+}
+
+static void* create_sleep_timer(void) {
+    return NULL;
+}
+
+static void destroy_sleep_timer(void* timer) {
+    (void)timer;
+}
+#endif
+
+#define CPU_TIMESTAMP_CALIBRATION_NANOSECONDS 20000000ull
+
+static struct {
+    bool calibrated;
+    bool active;
+    uint64_t timestamp_reference;
+    uint64_t nanoseconds_reference;
+    double nanoseconds_per_tick;
+} cpu_clock;
+
+void calibrate_cpu_timestamp(void) {
+    if (cpu_clock.calibrated) {
+        return;
+    }
+    // Bracket both ends with OS clock reads and take the midpoints, so the scale is not
+    // skewed by the cost of reading either clock.
+    uint64_t os_before = read_os_nanoseconds();
+    uint64_t timestamp_start = read_cpu_timestamp();
+    uint64_t os_start = (os_before + read_os_nanoseconds()) / 2;
+
+    while (read_os_nanoseconds() - os_start < CPU_TIMESTAMP_CALIBRATION_NANOSECONDS) {
+        cpu_relax();
+    }
+
+    os_before = read_os_nanoseconds();
+    uint64_t timestamp_end = read_cpu_timestamp();
+    uint64_t os_end = (os_before + read_os_nanoseconds()) / 2;
+
+    cpu_clock.timestamp_reference = timestamp_start;
+    cpu_clock.nanoseconds_reference = os_start;
+    cpu_clock.nanoseconds_per_tick = timestamp_end > timestamp_start ? (double)(os_end - os_start) / (double)(timestamp_end - timestamp_start) : 1.0;
+    cpu_clock.calibrated = true;
+}
+
+uint64_t cpu_timestamp_to_nanoseconds(uint64_t timestamp) {
+#if defined(CPU_TIMESTAMP_AVAILABLE)
+    DEBUG_ASSERT(cpu_clock.calibrated, return read_os_nanoseconds(), "Call calibrate_cpu_timestamp before converting timestamps");
+    int64_t ticks = (int64_t)(timestamp - cpu_clock.timestamp_reference);
+    return cpu_clock.nanoseconds_reference + (uint64_t)(int64_t)((double)ticks * cpu_clock.nanoseconds_per_tick);
+#else
+    return timestamp;
+#endif
+}
+
+result set_clock_source(clock_source source) {
+    if (source == CLOCK_SOURCE_OS) {
+        cpu_clock.active = false;
+        return RESULT_SUCCESS;
+    }
+
+    // Not an error: callers are expected to stay on the OS clock when this fails.
+    if (!has_invariant_cpu_timestamp()) {
+        return RESULT_FAILURE;
+    }
+    calibrate_cpu_timestamp();
+    cpu_clock.active = true;
+    return RESULT_SUCCESS;
+}
+
+uint64_t get_time_nanoseconds(void) {
+    if (cpu_clock.active) {
+        return cpu_timestamp_to_nanoseconds(read_cpu_timestamp());
+    }
+    return read_os_nanoseconds();
+}
+
+result create_frame_pacer(uint64_t target_frame_nanoseconds, uint64_t spin_nanoseconds, frame_pacer* out_pacer) {
+    ASSERT(out_pacer != NULL, return RESULT_FAILURE, "Frame pacer pointer is null");
+    ASSERT(target_frame_nanoseconds != 0, return RESULT_FAILURE, "Target frame time is zero");
+    memset(out_pacer, 0, sizeof(frame_pacer));
+    out_pacer->target_frame_nanoseconds = target_frame_nanoseconds;
+    out_pacer->spin_nanoseconds = spin_nanoseconds;
+    out_pacer->timer = create_sleep_timer();
+    out_pacer->last_release = get_time_nanoseconds();
+    out_pacer->next_deadline = out_pacer->last_release + target_frame_nanoseconds;
+    return RESULT_SUCCESS;
+}
+
+void destroy_frame_pacer(frame_pacer* pacer) {
+    ASSERT(pacer != NULL, return, "Frame pacer pointer is null");
+    if (pacer->timer != NULL) {
+        destroy_sleep_timer(pacer->timer);
+        pacer->timer = NULL;
+    }
+}
+
+void set_frame_pacer_budget(frame_pacer* pacer, uint64_t spin_nanoseconds) {
+    ASSERT(pacer != NULL, return, "Frame pacer pointer is null");
+    pacer->spin_nanoseconds = spin_nanoseconds;
+}
+
+void wait_for_next_frame(frame_pacer* pacer) {
+    ASSERT(pacer != NULL, return, "Frame pacer pointer is null");
+    uint64_t deadline = pacer->next_deadline;
+    uint64_t now = get_time_nanoseconds();
+
+    if (now + pacer->spin_nanoseconds < deadline) {
+        sleep_nanoseconds(pacer, deadline - pacer->spin_nanoseconds - now);
+        uint64_t woke = get_time_nanoseconds();
+        pacer->stats.slept_nanoseconds += woke - now;
+        now = woke;
+    }
+
+    uint64_t spin_start = now;
+    while (now < deadline) {
+        cpu_relax();
+        now = get_time_nanoseconds();
+    }
+    pacer->stats.spun_nanoseconds += now - spin_start;
+
+    frame_pacer_stats* stats = &pacer->stats;
+    uint64_t lateness = now - deadline;
+    stats->frames++;
+    stats->mean_lateness_nanoseconds += ((double)lateness - stats->mean_lateness_nanoseconds) / (double)stats->frames;
+    if (lateness > stats->max_lateness_nanoseconds) {
+        stats->max_lateness_nanoseconds = lateness;
+    }
+
+    // Welford's running variance of the release-to-release interval.
+    double frame_time = (double)(now - pacer->last_release);
+    double delta = frame_time - pacer->frame_time_mean;
+    pacer->frame_time_mean += delta / (double)stats->frames;
+    pacer->frame_time_m2 += delta * (frame_time - pacer->frame_time_mean);
+    stats->frame_time_deviation_nanoseconds = stats->frames > 1 ? sqrt(pacer->frame_time_m2 / (double)(stats->frames - 1)) : 0.0;
+    pacer->last_release = now;
+
+    if (lateness > pacer->target_frame_nanoseconds) {
+        stats->missed_deadlines++;
+        pacer->next_deadline = now + pacer->target_frame_nanoseconds;
+    }
+    else {
+        pacer->next_deadline = deadline + pacer->target_frame_nanoseconds;
+    }
+}
@@ -137,6 +137,23 @@ typedef struct {
     bool up : 1;
 } key_input;
 
+// One bit per keyboard_key, stored as 64-bit words so a whole set fits in one AVX2 register.
+#define KEY_BITSET_WORDS (KEY_COUNT / 64)
+typedef struct {
+    alignas(32) uint64_t words[KEY_BITSET_WORDS];
+} key_bitset;
+
+// current/previous are the level state at the end of this and the last frame.
+// pressed/released record every down/up edge seen this frame, so a key tapped and let go
+// within one frame is both pressed and released. held is current & previous.
+typedef struct {
+    key_bitset current;
+    key_bitset previous;
+    key_bitset pressed;
+    key_bitset released;
+    key_bitset held;
+} key_state;
+
 typedef struct {
     int32_t x;
     int32_t y;
@@ -149,24 +166,713 @@ DECLARE_CAPPED_ARRAY(wchar_t, typed_characters, MAX_TYPED_CHARACTERS)
 
 typedef struct {
     typed_characters typed_characters;
-    key_input keys[KEY_COUNT];
+    key_state keys;
     mouse_input mouse;
+    // Client area size in pixels. resized is set for the frame in which it changed.
+    uint32_t width;
+    uint32_t height;
+    bool resized;
     bool closed_window;
 } user_input;
 
+static inline bool key_bitset_test(const key_bitset* bits, keyboard_key key) {
+    return (bits->words[(uint32_t)key / 64] >> ((uint32_t)key % 64)) & 1;
+}
+
+// The per-key view user_input used to store: down/up mean pressed/released this frame.
+static inline key_input input_key(const user_input* input, keyboard_key key) {
+    key_input state = { 0 };
+    state.down = key_bitset_test(&input->keys.pressed, key);
+    state.up = key_bitset_test(&input->keys.released, key);
+    return state;
+}
+
+static inline bool input_key_held(const user_input* input, keyboard_key key) {
+    return key_bitset_test(&input->keys.held, key);
+}
+
+static inline bool input_key_is_down(const user_input* input, keyboard_key key) {
+    return key_bitset_test(&input->keys.current, key);
+}
+
+bool input_any_pressed(const user_input* input);
+bool input_any_released(const user_input* input);
+bool input_any_down(const user_input* input);
+
+// Walks the set bits of a key_bitset with count-trailing-zeros, lowest key first:
+//     key_iterator it = input_iterate_pressed(&window.input);
+//     keyboard_key key;
+//     while (key_iterator_next(&it, &key)) { ... }
+typedef struct {
+    key_bitset remaining;
+    uint32_t word;
+} key_iterator;
+
+static inline bool key_iterator_next(key_iterator* iterator, keyboard_key* out_key) {
+    while (iterator->word < KEY_BITSET_WORDS) {
+        uint64_t bits = iterator->remaining.words[iterator->word];
+        if (bits != 0) {
+            *out_key = (keyboard_key)(iterator->word * 64 + count_trailing_zeros64(bits));
+            iterator->remaining.words[iterator->word] = bits & (bits - 1);
+            return true;
+        }
+        ++iterator->word;
+    }
+    return false;
+}
+
+key_iterator input_iterate_pressed(const user_input* input);
+key_iterator input_iterate_released(const user_input* input);
+// Keys whose level differs from the previous frame.
+key_iterator input_iterate_changed(const user_input* input);
+
+typedef enum {
+    INPUT_EVENT_KEY_DOWN,
+    INPUT_EVENT_KEY_UP,
+    INPUT_EVENT_BUTTON_DOWN,
+    INPUT_EVENT_BUTTON_UP,
+    INPUT_EVENT_CHARACTER,
+    INPUT_EVENT_MOUSE_MOTION,
+    INPUT_EVENT_MOUSE_WHEEL,
+    INPUT_EVENT_RESIZE,
+    INPUT_EVENT_CLOSE,
+} input_event_type;
+
+// A single input change in the order the OS delivered it.
+// timestamp is on the get_time_nanoseconds clock. For keyboard and mouse events it is converted
+// from the OS event time, with the offset between the two clocks learned from the
+// least-delayed recent event; other events are stamped when the backend reads them.
+typedef struct {
+    uint64_t timestamp;
+    input_event_type type;
+    union {
+        keyboard_key key; // KEY_DOWN/KEY_UP, and BUTTON_DOWN/BUTTON_UP as KEY_*_MOUSE.
+        wchar_t character;
+        struct {
+            int32_t x;
+            int32_t y;
+        } motion;
+        int32_t wheel_delta;
+        struct {
+            uint32_t width;
+            uint32_t height;
+        } size;
+    };
+} input_event;
+
+#define INPUT_EVENT_QUEUE_CAPACITY 1024
+DECLARE_SPSC_RING(input_event, input_event_queue, INPUT_EVENT_QUEUE_CAPACITY)
+
+#if defined(_MSC_VER)
+#define CPU_TIMESTAMP_AVAILABLE
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CPU_TIMESTAMP_AVAILABLE
+#endif
+
+// Monotonic time in nanoseconds. Uses CLOCK_MONOTONIC_RAW on Linux and QueryPerformanceCounter
+// on Windows, or the calibrated CPU timestamp counter after set_clock_source(CLOCK_SOURCE_CPU_TIMESTAMP).
+uint64_t get_time_nanoseconds(void);
+
+typedef enum {
+    CLOCK_SOURCE_OS,
+    // Reads RDTSC and scales it by a calibration against the OS clock. Only accepted when the
+    // CPU reports an invariant TSC, which ticks at a constant rate across cores and power states.
+    CLOCK_SOURCE_CPU_TIMESTAMP,
+} clock_source;
+
+// Switching to CLOCK_SOURCE_CPU_TIMESTAMP calibrates first, which blocks for about 20ms.
+// Call it once at startup, before other threads read the clock.
+result set_clock_source(clock_source source);
+
+// Raw ticks of the CPU timestamp counter, for sub-20ns instrumentation. Convert with
+// cpu_timestamp_to_nanoseconds once the counter is calibrated.
+static inline uint64_t read_cpu_timestamp(void) {
+#if defined(CPU_TIMESTAMP_AVAILABLE)
+    return __rdtsc();
+#else
+    return get_time_nanoseconds();
+#endif
+}
+
+// Measures the counter rate against the OS clock, blocking for about 20ms the first time and
+// returning at once afterwards. Not thread-safe: call it at startup, before other threads
+// convert timestamps. set_clock_source and start_profiler call it.
+void calibrate_cpu_timestamp(void);
+// Converts a read_cpu_timestamp value into the get_time_nanoseconds time base.
+uint64_t cpu_timestamp_to_nanoseconds(uint64_t timestamp);
+
+typedef struct {
+    uint64_t frames;
+    uint64_t missed_deadlines;
+    // Lateness is how long after its deadline a frame was released.
+    double mean_lateness_nanoseconds;
+    uint64_t max_lateness_nanoseconds;
+    // Standard deviation of the time between consecutive releases.
+    double frame_time_deviation_nanoseconds;
+    uint64_t slept_nanoseconds;
+    uint64_t spun_nanoseconds;
+} frame_pacer_stats;
+
+// Releases the caller once per target frame time. The wait sleeps until spin_nanoseconds
+// before the deadline and busy-waits the rest: a larger spin budget burns more CPU and
+// absorbs more OS sleep overshoot.
+typedef struct {
+    uint64_t target_frame_nanoseconds;
+    uint64_t spin_nanoseconds;
+    uint64_t next_deadline;
+    uint64_t last_release;
+    double frame_time_mean;
+    double frame_time_m2;
+    frame_pacer_stats stats;
+    void* timer;
+} frame_pacer;
+
+result create_frame_pacer(uint64_t target_frame_nanoseconds, uint64_t spin_nanoseconds, frame_pacer* out_pacer);
+void destroy_frame_pacer(frame_pacer* pacer);
+void set_frame_pacer_budget(frame_pacer* pacer, uint64_t spin_nanoseconds);
+// Blocks until the next frame deadline. If the caller is more than a frame behind, the
+// schedule restarts from now rather than releasing a burst of catch-up frames.
+void wait_for_next_frame(frame_pacer* pacer);
+
+typedef void (*thread_function)(void* data);
+
+// The thread struct is referenced by the running thread until destroy_thread returns,
+// so it must not move while the thread is alive.
+typedef struct {
+    void* handle;
+    thread_function function;
+    void* data;
+} thread;
+
+result create_thread(thread_function function, void* data, thread* out_thread);
+// Waits for the thread to finish and releases it.
+void destroy_thread(thread* thread);
+
+// Bump allocator over a reserved range of address space. Pages are committed in chunks as
+// the arena grows, so reserving gigabytes up front only costs address space.
+typedef struct {
+    uint8_t* base;
+    size_t reserved_size;
+    size_t committed_size;
+    size_t used;
+    size_t commit_chunk_size;
+} arena_allocator;
+
+// A position in an arena to return to with arena_restore, for temporary allocations.
+typedef struct {
+    size_t used;
+} arena_marker;
+
+#define ARENA_DEFAULT_COMMIT_CHUNK_SIZE (64 * 1024)
+
+// commit_chunk_size is rounded up to the page size. 0 selects ARENA_DEFAULT_COMMIT_CHUNK_SIZE.
+result create_arena_allocator(size_t reserve_size, size_t commit_chunk_size, arena_allocator* out_arena);
+void destroy_arena_allocator(arena_allocator* arena);
+
+// Returns uninitialised memory, or NULL if the reservation is exhausted or the OS refuses to
+// commit more pages. A failed allocation leaves the arena unchanged.
+void* arena_allocate(arena_allocator* arena, size_t size, size_t alignment);
+void* arena_allocate_zeroed(arena_allocator* arena, size_t size, size_t alignment);
+void* arena_copy(arena_allocator* arena, const void* source, size_t size, size_t alignment);
+
+#define ARENA_ALLOCATE_ARRAY(arena, type, count) ((type*)arena_allocate((arena), sizeof(type) * (count), alignof(type)))
+
+static inline arena_marker arena_save(const arena_allocator* arena) {
+    arena_marker marker = { arena->used };
+    return marker;
+}
+
+// Frees everything allocated since the marker was saved. Committed pages are kept.
+void arena_restore(arena_allocator* arena, arena_marker marker);
+// Frees everything. With decommit the pages are returned to the OS, otherwise they stay
+// committed for the next round of allocations.
+void arena_reset(arena_allocator* arena, bool decommit);
+
+// Every thread has SCRATCH_ARENA_COUNT scratch arenas, created on first use. begin_scratch
+// hands out one that is not in conflicts: pass any arena the caller is already allocating
+// results into, so temporary data never lands in (and is never rewound out of) that arena.
+#define SCRATCH_ARENA_COUNT 2
+#define SCRATCH_ARENA_RESERVE_SIZE ((size_t)256 * 1024 * 1024)
+
+typedef struct {
+    arena_allocator* arena;
+    arena_marker marker;
+} scratch_arena;
+
+scratch_arena begin_scratch(arena_allocator* const* conflicts, uint32_t conflict_count);
+// Rewinds the scratch arena to where it was when begin_scratch returned it.
+void end_scratch(scratch_arena scratch);
+// Releases the calling thread's scratch arenas. Threads started with create_thread do this on exit.
+void release_scratch_arenas(void);
+
+// Transient per-frame memory: one arena per frame in flight, so data written during a frame
+// stays valid while the GPU consumes it.
+#define MAX_FRAME_ALLOCATOR_FRAMES 4
+
+typedef struct {
+    arena_allocator arenas[MAX_FRAME_ALLOCATOR_FRAMES];
+    uint32_t frame_count;
+} frame_allocator;
+
+// frame_count is the renderer's frames in flight, at most MAX_FRAME_ALLOCATOR_FRAMES.
+result create_frame_allocator(uint32_t frame_count, size_t reserve_size_per_frame, frame_allocator* out_allocator);
+void destroy_frame_allocator(frame_allocator* allocator);
+// Returns the arena of frame_slot, reset in bulk. Call once the slot's previous frame has
+// retired, i.e. after begin_frame has waited on its fence, with the renderer's frame_index.
+arena_allocator* begin_frame_allocator(frame_allocator* allocator, uint32_t frame_slot);
+
+// Read-only view of a whole file. The OS handles are closed once the view exists.
+typedef struct {
+    const void* data;
+    size_t size;
+} file_mapping;
+
+// Fails without reporting an error when the file does not exist, so callers can treat a
+// missing file as a cold start. An empty file maps to data == NULL and size == 0.
+result create_file_mapping(const char* path, file_mapping* out_mapping);
+void destroy_file_mapping(file_mapping* mapping);
+// Writes to path.tmp, flushes it to disk and renames it over path, so a crash leaves either
+// the old contents or the new ones, never a torn file.
+result write_file_atomically(const char* path, const void* data, size_t size);
+
+// A file kept open so views of any byte range can be mapped and dropped on demand, for files
+// too large to keep resident as a whole. Views must be unmapped before the file is closed.
+typedef struct {
+    // File mapping object on Windows; NULL when the file is empty.
+    void* handle;
+#if defined(PLATFORM_WINDOWS)
+    void* file_handle;
+#elif defined(PLATFORM_LINUX)
+    int descriptor;
+#endif
+    uint64_t size;
+    bool writable;
+} mapped_file;
+
+// Access hints are advisory and ignored where the platform has no equivalent.
+typedef enum {
+    // Shared mapping whose writes reach the file. Needs a file opened writable.
+    FILE_VIEW_WRITABLE = 1 << 0,
+    // Fault in every page while mapping, instead of on first touch.
+    FILE_VIEW_POPULATE = 1 << 1,
+    // Read ahead aggressively and drop pages soon after they are read.
+    FILE_VIEW_SEQUENTIAL = 1 << 2,
+    FILE_VIEW_RANDOM = 1 << 3,
+    // Start reading the view in the background without waiting for it.
+    FILE_VIEW_WILLNEED = 1 << 4,
+    // Back the view with transparent huge pages where the filesystem supports it.
+    FILE_VIEW_HUGEPAGE = 1 << 5,
+} file_view_flags;
+
+typedef struct {
+    // First requested byte; base is the same range rounded out to the mapping granularity.
+    void* data;
+    size_t size;
+    uint64_t offset;
+    void* base;
+    size_t mapped_size;
+    uint32_t flags;
+} file_view;
+
+// Opens an existing file. Fails without reporting an error when it does not exist. Views can
+// write to a writable file but never grow it.
+result open_mapped_file(const char* path, bool writable, mapped_file* out_file);
+void close_mapped_file(mapped_file* file);
+// Maps [offset, offset + size) of the file; size 0 maps to the end of the file.
+result map_file_view(const mapped_file* file, uint64_t offset, size_t size, uint32_t flags, file_view* out_view);
+void unmap_file_view(file_view* view);
+// Applies the hint bits of flags to an existing view, e.g. FILE_VIEW_WILLNEED ahead of use.
+void advise_file_view(const file_view* view, uint32_t flags);
+// Writes the view's dirty pages back. With wait, returns once they are durable on disk;
+// otherwise only schedules the write.
+result flush_file_view(const mapped_file* file, const file_view* view, bool wait);
+
+// Moving view over a large file, remapped whenever a requested range falls outside it, so only
+// about window_size bytes (rounded up to the mapping granularity) are mapped at a time.
+typedef struct {
+    const mapped_file* file;
+    file_view view;
+    size_t window_size;
+    uint32_t flags;
+    uint64_t remap_count;
+} file_window;
+
+// file must outlive the window.
+void create_file_window(const mapped_file* file, size_t window_size, uint32_t flags, file_window* out_window);
+void destroy_file_window(file_window* window);
+// Returns the address of file offset, valid until the next call, or NULL if the range is
+// outside the file or larger than the window. With FILE_VIEW_SEQUENTIAL the following window
+// is read ahead whenever the view moves.
+void* slide_file_window(file_window* window, uint64_t offset, size_t size);
+
+// Optional contention counters shared by the lock types below. Pass one when creating a lock
+// to record into it, or NULL to skip all bookkeeping. Several locks may share one stats block.
+// Wait time is only measured on the contended path, so uncontended locking stays cheap.
+typedef struct {
+    _Atomic uint64_t acquisitions;
+    _Atomic uint64_t contended_acquisitions;
+    _Atomic uint64_t wait_nanoseconds;
+} lock_stats;
+
+// None of the lock types own OS resources, so they have no destroy function.
+
+// Futex mutex: one atomic exchange when uncontended. Contended lockers spin for an adaptively
+// learned number of iterations before sleeping in the kernel.
+typedef struct {
+    _Atomic uint32_t state;
+    _Atomic uint32_t spin_limit;
+    lock_stats* stats;
+} mutex;
+
+void create_mutex(lock_stats* stats, mutex* out_mutex);
+void lock_mutex(mutex* mutex);
+bool try_lock_mutex(mutex* mutex);
+void unlock_mutex(mutex* mutex);
+
+// Ticket lock: FIFO, never sleeps. Waiters back off exponentially between polls.
+// Only for very short critical sections.
+typedef struct {
+    _Atomic uint32_t next_ticket;
+    _Atomic uint32_t now_serving;
+    lock_stats* stats;
+} spin_lock;
+
+void create_spin_lock(lock_stats* stats, spin_lock* out_lock);
+void lock_spin_lock(spin_lock* lock);
+void unlock_spin_lock(spin_lock* lock);
+
+// Reader-writer lock that prefers writers: new readers wait while a writer is queued.
+typedef struct {
+    _Atomic uint32_t state;
+    _Atomic uint32_t waiters;
+    _Atomic uint32_t writers_waiting;
+    // Bumped by every unlock; waiters sleep on it.
+    _Atomic uint32_t sequence;
+    lock_stats* stats;
+} rw_lock;
+
+void create_rw_lock(lock_stats* stats, rw_lock* out_lock);
+void lock_rw_lock_shared(rw_lock* lock);
+void unlock_rw_lock_shared(rw_lock* lock);
+void lock_rw_lock_exclusive(rw_lock* lock);
+void unlock_rw_lock_exclusive(rw_lock* lock);
+
+typedef struct {
+    _Atomic uint32_t count;
+    _Atomic uint32_t waiters;
+    lock_stats* stats;
+} semaphore;
+
+void create_semaphore(uint32_t initial_count, lock_stats* stats, semaphore* out_semaphore);
+void signal_semaphore(semaphore* semaphore, uint32_t count);
+void wait_semaphore(semaphore* semaphore);
+bool try_wait_semaphore(semaphore* semaphore);
+
+// Releases exactly one waiter per signal; signalling with no waiter leaves it set for the next one.
+typedef struct {
+    _Atomic uint32_t signaled;
+    _Atomic uint32_t waiters;
+    lock_stats* stats;
+} auto_reset_event;
+
+void create_auto_reset_event(bool signaled, lock_stats* stats, auto_reset_event* out_event);
+void signal_auto_reset_event(auto_reset_event* event);
+void wait_auto_reset_event(auto_reset_event* event);
+
+// Work-stealing job system. Each worker owns a Chase-Lev deque: it pushes and pops jobs at
+// the bottom while idle workers steal from the top. The thread that calls create_job_system
+// becomes worker 0; jobs may be submitted from it and from inside other jobs.
+typedef void (*job_function)(void* data, uint32_t begin, uint32_t end);
+
+// Counts unfinished jobs. Zero-initialise it, pass it to run_jobs and wait on it.
+typedef _Atomic uint32_t job_counter;
+
+typedef struct {
+    job_function function;
+    void* data;
+    uint32_t begin;
+    uint32_t end;
+    job_counter* counter;
+} job;
+
+#define JOB_DEQUE_CAPACITY 4096
+#define MAX_JOB_WORKERS 64
+
+typedef struct {
+    alignas(64) _Atomic int64_t top;
+    alignas(64) _Atomic int64_t bottom;
+    alignas(64) job* _Atomic entries[JOB_DEQUE_CAPACITY];
+} job_deque;
+
+typedef struct job_system job_system;
+
+typedef struct {
+    job_deque deque;
+    job_system* system;
+    uint32_t index;
+    thread thread;
+} job_worker;
+
+struct job_system {
+    arena_allocator memory;
+    job_worker* workers;
+    uint32_t worker_count;
+    _Atomic bool running;
+    // Idle workers sleep on wake_signal; pushers bump it when anyone is asleep.
+    alignas(64) _Atomic uint32_t wake_signal;
+    _Atomic uint32_t sleeping_workers;
+};
+
+// worker_count 0 uses one worker per logical processor the process may run on. Worker threads
+// are pinned to one of those processors each.
+result create_job_system(uint32_t worker_count, job_system* out_system);
+void destroy_job_system(job_system* system);
+
+// Queues count jobs on the calling worker. Each job is counted on counter, which the jobs must
+// outlive along with the job array. If the deque is full, the job runs immediately instead.
+void run_jobs(job_system* system, job* jobs, uint32_t count, job_counter* counter);
+// Runs queued and stolen jobs until counter reaches zero, so a waiting worker never idles while
+// there is work; a job can wait on the counter of jobs it depends on.
+void wait_for_counter(job_system* system, job_counter* counter);
+// Splits [0, count) into chunks of about count / (4 * workers) and waits for all of them.
+void parallel_for(job_system* system, uint32_t count, job_function function, void* data);
+// Index of the calling worker in [0, worker_count), or UINT32_MAX outside the job system.
+uint32_t get_job_worker_index(void);
+
+// Asynchronous file reads. On Linux they go through io_uring, driven with raw syscalls. Where
+// io_uring is unavailable (old kernels, sandboxes that block it, Windows), a few threads issue
+// blocking positional reads instead. Reads complete in any order.
+#define MAX_IO_QUEUE_DEPTH 256
+#define MAX_IO_FILES 64
+#define MAX_IO_BUFFERS 16
+#define IO_FALLBACK_THREAD_COUNT 4
+// Direct reads bypass the page cache and need the buffer address, offset and size aligned to
+// the device's logical block size; this covers every common device.
+#define IO_DIRECT_ALIGNMENT 4096
+#define IO_UNREGISTERED_BUFFER UINT32_MAX
+
+typedef enum {
+    IO_BACKEND_URING,
+    IO_BACKEND_THREADS,
+} io_backend;
+
+typedef struct {
+    void* user_data;
+    void* buffer;
+    uint64_t offset;
+    uint32_t size;
+    // Bytes read, fewer than size only at the end of the file, or a negative error code
+    // (an errno value on Linux).
+    int32_t result;
+    uint64_t latency_nanoseconds;
+} io_completion;
+
+// Runs on an I/O thread, which delivers no other completion meanwhile; keep it short. Reads
+// the kernel refuses to queue complete with an error on the thread that submitted them.
+typedef void (*io_callback)(const io_completion* completion);
+
+typedef struct {
+    uint32_t file;
+    uint64_t offset;
+    void* buffer;
+    uint32_t size;
+    // Registered buffer that contains buffer, or IO_UNREGISTERED_BUFFER. Registered buffers
+    // stay pinned, so the kernel skips mapping the pages on every read.
+    uint32_t buffer_index;
+    void* user_data;
+    // How the completion is delivered: callback is called, then counter is decremented so a
+    // job can wait_for_counter on the reads it needs. Reads with neither are reported through
+    // poll_io_completion.
+    io_callback callback;
+    job_counter* counter;
+} io_read;
+
+typedef struct {
+    void* base;
+    size_t size;
+} io_buffer;
+
+typedef struct {
+    _Atomic uint64_t submitted;
+    _Atomic uint64_t completed;
+    _Atomic uint64_t failed;
+    // Reads refused because the queue was at its depth.
+    _Atomic uint64_t rejected;
+    // Reads refused because they named a closed file or lay outside their registered buffer.
+    // Submission stops there, so the reads after one are counted here too.
+    _Atomic uint64_t invalid;
+    _Atomic uint64_t bytes_read;
+    _Atomic uint64_t total_latency_nanoseconds;
+    _Atomic uint64_t max_latency_nanoseconds;
+} io_stats;
+
+typedef struct {
+    io_read read;
+    uint64_t submit_time;
+    uint32_t next_free;
+    // The struct iovec of the read: vectored reads are the only unregistered reads io_uring
+    // supported before Linux 5.6.
+    io_buffer vector;
+} io_request;
+
+DECLARE_SPSC_RING(io_completion, io_completion_queue, MAX_IO_QUEUE_DEPTH)
+
+#if defined(PLATFORM_LINUX)
+// Kernel-shared rings of one io_uring instance, as laid out by io_uring_setup.
+typedef struct {
+    int descriptor;
+    void* submission_ring;
+    size_t submission_ring_size;
+    void* completion_ring;
+    size_t completion_ring_size;
+    void* entries;
+    size_t entries_size;
+    _Atomic uint32_t* submission_tail;
+    uint32_t* submission_array;
+    uint32_t submission_mask;
+    _Atomic uint32_t* completion_head;
+    _Atomic uint32_t* completion_tail;
+    void* completions;
+    uint32_t completion_mask;
+    bool files_registered;
+    bool buffers_registered;
+} io_uring_rings;
+#endif
+
+// The queue is referenced by its threads until destroy_io_queue, so it must not move.
+typedef struct {
+    io_backend backend;
+    uint32_t depth;
+    _Atomic bool running;
+
+    // Guards the request slots, the file table and submission.
+    mutex submit_lock;
+    io_request requests[MAX_IO_QUEUE_DEPTH];
+    uint32_t first_free;
+    uint32_t used_count;
+    // Event completions hold on to queue depth until they are polled.
+    _Atomic uint32_t queued_events;
+    _Atomic uint32_t reads_in_flight;
+
+    // Descriptors on Linux, HANDLEs on Windows; -1 marks a free entry.
+    intptr_t files[MAX_IO_FILES];
+    io_buffer buffers[MAX_IO_BUFFERS];
+    uint32_t buffer_count;
+
+#if defined(PLATFORM_LINUX)
+    io_uring_rings uring;
+#endif
+    thread completion_thread;
+
+    thread workers[IO_FALLBACK_THREAD_COUNT];
+    semaphore pending_signal;
+    uint32_t pending[MAX_IO_QUEUE_DEPTH];
+    uint32_t pending_head;
+    uint32_t pending_count;
+
+    // Completions are produced by several fallback threads.
+    mutex completion_lock;
+    io_completion_queue completions;
+    io_stats stats;
+} io_queue;
+
+// depth 0 or above MAX_IO_QUEUE_DEPTH selects MAX_IO_QUEUE_DEPTH. force_threads skips io_uring.
+result create_io_queue(uint32_t depth, bool force_threads, io_queue* out_queue);
+// Waits for every submitted read to complete.
+void destroy_io_queue(io_queue* queue);
+// Returns a file index for io_read, or UINT32_MAX without reporting an error when the file
+// does not exist or the file table is full. direct bypasses the page cache; see
+// IO_DIRECT_ALIGNMENT.
+uint32_t open_io_file(io_queue* queue, const char* path, bool direct, uint64_t* out_size);
+// No reads of the file may be in flight.
+void close_io_file(io_queue* queue, uint32_t file);
+// Replaces the registered buffer set. Call while no reads are in flight. Registration can
+// fail for lack of lockable memory; reads naming the buffers then work as unregistered ones.
+result register_io_buffers(io_queue* queue, const io_buffer* buffers, uint32_t count);
+// Submits reads in one batch and returns how many were accepted, fewer than count once the
+// queue reaches its depth or at the first invalid read. Each accepted read is counted on its counter, like run_jobs.
+uint32_t submit_io_reads(io_queue* queue, const io_read* reads, uint32_t count);
+// Only one thread may poll a queue.
+bool poll_io_completion(io_queue* queue, io_completion* out_completion);
+
 typedef enum {
     WINDOW_MODE_WINDOWED,
     WINDOW_MODE_FULLSCREEN,
     WINDOW_MODE_BORDERLESS,
 } window_mode;
 
+typedef enum {
+    WINDOW_FLAG_NONE = 0,
+    // The window is created and serviced by a dedicated thread that blocks on the OS queue.
+    // update_window_input then only drains a lock-free channel and makes no system calls.
+    WINDOW_FLAG_PUMP_THREAD = 1 << 0,
+} window_flags;
+
+typedef enum {
+    WINDOW_PUMP_STARTING,
+    WINDOW_PUMP_RUNNING,
+    WINDOW_PUMP_FAILED,
+    WINDOW_PUMP_STOPPING,
+} window_pump_state;
+
+// Time from the OS handing an event over to update_window_input applying it. Input events
+// carry an OS timestamp, so the time spent waiting in the OS queue for the next pump is
+// included in both modes. OS times have millisecond resolution; see input_event.timestamp.
+typedef struct {
+    uint64_t event_count;
+    uint64_t total_nanoseconds;
+    uint64_t max_nanoseconds;
+} input_latency_stats;
+
+#if defined(PLATFORM_LINUX)
+#define WINDOW_KEYCODE_COUNT 256
+#endif
+
 typedef struct {
     void* handle;
+#if defined(PLATFORM_LINUX)
+    // XCB connection owned by the window; handle holds the xcb_window_t.
+    void* connection;
+    uint32_t delete_window_atom;
+    // Keyboard mapping of the connection. Only the thread pumping the window reloads it.
+    uint8_t keycode_to_key[WINDOW_KEYCODE_COUNT];
+    uint32_t keycode_keysyms[WINDOW_KEYCODE_COUNT][2];
+#endif
     user_input input;
+
+    // Opt-in event stream, see enable_window_events.
+    input_event_queue events;
+    _Atomic uint32_t dropped_events;
+    bool events_enabled;
+
+    window_flags flags;
+    input_latency_stats input_latency;
+
+    // Written only by the thread pumping the backend; see os_event_time_to_nanoseconds.
+    uint64_t os_event_milliseconds;
+    int64_t os_clock_offset;
+    int64_t os_clock_epoch_offset;
+    uint64_t os_clock_epoch_start;
+    bool os_clock_synced;
+    // Timestamp of the OS event being translated, or 0 to stamp events with the current time.
+    uint64_t os_event_timestamp;
+
+    // Only used with WINDOW_FLAG_PUMP_THREAD.
+    thread pump_thread;
+    _Atomic int pump_state;
+    input_event_queue pump_events;
 } window;
 
-result create_window(const char* title, uint32_t width, uint32_t height, window_mode mode, window* out_window);
+// The window struct is referenced by the backend until destroy_window, so it must not move.
+result create_window(const char* title, uint32_t width, uint32_t height, window_mode mode, window_flags flags, window* out_window);
 void destroy_window(window* window);
 void update_window_input(window* window);
 
+// Once enabled, update_window_input also pushes every event it applies to window->input
+// into a bounded queue. The snapshot in window->input is unaffected. If the queue is full,
+// new events are dropped and counted in window->dropped_events.
+void enable_window_events(window* window, bool enabled);
+bool poll_window_event(window* window, input_event* out_event);
+
 #endif // PLATFORM_H
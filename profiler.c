@@ -0,0 +1,314 @@
+#include "profiler.h"
+#include "platform.h"
+
+IMPLEMENT_SPSC_RING(profile_event, profile_event_ring, PROFILE_RING_CAPACITY)
+
+typedef struct {
+    profile_event_ring ring;
+    // Producer-side copy of ring.head. Reloading the flusher's cache line only when the ring
+    // looks full keeps a zone to the owning thread's cache lines.
+    uint32_t cached_head;
+    // Recorded begins whose end is still to come. Each keeps a ring slot reserved for its end.
+    uint32_t open_zones;
+    // Nesting depth inside a zone whose begin was dropped; every event in there is dropped too,
+    // so the trace only ever holds whole zones.
+    uint32_t dropped_depth;
+    uint32_t thread_id;
+    const char* name;
+    bool name_written;
+    // Tracks hold get_time_nanoseconds values rather than timestamp counter ticks.
+    bool is_track;
+} profile_thread;
+
+static struct {
+    // Bumped by every start_profiler, so rings from an earlier capture are never reused.
+    _Atomic uint32_t session;
+    _Atomic bool running;
+    mutex registration;
+    arena_allocator memory;
+    profile_thread* threads[MAX_PROFILE_THREADS];
+    _Atomic uint32_t thread_count;
+    FILE* file;
+    bool first_event;
+    uint64_t base_timestamp;
+    thread flusher;
+    profiler_stats stats;
+} profiler;
+
+static THREAD_LOCAL profile_thread* current_profile_thread;
+static THREAD_LOCAL uint32_t current_profile_session;
+static THREAD_LOCAL profile_thread* current_profile_track;
+static THREAD_LOCAL uint32_t current_profile_track_session;
+
+static profile_thread* register_profile_thread(void) {
+    if (!atomic_load_explicit(&profiler.running, memory_order_acquire)) {
+        return NULL;
+    }
+
+    profile_thread* registered = NULL;
+    lock_mutex(&profiler.registration);
+    uint32_t count = atomic_load_explicit(&profiler.thread_count, memory_order_relaxed);
+    if (atomic_load_explicit(&profiler.running, memory_order_relaxed) && count < MAX_PROFILE_THREADS) {
+        registered = arena_allocate_zeroed(&profiler.memory, sizeof(profile_thread), alignof(profile_thread));
+        if (registered != NULL) {
+            registered->thread_id = count + 1;
+            profiler.threads[count] = registered;
+            atomic_store_explicit(&profiler.thread_count, count + 1, memory_order_release);
+        }
+    }
+    unlock_mutex(&profiler.registration);
+
+    current_profile_thread = registered;
+    current_profile_session = atomic_load_explicit(&profiler.session, memory_order_relaxed);
+    return registered;
+}
+
+static inline profile_thread* get_profile_thread(void) {
+    if (current_profile_session == atomic_load_explicit(&profiler.session, memory_order_relaxed)) {
+        return current_profile_thread;
+    }
+    return register_profile_thread();
+}
+
+// Checks for count free slots, reloading the consumer's head only when the ring looks full.
+static bool has_profile_ring_space(profile_thread* thread, uint32_t count) {
+    profile_event_ring* ring = &thread->ring;
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - thread->cached_head > PROFILE_RING_CAPACITY - count) {
+        thread->cached_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        return tail - thread->cached_head <= PROFILE_RING_CAPACITY - count;
+    }
+    return true;
+}
+
+static void write_profile_event(profile_thread* thread, const char* name) {
+    profile_event_ring* ring = &thread->ring;
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    profile_event* event = &ring->data[tail & (PROFILE_RING_CAPACITY - 1)];
+    event->timestamp = read_cpu_timestamp();
+    event->name = name;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+void profile_begin(const char* name) {
+    profile_thread* thread = get_profile_thread();
+    if (thread == NULL) {
+        return;
+    }
+    // The begin needs its own slot plus one for the end of every open zone, this one included.
+    if (thread->dropped_depth != 0 || !has_profile_ring_space(thread, thread->open_zones + 2)) {
+        thread->dropped_depth++;
+        atomic_fetch_add_explicit(&profiler.stats.dropped_events, 2, memory_order_relaxed);
+        return;
+    }
+    thread->open_zones++;
+    write_profile_event(thread, name);
+}
+
+void profile_end(void) {
+    profile_thread* thread = get_profile_thread();
+    if (thread == NULL) {
+        return;
+    }
+    if (thread->dropped_depth != 0) {
+        thread->dropped_depth--;
+        return;
+    }
+    // No open zone means the begin came before this capture started.
+    if (thread->open_zones == 0) {
+        return;
+    }
+    thread->open_zones--;
+    write_profile_event(thread, NULL);
+}
+
+void profile_thread_name(const char* name) {
+    profile_thread* thread = get_profile_thread();
+    if (thread != NULL) {
+        thread->name = name;
+    }
+}
+
+static profile_thread* get_profile_track(const char* track) {
+    uint32_t session = atomic_load_explicit(&profiler.session, memory_order_relaxed);
+    if (current_profile_track_session == session && current_profile_track != NULL && current_profile_track->name == track) {
+        return current_profile_track;
+    }
+    if (!atomic_load_explicit(&profiler.running, memory_order_acquire)) {
+        return NULL;
+    }
+
+    profile_thread* found = NULL;
+    lock_mutex(&profiler.registration);
+    uint32_t count = atomic_load_explicit(&profiler.thread_count, memory_order_relaxed);
+    for (uint32_t i = 0; i < count && found == NULL; i++) {
+        if (profiler.threads[i]->is_track && profiler.threads[i]->name == track) {
+            found = profiler.threads[i];
+        }
+    }
+    if (found == NULL && atomic_load_explicit(&profiler.running, memory_order_relaxed) && count < MAX_PROFILE_THREADS) {
+        found = arena_allocate_zeroed(&profiler.memory, sizeof(profile_thread), alignof(profile_thread));
+        if (found != NULL) {
+            found->thread_id = count + 1;
+            found->name = track;
+            found->is_track = true;
+            profiler.threads[count] = found;
+            atomic_store_explicit(&profiler.thread_count, count + 1, memory_order_release);
+        }
+    }
+    unlock_mutex(&profiler.registration);
+
+    current_profile_track = found;
+    current_profile_track_session = session;
+    return found;
+}
+
+void profile_track_events(const char* track, const profile_event* events, uint32_t count) {
+    ASSERT(track != NULL, return, "Track name is null");
+    ASSERT(count <= PROFILE_RING_CAPACITY, return, "Too many track events");
+    profile_thread* thread = get_profile_track(track);
+    if (thread == NULL || count == 0) {
+        return;
+    }
+    if (!has_profile_ring_space(thread, count)) {
+        atomic_fetch_add_explicit(&profiler.stats.dropped_events, count, memory_order_relaxed);
+        return;
+    }
+    profile_event_ring* ring = &thread->ring;
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    for (uint32_t i = 0; i < count; i++) {
+        ring->data[(tail + i) & (PROFILE_RING_CAPACITY - 1)] = events[i];
+    }
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+}
+
+static void write_json_string(FILE* file, const char* string) {
+    fputc('"', file);
+    for (; *string != '\0'; string++) {
+        if (*string == '"' || *string == '\\') {
+            fputc('\\', file);
+        }
+        if ((unsigned char)*string >= 0x20) {
+            fputc(*string, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static void begin_trace_event(void) {
+    fputs(profiler.first_event ? "\n" : ",\n", profiler.file);
+    profiler.first_event = false;
+}
+
+static void write_profile_events(void) {
+    uint64_t base = cpu_timestamp_to_nanoseconds(profiler.base_timestamp);
+    uint32_t count = atomic_load_explicit(&profiler.thread_count, memory_order_acquire);
+    for (uint32_t i = 0; i < count; i++) {
+        profile_thread* thread = profiler.threads[i];
+        const char* name = thread->name;
+        if (name != NULL && !thread->name_written) {
+            begin_trace_event();
+            fprintf(profiler.file, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", thread->thread_id);
+            write_json_string(profiler.file, name);
+            fputs("}}", profiler.file);
+            thread->name_written = true;
+        }
+
+        profile_event event;
+        uint64_t written = 0;
+        while (profile_event_ring_pop(&thread->ring, &event)) {
+            // Chrome trace timestamps are microseconds; keep the nanosecond digits as a fraction.
+            // Track events can predate the capture, as GPU work submitted before it started.
+            uint64_t timestamp = thread->is_track ? event.timestamp : cpu_timestamp_to_nanoseconds(event.timestamp);
+            uint64_t nanoseconds = timestamp > base ? timestamp - base : 0;
+            begin_trace_event();
+            if (event.name != NULL) {
+                fputs("{\"ph\":\"B\",\"name\":", profiler.file);
+                write_json_string(profiler.file, event.name);
+            }
+            else {
+                fputs("{\"ph\":\"E\"", profiler.file);
+            }
+            fprintf(profiler.file, ",\"pid\":1,\"tid\":%u,\"ts\":%llu.%03u}", thread->thread_id,
+                    (unsigned long long)(nanoseconds / 1000), (unsigned)(nanoseconds % 1000));
+            written++;
+        }
+        atomic_fetch_add_explicit(&profiler.stats.written_events, written, memory_order_relaxed);
+    }
+}
+
+static void profile_flusher_main(void* data) {
+    (void)data;
+    PROFILE_THREAD_NAME("profile flusher");
+    frame_pacer pacer;
+    if (create_frame_pacer(PROFILE_FLUSH_INTERVAL_NANOSECONDS, 0, &pacer) != RESULT_SUCCESS) {
+        return;
+    }
+    while (atomic_load_explicit(&profiler.running, memory_order_acquire)) {
+        write_profile_events();
+        wait_for_next_frame(&pacer);
+    }
+    destroy_frame_pacer(&pacer);
+}
+
+result start_profiler(const char* trace_path) {
+    ASSERT(trace_path != NULL, return RESULT_FAILURE, "Trace path is null");
+    ASSERT(!atomic_load(&profiler.running), return RESULT_FAILURE, "Profiler is already running");
+
+    profiler.file = fopen(trace_path, "wb");
+    if (profiler.file == NULL) {
+        ERROR_BREAKPOINT("Failed to open the trace file");
+        return RESULT_FAILURE;
+    }
+
+    size_t reserve_size = (size_t)MAX_PROFILE_THREADS * sizeof(profile_thread) + (size_t)MAX_PROFILE_THREADS * 4096;
+    if (create_arena_allocator(reserve_size, ARENA_DEFAULT_COMMIT_CHUNK_SIZE, &profiler.memory) != RESULT_SUCCESS) {
+        fclose(profiler.file);
+        profiler.file = NULL;
+        return RESULT_FAILURE;
+    }
+
+    create_mutex(NULL, &profiler.registration);
+    atomic_store(&profiler.thread_count, 0);
+    atomic_store(&profiler.stats.dropped_events, 0);
+    atomic_store(&profiler.stats.written_events, 0);
+    profiler.first_event = true;
+    // Before the flusher thread exists, which is the first to convert timestamps.
+    calibrate_cpu_timestamp();
+    profiler.base_timestamp = read_cpu_timestamp();
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", profiler.file);
+
+    atomic_fetch_add(&profiler.session, 1);
+    atomic_store(&profiler.running, true);
+    if (create_thread(profile_flusher_main, NULL, &profiler.flusher) != RESULT_SUCCESS) {
+        atomic_store(&profiler.running, false);
+        destroy_arena_allocator(&profiler.memory);
+        fclose(profiler.file);
+        profiler.file = NULL;
+        return RESULT_FAILURE;
+    }
+    return RESULT_SUCCESS;
+}
+
+void stop_profiler(void) {
+    if (!atomic_load(&profiler.running)) {
+        return;
+    }
+
+    lock_mutex(&profiler.registration);
+    atomic_store(&profiler.running, false);
+    unlock_mutex(&profiler.registration);
+    destroy_thread(&profiler.flusher);
+
+    write_profile_events();
+    fputs("\n]}\n", profiler.file);
+    fclose(profiler.file);
+    profiler.file = NULL;
+
+    atomic_fetch_add(&profiler.session, 1);
+    destroy_arena_allocator(&profiler.memory);
+}
+
+const profiler_stats* get_profiler_stats(void) {
+    return &profiler.stats;
+}
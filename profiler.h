@@ -0,0 +1,62 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "fundamental.h"
+
+// Zones record a begin and an end event with CPU timestamp counter ticks into a ring owned by the
+// calling thread. A flusher thread drains every ring into a Chrome trace JSON file, which also
+// opens in Perfetto. Define PROFILER_DISABLED to compile every zone out.
+//
+//     PROFILE_BEGIN("create_renderer");
+//     ...
+//     PROFILE_END();
+//
+// Names are stored by pointer, so they must outlive the capture; string literals are the intent.
+
+#define PROFILE_RING_CAPACITY 16384
+#define MAX_PROFILE_THREADS 64
+#define PROFILE_FLUSH_INTERVAL_NANOSECONDS 10000000ull
+
+// An end event has a NULL name.
+typedef struct {
+    uint64_t timestamp;
+    const char* name;
+} profile_event;
+
+DECLARE_SPSC_RING(profile_event, profile_event_ring, PROFILE_RING_CAPACITY)
+
+typedef struct {
+    // Events a thread could not record because its ring was full. Zones are dropped whole,
+    // begin and end together, along with every zone nested in them.
+    _Atomic uint64_t dropped_events;
+    _Atomic uint64_t written_events;
+} profiler_stats;
+
+// Opens trace_path and starts recording. Threads register on their first zone.
+result start_profiler(const char* trace_path);
+// Flushes the remaining events and closes the trace. Call it once no other thread is inside a zone.
+void stop_profiler(void);
+const profiler_stats* get_profiler_stats(void);
+
+void profile_begin(const char* name);
+void profile_end(void);
+// Labels the calling thread in the trace. Only takes effect while the profiler is running.
+void profile_thread_name(const char* name);
+// Adds events timed on another clock, such as GPU passes, as their own row named track.
+// Timestamps are get_time_nanoseconds values and events nest like zones. Either every event is
+// recorded or none are. A track must be fed by one thread at a time.
+void profile_track_events(const char* track, const profile_event* events, uint32_t count);
+
+#if defined(PROFILER_DISABLED)
+#define PROFILE_BEGIN(name) ((void)0)
+#define PROFILE_END() ((void)0)
+#define PROFILE_THREAD_NAME(name) ((void)0)
+#define PROFILE_TRACK_EVENTS(track, events, count) ((void)0)
+#else
+#define PROFILE_BEGIN(name) profile_begin(name)
+#define PROFILE_END() profile_end()
+#define PROFILE_THREAD_NAME(name) profile_thread_name(name)
+#define PROFILE_TRACK_EVENTS(track, events, count) profile_track_events(track, events, count)
+#endif
+
+#endif // PROFILER_H
@@ -0,0 +1,122 @@
+// Drives the XCB backend with events sent from a second connection, in both pumping modes.
+// Needs an X server; on machines without a display run it under Xvfb:
+//
+//     xvfb-run -a ./window_test
+#define _GNU_SOURCE
+#include "fundamental.h"
+#include "platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <xcb/xcb.h>
+
+#define WINDOW_TEST_TIMEOUT_NANOSECONDS 2000000000ull
+
+// Windows must not move while they exist.
+static window test_window;
+
+static xcb_keycode_t find_keycode(const window* window, keyboard_key key) {
+    for (uint32_t keycode = 0; keycode < WINDOW_KEYCODE_COUNT; ++keycode) {
+        if (window->keycode_to_key[keycode] == key) {
+            return (xcb_keycode_t)keycode;
+        }
+    }
+    return 0;
+}
+
+static void send_key(xcb_connection_t* connection, xcb_window_t destination, uint8_t type, xcb_keycode_t keycode, uint32_t time) {
+    xcb_key_press_event_t event = { 0 };
+    event.response_type = type;
+    event.detail = keycode;
+    event.time = time;
+    event.root = XCB_NONE;
+    event.event = destination;
+    event.child = XCB_NONE;
+    event.same_screen = 1;
+    // An empty event mask delivers to the client that created the window.
+    xcb_send_event(connection, 0, destination, 0, (const char*)&event);
+    xcb_flush(connection);
+}
+
+static void send_close(xcb_connection_t* connection, xcb_window_t destination, const window* window) {
+    xcb_intern_atom_reply_t* protocols = xcb_intern_atom_reply(connection, xcb_intern_atom(connection, 0, 12, "WM_PROTOCOLS"), NULL);
+    xcb_client_message_event_t event = { 0 };
+    event.response_type = XCB_CLIENT_MESSAGE;
+    event.format = 32;
+    event.window = destination;
+    event.type = protocols != NULL ? protocols->atom : XCB_ATOM_NONE;
+    event.data.data32[0] = window->delete_window_atom;
+    free(protocols);
+    xcb_send_event(connection, 0, destination, 0, (const char*)&event);
+    xcb_flush(connection);
+}
+
+typedef enum {
+    WAIT_FOR_PRESS,
+    WAIT_FOR_RELEASE,
+    WAIT_FOR_CLOSE,
+} wait_condition;
+
+static bool wait_for_input(window* window, wait_condition condition) {
+    uint64_t deadline = get_time_nanoseconds() + WINDOW_TEST_TIMEOUT_NANOSECONDS;
+    while (get_time_nanoseconds() < deadline) {
+        update_window_input(window);
+        const user_input* input = &window->input;
+        if ((condition == WAIT_FOR_PRESS && input_key(input, KEY_A).down && input->typed_characters.count > 0 && input->typed_characters.data[0] == L'a') ||
+            (condition == WAIT_FOR_RELEASE && input_key(input, KEY_A).up) || (condition == WAIT_FOR_CLOSE && input->closed_window)) {
+            return true;
+        }
+        struct timespec pause = { 0, 1000000 };
+        nanosleep(&pause, NULL);
+    }
+    return false;
+}
+
+static bool run_window_test(window_flags flags, const char* name) {
+    if (create_window("window_test", 320, 240, WINDOW_MODE_WINDOWED, flags, &test_window) != RESULT_SUCCESS) {
+        printf("FAIL %s: create_window\n", name);
+        return false;
+    }
+    xcb_connection_t* sender = xcb_connect(NULL, NULL);
+    xcb_window_t destination = (xcb_window_t)(uintptr_t)test_window.handle;
+    xcb_keycode_t keycode = find_keycode(&test_window, KEY_A);
+
+    const char* failure = NULL;
+    if (xcb_connection_has_error(sender) || keycode == 0) {
+        failure = "no sender connection or no keycode for A";
+    }
+    if (failure == NULL) {
+        send_key(sender, destination, XCB_KEY_PRESS, keycode, 1);
+        failure = wait_for_input(&test_window, WAIT_FOR_PRESS) ? NULL : "key press";
+    }
+    if (failure == NULL) {
+        send_key(sender, destination, XCB_KEY_RELEASE, keycode, 100);
+        failure = wait_for_input(&test_window, WAIT_FOR_RELEASE) ? NULL : "key release";
+    }
+    if (failure == NULL) {
+        send_close(sender, destination, &test_window);
+        failure = wait_for_input(&test_window, WAIT_FOR_CLOSE) ? NULL : "close request";
+    }
+
+    xcb_disconnect(sender);
+    destroy_window(&test_window);
+    printf("%s %s%s%s\n", failure == NULL ? "PASS" : "FAIL", name, failure == NULL ? "" : ": ", failure == NULL ? "" : failure);
+    return failure == NULL;
+}
+
+// ctest reports this exit code as skipped.
+#define WINDOW_TEST_SKIPPED 77
+
+int main(void) {
+    xcb_connection_t* probe = xcb_connect(NULL, NULL);
+    bool has_display = !xcb_connection_has_error(probe);
+    xcb_disconnect(probe);
+    if (!has_display) {
+        printf("SKIP: no X server; run under xvfb-run\n");
+        return WINDOW_TEST_SKIPPED;
+    }
+
+    bool passed = run_window_test(WINDOW_FLAG_NONE, "polled");
+    passed = run_window_test(WINDOW_FLAG_PUMP_THREAD, "pump thread") && passed;
+    return passed ? 0 : 1;
+}